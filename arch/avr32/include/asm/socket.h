@@ -62,4 +62,6 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ZEROCOPY             41
+
 #endif /* __ASM_AVR32_SOCKET_H */
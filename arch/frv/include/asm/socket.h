@@ -62,5 +62,7 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ZEROCOPY             41
+
 #endif /* _ASM_SOCKET_H */
 
@@ -681,6 +681,8 @@ __SYSCALL(__NR_syncfs, sys_syncfs)
 __SYSCALL(__NR_sendmmsg, sys_sendmmsg)
 #define __NR_setns				308
 __SYSCALL(__NR_setns, sys_setns)
+#define __NR_epoll_ctl_batch			309
+__SYSCALL(__NR_epoll_ctl_batch, sys_epoll_ctl_batch)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
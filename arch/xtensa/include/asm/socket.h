@@ -73,4 +73,6 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ZEROCOPY             41
+
 #endif	/* _XTENSA_SOCKET_H */
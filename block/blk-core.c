@@ -367,6 +367,10 @@ void blk_cleanup_queue(struct request_queue *q)
 	queue_flag_set_unlocked(QUEUE_FLAG_DEAD, q);
 	mutex_unlock(&q->sysfs_lock);
 
+	/* wait for the submitters which got past the QUEUE_FLAG_DEAD check */
+	percpu_ref_kill(&q->q_usage_counter);
+	wait_event(q->q_usage_wq, percpu_ref_is_zero(&q->q_usage_counter));
+
 	if (q->elevator)
 		elevator_exit(q->elevator);
 
@@ -404,6 +408,14 @@ struct request_queue *blk_alloc_queue(gfp_t gfp_mask)
 }
 EXPORT_SYMBOL(blk_alloc_queue);
 
+static void blk_queue_usage_counter_release(struct percpu_ref *ref)
+{
+	struct request_queue *q =
+		container_of(ref, struct request_queue, q_usage_counter);
+
+	wake_up_all(&q->q_usage_wq);
+}
+
 struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 {
 	struct request_queue *q;
@@ -420,16 +432,17 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->backing_dev_info.capabilities = BDI_CAP_MAP_COPY;
 	q->backing_dev_info.name = "block";
 
+	init_waitqueue_head(&q->q_usage_wq);
+	if (percpu_ref_init(&q->q_usage_counter,
+			    blk_queue_usage_counter_release))
+		goto fail_q;
+
 	err = bdi_init(&q->backing_dev_info);
-	if (err) {
-		kmem_cache_free(blk_requestq_cachep, q);
-		return NULL;
-	}
+	if (err)
+		goto fail_ref;
 
-	if (blk_throtl_init(q)) {
-		kmem_cache_free(blk_requestq_cachep, q);
-		return NULL;
-	}
+	if (blk_throtl_init(q))
+		goto fail_ref;
 
 	setup_timer(&q->backing_dev_info.laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
@@ -452,6 +465,12 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->queue_lock = &q->__queue_lock;
 
 	return q;
+
+fail_ref:
+	percpu_ref_exit(&q->q_usage_counter);
+fail_q:
+	kmem_cache_free(blk_requestq_cachep, q);
+	return NULL;
 }
 EXPORT_SYMBOL(blk_alloc_queue_node);
 
@@ -1543,7 +1562,10 @@ static inline void __generic_make_request(struct bio *bio)
 
 		trace_block_bio_queue(q, bio);
 
+		if (unlikely(!percpu_ref_tryget_live(&q->q_usage_counter)))
+			goto end_io;
 		ret = q->make_request_fn(q, bio);
+		percpu_ref_put(&q->q_usage_counter);
 	} while (ret);
 
 	return;
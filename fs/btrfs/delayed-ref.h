@@ -142,6 +142,16 @@ struct btrfs_delayed_ref_root {
 	u64 run_delayed_start;
 };
 
+/*
+ * Once BTRFS_DELAYED_REFS_BACKGROUND heads are ready to run, a worker
+ * starts running them in the background.  When more than
+ * BTRFS_DELAYED_REFS_WRITEBACK are ready the worker is not keeping up, and
+ * every task ending a transaction handle runs as many refs as it queued,
+ * so the commit never has more than about that many left to run.
+ */
+#define BTRFS_DELAYED_REFS_BACKGROUND	64
+#define BTRFS_DELAYED_REFS_WRITEBACK	1024
+
 static inline void btrfs_put_delayed_ref(struct btrfs_delayed_ref_node *ref)
 {
 	WARN_ON(atomic_read(&ref->refs) == 0);
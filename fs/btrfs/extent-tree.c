@@ -2258,7 +2258,8 @@ again:
 	}
 	while (1) {
 		if (!(run_all || run_most) &&
-		    delayed_refs->num_heads_ready < 64)
+		    delayed_refs->num_heads_ready <
+		    BTRFS_DELAYED_REFS_BACKGROUND)
 			break;
 
 		/*
@@ -2319,6 +2320,88 @@ out:
 	return 0;
 }
 
+struct async_delayed_refs {
+	struct btrfs_root *root;
+	struct btrfs_work work;
+};
+
+static void delayed_ref_async_start(struct btrfs_work *work)
+{
+	struct async_delayed_refs *async;
+	struct btrfs_fs_info *fs_info;
+	struct btrfs_trans_handle *trans;
+	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_root *root;
+	unsigned long count;
+
+	async = container_of(work, struct async_delayed_refs, work);
+	root = async->root;
+	fs_info = root->fs_info;
+
+	if (fs_info->closing)
+		goto done;
+
+	/*
+	 * the refs belong to the running transaction, don't start a new
+	 * empty one if it committed since we were queued
+	 */
+	spin_lock(&fs_info->trans_lock);
+	if (!fs_info->running_transaction) {
+		spin_unlock(&fs_info->trans_lock);
+		goto done;
+	}
+	spin_unlock(&fs_info->trans_lock);
+
+	trans = btrfs_join_transaction(root);
+	if (IS_ERR(trans))
+		goto done;
+
+	/*
+	 * run the refs that were ready when we got here, once the commit
+	 * has started flushing it takes care of them itself
+	 */
+	delayed_refs = &trans->transaction->delayed_refs;
+	count = delayed_refs->num_heads_ready;
+	if (count >= BTRFS_DELAYED_REFS_BACKGROUND &&
+	    !delayed_refs->flushing && !trans->transaction->blocked)
+		btrfs_run_delayed_refs(trans, root, count);
+	btrfs_end_transaction(trans, root);
+done:
+	kfree(async);
+	atomic_set(&fs_info->async_delayed_refs, 0);
+	smp_mb();
+	if (waitqueue_active(&fs_info->transaction_wait))
+		wake_up(&fs_info->transaction_wait);
+}
+
+/*
+ * kick off a background run of the delayed refs, unless one is already
+ * queued.  This keeps the backlog small without making the tasks that
+ * queue the refs wait for them.
+ */
+int btrfs_async_run_delayed_refs(struct btrfs_root *root)
+{
+	struct btrfs_fs_info *fs_info = root->fs_info;
+	struct async_delayed_refs *async;
+
+	if (fs_info->closing)
+		return 0;
+	if (atomic_cmpxchg(&fs_info->async_delayed_refs, 0, 1))
+		return 0;
+
+	async = kmalloc(sizeof(*async), GFP_NOFS);
+	if (!async) {
+		atomic_set(&fs_info->async_delayed_refs, 0);
+		return -ENOMEM;
+	}
+
+	async->root = fs_info->tree_root;
+	async->work.func = delayed_ref_async_start;
+	async->work.flags = 0;
+	btrfs_queue_worker(&fs_info->delayed_workers, &async->work);
+	return 0;
+}
+
 int btrfs_set_disk_extent_flags(struct btrfs_trans_handle *trans,
 				struct btrfs_root *root,
 				u64 bytenr, u64 num_bytes, u64 flags,
@@ -450,8 +450,14 @@ int btrfs_should_end_transaction(struct btrfs_trans_handle *trans,
 
 	updates = trans->delayed_ref_updates;
 	trans->delayed_ref_updates = 0;
-	if (updates)
+	if (updates &&
+	    cur_trans->delayed_refs.num_heads_ready >
+	    BTRFS_DELAYED_REFS_WRITEBACK)
 		btrfs_run_delayed_refs(trans, root, updates);
+	else if (updates &&
+		 cur_trans->delayed_refs.num_heads_ready >=
+		 BTRFS_DELAYED_REFS_BACKGROUND)
+		btrfs_async_run_delayed_refs(root);
 
 	return should_end_transaction(trans, root);
 }
@@ -468,18 +474,29 @@ static int __btrfs_end_transaction(struct btrfs_trans_handle *trans,
 		return 0;
 	}
 
+	/*
+	 * leave the delayed refs to the background worker unless it is
+	 * falling behind, or the transaction is trying to close.  Then we
+	 * run as many as we queued ourselves.
+	 */
+	if (trans->delayed_ref_updates &&
+	    cur_trans->delayed_refs.num_heads_ready >=
+	    BTRFS_DELAYED_REFS_BACKGROUND)
+		btrfs_async_run_delayed_refs(root);
+
 	while (count < 4) {
 		unsigned long cur = trans->delayed_ref_updates;
-		trans->delayed_ref_updates = 0;
-		if (cur &&
-		    trans->transaction->delayed_refs.num_heads_ready > 64) {
-			trans->delayed_ref_updates = 0;
+		unsigned long limit = BTRFS_DELAYED_REFS_WRITEBACK;
 
+		trans->delayed_ref_updates = 0;
+		if (cur_trans->delayed_refs.flushing)
+			limit = BTRFS_DELAYED_REFS_BACKGROUND;
+		if (cur && cur_trans->delayed_refs.num_heads_ready > limit) {
 			/*
 			 * do a full flush if the transaction is trying
 			 * to close
 			 */
-			if (trans->transaction->delayed_refs.flushing)
+			if (cur_trans->delayed_refs.flushing)
 				cur = 0;
 			btrfs_run_delayed_refs(trans, root, cur);
 		} else {
@@ -46,8 +46,8 @@
  *   - the dcache hash table
  * s_anon bl list spinlock protects:
  *   - the s_anon list (see __d_drop)
- * dcache_lru_lock protects:
- *   - the dcache lru lists and counters
+ * sb->s_dentry_lru_lock protects:
+ *   - the superblock's dentry lru lists and counters
  * d_lock protects:
  *   - d_flags
  *   - d_name
@@ -61,7 +61,7 @@
  * Ordering:
  * dentry->d_inode->i_lock
  *   dentry->d_lock
- *     dcache_lru_lock
+ *     sb->s_dentry_lru_lock
  *     dcache_hash_bucket lock
  *     s_anon lock
  *
@@ -79,7 +79,12 @@
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
-static __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lru_lock);
+/*
+ * Most unused negative dentries a superblock may keep before they are
+ * trimmed in the background, 0 for no limit.
+ */
+int sysctl_negative_dentry_limit __read_mostly;
+
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(rename_lock);
@@ -116,6 +121,8 @@ struct dentry_stat_t dentry_stat = {
 };
 
 static DEFINE_PER_CPU(unsigned int, nr_dentry);
+static DEFINE_PER_CPU(unsigned int, nr_dentry_unused);
+static DEFINE_PER_CPU(unsigned int, nr_dentry_negative);
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 static int get_nr_dentry(void)
@@ -127,10 +134,30 @@ static int get_nr_dentry(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static int get_nr_dentry_unused(void)
+{
+	int i;
+	int sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_unused, i);
+	return sum < 0 ? 0 : sum;
+}
+
+static int get_nr_dentry_negative(void)
+{
+	int i;
+	int sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
 int proc_nr_dentry(ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
+	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_dointvec(table, write, buffer, lenp, ppos);
 }
 #endif
@@ -176,6 +203,101 @@ static inline void dentry_rcuwalk_barrier(struct dentry *dentry)
 	write_seqcount_barrier(&dentry->d_seq);
 }
 
+/*
+ * Unused negative dentries are kept on an lru of their own, so that they
+ * can be trimmed without walking past all the positive ones.
+ */
+static inline struct list_head *dentry_lru_list(struct dentry *dentry)
+{
+	if (dentry->d_inode)
+		return &dentry->d_sb->s_dentry_lru;
+	return &dentry->d_sb->s_dentry_negative_lru;
+}
+
+static void dentry_lru_count(struct dentry *dentry, int delta)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	sb->s_nr_dentry_unused += delta;
+	this_cpu_add(nr_dentry_unused, delta);
+	if (!dentry->d_inode) {
+		sb->s_nr_dentry_negative += delta;
+		this_cpu_add(nr_dentry_negative, delta);
+	}
+}
+
+/*
+ * dentry_lru_(add|del|move_tail) and dentry_set_inode must be called with
+ * d_lock held.
+ */
+static void dentry_lru_add(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	if (list_empty(&dentry->d_lru)) {
+		spin_lock(&sb->s_dentry_lru_lock);
+		list_add(&dentry->d_lru, dentry_lru_list(dentry));
+		dentry_lru_count(dentry, 1);
+		spin_unlock(&sb->s_dentry_lru_lock);
+
+		if (!dentry->d_inode && sysctl_negative_dentry_limit &&
+		    sb->s_nr_dentry_negative > sysctl_negative_dentry_limit)
+			schedule_work(&sb->s_dentry_trim_work);
+	}
+}
+
+static void __dentry_lru_del(struct dentry *dentry)
+{
+	list_del_init(&dentry->d_lru);
+	dentry_lru_count(dentry, -1);
+}
+
+static void dentry_lru_del(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	if (!list_empty(&dentry->d_lru)) {
+		spin_lock(&sb->s_dentry_lru_lock);
+		__dentry_lru_del(dentry);
+		spin_unlock(&sb->s_dentry_lru_lock);
+	}
+}
+
+static void dentry_lru_move_tail(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	if (list_empty(&dentry->d_lru)) {
+		list_add_tail(&dentry->d_lru, dentry_lru_list(dentry));
+		dentry_lru_count(dentry, 1);
+	} else {
+		list_move_tail(&dentry->d_lru, dentry_lru_list(dentry));
+	}
+	spin_unlock(&sb->s_dentry_lru_lock);
+}
+
+/*
+ * Set the inode of a dentry which may be on the lru, and move it between
+ * the negative and positive lrus as needed.
+ */
+static void dentry_set_inode(struct dentry *dentry, struct inode *inode)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	if (list_empty(&dentry->d_lru)) {
+		dentry->d_inode = inode;
+		return;
+	}
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	dentry_lru_count(dentry, -1);
+	dentry->d_inode = inode;
+	dentry_lru_count(dentry, 1);
+	list_move(&dentry->d_lru, dentry_lru_list(dentry));
+	spin_unlock(&sb->s_dentry_lru_lock);
+}
+
 /*
  * Release the dentry's inode, using the filesystem
  * d_iput() operation if defined. Dentry has no refcount
@@ -211,7 +333,7 @@ static void dentry_unlink_inode(struct dentry * dentry)
 	__releases(dentry->d_inode->i_lock)
 {
 	struct inode *inode = dentry->d_inode;
-	dentry->d_inode = NULL;
+	dentry_set_inode(dentry, NULL);
 	list_del_init(&dentry->d_alias);
 	dentry_rcuwalk_barrier(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -224,49 +346,6 @@ static void dentry_unlink_inode(struct dentry * dentry)
 		iput(inode);
 }
 
-/*
- * dentry_lru_(add|del|move_tail) must be called with d_lock held.
- */
-static void dentry_lru_add(struct dentry *dentry)
-{
-	if (list_empty(&dentry->d_lru)) {
-		spin_lock(&dcache_lru_lock);
-		list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-		dentry->d_sb->s_nr_dentry_unused++;
-		dentry_stat.nr_unused++;
-		spin_unlock(&dcache_lru_lock);
-	}
-}
-
-static void __dentry_lru_del(struct dentry *dentry)
-{
-	list_del_init(&dentry->d_lru);
-	dentry->d_sb->s_nr_dentry_unused--;
-	dentry_stat.nr_unused--;
-}
-
-static void dentry_lru_del(struct dentry *dentry)
-{
-	if (!list_empty(&dentry->d_lru)) {
-		spin_lock(&dcache_lru_lock);
-		__dentry_lru_del(dentry);
-		spin_unlock(&dcache_lru_lock);
-	}
-}
-
-static void dentry_lru_move_tail(struct dentry *dentry)
-{
-	spin_lock(&dcache_lru_lock);
-	if (list_empty(&dentry->d_lru)) {
-		list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-		dentry->d_sb->s_nr_dentry_unused++;
-		dentry_stat.nr_unused++;
-	} else {
-		list_move_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-	}
-	spin_unlock(&dcache_lru_lock);
-}
-
 /**
  * d_kill - kill dentry and return parent
  * @dentry: dentry to kill
@@ -731,28 +810,29 @@ static void shrink_dentry_list(struct list_head *list)
 }
 
 /**
- * __shrink_dcache_sb - shrink the dentry LRU on a given superblock
+ * __shrink_dcache_sb - shrink a dentry LRU on a given superblock
  * @sb:		superblock to shrink dentry LRU.
+ * @lru:	s_dentry_lru or s_dentry_negative_lru of @sb
  * @count:	number of entries to prune
  * @flags:	flags to control the dentry processing
  *
  * If flags contains DCACHE_REFERENCED reference dentries will not be pruned.
  */
-static void __shrink_dcache_sb(struct super_block *sb, int count, int flags)
+static void __shrink_dcache_sb(struct super_block *sb, struct list_head *lru,
+			       int count, int flags)
 {
 	struct dentry *dentry;
 	LIST_HEAD(referenced);
 	LIST_HEAD(tmp);
 
 relock:
-	spin_lock(&dcache_lru_lock);
-	while (!list_empty(&sb->s_dentry_lru)) {
-		dentry = list_entry(sb->s_dentry_lru.prev,
-				struct dentry, d_lru);
+	spin_lock(&sb->s_dentry_lru_lock);
+	while (!list_empty(lru)) {
+		dentry = list_entry(lru->prev, struct dentry, d_lru);
 		BUG_ON(dentry->d_sb != sb);
 
 		if (!spin_trylock(&dentry->d_lock)) {
-			spin_unlock(&dcache_lru_lock);
+			spin_unlock(&sb->s_dentry_lru_lock);
 			cpu_relax();
 			goto relock;
 		}
@@ -773,11 +853,11 @@ relock:
 			if (!--count)
 				break;
 		}
-		cond_resched_lock(&dcache_lru_lock);
+		cond_resched_lock(&sb->s_dentry_lru_lock);
 	}
 	if (!list_empty(&referenced))
-		list_splice(&referenced, &sb->s_dentry_lru);
-	spin_unlock(&dcache_lru_lock);
+		list_splice(&referenced, lru);
+	spin_unlock(&sb->s_dentry_lru_lock);
 
 	shrink_dentry_list(&tmp);
 }
@@ -788,14 +868,59 @@ relock:
  *
  * Attempt to shrink the superblock dcache LRU by @nr_to_scan entries. This is
  * done when we need more memory an called from the superblock shrinker
- * function.
+ * function.  Negative dentries are the cheapest to bring back, so they go
+ * first.
  *
  * This function may fail to free any resources if all the dentries are in
  * use.
  */
 void prune_dcache_sb(struct super_block *sb, int nr_to_scan)
 {
-	__shrink_dcache_sb(sb, nr_to_scan, DCACHE_REFERENCED);
+	int negative = min(nr_to_scan, sb->s_nr_dentry_negative);
+
+	if (negative > 0)
+		__shrink_dcache_sb(sb, &sb->s_dentry_negative_lru, negative,
+				   DCACHE_REFERENCED);
+	if (nr_to_scan > negative)
+		__shrink_dcache_sb(sb, &sb->s_dentry_lru,
+				   nr_to_scan - negative, DCACHE_REFERENCED);
+}
+
+/*
+ * Trimming stops this far below sysctl_negative_dentry_limit, and takes
+ * at most this many dentries before dropping the superblock, so that
+ * neither the lru lock nor s_umount is held for long.
+ */
+#define NEGATIVE_DENTRY_SLACK(limit)	((limit) / 8)
+#define NEGATIVE_DENTRY_BATCH		1024
+
+/**
+ * trim_negative_dentries - keep unused negative dentries under the limit
+ * @work: the superblock's s_dentry_trim_work
+ *
+ * Queued when a superblock gets more than sysctl_negative_dentry_limit
+ * unused negative dentries, and requeues itself until it is back under.
+ */
+void trim_negative_dentries(struct work_struct *work)
+{
+	struct super_block *sb = container_of(work, struct super_block,
+					      s_dentry_trim_work);
+	int limit = sysctl_negative_dentry_limit;
+	int excess;
+
+	if (!limit || !grab_super_passive(sb))
+		return;
+
+	excess = sb->s_nr_dentry_negative - limit +
+		 NEGATIVE_DENTRY_SLACK(limit);
+	if (excess > 0) {
+		__shrink_dcache_sb(sb, &sb->s_dentry_negative_lru,
+				   min(excess, NEGATIVE_DENTRY_BATCH),
+				   DCACHE_REFERENCED);
+		if (excess > NEGATIVE_DENTRY_BATCH)
+			schedule_work(work);
+	}
+	drop_super(sb);
 }
 
 /**
@@ -809,14 +934,16 @@ void shrink_dcache_sb(struct super_block *sb)
 {
 	LIST_HEAD(tmp);
 
-	spin_lock(&dcache_lru_lock);
-	while (!list_empty(&sb->s_dentry_lru)) {
+	spin_lock(&sb->s_dentry_lru_lock);
+	while (!list_empty(&sb->s_dentry_lru) ||
+	       !list_empty(&sb->s_dentry_negative_lru)) {
 		list_splice_init(&sb->s_dentry_lru, &tmp);
-		spin_unlock(&dcache_lru_lock);
+		list_splice_init(&sb->s_dentry_negative_lru, &tmp);
+		spin_unlock(&sb->s_dentry_lru_lock);
 		shrink_dentry_list(&tmp);
-		spin_lock(&dcache_lru_lock);
+		spin_lock(&sb->s_dentry_lru_lock);
 	}
-	spin_unlock(&dcache_lru_lock);
+	spin_unlock(&sb->s_dentry_lru_lock);
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
@@ -1069,12 +1196,13 @@ EXPORT_SYMBOL(have_submounts);
  *
  * It returns zero iff there are no unused children,
  * otherwise  it returns the number of children moved to
- * the end of the unused list. This may not be the total
- * number of unused children, because select_parent can
- * drop the lock and return early due to latency
+ * the end of the unused list, and how many of them went
+ * to the negative one in *negative. This may not be the
+ * total number of unused children, because select_parent
+ * can drop the lock and return early due to latency
  * constraints.
  */
-static int select_parent(struct dentry * parent)
+static int select_parent(struct dentry *parent, int *negative)
 {
 	struct dentry *this_parent;
 	struct list_head *next;
@@ -1082,6 +1210,8 @@ static int select_parent(struct dentry * parent)
 	int found = 0;
 	int locked = 0;
 
+	*negative = 0;
+
 	seq = read_seqbegin(&rename_lock);
 again:
 	this_parent = parent;
@@ -1103,6 +1233,8 @@ resume:
 		if (!dentry->d_count) {
 			dentry_lru_move_tail(dentry);
 			found++;
+			if (!dentry->d_inode)
+				(*negative)++;
 		} else {
 			dentry_lru_del(dentry);
 		}
@@ -1167,10 +1299,16 @@ rename_retry:
 void shrink_dcache_parent(struct dentry * parent)
 {
 	struct super_block *sb = parent->d_sb;
-	int found;
-
-	while ((found = select_parent(parent)) != 0)
-		__shrink_dcache_sb(sb, found, 0);
+	int found, negative;
+
+	while ((found = select_parent(parent, &negative)) != 0) {
+		if (negative)
+			__shrink_dcache_sb(sb, &sb->s_dentry_negative_lru,
+					   negative, 0);
+		if (found > negative)
+			__shrink_dcache_sb(sb, &sb->s_dentry_lru,
+					   found - negative, 0);
+	}
 }
 EXPORT_SYMBOL(shrink_dcache_parent);
 
@@ -1309,7 +1447,7 @@ static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 			dentry->d_flags |= DCACHE_NEED_AUTOMOUNT;
 		list_add(&dentry->d_alias, &inode->i_dentry);
 	}
-	dentry->d_inode = inode;
+	dentry_set_inode(dentry, inode);
 	dentry_rcuwalk_barrier(dentry);
 	spin_unlock(&dentry->d_lock);
 	fsnotify_d_instantiate(dentry, inode);
@@ -258,6 +258,27 @@ static inline void ext4_update_inode_fsync_trans(handle_t *handle,
 	}
 }
 
+/*
+ * Record that @handle changes @inode in a way that fast commits can't
+ * log, so that an fsync needs the full commit of the transaction.
+ */
+static inline void ext4_fc_mark_ineligible(handle_t *handle,
+					   struct inode *inode)
+{
+	if (ext4_handle_valid(handle))
+		EXT4_I(inode)->i_fc_ineligible_tid =
+			handle->h_transaction->t_tid;
+}
+
+/* Same for changes which fast commits of any inode depend on */
+static inline void ext4_fc_mark_sb_ineligible(handle_t *handle,
+					      struct super_block *sb)
+{
+	if (ext4_handle_valid(handle))
+		EXT4_SB(sb)->s_fc_ineligible_tid =
+			handle->h_transaction->t_tid;
+}
+
 /* super.c */
 int ext4_force_commit(struct super_block *sb);
 
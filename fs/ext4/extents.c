@@ -43,6 +43,7 @@
 #include <linux/fiemap.h>
 #include "ext4_jbd2.h"
 #include "ext4_extents.h"
+#include "xattr.h"
 
 #include <trace/events/ext4.h>
 
@@ -1293,12 +1294,13 @@ static int ext4_ext_search_left(struct inode *inode,
  * search the closest allocated block to the right for *logical
  * and returns it at @logical + it's physical address at @phys
  * if *logical is the smallest allocated block, the function
- * returns 0 at @phys
+ * returns 0 at @phys; otherwise the extent found is copied to @ret_ex
  * return value contains 0 (success) or error code
  */
 static int ext4_ext_search_right(struct inode *inode,
 				 struct ext4_ext_path *path,
-				 ext4_lblk_t *logical, ext4_fsblk_t *phys)
+				 ext4_lblk_t *logical, ext4_fsblk_t *phys,
+				 struct ext4_extent *ret_ex)
 {
 	struct buffer_head *bh = NULL;
 	struct ext4_extent_header *eh;
@@ -1342,6 +1344,7 @@ static int ext4_ext_search_right(struct inode *inode,
 		}
 		*logical = le32_to_cpu(ex->ee_block);
 		*phys = ext4_ext_pblock(ex);
+		*ret_ex = *ex;
 		return 0;
 	}
 
@@ -1357,6 +1360,7 @@ static int ext4_ext_search_right(struct inode *inode,
 		ex++;
 		*logical = le32_to_cpu(ex->ee_block);
 		*phys = ext4_ext_pblock(ex);
+		*ret_ex = *ex;
 		return 0;
 	}
 
@@ -1402,6 +1406,7 @@ got_index:
 	ex = EXT_FIRST_EXTENT(eh);
 	*logical = le32_to_cpu(ex->ee_block);
 	*phys = ext4_ext_pblock(ex);
+	*ret_ex = *ex;
 	put_bh(bh);
 	return 0;
 }
@@ -1660,6 +1665,7 @@ static unsigned int ext4_ext_check_overlap(struct inode *inode,
 					   struct ext4_extent *newext,
 					   struct ext4_ext_path *path)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	ext4_lblk_t b1, b2;
 	unsigned int depth, len1;
 	unsigned int ret = 0;
@@ -1669,7 +1675,9 @@ static unsigned int ext4_ext_check_overlap(struct inode *inode,
 	depth = ext_depth(inode);
 	if (!path[depth].p_ext)
 		goto out;
+	/* the new extent must not reach into the next extent's cluster */
 	b2 = le32_to_cpu(path[depth].p_ext->ee_block);
+	b2 &= ~(sbi->s_cluster_ratio - 1);
 
 	/*
 	 * get the next allocated block if the extent in the path
@@ -1679,6 +1687,7 @@ static unsigned int ext4_ext_check_overlap(struct inode *inode,
 		b2 = ext4_ext_next_allocated_block(path);
 		if (b2 == EXT_MAX_BLOCKS)
 			goto out;
+		b2 &= ~(sbi->s_cluster_ratio - 1);
 	}
 
 	/* check for wrap through zero on extent logical start block*/
@@ -2222,11 +2231,19 @@ int ext4_ext_index_trans_blocks(struct inode *inode, int nrblocks, int chunk)
 	return index;
 }
 
+/*
+ * With bigalloc, a cluster partly freed by truncate may still be used by
+ * the extent to the left.  Its number is kept in *@partial_cluster until
+ * that is known, and the cluster is freed by whoever finds out it isn't.
+ */
 static int ext4_remove_blocks(handle_t *handle, struct inode *inode,
-				struct ext4_extent *ex,
-				ext4_lblk_t from, ext4_lblk_t to)
+			      struct ext4_extent *ex,
+			      ext4_fsblk_t *partial_cluster,
+			      ext4_lblk_t from, ext4_lblk_t to)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	unsigned short ee_len =  ext4_ext_get_actual_len(ex);
+	ext4_fsblk_t pblk;
 	int flags = EXT4_FREE_BLOCKS_FORGET;
 
 	if (S_ISDIR(inode->i_mode) || S_ISLNK(inode->i_mode))
@@ -2246,16 +2263,41 @@ static int ext4_remove_blocks(handle_t *handle, struct inode *inode,
 		spin_unlock(&sbi->s_ext_stats_lock);
 	}
 #endif
+	/*
+	 * A pending partial cluster which this extent doesn't end in isn't
+	 * used by anything left of it anymore.
+	 */
+	pblk = ext4_ext_pblock(ex) + ee_len - 1;
+	if (*partial_cluster && EXT4_B2C(sbi, pblk) != *partial_cluster) {
+		ext4_free_blocks(handle, inode, NULL,
+				 EXT4_C2B(sbi, *partial_cluster),
+				 sbi->s_cluster_ratio, flags);
+		*partial_cluster = 0;
+	}
+
 	if (from >= le32_to_cpu(ex->ee_block)
 	    && to == le32_to_cpu(ex->ee_block) + ee_len - 1) {
 		/* tail removal */
 		ext4_lblk_t num;
-		ext4_fsblk_t start;
+		int nofree = 0;
 
 		num = le32_to_cpu(ex->ee_block) + ee_len - from;
-		start = ext4_ext_pblock(ex) + ee_len - num;
-		ext_debug("free last %u blocks starting %llu\n", num, start);
-		ext4_free_blocks(handle, inode, NULL, start, num, flags);
+		pblk = ext4_ext_pblock(ex) + ee_len - num;
+		if (*partial_cluster)
+			nofree |= EXT4_FREE_BLOCKS_NOFREE_LAST_CLUSTER;
+		if (pblk & (sbi->s_cluster_ratio - 1))
+			nofree |= EXT4_FREE_BLOCKS_NOFREE_FIRST_CLUSTER;
+		ext_debug("free last %u blocks starting %llu\n", num, pblk);
+		ext4_free_blocks(handle, inode, NULL, pblk, num,
+				 flags | nofree);
+		/*
+		 * If the range didn't start at a cluster boundary, the
+		 * first cluster may still be used by the blocks left of it.
+		 */
+		if (nofree & EXT4_FREE_BLOCKS_NOFREE_FIRST_CLUSTER)
+			*partial_cluster = EXT4_B2C(sbi, pblk);
+		else
+			*partial_cluster = 0;
 	} else if (from == le32_to_cpu(ex->ee_block)
 		   && to <= le32_to_cpu(ex->ee_block) + ee_len - 1) {
 		/* head removal */
@@ -2290,9 +2332,10 @@ static int ext4_remove_blocks(handle_t *handle, struct inode *inode,
  */
 static int
 ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
-		struct ext4_ext_path *path, ext4_lblk_t start,
-		ext4_lblk_t end)
+		struct ext4_ext_path *path, ext4_fsblk_t *partial_cluster,
+		ext4_lblk_t start, ext4_lblk_t end)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	int err = 0, correct_index = 0;
 	int depth = ext_depth(inode), credits;
 	struct ext4_extent_header *eh;
@@ -2444,7 +2487,8 @@ ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
 		if (err)
 			goto out;
 
-		err = ext4_remove_blocks(handle, inode, ex, a, b);
+		err = ext4_remove_blocks(handle, inode, ex, partial_cluster,
+					 a, b);
 		if (err)
 			goto out;
 
@@ -2501,6 +2545,25 @@ ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
 		ex_ee_len = ext4_ext_get_actual_len(ex);
 	}
 
+	/*
+	 * The extent left of the removed ones, if any, tells whether the
+	 * pending partial cluster is still in use.
+	 */
+	if (*partial_cluster && ex >= EXT_FIRST_EXTENT(eh)) {
+		ext4_fsblk_t pblk = ext4_ext_pblock(ex) + ex_ee_len - 1;
+
+		if (EXT4_B2C(sbi, pblk) != *partial_cluster) {
+			int flags = EXT4_FREE_BLOCKS_FORGET;
+
+			if (S_ISDIR(inode->i_mode) || S_ISLNK(inode->i_mode))
+				flags |= EXT4_FREE_BLOCKS_METADATA;
+			ext4_free_blocks(handle, inode, NULL,
+					 EXT4_C2B(sbi, *partial_cluster),
+					 sbi->s_cluster_ratio, flags);
+		}
+		*partial_cluster = 0;
+	}
+
 	if (correct_index && eh->eh_entries)
 		err = ext4_ext_correct_indexes(handle, inode, path);
 
@@ -2540,6 +2603,7 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start,
 	struct super_block *sb = inode->i_sb;
 	int depth = ext_depth(inode);
 	struct ext4_ext_path *path;
+	ext4_fsblk_t partial_cluster = 0;
 	handle_t *handle;
 	int i, err;
 
@@ -2575,7 +2639,7 @@ again:
 		if (i == depth) {
 			/* this is leaf block */
 			err = ext4_ext_rm_leaf(handle, inode, path,
-					start, end);
+					&partial_cluster, start, end);
 			/* root level has p_bh == NULL, brelse() eats this */
 			brelse(path[i].p_bh);
 			path[i].p_bh = NULL;
@@ -2647,6 +2711,18 @@ again:
 		}
 	}
 
+	/* Nothing is left to share a still pending partial cluster */
+	if (partial_cluster && err == 0) {
+		int flags = EXT4_FREE_BLOCKS_FORGET;
+
+		if (S_ISDIR(inode->i_mode) || S_ISLNK(inode->i_mode))
+			flags |= EXT4_FREE_BLOCKS_METADATA;
+		ext4_free_blocks(handle, inode, NULL,
+				 EXT4_C2B(EXT4_SB(sb), partial_cluster),
+				 EXT4_SB(sb)->s_cluster_ratio, flags);
+		partial_cluster = 0;
+	}
+
 	/* TODO: flexible tree reduction should be here */
 	if (path->p_hdr->eh_entries == 0) {
 		/*
@@ -3320,6 +3396,57 @@ out2:
 	return err ? err : allocated;
 }
 
+/*
+ * With bigalloc, the blocks of a logical cluster must all live in the
+ * same physical cluster, at the same offset.  If the requested block
+ * falls in a cluster which @ex (the extent found to its left or right)
+ * already uses, map it inside that physical cluster instead of allocating
+ * a new one.  @map is clamped to the free part of the cluster, and 1 is
+ * returned; 0 means a new cluster is needed.
+ */
+static int get_implied_cluster_alloc(struct super_block *sb,
+				     struct ext4_map_blocks *map,
+				     struct ext4_extent *ex,
+				     struct ext4_ext_path *path)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_lblk_t c_offset = map->m_lblk & (sbi->s_cluster_ratio - 1);
+	ext4_lblk_t ex_cluster_start, ex_cluster_end;
+	ext4_lblk_t rr_cluster_start;
+	ext4_lblk_t ee_block = le32_to_cpu(ex->ee_block);
+	ext4_fsblk_t ee_start = ext4_ext_pblock(ex);
+	unsigned short ee_len = ext4_ext_get_actual_len(ex);
+
+	/* The extent passed in that we are trying to match */
+	ex_cluster_start = EXT4_B2C(sbi, ee_block);
+	ex_cluster_end = EXT4_B2C(sbi, ee_block + ee_len - 1);
+
+	/* The requested region passed into ext4_map_blocks() */
+	rr_cluster_start = EXT4_B2C(sbi, map->m_lblk);
+
+	if (rr_cluster_start != ex_cluster_end &&
+	    rr_cluster_start != ex_cluster_start)
+		return 0;
+
+	if (rr_cluster_start == ex_cluster_end)
+		ee_start += ee_len - 1;
+	map->m_pblk = (ee_start & ~((ext4_fsblk_t) sbi->s_cluster_ratio - 1)) +
+		c_offset;
+	map->m_len = min(map->m_len,
+			 (unsigned) sbi->s_cluster_ratio - c_offset);
+
+	/* Stop before @ex if the requested block is to its left... */
+	if (map->m_lblk < ee_block)
+		map->m_len = min(map->m_len, ee_block - map->m_lblk);
+
+	/* ...or before the next extent if it is to its right */
+	if (map->m_lblk > ee_block) {
+		ext4_lblk_t next = ext4_ext_next_allocated_block(path);
+		map->m_len = min(map->m_len, next - map->m_lblk);
+	}
+	return 1;
+}
+
 /*
  * Block allocation/map/preallocation routine for extents based files
  *
@@ -3342,10 +3469,11 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 			struct ext4_map_blocks *map, int flags)
 {
 	struct ext4_ext_path *path = NULL;
-	struct ext4_extent newex, *ex;
+	struct ext4_extent newex, *ex, ex2 = { 0 };
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	ext4_fsblk_t newblock = 0;
-	int err = 0, depth, ret;
-	unsigned int allocated = 0;
+	int free_on_err = 0, err = 0, depth, ret;
+	unsigned int allocated = 0, offset = 0;
 	unsigned int punched_out = 0;
 	unsigned int result = 0;
 	struct ext4_allocation_request ar;
@@ -3519,6 +3647,18 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 	/*
 	 * Okay, we need to do block allocation.
 	 */
+	newex.ee_block = cpu_to_le32(map->m_lblk);
+
+	/*
+	 * If we are doing bigalloc, check to see if the extent returned
+	 * by ext4_ext_find_extent() implies a cluster we can use.
+	 */
+	if ((map->m_lblk & (sbi->s_cluster_ratio - 1)) && ex &&
+	    get_implied_cluster_alloc(inode->i_sb, map, ex, path)) {
+		ar.len = allocated = map->m_len;
+		newblock = map->m_pblk;
+		goto got_allocated_blocks;
+	}
 
 	/* find neighbour allocated blocks */
 	ar.lleft = map->m_lblk;
@@ -3526,10 +3666,21 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 	if (err)
 		goto out2;
 	ar.lright = map->m_lblk;
-	err = ext4_ext_search_right(inode, path, &ar.lright, &ar.pright);
+	err = ext4_ext_search_right(inode, path, &ar.lright, &ar.pright, &ex2);
 	if (err)
 		goto out2;
 
+	/*
+	 * Or the extent to the right does, even for a cluster-aligned block.
+	 * ex2 is only filled in if there is one.
+	 */
+	if (sbi->s_cluster_ratio > 1 && ex2.ee_len &&
+	    get_implied_cluster_alloc(inode->i_sb, map, &ex2, path)) {
+		ar.len = allocated = map->m_len;
+		newblock = map->m_pblk;
+		goto got_allocated_blocks;
+	}
+
 	/*
 	 * See if request is beyond maximum number of blocks we can have in
 	 * a single extent. For an initialized extent this limit is
@@ -3544,7 +3695,6 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 		map->m_len = EXT_UNINIT_MAX_LEN;
 
 	/* Check if we can really insert (m_lblk)::(m_lblk + m_len) extent */
-	newex.ee_block = cpu_to_le32(map->m_lblk);
 	newex.ee_len = cpu_to_le16(map->m_len);
 	err = ext4_ext_check_overlap(inode, &newex, path);
 	if (err)
@@ -3556,7 +3706,15 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 	ar.inode = inode;
 	ar.goal = ext4_ext_find_goal(inode, path, map->m_lblk);
 	ar.logical = map->m_lblk;
-	ar.len = allocated;
+	/*
+	 * The physical block must sit at the same offset in its cluster as
+	 * the logical block does in its own, for get_implied_cluster_alloc()
+	 * to find it later: allocate from the start of the logical cluster.
+	 */
+	offset = map->m_lblk & (sbi->s_cluster_ratio - 1);
+	ar.len = EXT4_NUM_B2C(sbi, offset + allocated);
+	ar.goal -= offset;
+	ar.logical -= offset;
 	if (S_ISREG(inode->i_mode))
 		ar.flags = EXT4_MB_HINT_DATA;
 	else
@@ -3569,9 +3727,14 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 		goto out2;
 	ext_debug("allocate new block: goal %llu, found %llu/%u\n",
 		  ar.goal, newblock, allocated);
+	free_on_err = 1;
+	ar.len = EXT4_C2B(sbi, ar.len) - offset;
+	if (ar.len > allocated)
+		ar.len = allocated;
 
+got_allocated_blocks:
 	/* try to insert new extent into found leaf and return */
-	ext4_ext_store_pblock(&newex, newblock);
+	ext4_ext_store_pblock(&newex, newblock + offset);
 	newex.ee_len = cpu_to_le16(ar.len);
 	/* Mark uninitialized */
 	if (flags & EXT4_GET_BLOCKS_UNINIT_EXT){
@@ -3600,7 +3763,7 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 		goto out2;
 
 	err = ext4_ext_insert_extent(handle, inode, path, &newex, flags);
-	if (err) {
+	if (err && free_on_err) {
 		/* free data blocks we just allocated */
 		/* not a good idea to call discard here directly,
 		 * but otherwise we'd need to call it every free() */
@@ -3609,6 +3772,8 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 				 ext4_ext_get_actual_len(&newex), 0);
 		goto out2;
 	}
+	if (err)
+		goto out2;
 
 	/* previous routine could use block we allocated */
 	newblock = ext4_ext_pblock(&newex);
@@ -3675,6 +3840,7 @@ void ext4_ext_truncate(struct inode *inode)
 	handle = ext4_journal_start(inode, err);
 	if (IS_ERR(handle))
 		return;
+	ext4_fc_mark_ineligible(handle, inode);
 
 	if (inode->i_size & (sb->s_blocksize - 1))
 		ext4_block_truncate_page(handle, mapping, inode->i_size);
@@ -3774,6 +3940,13 @@ long ext4_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
 	struct ext4_map_blocks map;
 	unsigned int credits, blkbits = inode->i_blkbits;
 
+	/* Inline data has to move to a block before any allocation */
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_convert_inline_data(inode);
+		if (ret)
+			return ret;
+	}
+
 	/*
 	 * currently supporting (pre)allocate mode for extent-based
 	 * files _only_
@@ -3911,6 +4084,87 @@ int ext4_convert_unwritten_extents(struct inode *inode, loff_t offset,
 	return ret > 0 ? ret2 : ret;
 }
 
+/*
+ * ext4_ext_replay_range() maps @len blocks from @lblk of @inode to the
+ * blocks from @pblk as a fast commit logged them, for as far as the
+ * extent or the hole which @lblk is in goes:
+ *  - blocks already mapped there are left alone, except that they get
+ *    converted to initialized if the log says so, their data being on
+ *    disk: they are never zeroed out here;
+ *  - a hole gets the extent, once its blocks are claimed from mballoc
+ *    so that growing the tree can't allocate them.
+ * The caller holds i_data_sem for writing.  Returns the number of blocks
+ * done with, or an error.
+ */
+int ext4_ext_replay_range(handle_t *handle, struct inode *inode,
+			  ext4_lblk_t lblk, ext4_fsblk_t pblk,
+			  unsigned int len, int unwritten)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_ext_path *path;
+	struct ext4_extent *ex, newex;
+	struct ext4_map_blocks map;
+	ext4_group_t group;
+	ext4_grpblk_t offset;
+	int err = 0;
+
+	len = min_t(unsigned int, len,
+		    unwritten ? EXT_UNINIT_MAX_LEN : EXT_INIT_MAX_LEN);
+
+	path = ext4_ext_find_extent(inode, lblk, NULL);
+	if (IS_ERR(path))
+		return PTR_ERR(path);
+	ex = path[ext_depth(inode)].p_ext;
+
+	if (ex && in_range(lblk, le32_to_cpu(ex->ee_block),
+			   ext4_ext_get_actual_len(ex))) {
+		ext4_lblk_t ee_block = le32_to_cpu(ex->ee_block);
+
+		len = min_t(unsigned int, len,
+			    ee_block + ext4_ext_get_actual_len(ex) - lblk);
+		if (ext4_ext_pblock(ex) + lblk - ee_block != pblk) {
+			ext4_warning(sb, "inode %lu: block %u is mapped "
+				     "elsewhere than logged", inode->i_ino,
+				     lblk);
+			goto out;
+		}
+		if (!unwritten && ext4_ext_is_uninitialized(ex)) {
+			map.m_lblk = lblk;
+			map.m_len = len;
+			map.m_flags = 0;
+			err = ext4_split_extent(handle, inode, path, &map,
+						0, 0);
+			if (err > 0)
+				err = 0;
+		}
+		goto out;
+	}
+
+	/* mballoc only claims blocks within one group */
+	ext4_get_group_no_and_offset(sb, pblk, &group, &offset);
+	len = min_t(unsigned int, len, EXT4_BLOCKS_PER_GROUP(sb) - offset);
+
+	newex.ee_block = cpu_to_le32(lblk);
+	ext4_ext_store_pblock(&newex, pblk);
+	newex.ee_len = cpu_to_le16(len);
+	ext4_ext_check_overlap(inode, &newex, path);
+	len = ext4_ext_get_actual_len(&newex);
+	if (unwritten)
+		ext4_ext_mark_uninitialized(&newex);
+
+	err = ext4_mb_mark_used_range(handle, sb, pblk, len);
+	if (err)
+		goto out;
+	err = ext4_ext_insert_extent(handle, inode, path, &newex, 0);
+	if (!err)
+		dquot_alloc_block_nofail(inode, len);
+out:
+	ext4_ext_invalidate_cache(inode);
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	return err ? err : len;
+}
+
 /*
  * Callback function called for each extent to gather FIEMAP information.
  */
@@ -4177,6 +4431,10 @@ int ext4_ext_punch_hole(struct file *file, loff_t offset, loff_t length)
 	loff_t first_page, last_page, first_page_offset, last_page_offset;
 	int ret, credits, blocks_released, err = 0;
 
+	/* Partial cluster tracking only handles truncation for now */
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC))
+		return -EOPNOTSUPP;
+
 	first_block = (offset + sb->s_blocksize - 1) >>
 		EXT4_BLOCK_SIZE_BITS(sb);
 	last_block = (offset + length) >> EXT4_BLOCK_SIZE_BITS(sb);
@@ -4216,6 +4474,7 @@ int ext4_ext_punch_hole(struct file *file, loff_t offset, loff_t length)
 	handle = ext4_journal_start(inode, credits);
 	if (IS_ERR(handle))
 		return PTR_ERR(handle);
+	ext4_fc_mark_ineligible(handle, inode);
 
 	err = ext4_orphan_add(handle, inode);
 	if (err)
@@ -4329,6 +4588,15 @@ int ext4_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 	ext4_lblk_t start_blk;
 	int error = 0;
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		error = ext4_inline_data_fiemap(inode, fieinfo,
+						&has_inline_data);
+		if (has_inline_data)
+			return error;
+	}
+
 	/* fallback to generic here if not in extents fmt */
 	if (!(ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
 		return generic_block_fiemap(inode, fieinfo, start, len,
@@ -0,0 +1,563 @@
+/*
+ *  linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits make fsync of a regular file cheap.  Instead of
+ * committing the running transaction, which writes every metadata block
+ * it touched (bitmaps, group descriptors, inode table and extent tree
+ * blocks) to the journal, fsync logs the inode fields and the extents
+ * which the transaction mapped in the file, most often in a single block
+ * of the fast commit area of the journal.  The transaction still commits
+ * in full later, when the commit interval expires or an fsync can't use
+ * a fast commit, and the fast commit area is reused after that.  If the
+ * transaction never makes it to disk, ext4_fc_replay() applies the fast
+ * commits written for it at mount time, after journal recovery.
+ *
+ * Fast commits don't log namespace, xattr or flag changes, truncates or
+ * anything else which frees blocks: those mark the inode ineligible for
+ * fast commits until the transaction which made them commits, as do
+ * filesystem wide changes like resizing for all inodes.  In data=ordered
+ * mode blocks freed by a transaction aren't reused until it commits, so
+ * a logged extent never overlaps blocks which a lost transaction freed.
+ */
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/crc32.h>
+#include <linux/quotaops.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "fast_commit.h"
+
+/*
+ * Record that blocks @lblk to @lblk + @len - 1 of @inode were mapped or
+ * converted to initialized by @handle, for a fast commit of its
+ * transaction to log their extents.  Called with i_data_sem held for
+ * writing.
+ */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_lblk_t lblk, ext4_lblk_t len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t end;
+	tid_t tid;
+
+	if (!ext4_handle_valid(handle) ||
+	    !test_opt2(inode->i_sb, JOURNAL_FAST_COMMIT))
+		return;
+
+	tid = handle->h_transaction->t_tid;
+	if (ei->i_fc_tid != tid || !ei->i_fc_lblk_len) {
+		ei->i_fc_tid = tid;
+		ei->i_fc_lblk_start = lblk;
+		ei->i_fc_lblk_len = len;
+		return;
+	}
+	end = max(ei->i_fc_lblk_start + ei->i_fc_lblk_len, lblk + len);
+	ei->i_fc_lblk_start = min(ei->i_fc_lblk_start, lblk);
+	ei->i_fc_lblk_len = end - ei->i_fc_lblk_start;
+}
+
+static int ext4_fc_eligible(struct inode *inode, tid_t tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	return JBD2_HAS_INCOMPAT_FEATURE(sbi->s_journal,
+					 JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+		ext4_should_order_data(inode) &&
+		ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) &&
+		!ext4_has_inline_data(inode) &&
+		sbi->s_cluster_ratio == 1 &&
+		!sb_any_quota_loaded(sb) &&
+		EXT4_I(inode)->i_fc_ineligible_tid != tid &&
+		sbi->s_fc_ineligible_tid != tid;
+}
+
+/* A fast commit being written */
+struct ext4_fc_writer {
+	journal_t *journal;
+	struct buffer_head *bh[EXT4_FC_MAX_BLOCKS];
+	int nr;			/* blocks used */
+	int off;		/* offset of the next record in the last one */
+};
+
+/*
+ * Append a record to the fast commit, in a new block if it doesn't fit
+ * in the current one, whose remainder gets a pad record.
+ */
+static int ext4_fc_add(struct ext4_fc_writer *w, int tag, int len,
+		       const void *val)
+{
+	int bsize = w->journal->j_blocksize;
+	struct ext4_fc_tl tl;
+	char *dst;
+	int err;
+
+	if (!w->nr || w->off + sizeof(tl) + len > bsize) {
+		if (w->nr && w->off + sizeof(tl) <= bsize) {
+			tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_PAD);
+			tl.fc_len = cpu_to_le16(bsize - w->off - sizeof(tl));
+			memcpy(w->bh[w->nr - 1]->b_data + w->off, &tl,
+			       sizeof(tl));
+		}
+		if (w->nr == EXT4_FC_MAX_BLOCKS)
+			return -ENOSPC;
+		err = jbd2_fc_get_buf(w->journal, &w->bh[w->nr]);
+		if (err)
+			return err;
+		w->nr++;
+		w->off = 0;
+	}
+
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len);
+	dst = w->bh[w->nr - 1]->b_data + w->off;
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), val, len);
+	w->off += sizeof(tl) + len;
+	return 0;
+}
+
+/* CRC of the fast commit in @bh[0..@nr), up to @off in the last block */
+static u32 ext4_fc_crc(struct buffer_head **bh, int nr, int off)
+{
+	u32 crc = ~0;
+	int i;
+
+	for (i = 0; i < nr - 1; i++)
+		crc = crc32_be(crc, bh[i]->b_data, bh[i]->b_size);
+	return crc32_be(crc, bh[nr - 1]->b_data, off);
+}
+
+static void ext4_fc_submit_bh(struct buffer_head *bh, int rw)
+{
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	get_bh(bh);
+	submit_bh(rw, bh);
+}
+
+/*
+ * Write the fast commit.  Its last block goes last, with a cache flush
+ * first so that the file data and the other blocks are stable by then,
+ * and FUA to be stable itself when the write completes.
+ */
+static int ext4_fc_submit(struct ext4_fc_writer *w)
+{
+	journal_t *journal = w->journal;
+	int rw = WRITE_SYNC;
+	int i, err = 0;
+
+	if (journal->j_flags & JBD2_BARRIER) {
+		rw = WRITE_FLUSH_FUA;
+		/* that flush only covers the journal device */
+		if (journal->j_fs_dev != journal->j_dev)
+			err = blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS,
+						 NULL);
+	}
+
+	for (i = 0; i < w->nr - 1; i++)
+		ext4_fc_submit_bh(w->bh[i], WRITE_SYNC);
+	for (i = 0; i < w->nr - 1; i++)
+		wait_on_buffer(w->bh[i]);
+	ext4_fc_submit_bh(w->bh[w->nr - 1], rw);
+	wait_on_buffer(w->bh[w->nr - 1]);
+
+	for (i = 0; i < w->nr; i++)
+		if (!buffer_uptodate(w->bh[i]))
+			err = -EIO;
+	return err;
+}
+
+/* Log the inode fields and the extents mapped by transaction @tid */
+static int ext4_fc_write(struct inode *inode, tid_t tid)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_fc_writer w;
+	struct ext4_fc_head head;
+	struct ext4_fc_inode fi;
+	struct ext4_fc_range fr;
+	struct ext4_fc_tail tail;
+	struct ext4_map_blocks map;
+	ext4_lblk_t lblk = 0, end = 0;
+	int crc_off, i, ret;
+
+	memset(&w, 0, sizeof(w));
+	w.journal = EXT4_SB(inode->i_sb)->s_journal;
+
+	down_read(&ei->i_data_sem);
+	if (ei->i_fc_tid == tid) {
+		lblk = ei->i_fc_lblk_start;
+		end = lblk + ei->i_fc_lblk_len;
+	}
+	fi.fc_size = cpu_to_le64(ei->i_disksize);
+	up_read(&ei->i_data_sem);
+
+	head.fc_features = 0;
+	head.fc_tid = cpu_to_le32(tid);
+	ret = ext4_fc_add(&w, EXT4_FC_TAG_HEAD, sizeof(head), &head);
+	if (ret)
+		goto out;
+
+	fi.fc_ino = cpu_to_le32(inode->i_ino);
+	fi.fc_mode = cpu_to_le16(inode->i_mode);
+	fi.fc_flags = cpu_to_le16(ext4_test_inode_flag(inode,
+						       EXT4_INODE_EOFBLOCKS) ?
+				  EXT4_FC_INODE_EOFBLOCKS : 0);
+	fi.fc_uid = cpu_to_le32(inode->i_uid);
+	fi.fc_gid = cpu_to_le32(inode->i_gid);
+	fi.fc_atime = cpu_to_le32(inode->i_atime.tv_sec);
+	fi.fc_atime_nsec = cpu_to_le32(inode->i_atime.tv_nsec);
+	fi.fc_ctime = cpu_to_le32(inode->i_ctime.tv_sec);
+	fi.fc_ctime_nsec = cpu_to_le32(inode->i_ctime.tv_nsec);
+	fi.fc_mtime = cpu_to_le32(inode->i_mtime.tv_sec);
+	fi.fc_mtime_nsec = cpu_to_le32(inode->i_mtime.tv_nsec);
+	ret = ext4_fc_add(&w, EXT4_FC_TAG_INODE, sizeof(fi), &fi);
+	if (ret)
+		goto out;
+
+	fr.fc_ino = fi.fc_ino;
+	while (lblk < end) {
+		map.m_lblk = lblk;
+		map.m_len = end - lblk;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			goto out;
+		if (!ret) {
+			lblk++;
+			continue;
+		}
+		fr.fc_lblk = cpu_to_le32(lblk);
+		fr.fc_pblk = cpu_to_le64(map.m_pblk);
+		fr.fc_len = cpu_to_le32(ret);
+		fr.fc_flags = cpu_to_le32(map.m_flags & EXT4_MAP_UNWRITTEN ?
+					  EXT4_FC_RANGE_UNWRITTEN : 0);
+		lblk += ret;
+		ret = ext4_fc_add(&w, EXT4_FC_TAG_ADD_RANGE, sizeof(fr), &fr);
+		if (ret)
+			goto out;
+	}
+
+	tail.fc_tid = cpu_to_le32(tid);
+	tail.fc_crc = 0;
+	ret = ext4_fc_add(&w, EXT4_FC_TAG_TAIL, sizeof(tail), &tail);
+	if (ret)
+		goto out;
+	crc_off = w.off - sizeof(tail) + offsetof(struct ext4_fc_tail, fc_crc);
+	tail.fc_crc = cpu_to_le32(ext4_fc_crc(w.bh, w.nr, crc_off));
+	memcpy(w.bh[w.nr - 1]->b_data + crc_off, &tail.fc_crc,
+	       sizeof(tail.fc_crc));
+
+	ret = ext4_fc_submit(&w);
+out:
+	for (i = 0; i < w.nr; i++)
+		brelse(w.bh[i]);
+	return ret;
+}
+
+/*
+ * Make the changes of transaction @commit_tid to @inode durable with a
+ * fast commit, for fsync.  The data has been written already.  Returns
+ * 0 on success, or 1 if the transaction has to be committed in full
+ * instead: the inode is ineligible, the fast commit area is full or
+ * the transaction committed meanwhile.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t commit_tid)
+{
+	journal_t *journal = EXT4_SB(inode->i_sb)->s_journal;
+	int ret;
+
+	do {
+		ret = jbd2_fc_begin_commit(journal, commit_tid);
+	} while (ret == -EAGAIN);
+	if (ret)
+		return 1;
+
+	if (ext4_fc_eligible(inode, commit_tid))
+		ret = ext4_fc_write(inode, commit_tid);
+	else
+		ret = 1;
+	jbd2_fc_end_commit(journal);
+	return ret ? 1 : 0;
+}
+
+static void ext4_fc_replay_inode(struct super_block *sb,
+				 struct ext4_fc_inode *fi)
+{
+	struct inode *inode;
+	handle_t *handle;
+	umode_t mode = le16_to_cpu(fi->fc_mode);
+	loff_t size = le64_to_cpu(fi->fc_size);
+
+	inode = ext4_iget(sb, le32_to_cpu(fi->fc_ino));
+	if (IS_ERR(inode)) {
+		ext4_msg(sb, KERN_WARNING, "fast commit replay: inode %u "
+			 "not found", le32_to_cpu(fi->fc_ino));
+		return;
+	}
+	if ((inode->i_mode ^ mode) & S_IFMT) {
+		ext4_msg(sb, KERN_WARNING, "fast commit replay: inode %lu "
+			 "changed type", inode->i_ino);
+		goto out;
+	}
+
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle))
+		goto out;
+	inode->i_mode = mode;
+	inode->i_uid = le32_to_cpu(fi->fc_uid);
+	inode->i_gid = le32_to_cpu(fi->fc_gid);
+	i_size_write(inode, size);
+	EXT4_I(inode)->i_disksize = size;
+	inode->i_atime.tv_sec = (signed)le32_to_cpu(fi->fc_atime);
+	inode->i_atime.tv_nsec = le32_to_cpu(fi->fc_atime_nsec);
+	inode->i_ctime.tv_sec = (signed)le32_to_cpu(fi->fc_ctime);
+	inode->i_ctime.tv_nsec = le32_to_cpu(fi->fc_ctime_nsec);
+	inode->i_mtime.tv_sec = (signed)le32_to_cpu(fi->fc_mtime);
+	inode->i_mtime.tv_nsec = le32_to_cpu(fi->fc_mtime_nsec);
+	if (le16_to_cpu(fi->fc_flags) & EXT4_FC_INODE_EOFBLOCKS)
+		ext4_set_inode_flag(inode, EXT4_INODE_EOFBLOCKS);
+	else
+		ext4_clear_inode_flag(inode, EXT4_INODE_EOFBLOCKS);
+	ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+out:
+	iput(inode);
+}
+
+static void ext4_fc_replay_range(struct super_block *sb,
+				 struct ext4_fc_range *fr)
+{
+	struct inode *inode;
+	handle_t *handle;
+	ext4_lblk_t lblk = le32_to_cpu(fr->fc_lblk);
+	ext4_fsblk_t pblk = le64_to_cpu(fr->fc_pblk);
+	unsigned int len = le32_to_cpu(fr->fc_len);
+	int unwritten = le32_to_cpu(fr->fc_flags) & EXT4_FC_RANGE_UNWRITTEN;
+	int ret;
+
+	inode = ext4_iget(sb, le32_to_cpu(fr->fc_ino));
+	if (IS_ERR(inode)) {
+		ext4_msg(sb, KERN_WARNING, "fast commit replay: inode %u "
+			 "not found", le32_to_cpu(fr->fc_ino));
+		return;
+	}
+	if (!ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    !ext4_data_block_valid(EXT4_SB(sb), pblk, len)) {
+		ext4_msg(sb, KERN_WARNING, "fast commit replay: bad extent "
+			 "%u/%llu/%u for inode %lu", lblk, pblk, len,
+			 inode->i_ino);
+		goto out;
+	}
+
+	while (len) {
+		handle = ext4_journal_start(inode,
+					   ext4_chunk_trans_blocks(inode, len));
+		if (IS_ERR(handle))
+			break;
+		down_write(&EXT4_I(inode)->i_data_sem);
+		ret = ext4_ext_replay_range(handle, inode, lblk, pblk, len,
+					    unwritten);
+		up_write(&EXT4_I(inode)->i_data_sem);
+		if (ret > 0)
+			ext4_mark_inode_dirty(handle, inode);
+		ext4_journal_stop(handle);
+		if (ret <= 0)
+			break;
+		lblk += ret;
+		pblk += ret;
+		len -= ret;
+	}
+out:
+	iput(inode);
+}
+
+/*
+ * Go through the records of block @nr of the fast commit in @bh[],
+ * checking them, and replaying them if @replay is set.  Returns 1 at the
+ * tail, 0 at the end of the block, or -EINVAL if the block doesn't carry
+ * on a complete fast commit for transaction @tid.
+ */
+static int ext4_fc_walk_block(struct super_block *sb,
+			      struct buffer_head **bh, int nr, tid_t tid,
+			      int replay)
+{
+	char *data = bh[nr]->b_data;
+	int bsize = bh[nr]->b_size;
+	struct ext4_fc_tl tl;
+	struct ext4_fc_head head;
+	struct ext4_fc_inode fi;
+	struct ext4_fc_range fr;
+	struct ext4_fc_tail tail;
+	int off, tag, len, crc_off;
+
+	for (off = 0; off + sizeof(tl) <= bsize; off += sizeof(tl) + len) {
+		memcpy(&tl, data + off, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+		if (off + sizeof(tl) + len > bsize)
+			return -EINVAL;
+		/* the head comes first, and only there */
+		if ((!nr && !off) != (tag == EXT4_FC_TAG_HEAD))
+			return -EINVAL;
+
+		switch (tag) {
+		case EXT4_FC_TAG_HEAD:
+			if (len != sizeof(head))
+				return -EINVAL;
+			memcpy(&head, data + off + sizeof(tl), len);
+			if (le32_to_cpu(head.fc_tid) != tid)
+				return -EINVAL;
+			break;
+		case EXT4_FC_TAG_INODE:
+			if (len != sizeof(fi))
+				return -EINVAL;
+			memcpy(&fi, data + off + sizeof(tl), len);
+			if (replay)
+				ext4_fc_replay_inode(sb, &fi);
+			break;
+		case EXT4_FC_TAG_ADD_RANGE:
+			if (len != sizeof(fr))
+				return -EINVAL;
+			memcpy(&fr, data + off + sizeof(tl), len);
+			if (replay)
+				ext4_fc_replay_range(sb, &fr);
+			break;
+		case EXT4_FC_TAG_PAD:
+			return 0;
+		case EXT4_FC_TAG_TAIL:
+			if (len != sizeof(tail))
+				return -EINVAL;
+			memcpy(&tail, data + off + sizeof(tl), len);
+			crc_off = off + sizeof(tl) +
+				offsetof(struct ext4_fc_tail, fc_crc);
+			if (le32_to_cpu(tail.fc_tid) != tid ||
+			    le32_to_cpu(tail.fc_crc) !=
+			    ext4_fc_crc(bh, nr + 1, crc_off))
+				return -EINVAL;
+			return 1;
+		default:
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read the fast commit starting at block @first of the journal into
+ * @bh[].  Returns the number of its blocks if it is a complete fast
+ * commit for transaction @tid, or 0.
+ */
+static int ext4_fc_read(struct super_block *sb, unsigned long first,
+			tid_t tid, struct buffer_head **bh)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+	unsigned long long pblock;
+	int nr, ret;
+
+	memset(bh, 0, sizeof(*bh) * EXT4_FC_MAX_BLOCKS);
+	for (nr = 0; nr < EXT4_FC_MAX_BLOCKS &&
+		     first + nr < journal->j_fc_last; nr++) {
+		if (jbd2_journal_bmap(journal, first + nr, &pblock))
+			break;
+		bh[nr] = __bread(journal->j_dev, pblock, journal->j_blocksize);
+		if (!bh[nr])
+			break;
+		ret = ext4_fc_walk_block(sb, bh, nr, tid, 0);
+		if (ret < 0)
+			break;
+		if (ret > 0)
+			return nr + 1;
+	}
+
+	for (nr = 0; nr < EXT4_FC_MAX_BLOCKS; nr++)
+		brelse(bh[nr]);
+	return 0;
+}
+
+/* The transaction of the fast commit starting at block @blk, if any */
+static int ext4_fc_peek_tid(struct super_block *sb, unsigned long blk,
+			    tid_t *tid)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+	struct buffer_head *bh;
+	unsigned long long pblock;
+	struct ext4_fc_tl tl;
+	struct ext4_fc_head head;
+	int ret = -EINVAL;
+
+	if (jbd2_journal_bmap(journal, blk, &pblock))
+		return -EIO;
+	bh = __bread(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -EIO;
+	memcpy(&tl, bh->b_data, sizeof(tl));
+	if (le16_to_cpu(tl.fc_tag) == EXT4_FC_TAG_HEAD &&
+	    le16_to_cpu(tl.fc_len) == sizeof(head)) {
+		memcpy(&head, bh->b_data + sizeof(tl), sizeof(head));
+		*tid = le32_to_cpu(head.fc_tid);
+		ret = 0;
+	}
+	brelse(bh);
+	return ret;
+}
+
+/*
+ * Replay the fast commits written for the transaction which didn't make
+ * it to disk before a crash, if any, once the journal is recovered.
+ * They come first in the fast commit area, whatever follows them is
+ * older.  The replayed changes are committed right away, which makes
+ * the fast commits obsolete.  Must run before any handle is started.
+ */
+void ext4_fc_replay(struct super_block *sb)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+	struct buffer_head *bh[EXT4_FC_MAX_BLOCKS];
+	unsigned long s_flags = sb->s_flags;
+	unsigned long blk = journal->j_fc_first;
+	int nr, i, count = 0;
+	tid_t tid;
+
+	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT) ||
+	    ext4_fc_peek_tid(sb, blk, &tid))
+		return;
+
+	/*
+	 * Recovery leaves j_transaction_sequence one past the first
+	 * transaction it didn't find committed, and all transactions
+	 * before the one a fast commit is for have committed when it is
+	 * written: fast commits for older transactions are stale.
+	 */
+	if (!tid_geq(tid, journal->j_transaction_sequence - 1))
+		return;
+
+	if (bdev_read_only(sb->s_bdev)) {
+		ext4_msg(sb, KERN_ERR, "write access unavailable, "
+			 "skipping fast commit replay");
+		return;
+	}
+	if (s_flags & MS_RDONLY) {
+		ext4_msg(sb, KERN_INFO, "fast commit replay on readonly fs");
+		sb->s_flags &= ~MS_RDONLY;
+	}
+
+	while ((nr = ext4_fc_read(sb, blk, tid, bh)) > 0) {
+		for (i = 0; i < nr; i++)
+			ext4_fc_walk_block(sb, bh, i, tid, 1);
+		for (i = 0; i < nr; i++)
+			brelse(bh[i]);
+		blk += nr;
+		count++;
+	}
+
+	if (count) {
+		ext4_msg(sb, KERN_INFO, "replayed %d fast commit%s",
+			 count, count == 1 ? "" : "s");
+		ext4_force_commit(sb);
+	}
+	sb->s_flags = s_flags;
+}
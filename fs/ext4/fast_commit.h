@@ -0,0 +1,72 @@
+/*
+ *  fs/ext4/fast_commit.h
+ *
+ *  On-disk format of ext4 fast commits.
+ */
+#ifndef _EXT4_FAST_COMMIT_H
+#define _EXT4_FAST_COMMIT_H
+
+/*
+ * A fast commit is a run of blocks in the fast commit area of the
+ * journal holding tag-length-value records: a head, the records, and a
+ * tail whose CRC covers all the bytes before it from the start of the
+ * first block.  A record never crosses a block boundary, a pad record
+ * skips the rest of its block instead, and whatever follows the tail
+ * in its block is ignored.  The next fast commit starts in a new block.
+ */
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;		/* length of the value following */
+};
+
+#define EXT4_FC_TAG_HEAD	0x0001
+#define EXT4_FC_TAG_INODE	0x0002
+#define EXT4_FC_TAG_ADD_RANGE	0x0003
+#define EXT4_FC_TAG_PAD		0x0004
+#define EXT4_FC_TAG_TAIL	0x0005
+
+/* First record, the transaction which the fast commit is for */
+struct ext4_fc_head {
+	__le32 fc_features;	/* none so far */
+	__le32 fc_tid;
+};
+
+/* The inode fields a fast commit restores */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__le16 fc_mode;
+	__le16 fc_flags;	/* EXT4_FC_INODE_* */
+	__le32 fc_uid;
+	__le32 fc_gid;
+	__le64 fc_size;		/* i_disksize */
+	__le32 fc_atime;
+	__le32 fc_atime_nsec;
+	__le32 fc_ctime;
+	__le32 fc_ctime_nsec;
+	__le32 fc_mtime;
+	__le32 fc_mtime_nsec;
+};
+
+#define EXT4_FC_INODE_EOFBLOCKS	0x0001	/* EXT4_INODE_EOFBLOCKS is set */
+
+/* An extent of an inode, as mapped when the fast commit was written */
+struct ext4_fc_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le64 fc_pblk;
+	__le32 fc_len;
+	__le32 fc_flags;	/* EXT4_FC_RANGE_* */
+};
+
+#define EXT4_FC_RANGE_UNWRITTEN	0x0001	/* uninitialized extent */
+
+/* Last record */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;		/* crc32_be of the fast commit up to here */
+};
+
+/* Most blocks one fast commit may take, more needs a full commit */
+#define EXT4_FC_MAX_BLOCKS	16
+
+#endif /* _EXT4_FAST_COMMIT_H */
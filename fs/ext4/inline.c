@@ -0,0 +1,1131 @@
+/*
+ * linux/fs/ext4/inline.c
+ *
+ * Inline data: small files and directories kept in the inode body.
+ *
+ * The data of an inline inode is made of the EXT4_MIN_INLINE_DATA_SIZE
+ * bytes of i_block, followed by the value of the "system.data" extended
+ * attribute, which always lives in the inode body and is resized as the
+ * data grows or shrinks.  Data beyond i_size is kept zeroed, and a file
+ * may be larger than its inline data, the rest reading as a hole.
+ *
+ * The raw inode is authoritative for inline data: it is only read and
+ * written through the inode buffer, with xattr_sem held, and never
+ * copied to or from ei->i_data.
+ *
+ * Inline directories hold the parent inode number in i_block[0] instead
+ * of the "." and ".." entries, then ordinary directory entries filling
+ * the rest of i_block and the attribute value.
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/fiemap.h>
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "xattr.h"
+
+#define EXT4_XATTR_SYSTEM_DATA	"data"
+
+/* Extra space taken by "." and ".." over the parent inode number */
+#define EXT4_INLINE_DIR_EXTRA	(EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2) - \
+				 EXT4_INLINE_DOTDOT_SIZE)
+
+static int ext4_find_inline_xattr(struct inode *inode, struct ext4_iloc *iloc,
+				  struct ext4_xattr_info *i,
+				  struct ext4_xattr_ibody_find *is)
+{
+	i->name_index = EXT4_XATTR_INDEX_SYSTEM_DATA;
+	i->name = EXT4_XATTR_SYSTEM_DATA;
+	i->value = NULL;
+	i->value_len = 0;
+	is->s.not_found = -ENODATA;
+	is->iloc = *iloc;
+	return ext4_xattr_ibody_find(inode, i, is);
+}
+
+/*
+ * Look up the "system.data" attribute of an inline inode: return its
+ * size and where its value is.
+ */
+static int ext4_get_inline_xattr(struct inode *inode, struct ext4_iloc *iloc,
+				 void **value)
+{
+	struct ext4_xattr_info i;
+	struct ext4_xattr_ibody_find is;
+	size_t offs, size;
+	int error;
+
+	error = ext4_find_inline_xattr(inode, iloc, &i, &is);
+	if (error)
+		return error;
+	if (is.s.not_found) {
+		EXT4_ERROR_INODE(inode, "missing inline data attribute");
+		return -EIO;
+	}
+	offs = le16_to_cpu(is.s.here->e_value_offs);
+	size = le32_to_cpu(is.s.here->e_value_size);
+	if (size && offs + size > is.s.end - is.s.base) {
+		EXT4_ERROR_INODE(inode, "corrupted inline data attribute");
+		return -EIO;
+	}
+	*value = is.s.base + offs;
+	return size;
+}
+
+static int __ext4_get_inline_size(struct inode *inode, struct ext4_iloc *iloc)
+{
+	void *value;
+	int size;
+
+	size = ext4_get_inline_xattr(inode, iloc, &value);
+	if (size < 0)
+		return size;
+	return EXT4_MIN_INLINE_DATA_SIZE + size;
+}
+
+/*
+ * Return how many bytes of inline data @inode can hold right now.
+ * Called with xattr_sem held.
+ */
+int ext4_get_inline_size(struct inode *inode)
+{
+	struct ext4_iloc iloc;
+	int ret;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+	ret = __ext4_get_inline_size(inode, &iloc);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Copy up to @len bytes of inline data to @buffer, returning how many
+ * were copied.
+ */
+static int ext4_read_inline_data(struct inode *inode, void *buffer,
+				 unsigned int len, struct ext4_iloc *iloc)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(iloc);
+	unsigned int cp_len;
+	void *value;
+	int size;
+
+	cp_len = min_t(unsigned int, len, EXT4_MIN_INLINE_DATA_SIZE);
+	memcpy(buffer, (void *)raw_inode->i_block, cp_len);
+	if (len == cp_len)
+		return cp_len;
+
+	size = ext4_get_inline_xattr(inode, iloc, &value);
+	if (size < 0)
+		return size;
+	len = min_t(unsigned int, len - cp_len, size);
+	memcpy(buffer + cp_len, value, len);
+	return cp_len + len;
+}
+
+/*
+ * Copy @len bytes at @pos of the inline data from @buffer.  The caller
+ * has made room for them and got write access to the inode buffer.
+ */
+static int ext4_write_inline_data(struct inode *inode, struct ext4_iloc *iloc,
+				  void *buffer, loff_t pos, unsigned int len)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(iloc);
+	unsigned int cp_len;
+	void *value;
+	int size;
+
+	if (pos < EXT4_MIN_INLINE_DATA_SIZE) {
+		cp_len = min_t(unsigned int, len,
+			       EXT4_MIN_INLINE_DATA_SIZE - pos);
+		memcpy((void *)raw_inode->i_block + pos, buffer, cp_len);
+		buffer += cp_len;
+		pos += cp_len;
+		len -= cp_len;
+	}
+	if (!len)
+		return 0;
+
+	size = ext4_get_inline_xattr(inode, iloc, &value);
+	if (size < 0)
+		return size;
+	pos -= EXT4_MIN_INLINE_DATA_SIZE;
+	BUG_ON(pos + len > size);
+	memcpy(value + pos, buffer, len);
+	return 0;
+}
+
+/*
+ * Resize the "system.data" attribute for @len bytes of inline data in
+ * all, creating it if needed.  The contents are kept up to the new size
+ * and the rest is zeroed.  Returns -ENOSPC if the inode body has no
+ * room for it.
+ */
+static int ext4_update_inline_xattr(handle_t *handle, struct inode *inode,
+				    struct ext4_iloc *iloc, unsigned int len)
+{
+	struct ext4_xattr_info i;
+	struct ext4_xattr_ibody_find is;
+	size_t old_size = 0, new_size = 0;
+	void *value = NULL;
+	int error;
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE)
+		new_size = len - EXT4_MIN_INLINE_DATA_SIZE;
+
+	error = ext4_find_inline_xattr(inode, iloc, &i, &is);
+	if (error)
+		return error;
+	if (!is.s.not_found) {
+		old_size = le32_to_cpu(is.s.here->e_value_size);
+		if (old_size == new_size)
+			return 0;
+	}
+
+	if (new_size) {
+		value = kzalloc(new_size, GFP_NOFS);
+		if (!value)
+			return -ENOMEM;
+		if (old_size)
+			memcpy(value, is.s.base +
+			       le16_to_cpu(is.s.here->e_value_offs),
+			       min(old_size, new_size));
+	}
+	/* An empty value still marks the inode as having inline data */
+	i.value = value ? value : "";
+	i.value_len = new_size;
+	error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	kfree(value);
+	return error;
+}
+
+/*
+ * Make room for @len bytes of inline data, turning @inode into an
+ * inline inode if it isn't yet.  Returns -ENOSPC if the data can't be
+ * kept inline.  Called with xattr_sem held for writing.
+ */
+static int ext4_prepare_inline_data(handle_t *handle, struct inode *inode,
+				    unsigned int len)
+{
+	struct ext4_iloc iloc;
+	int ret, size;
+
+	if (!ext4_has_inline_data(inode) &&
+	    !ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA))
+		return -ENOSPC;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	if (ext4_has_inline_data(inode)) {
+		size = __ext4_get_inline_size(inode, &iloc);
+		if (size < 0 || size >= len) {
+			ret = size < 0 ? size : 0;
+			goto out;
+		}
+	}
+
+	BUFFER_TRACE(iloc.bh, "get_write_access");
+	ret = ext4_journal_get_write_access(handle, iloc.bh);
+	if (ret)
+		goto out;
+	ret = ext4_update_inline_xattr(handle, inode, &iloc, len);
+	if (ret)
+		goto out;
+
+	if (!ext4_has_inline_data(inode)) {
+		memset((void *)ext4_raw_inode(&iloc)->i_block, 0,
+		       EXT4_MIN_INLINE_DATA_SIZE);
+		ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+		ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+		ext4_fc_mark_ineligible(handle, inode);
+	}
+	get_bh(iloc.bh);
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+out:
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Store @len bytes from @buf as the inline data of @inode.  Called with
+ * xattr_sem held for writing.
+ */
+static int ext4_put_inline_data(handle_t *handle, struct inode *inode,
+				void *buf, unsigned int len)
+{
+	struct ext4_iloc iloc;
+	int ret;
+
+	ret = ext4_prepare_inline_data(handle, inode, len);
+	if (ret)
+		return ret;
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		return ret;
+	ret = ext4_write_inline_data(inode, &iloc, buf, 0, len);
+	if (ret) {
+		brelse(iloc.bh);
+		return ret;
+	}
+	return ext4_mark_iloc_dirty(handle, inode, &iloc);
+}
+
+/*
+ * Drop the inline data of @inode, which gets an empty block map in its
+ * place.  Called with xattr_sem held for writing.
+ */
+int ext4_destroy_inline_data(handle_t *handle, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_xattr_info i;
+	struct ext4_xattr_ibody_find is;
+	struct ext4_iloc iloc;
+	int error;
+
+	if (!ext4_has_inline_data(inode))
+		return 0;
+
+	error = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (error)
+		return error;
+
+	error = ext4_find_inline_xattr(inode, &iloc, &i, &is);
+	if (error)
+		goto out;
+	if (!is.s.not_found) {
+		/* i.value is NULL: remove the attribute */
+		error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+		if (error)
+			goto out;
+	}
+
+	memset((void *)ext4_raw_inode(&iloc)->i_block, 0,
+	       EXT4_MIN_INLINE_DATA_SIZE);
+	memset(ei->i_data, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	if (EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+				      EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+		ext4_ext_tree_init(handle, inode);
+	}
+	ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_fc_mark_ineligible(handle, inode);
+
+	get_bh(iloc.bh);
+	error = ext4_mark_iloc_dirty(handle, inode, &iloc);
+out:
+	brelse(iloc.bh);
+	return error;
+}
+
+/*
+ * Fill locked page 0 of @inode from its inline data.  Returns the
+ * number of bytes read.  Called with xattr_sem held.
+ */
+int ext4_read_inline_page(struct inode *inode, struct page *page)
+{
+	struct ext4_iloc iloc;
+	void *kaddr;
+	size_t len;
+	int ret;
+
+	BUG_ON(!PageLocked(page));
+	BUG_ON(page->index);
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	len = min_t(loff_t, i_size_read(inode), PAGE_CACHE_SIZE);
+	kaddr = kmap(page);
+	ret = ext4_read_inline_data(inode, kaddr, len, &iloc);
+	if (ret >= 0)
+		memset(kaddr + ret, 0, PAGE_CACHE_SIZE - ret);
+	kunmap(page);
+	if (ret >= 0) {
+		flush_dcache_page(page);
+		SetPageUptodate(page);
+	}
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Read a page of an inline file.  Returns -EAGAIN if the file no longer
+ * has inline data, for the caller to read it from blocks.
+ */
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	int ret = 0;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		return -EAGAIN;
+	}
+
+	/* Only page 0 has data, the rest of the file is a hole */
+	if (!page->index)
+		ret = ext4_read_inline_page(inode, page);
+	else if (!PageUptodate(page)) {
+		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		SetPageUptodate(page);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	unlock_page(page);
+	return ret >= 0 ? 0 : ret;
+}
+
+/*
+ * Try to set up a write of @len bytes at @pos to be kept inline.
+ * Returns 1 with page 0 locked in *@pagep and a handle started if so,
+ * and 0 once the file has moved to blocks, for the caller to go on with
+ * a regular write.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode,
+				  loff_t pos, unsigned len,
+				  unsigned flags,
+				  struct page **pagep)
+{
+	handle_t *handle;
+	struct page *page;
+	int ret;
+
+	/* The data can't be larger than the inode */
+	if (pos + len > EXT4_INODE_SIZE(inode->i_sb))
+		goto convert;
+
+	/* The inode, and the superblock for the orphan list on failure */
+	handle = ext4_journal_start(inode, 2);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	/* We cannot recurse into the filesystem as the transaction is already
+	 * started */
+	flags |= AOP_FLAG_NOFS;
+
+	page = grab_cache_page_write_begin(mapping, 0, flags);
+	if (!page) {
+		ext4_journal_stop(handle);
+		return -ENOMEM;
+	}
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	ret = ext4_prepare_inline_data(handle, inode, pos + len);
+	if (!ret && !PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret > 0)
+			ret = 0;
+	}
+	up_write(&EXT4_I(inode)->xattr_sem);
+
+	if (!ret) {
+		*pagep = page;
+		return 1;
+	}
+
+	unlock_page(page);
+	page_cache_release(page);
+	ext4_journal_stop(handle);
+	if (ret != -ENOSPC)
+		return ret;
+convert:
+	return ext4_convert_inline_data(inode);
+}
+
+/*
+ * Copy what was written to page 0 into the inline data.  The page is
+ * left clean, as the data goes to disk with the inode.  Returns the
+ * number of bytes copied.
+ */
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_iloc iloc;
+	void *kaddr;
+	int ret;
+
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		return ret;
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	kaddr = kmap(page);
+	ret = ext4_write_inline_data(inode, &iloc, kaddr + pos, pos, copied);
+	kunmap(page);
+	up_write(&EXT4_I(inode)->xattr_sem);
+	if (ret) {
+		brelse(iloc.bh);
+		return ret;
+	}
+
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	return ret ? ret : copied;
+}
+
+/*
+ * Put the first @len bytes of page 0 back inline after failing to
+ * allocate a block for them.  Called with xattr_sem held for writing.
+ */
+int ext4_restore_inline_data(handle_t *handle, struct inode *inode,
+			     struct page *page, unsigned len)
+{
+	void *kaddr;
+	int ret;
+
+	ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	kaddr = kmap(page);
+	ret = ext4_put_inline_data(handle, inode, kaddr, len);
+	kunmap(page);
+	return ret;
+}
+
+/*
+ * Truncate the inline data of @inode to i_size.  *@has_inline_data is
+ * cleared if the file turns out not to have inline data any more.
+ */
+void ext4_inline_data_truncate(struct inode *inode, int *has_inline_data)
+{
+	handle_t *handle;
+	struct ext4_iloc iloc;
+	struct ext4_inode *raw_inode;
+	loff_t i_size = inode->i_size;
+	int size, err;
+
+	/* The inode, and the superblock and an inode for the orphan list */
+	handle = ext4_journal_start(inode, 3);
+	if (IS_ERR(handle))
+		return;
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline_data = 0;
+		up_write(&EXT4_I(inode)->xattr_sem);
+		ext4_journal_stop(handle);
+		return;
+	}
+
+	err = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (err)
+		goto out_unlock;
+	size = __ext4_get_inline_size(inode, &iloc);
+	if (size < 0) {
+		err = size;
+		goto out_brelse;
+	}
+	if (i_size < size) {
+		/* Keep the data beyond i_size zeroed */
+		raw_inode = ext4_raw_inode(&iloc);
+		if (i_size < EXT4_MIN_INLINE_DATA_SIZE)
+			memset((void *)raw_inode->i_block + i_size, 0,
+			       EXT4_MIN_INLINE_DATA_SIZE - i_size);
+		err = ext4_update_inline_xattr(handle, inode, &iloc, i_size);
+		if (err)
+			goto out_brelse;
+		get_bh(iloc.bh);
+		err = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	}
+out_brelse:
+	brelse(iloc.bh);
+out_unlock:
+	up_write(&EXT4_I(inode)->xattr_sem);
+	if (err)
+		ext4_std_error(inode->i_sb, err);
+
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_inode_dirty(handle, inode);
+
+	/*
+	 * If this was a simple ftruncate() and the file will remain alive,
+	 * then we need to clear up the orphan record which we created above.
+	 * However, if this was a real unlink then we were called by
+	 * ext4_evict_inode(), and we allow that function to clean up the
+	 * orphan info for us.
+	 */
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+
+	ext4_journal_stop(handle);
+}
+
+/*
+ * Report the inline data of @inode as a single extent at its place in
+ * the inode table.
+ */
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo,
+			    int *has_inline_data)
+{
+	__u32 flags = FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED |
+		      FIEMAP_EXTENT_LAST;
+	struct ext4_iloc iloc;
+	__u64 physical, length;
+	int error;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	error = __ext4_get_inline_size(inode, &iloc);
+	if (error < 0)
+		goto out;
+	length = min_t(__u64, i_size_read(inode), error);
+	error = 0;
+	if (!length)
+		goto out;
+
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += (char *)ext4_raw_inode(&iloc) - iloc.bh->b_data;
+	physical += offsetof(struct ext4_inode, i_block);
+
+	error = fiemap_fill_next_extent(fieinfo, 0, physical, length, flags);
+	if (error > 0)
+		error = 0;
+out:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+	return error;
+}
+
+/*
+ * Set up the new directory @inode inline, with an empty entry after the
+ * parent inode number.  Returns -ENOSPC if it has to get a block.
+ */
+int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			       struct inode *inode)
+{
+	struct ext4_iloc iloc;
+	struct ext4_inode *raw_inode;
+	struct ext4_dir_entry_2 *de;
+	int ret;
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	ret = ext4_prepare_inline_data(handle, inode,
+				       EXT4_MIN_INLINE_DATA_SIZE);
+	if (ret)
+		goto out;
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		goto out;
+
+	raw_inode = ext4_raw_inode(&iloc);
+	raw_inode->i_block[0] = cpu_to_le32(parent->i_ino);
+	de = (void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE;
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_MIN_INLINE_DATA_SIZE -
+					   EXT4_INLINE_DOTDOT_SIZE,
+					   inode->i_sb->s_blocksize);
+	inode->i_size = EXT4_I(inode)->i_disksize = EXT4_MIN_INLINE_DATA_SIZE;
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+out:
+	up_write(&EXT4_I(inode)->xattr_sem);
+	return ret;
+}
+
+/*
+ * Look @d_name up in inline directory @dir.  Like ext4_find_entry(), the
+ * returned buffer, here the inode's, has ->b_count elevated.  ".." maps
+ * to the parent inode number, only ->inode of that entry is valid.
+ */
+struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					const struct qstr *d_name,
+					struct ext4_dir_entry_2 **res_dir,
+					int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+	struct ext4_inode *raw_inode;
+	void *value;
+	int ret, size;
+
+	if (ext4_get_inode_loc(dir, &iloc))
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	if (d_name->len == 2 && !memcmp(d_name->name, "..", 2)) {
+		*res_dir = (struct ext4_dir_entry_2 *)raw_inode->i_block;
+		goto out_find;
+	}
+
+	ret = ext4_search_dir(iloc.bh, (void *)raw_inode->i_block +
+			      EXT4_INLINE_DOTDOT_SIZE,
+			      EXT4_MIN_INLINE_DATA_SIZE -
+			      EXT4_INLINE_DOTDOT_SIZE,
+			      dir, d_name, 0, res_dir);
+	if (ret == 1)
+		goto out_find;
+	if (ret < 0)
+		goto out;
+
+	size = ext4_get_inline_xattr(dir, &iloc, &value);
+	if (size <= 0)
+		goto out;
+	ret = ext4_search_dir(iloc.bh, value, size, dir, d_name, 0, res_dir);
+	if (ret == 1)
+		goto out_find;
+out:
+	brelse(iloc.bh);
+	iloc.bh = NULL;
+out_find:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	return iloc.bh;
+}
+
+/* Add an entry to the @buf_size bytes of inline entries at @buf. */
+static int ext4_add_dirent_to_inline(struct inode *dir, struct inode *inode,
+				     struct ext4_iloc *iloc,
+				     void *buf, int buf_size,
+				     const char *name, int namelen)
+{
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	err = ext4_find_dest_de(dir, iloc->bh, buf, buf_size,
+				name, namelen, &de);
+	if (err)
+		return err;
+
+	ext4_insert_dentry(dir, inode, de, buf_size, name, namelen);
+	dir->i_mtime = dir->i_ctime = ext4_current_time(dir);
+	dir->i_version++;
+	return 0;
+}
+
+/*
+ * Check the entries of both inline regions of directory @dir, copied to
+ * @buf along with the parent inode number.
+ */
+static int ext4_check_inline_dir(struct inode *dir, char *buf, int size)
+{
+	struct ext4_dir_entry_2 *de;
+	int start = EXT4_INLINE_DOTDOT_SIZE;
+	int end = EXT4_MIN_INLINE_DATA_SIZE;
+	int offset;
+
+	while (start < size) {
+		for (offset = start; offset < end;
+		     offset += ext4_rec_len_from_disk(de->rec_len,
+						      dir->i_sb->s_blocksize)) {
+			de = (struct ext4_dir_entry_2 *)(buf + offset);
+			if (ext4_check_dir_entry(dir, NULL, de, NULL,
+						 buf + start, end - start,
+						 offset))
+				return -EIO;
+		}
+		start = EXT4_MIN_INLINE_DATA_SIZE;
+		end = size;
+	}
+	return 0;
+}
+
+/*
+ * Move the entries of inline directory @dir to its first block.  Called
+ * with xattr_sem held for writing and write access to @iloc.
+ */
+static int ext4_convert_inline_dir(handle_t *handle, struct inode *dir,
+				   struct ext4_iloc *iloc)
+{
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	struct ext4_dir_entry_2 *de, *last;
+	struct buffer_head *bh;
+	char *buf, *limit;
+	int size, err, no_expand;
+
+	size = __ext4_get_inline_size(dir, iloc);
+	if (size < 0)
+		return size;
+	buf = kmalloc(size, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+	err = ext4_read_inline_data(dir, buf, size, iloc);
+	if (err < 0)
+		goto out;
+	err = ext4_check_inline_dir(dir, buf, size);
+	if (err)
+		goto out;
+
+	/* Don't let the block allocation expand the inode under xattr_sem */
+	no_expand = ext4_test_inode_state(dir, EXT4_STATE_NO_EXPAND);
+	ext4_set_inode_state(dir, EXT4_STATE_NO_EXPAND);
+
+	err = ext4_destroy_inline_data(handle, dir);
+	if (err)
+		goto out_expand;
+
+	dir->i_size = EXT4_I(dir)->i_disksize = 0;
+	bh = ext4_bread(handle, dir, 0, 1, &err);
+	if (!bh) {
+		/* Nothing got allocated, keep the directory inline */
+		if (!ext4_put_inline_data(handle, dir, buf, size))
+			dir->i_size = EXT4_I(dir)->i_disksize = size;
+		goto out_expand;
+	}
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (err)
+		goto out_brelse;
+
+	/* "." and "..", then the entries of both regions in a row */
+	de = ext4_init_dot_dotdot(dir, (struct ext4_dir_entry_2 *)bh->b_data,
+				  blocksize, le32_to_cpu(((__le32 *)buf)[0]), 1);
+	memcpy(de, buf + EXT4_INLINE_DOTDOT_SIZE,
+	       size - EXT4_INLINE_DOTDOT_SIZE);
+	limit = (char *)de + size - EXT4_INLINE_DOTDOT_SIZE;
+	do {
+		last = de;
+		de = ext4_next_entry(de, blocksize);
+	} while ((char *)de < limit);
+	last->rec_len = ext4_rec_len_to_disk(bh->b_data + blocksize -
+					     (char *)last, blocksize);
+
+	BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+	err = ext4_handle_dirty_metadata(handle, dir, bh);
+	if (err)
+		goto out_brelse;
+	dir->i_size = EXT4_I(dir)->i_disksize = blocksize;
+	dir->i_version++;
+	err = ext4_mark_inode_dirty(handle, dir);
+out_brelse:
+	brelse(bh);
+out_expand:
+	if (!no_expand)
+		ext4_clear_inode_state(dir, EXT4_STATE_NO_EXPAND);
+out:
+	kfree(buf);
+	return err;
+}
+
+/*
+ * Add @dentry to inline directory @dir, growing the inline data for it
+ * if needed.  Returns 1 if the entry was added inline, and 0 if the
+ * directory doesn't have inline data any more, for the caller to add
+ * the entry to its blocks.
+ */
+int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			      struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	int reclen = EXT4_DIR_REC_LEN(namelen);
+	struct ext4_inode *raw_inode;
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	void *value;
+	int ret, size;
+
+	ret = ext4_reserve_inode_write(handle, dir, &iloc);
+	if (ret)
+		return ret;
+
+	down_write(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir))
+		goto out;
+
+	raw_inode = ext4_raw_inode(&iloc);
+	ret = ext4_add_dirent_to_inline(dir, inode, &iloc,
+					(void *)raw_inode->i_block +
+					EXT4_INLINE_DOTDOT_SIZE,
+					EXT4_MIN_INLINE_DATA_SIZE -
+					EXT4_INLINE_DOTDOT_SIZE,
+					name, namelen);
+	if (ret != -ENOSPC)
+		goto out_added;
+
+	size = ext4_get_inline_xattr(dir, &iloc, &value);
+	if (size < 0) {
+		ret = size;
+		goto out;
+	}
+	if (size) {
+		ret = ext4_add_dirent_to_inline(dir, inode, &iloc, value, size,
+						name, namelen);
+		if (ret != -ENOSPC)
+			goto out_added;
+	}
+
+	/* Grow the attribute by an empty entry for the new one */
+	ret = ext4_update_inline_xattr(handle, dir, &iloc,
+				       EXT4_MIN_INLINE_DATA_SIZE + size +
+				       reclen);
+	if (!ret) {
+		size = ext4_get_inline_xattr(dir, &iloc, &value);
+		if (size < 0) {
+			ret = size;
+			goto out;
+		}
+		de = value + size - reclen;
+		de->inode = 0;
+		de->rec_len = ext4_rec_len_to_disk(reclen,
+						   dir->i_sb->s_blocksize);
+		dir->i_size = EXT4_I(dir)->i_disksize =
+			EXT4_MIN_INLINE_DATA_SIZE + size;
+		ret = ext4_add_dirent_to_inline(dir, inode, &iloc, value, size,
+						name, namelen);
+		goto out_added;
+	}
+	if (ret == -ENOSPC)
+		ret = ext4_convert_inline_dir(handle, dir, &iloc);
+	goto out;
+
+out_added:
+	if (!ret)
+		ret = 1;
+out:
+	up_write(&EXT4_I(dir)->xattr_sem);
+	if (ret == 1) {
+		int err = ext4_mark_iloc_dirty(handle, dir, &iloc);
+
+		return err ? err : 1;
+	}
+	brelse(iloc.bh);
+	if (!ret && ext4_has_inline_data(dir))
+		ret = -EIO;
+	return ret;
+}
+
+/*
+ * Delete entry @de_del, found by ext4_find_inline_entry() in @bh, from
+ * inline directory @dir.
+ */
+int ext4_delete_inline_entry(handle_t *handle, struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh,
+			     int *has_inline_data)
+{
+	struct ext4_inode *raw_inode;
+	struct ext4_iloc iloc;
+	void *value, *start;
+	int err, size;
+
+	err = ext4_reserve_inode_write(handle, dir, &iloc);
+	if (err)
+		return err;
+
+	down_write(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	start = (void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE;
+	if ((void *)de_del >= start &&
+	    (void *)de_del < (void *)raw_inode->i_block +
+			     EXT4_MIN_INLINE_DATA_SIZE) {
+		err = ext4_generic_delete_entry(dir, de_del, iloc.bh, start,
+						EXT4_MIN_INLINE_DATA_SIZE -
+						EXT4_INLINE_DOTDOT_SIZE);
+	} else {
+		size = ext4_get_inline_xattr(dir, &iloc, &value);
+		if (size < 0)
+			err = size;
+		else
+			err = ext4_generic_delete_entry(dir, de_del, iloc.bh,
+							value, size);
+	}
+	if (err)
+		goto out;
+
+	get_bh(iloc.bh);
+	err = ext4_mark_iloc_dirty(handle, dir, &iloc);
+out:
+	up_write(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	if (err && err != -ENOENT)
+		ext4_std_error(dir->i_sb, err);
+	return err;
+}
+
+/*
+ * Check whether inline directory @dir is empty, for rmdir.  Errors
+ * count as empty, like in empty_dir().
+ */
+int empty_inline_dir(struct inode *dir, int *has_inline_data)
+{
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	char *buf = NULL;
+	int size, offset, ret = 1;
+
+	if (ext4_get_inode_loc(dir, &iloc)) {
+		EXT4_ERROR_INODE(dir, "error reading inline directory");
+		return 1;
+	}
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	size = __ext4_get_inline_size(dir, &iloc);
+	if (size < 0)
+		goto out;
+	buf = kmalloc(size, GFP_NOFS);
+	if (!buf)
+		goto out;
+	if (ext4_read_inline_data(dir, buf, size, &iloc) < 0 ||
+	    ext4_check_inline_dir(dir, buf, size))
+		goto out;
+
+	if (!le32_to_cpu(((__le32 *)buf)[0])) {
+		ext4_warning(dir->i_sb, "bad inline directory (dir #%lu) - "
+			     "no `..'", dir->i_ino);
+		goto out;
+	}
+	for (offset = EXT4_INLINE_DOTDOT_SIZE; offset < size;
+	     offset += ext4_rec_len_from_disk(de->rec_len,
+					      dir->i_sb->s_blocksize)) {
+		de = (struct ext4_dir_entry_2 *)(buf + offset);
+		if (le32_to_cpu(de->inode)) {
+			ret = 0;
+			break;
+		}
+	}
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	kfree(buf);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * readdir() of an inline directory.  Its entries are listed at the
+ * offsets they would have in a directory block, after "." and "..", so
+ * that f_pos stays meaningful whether the directory changes or not.
+ */
+int ext4_read_inline_dir(struct file *filp, void *dirent, filldir_t filldir,
+			 int *has_inline_data)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	unsigned int offset, rlen;
+	char *buf;
+	int size, ret;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	/* Work on a copy, filldir() may fault */
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		*has_inline_data = 0;
+		brelse(iloc.bh);
+		return 0;
+	}
+	size = __ext4_get_inline_size(inode, &iloc);
+	buf = size < 0 ? NULL : kmalloc(size, GFP_NOFS);
+	if (!buf)
+		ret = size < 0 ? size : -ENOMEM;
+	else
+		ret = ext4_read_inline_data(inode, buf, size, &iloc);
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+	if (ret < 0)
+		goto out;
+	ret = 0;
+
+	if (filp->f_pos < EXT4_DIR_REC_LEN(1)) {
+		if (filldir(dirent, ".", 1, 0, inode->i_ino, DT_DIR) < 0)
+			goto out;
+		filp->f_pos = EXT4_DIR_REC_LEN(1);
+	}
+	if (filp->f_pos < EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2)) {
+		if (filldir(dirent, "..", 2, EXT4_DIR_REC_LEN(1),
+			    le32_to_cpu(((__le32 *)buf)[0]), DT_DIR) < 0)
+			goto out;
+		filp->f_pos = EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2);
+	}
+
+	if (ext4_check_inline_dir(inode, buf, size)) {
+		filp->f_pos = size + EXT4_INLINE_DIR_EXTRA;
+		goto out;
+	}
+
+	for (offset = EXT4_INLINE_DOTDOT_SIZE; offset < size; offset += rlen) {
+		de = (struct ext4_dir_entry_2 *)(buf + offset);
+		rlen = ext4_rec_len_from_disk(de->rec_len, sb->s_blocksize);
+		if (offset + EXT4_INLINE_DIR_EXTRA < filp->f_pos)
+			continue;
+		if (le32_to_cpu(de->inode)) {
+			if (filldir(dirent, de->name, de->name_len,
+				    offset + EXT4_INLINE_DIR_EXTRA,
+				    le32_to_cpu(de->inode),
+				    get_dtype(sb, de->file_type)) < 0)
+				goto out;
+		}
+		filp->f_pos = offset + rlen + EXT4_INLINE_DIR_EXTRA;
+	}
+out:
+	kfree(buf);
+	return ret;
+}
+
+/* Read the parent inode number of inline directory @dir. */
+int ext4_get_inline_dotdot(struct inode *dir, __u32 *parent_ino,
+			   int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+	int err;
+
+	err = ext4_get_inode_loc(dir, &iloc);
+	if (err)
+		return err;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (ext4_has_inline_data(dir))
+		*parent_ino = le32_to_cpu(ext4_raw_inode(&iloc)->i_block[0]);
+	else
+		*has_inline_data = 0;
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	return 0;
+}
+
+/* Set the parent inode number of inline directory @dir. */
+int ext4_set_inline_dotdot(handle_t *handle, struct inode *dir,
+			   __u32 parent_ino, int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+	int err;
+
+	err = ext4_reserve_inode_write(handle, dir, &iloc);
+	if (err)
+		return err;
+
+	down_write(&EXT4_I(dir)->xattr_sem);
+	if (ext4_has_inline_data(dir)) {
+		ext4_raw_inode(&iloc)->i_block[0] = cpu_to_le32(parent_ino);
+		err = ext4_mark_iloc_dirty(handle, dir, &iloc);
+	} else {
+		*has_inline_data = 0;
+		brelse(iloc.bh);
+	}
+	up_write(&EXT4_I(dir)->xattr_sem);
+	return err;
+}
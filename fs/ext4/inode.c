@@ -1009,6 +1009,14 @@ static int ext4_ind_map_blocks(handle_t *handle, struct inode *inode,
 	/*
 	 * Okay, we need to do block allocation.
 	*/
+	if (EXT4_HAS_RO_COMPAT_FEATURE(inode->i_sb,
+				       EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		EXT4_ERROR_INODE(inode, "Can't allocate blocks for "
+				 "non-extent mapped inodes with bigalloc");
+		err = -ENOSPC;
+		goto cleanup;
+	}
+
 	goal = ext4_find_goal(inode, map->m_lblk, partial);
 
 	/* the number of blocks need to allocate for [d,t]indirect blocks */
@@ -1134,7 +1142,7 @@ void ext4_da_update_reserve_space(struct inode *inode,
 	/* Update per-inode reservations */
 	ei->i_reserved_data_blocks -= used;
 	ei->i_reserved_meta_blocks -= ei->i_allocated_meta_blocks;
-	percpu_counter_sub(&sbi->s_dirtyblocks_counter,
+	percpu_counter_sub(&sbi->s_dirtyclusters_counter,
 			   used + ei->i_allocated_meta_blocks);
 	ei->i_allocated_meta_blocks = 0;
 
@@ -1144,7 +1152,7 @@ void ext4_da_update_reserve_space(struct inode *inode,
 		 * only when we have written all of the delayed
 		 * allocation blocks.
 		 */
-		percpu_counter_sub(&sbi->s_dirtyblocks_counter,
+		percpu_counter_sub(&sbi->s_dirtyclusters_counter,
 				   ei->i_reserved_meta_blocks);
 		ei->i_reserved_meta_blocks = 0;
 		ei->i_da_metadata_calc_len = 0;
@@ -1304,6 +1312,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	if ((flags & EXT4_GET_BLOCKS_CREATE) == 0)
 		return retval;
 
+	/* The file is getting blocks, its data can't go inline any more */
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
 	/*
 	 * Returns if the blocks have already allocated
 	 *
@@ -1348,6 +1359,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	 */
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		retval = ext4_ext_map_blocks(handle, inode, map, flags);
+		if (retval > 0)
+			ext4_fc_track_range(handle, inode, map->m_lblk,
+					    retval);
 	} else {
 		retval = ext4_ind_map_blocks(handle, inode, map, flags);
 
@@ -1623,6 +1637,13 @@ static int ext4_write_begin(struct file *file, struct address_space *mapping,
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret)
+			return ret < 0 ? ret : 0;
+	}
+
 retry:
 	handle = ext4_journal_start(inode, needed_blocks);
 	if (IS_ERR(handle)) {
@@ -1704,7 +1725,20 @@ static int ext4_generic_write_end(struct file *file,
 	struct inode *inode = mapping->host;
 	handle_t *handle = ext4_journal_current_handle();
 
-	copied = block_write_end(file, mapping, pos, len, copied, page, fsdata);
+	if (ext4_has_inline_data(inode)) {
+		int ret;
+
+		ret = ext4_write_inline_data_end(inode, pos, len, copied,
+						 page);
+		if (ret < 0) {
+			unlock_page(page);
+			page_cache_release(page);
+			return ret;
+		}
+		copied = ret;
+	} else
+		copied = block_write_end(file, mapping, pos, len, copied,
+					 page, fsdata);
 
 	/*
 	 * No need to use i_size_read() here, the i_size
@@ -1849,6 +1883,17 @@ static int ext4_journalled_write_end(struct file *file,
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
+	if (ext4_has_inline_data(inode)) {
+		/* Inline data is journalled with the inode */
+		ret2 = ext4_generic_write_end(file, mapping, pos, len, copied,
+					      page, fsdata);
+		if (ret2 < 0)
+			ret = ret2;
+		else
+			copied = ret2;
+		goto out;
+	}
+
 	if (copied < len) {
 		if (!PageUptodate(page))
 			copied = 0;
@@ -1872,6 +1917,7 @@ static int ext4_journalled_write_end(struct file *file,
 
 	unlock_page(page);
 	page_cache_release(page);
+out:
 	if (pos + len > inode->i_size && ext4_can_truncate(inode))
 		/* if we have allocated more blocks and copied
 		 * less. We will have blocks allocated outside
@@ -1896,6 +1942,90 @@ static int ext4_journalled_write_end(struct file *file,
 	return ret ? ret : copied;
 }
 
+/*
+ * Move the inline data of @inode to a block, for the file to grow
+ * beyond what the inode can hold or to be mapped.  This also stops
+ * further writes from trying to keep the data inline.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	handle_t *handle;
+	struct page *page;
+	unsigned len = 0;
+	int ret, err, retries = 0;
+
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	if (!ext4_has_inline_data(inode))
+		return 0;
+
+retry:
+	handle = ext4_journal_start(inode, ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = grab_cache_page_write_begin(inode->i_mapping, 0, AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_write(&EXT4_I(inode)->xattr_sem);
+		ret = 0;
+		goto out_unlock;
+	}
+	ret = ext4_get_inline_size(inode);
+	if (ret >= 0) {
+		len = min_t(loff_t, i_size_read(inode), ret);
+		ret = 0;
+		if (!PageUptodate(page))
+			ret = ext4_read_inline_page(inode, page);
+	}
+	if (ret >= 0)
+		ret = ext4_destroy_inline_data(handle, inode);
+	up_write(&EXT4_I(inode)->xattr_sem);
+	if (ret || !len)
+		goto out_unlock;
+
+	/*
+	 * The inline data fits in the first block, so either it gets
+	 * allocated or nothing does, and the page isn't zeroed on failure.
+	 */
+	ret = __block_write_begin(page, 0, len, ext4_get_block);
+	if (ret) {
+		/* Don't lose the data, put it back inline */
+		down_write(&EXT4_I(inode)->xattr_sem);
+		err = ext4_restore_inline_data(handle, inode, page, len);
+		up_write(&EXT4_I(inode)->xattr_sem);
+		if (err)
+			ext4_std_error(inode->i_sb, err);
+		goto out_unlock;
+	}
+	if (ext4_should_journal_data(inode)) {
+		ret = walk_page_buffers(handle, page_buffers(page), 0, len,
+					NULL, do_journal_get_write_access);
+		if (!ret)
+			ret = walk_page_buffers(handle, page_buffers(page), 0,
+						len, NULL, write_end_fn);
+		ext4_set_inode_state(inode, EXT4_STATE_JDATA);
+	} else {
+		if (ext4_should_order_data(inode))
+			ret = ext4_jbd2_file_inode(handle, inode);
+		block_commit_write(page, 0, len);
+	}
+out_unlock:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	err = ext4_journal_stop(handle);
+	if (!ret)
+		ret = err;
+	if (ret == -ENOSPC && ext4_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+	return ret;
+}
+
 /*
  * Reserve a single block located at lblock
  */
@@ -1930,7 +2060,7 @@ repeat:
 	 * We do still charge estimated metadata to the sb though;
 	 * we cannot afford to run out of free blocks.
 	 */
-	if (ext4_claim_free_blocks(sbi, md_needed + 1, 0)) {
+	if (ext4_claim_free_clusters(sbi, md_needed + 1, 0)) {
 		dquot_release_reservation_block(inode, 1);
 		if (ext4_should_retry_alloc(inode->i_sb, &retries)) {
 			yield();
@@ -1979,14 +2109,14 @@ static void ext4_da_release_space(struct inode *inode, int to_free)
 		 * only when we have written all of the delayed
 		 * allocation blocks.
 		 */
-		percpu_counter_sub(&sbi->s_dirtyblocks_counter,
+		percpu_counter_sub(&sbi->s_dirtyclusters_counter,
 				   ei->i_reserved_meta_blocks);
 		ei->i_reserved_meta_blocks = 0;
 		ei->i_da_metadata_calc_len = 0;
 	}
 
 	/* update fs dirty data blocks counter */
-	percpu_counter_sub(&sbi->s_dirtyblocks_counter, to_free);
+	percpu_counter_sub(&sbi->s_dirtyclusters_counter, to_free);
 
 	spin_unlock(&EXT4_I(inode)->i_block_reservation_lock);
 
@@ -2201,12 +2331,12 @@ static void ext4_print_free_blocks(struct inode *inode)
 {
 	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	printk(KERN_CRIT "Total free blocks count %lld\n",
-	       ext4_count_free_blocks(inode->i_sb));
+	       ext4_count_free_clusters(inode->i_sb));
 	printk(KERN_CRIT "Free/Dirty block details\n");
 	printk(KERN_CRIT "free_blocks=%lld\n",
-	       (long long) percpu_counter_sum(&sbi->s_freeblocks_counter));
+	       (long long) percpu_counter_sum(&sbi->s_freeclusters_counter));
 	printk(KERN_CRIT "dirty_blocks=%lld\n",
-	       (long long) percpu_counter_sum(&sbi->s_dirtyblocks_counter));
+	       (long long) percpu_counter_sum(&sbi->s_dirtyclusters_counter));
 	printk(KERN_CRIT "Block reservation details\n");
 	printk(KERN_CRIT "i_reserved_data_blocks=%u\n",
 	       EXT4_I(inode)->i_reserved_data_blocks);
@@ -2286,7 +2416,7 @@ static void mpage_da_map_and_submit(struct mpage_da_data *mpd)
 			goto submit_io;
 
 		if (err == -ENOSPC &&
-		    ext4_count_free_blocks(sb)) {
+		    ext4_count_free_clusters(sb)) {
 			mpd->retval = err;
 			goto submit_io;
 		}
@@ -3078,10 +3208,10 @@ static int ext4_nonda_switch(struct super_block *sb)
 	 * Delalloc need an accurate free block accounting. So switch
 	 * to non delalloc when we are near to error range.
 	 */
-	free_blocks  = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
-	dirty_blocks = percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
+	free_blocks  = percpu_counter_read_positive(&sbi->s_freeclusters_counter);
+	dirty_blocks = percpu_counter_read_positive(&sbi->s_dirtyclusters_counter);
 	if (2 * free_blocks < 3 * dirty_blocks ||
-		free_blocks < (dirty_blocks + EXT4_FREEBLOCKS_WATERMARK)) {
+		free_blocks < (dirty_blocks + EXT4_FREECLUSTERS_WATERMARK)) {
 		/*
 		 * free block count is less than 150% of dirty blocks
 		 * or free blocks is less than watermark
@@ -3117,6 +3247,18 @@ static int ext4_da_write_begin(struct file *file, struct address_space *mapping,
 	}
 	*fsdata = (void *)0;
 	trace_ext4_da_write_begin(inode, pos, len, flags);
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			return ret;
+		if (ret == 1) {
+			/* Nothing to delay, finish as a nondelalloc write */
+			*fsdata = (void *)FALL_BACK_TO_NONDELALLOC;
+			return 0;
+		}
+	}
 retry:
 	/*
 	 * With delayed allocation, we don't log the i_disksize update
@@ -3335,6 +3477,10 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* Inline data has no blocks to map */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) &&
 			test_opt(inode->i_sb, DELALLOC)) {
 		/*
@@ -3380,14 +3526,30 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 
 static int ext4_readpage(struct file *file, struct page *page)
 {
+	int ret = -EAGAIN;
+	struct inode *inode = page->mapping->host;
+
 	trace_ext4_readpage(page);
-	return mpage_readpage(page, ext4_get_block);
+
+	if (ext4_has_inline_data(inode))
+		ret = ext4_readpage_inline(inode, page);
+
+	if (ret == -EAGAIN)
+		return mpage_readpage(page, ext4_get_block);
+
+	return ret;
 }
 
 static int
 ext4_readpages(struct file *file, struct address_space *mapping,
 		struct list_head *pages, unsigned nr_pages)
 {
+	struct inode *inode = mapping->host;
+
+	/* If the file has inline data, no need to do readahead. */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	return mpage_readpages(mapping, pages, nr_pages, ext4_get_block);
 }
 
@@ -3805,6 +3967,10 @@ static ssize_t ext4_direct_IO(int rw, struct kiocb *iocb,
 	struct inode *inode = file->f_mapping->host;
 	ssize_t ret;
 
+	/* Let buffered I/O handle inline data */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	trace_ext4_direct_IO_enter(inode, offset, iov_length(iov, nr_segs), rw);
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
 		ret = ext4_ext_direct_IO(rw, iocb, iov, offset, nr_segs);
@@ -4499,6 +4665,16 @@ void ext4_truncate(struct inode *inode)
 	if (inode->i_size == 0 && !test_opt(inode->i_sb, NO_AUTO_DA_ALLOC))
 		ext4_set_inode_state(inode, EXT4_STATE_DA_ALLOC_CLOSE);
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		ext4_inline_data_truncate(inode, &has_inline_data);
+		if (has_inline_data) {
+			trace_ext4_truncate_exit(inode);
+			return;
+		}
+	}
+
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		ext4_ext_truncate(inode);
 		trace_ext4_truncate_exit(inode);
@@ -4802,7 +4978,8 @@ void ext4_set_inode_flags(struct inode *inode)
 {
 	unsigned int flags = EXT4_I(inode)->i_flags;
 
-	inode->i_flags &= ~(S_SYNC|S_APPEND|S_IMMUTABLE|S_NOATIME|S_DIRSYNC);
+	inode->i_flags &= ~(S_SYNC|S_APPEND|S_IMMUTABLE|S_NOATIME|S_DIRSYNC|
+			    S_PARDIROPS);
 	if (flags & EXT4_SYNC_FL)
 		inode->i_flags |= S_SYNC;
 	if (flags & EXT4_APPEND_FL)
@@ -4813,6 +4990,10 @@ void ext4_set_inode_flags(struct inode *inode)
 		inode->i_flags |= S_NOATIME;
 	if (flags & EXT4_DIRSYNC_FL)
 		inode->i_flags |= S_DIRSYNC;
+	/* Only the htree can take creates and unlinks in parallel */
+	if (S_ISDIR(inode->i_mode) && is_dx(inode) &&
+	    test_opt2(inode->i_sb, PDIROPS))
+		inode->i_flags |= S_PARDIROPS;
 }
 
 /* Propagate flags from i_flags to EXT4_I(inode)->i_flags */
@@ -4960,6 +5141,8 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 		read_unlock(&journal->j_state_lock);
 		ei->i_sync_tid = tid;
 		ei->i_datasync_tid = tid;
+		/* changes before the inode was evicted weren't tracked */
+		ei->i_fc_ineligible_tid = tid;
 	}
 
 	if (EXT4_INODE_SIZE(inode->i_sb) > EXT4_GOOD_OLD_INODE_SIZE) {
@@ -5002,6 +5185,16 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 				 ei->i_file_acl);
 		ret = -EIO;
 		goto bad_inode;
+	} else if (ext4_has_inline_data(inode)) {
+		if (!EXT4_HAS_INCOMPAT_FEATURE(sb,
+				EXT4_FEATURE_INCOMPAT_INLINE_DATA) ||
+		    !ei->i_extra_isize ||
+		    !(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))) {
+			EXT4_ERROR_INODE(inode, "bad inline data inode");
+			ret = -EIO;
+			goto bad_inode;
+		}
+		ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
 	} else if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 		    (S_ISLNK(inode->i_mode) &&
@@ -5195,9 +5388,11 @@ static int ext4_do_update_inode(handle_t *handle,
 				cpu_to_le32(new_encode_dev(inode->i_rdev));
 			raw_inode->i_block[2] = 0;
 		}
-	} else
+	} else if (!ext4_has_inline_data(inode)) {
+		/* Inline data is only ever updated in the raw inode */
 		for (block = 0; block < EXT4_N_BLOCKS; block++)
 			raw_inode->i_block[block] = ei->i_data[block];
+	}
 
 	raw_inode->i_disk_version = cpu_to_le32(inode->i_version);
 	if (ei->i_extra_isize) {
@@ -5691,9 +5886,11 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 	might_sleep();
 	trace_ext4_mark_inode_dirty(inode, _RET_IP_);
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
+	/* Inline data must stay in the inode body, don't shift it out */
 	if (ext4_handle_valid(handle) &&
 	    EXT4_I(inode)->i_extra_isize < sbi->s_want_extra_isize &&
-	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND)) {
+	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND) &&
+	    !ext4_has_inline_data(inode)) {
 		/*
 		 * We need extra buffer credits since we may write into EA block
 		 * with this same handle. If journal_extend fails, then it will
@@ -5863,6 +6060,14 @@ int ext4_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
 	 * __block_page_mkwrite() to do a reliable check.
 	 */
 	vfs_check_frozen(inode->i_sb, SB_FREEZE_WRITE);
+
+	/* Inline data can't be mapped, move it to a block first */
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_convert_inline_data(inode);
+		if (ret)
+			goto out_ret;
+	}
+
 	/* Delalloc case is easy... */
 	if (test_opt(inode->i_sb, DELALLOC) &&
 	    !ext4_should_journal_data(inode) &&
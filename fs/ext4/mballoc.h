@@ -105,8 +105,8 @@ struct ext4_free_data {
 	/* group which free block extent belongs */
 	ext4_group_t group;
 
-	/* free block extent */
-	ext4_grpblk_t start_blk;
+	/* free block extent, in clusters */
+	ext4_grpblk_t start_cluster;
 	ext4_grpblk_t count;
 
 	/* transaction which freed this extent */
@@ -125,8 +125,9 @@ struct ext4_prealloc_space {
 	unsigned		pa_deleted;
 	ext4_fsblk_t		pa_pstart;	/* phys. block */
 	ext4_lblk_t		pa_lstart;	/* log. block */
-	ext4_grpblk_t		pa_len;		/* len of preallocated chunk */
-	ext4_grpblk_t		pa_free;	/* how many blocks are free */
+	ext4_grpblk_t		pa_len;		/* len of preallocated chunk,
+						 * in clusters */
+	ext4_grpblk_t		pa_free;	/* how many clusters are free */
 	unsigned short		pa_type;	/* pa type. inode or group */
 	spinlock_t		*pa_obj_lock;
 	struct inode		*pa_inode;	/* hack, for history only */
@@ -137,11 +138,12 @@ enum {
 	MB_GROUP_PA = 1
 };
 
+/* An extent of clusters in a group, at logical block fe_logical */
 struct ext4_free_extent {
 	ext4_lblk_t fe_logical;
-	ext4_grpblk_t fe_start;
+	ext4_grpblk_t fe_start;	/* In cluster units */
 	ext4_group_t fe_group;
-	ext4_grpblk_t fe_len;
+	ext4_grpblk_t fe_len;	/* In cluster units */
 };
 
 /*
@@ -217,6 +219,7 @@ struct ext4_buddy {
 static inline ext4_fsblk_t ext4_grp_offs_to_block(struct super_block *sb,
 					struct ext4_free_extent *fex)
 {
-	return ext4_group_first_block_no(sb, fex->fe_group) + fex->fe_start;
+	return ext4_group_first_block_no(sb, fex->fe_group) +
+		EXT4_C2B(EXT4_SB(sb), fex->fe_start);
 }
 #endif
@@ -360,6 +360,7 @@ static int ext4_ext_swap_inode_data(handle_t *handle, struct inode *inode,
 	i_data[1] = ei->i_data[EXT4_DIND_BLOCK];
 	i_data[2] = ei->i_data[EXT4_TIND_BLOCK];
 
+	ext4_fc_mark_ineligible(handle, inode);
 	down_write(&EXT4_I(inode)->i_data_sem);
 	/*
 	 * if EXT4_STATE_EXT_MIGRATE is cleared a block allocation
@@ -478,6 +479,10 @@ int ext4_ext_migrate(struct inode *inode)
 	    (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
 		return -EINVAL;
 
+	/* Inline data has no block map to migrate */
+	if (ext4_has_inline_data(inode))
+		return -EOPNOTSUPP;
+
 	if (S_ISLNK(inode->i_mode) && inode->i_blocks == 0)
 		/*
 		 * don't migrate fast symlink
@@ -664,6 +664,9 @@ mext_replace_branches(handle_t *handle, struct inode *orig_inode,
 	int replaced_count = 0;
 	int dext_alen;
 
+	ext4_fc_mark_ineligible(handle, orig_inode);
+	ext4_fc_mark_ineligible(handle, donor_inode);
+
 	/* Protect extent trees against block allocations via delalloc */
 	double_down_write_data_sem(orig_inode, donor_inode);
 
@@ -49,6 +49,45 @@
 #define NAMEI_RA_SIZE	     (NAMEI_RA_CHUNKS * NAMEI_RA_BLOCKS)
 #define NAMEI_RA_INDEX(c,b)  (((c) * NAMEI_RA_BLOCKS) + (b))
 
+/*
+ * Creates and unlinks in an indexed directory run under a shared
+ * i_dir_sem, so they may be changing other leaf blocks at the same time
+ * (see the pdirops mount option).  Whoever parses or changes a leaf
+ * under the shared lock holds that leaf's BH_Dirlock bit while doing
+ * so.  The index blocks only change under the exclusive lock.
+ */
+static int ext4_dirblock_wait(void *word)
+{
+	schedule();
+	return 0;
+}
+
+static void ext4_lock_dirblock(struct buffer_head *bh)
+{
+	wait_on_bit_lock(&bh->b_state, BH_Dirlock, ext4_dirblock_wait,
+			 TASK_UNINTERRUPTIBLE);
+}
+
+static void ext4_unlock_dirblock(struct buffer_head *bh)
+{
+	clear_bit_unlock(BH_Dirlock, &bh->b_state);
+	smp_mb__after_clear_bit();
+	wake_up_bit(&bh->b_state, BH_Dirlock);
+}
+
+/*
+ * Turning the index on or off changes S_PARDIROPS, but ext4_set_inode_flags()
+ * rewrites i_flags without any atomicity, so leave that to callers that
+ * hold the directory exclusively.  Parallel creates count themselves in
+ * i_dio_count (see fs/namei.c), and a non-indexed directory that still
+ * has S_PARDIROPS only ever gets i_dir_sem taken exclusive for adds.
+ */
+static void ext4_dir_set_inode_flags(struct inode *dir)
+{
+	if (!atomic_read(&dir->i_dio_count))
+		ext4_set_inode_flags(dir);
+}
+
 static struct buffer_head *ext4_append(handle_t *handle,
 					struct inode *inode,
 					ext4_lblk_t *block, int *err)
@@ -178,17 +217,7 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 		struct ext4_dir_entry_2 **res_dir,
 		int *err);
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
-			     struct inode *inode);
-
-/*
- * p is at least 6 bytes before the end of page
- */
-static inline struct ext4_dir_entry_2 *
-ext4_next_entry(struct ext4_dir_entry_2 *p, unsigned long blocksize)
-{
-	return (struct ext4_dir_entry_2 *)((char *)p +
-		ext4_rec_len_from_disk(p->rec_len, blocksize));
-}
+			     struct inode *inode, int shared);
 
 /*
  * Future: use high four bits of block for coalesce-on-delete flags
@@ -577,17 +606,20 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 	if (!(bh = ext4_bread (NULL, dir, block, 0, &err)))
 		return err;
 
+	ext4_lock_dirblock(bh);
 	de = (struct ext4_dir_entry_2 *) bh->b_data;
 	top = (struct ext4_dir_entry_2 *) ((char *) de +
 					   dir->i_sb->s_blocksize -
 					   EXT4_DIR_REC_LEN(0));
 	for (; de < top; de = ext4_next_entry(de, dir->i_sb->s_blocksize)) {
 		if (ext4_check_dir_entry(dir, NULL, de, bh,
+				bh->b_data, bh->b_size,
 				(block<<EXT4_BLOCK_SIZE_BITS(dir->i_sb))
 					 + ((char *)de - bh->b_data))) {
 			/* On error, skip the f_pos to the next block. */
 			dir_file->f_pos = (dir_file->f_pos |
 					(dir->i_sb->s_blocksize - 1)) + 1;
+			ext4_unlock_dirblock(bh);
 			brelse(bh);
 			return count;
 		}
@@ -600,11 +632,13 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 			continue;
 		if ((err = ext4_htree_store_dirent(dir_file,
 				   hinfo->hash, hinfo->minor_hash, de)) != 0) {
+			ext4_unlock_dirblock(bh);
 			brelse(bh);
 			return err;
 		}
 		count++;
 	}
+	ext4_unlock_dirblock(bh);
 	brelse(bh);
 	return count;
 }
@@ -633,6 +667,7 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	dxtrace(printk(KERN_DEBUG "In htree_fill_tree, start hash: %x:%x\n",
 		       start_hash, start_minor_hash));
 	dir = dir_file->f_path.dentry->d_inode;
+	down_read(&EXT4_I(dir)->i_dir_sem);
 	if (!(ext4_test_inode_flag(dir, EXT4_INODE_INDEX))) {
 		hinfo.hash_version = EXT4_SB(dir->i_sb)->s_def_hash_version;
 		if (hinfo.hash_version <= DX_HASH_TEA)
@@ -642,13 +677,16 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 		count = htree_dirblock_to_tree(dir_file, dir, 0, &hinfo,
 					       start_hash, start_minor_hash);
 		*next_hash = ~0;
+		up_read(&EXT4_I(dir)->i_dir_sem);
 		return count;
 	}
 	hinfo.hash = start_hash;
 	hinfo.minor_hash = 0;
 	frame = dx_probe(NULL, dir, &hinfo, frames, &err);
-	if (!frame)
+	if (!frame) {
+		up_read(&EXT4_I(dir)->i_dir_sem);
 		return err;
+	}
 
 	/* Add '.' and '..' from the htree header */
 	if (!start_hash && !start_minor_hash) {
@@ -692,11 +730,13 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 			break;
 	}
 	dx_release(frames);
+	up_read(&EXT4_I(dir)->i_dir_sem);
 	dxtrace(printk(KERN_DEBUG "Fill tree: returned %d entries, "
 		       "next hash: %x\n", count, *next_hash));
 	return count;
 errout:
 	dx_release(frames);
+	up_read(&EXT4_I(dir)->i_dir_sem);
 	return (err);
 }
 
@@ -798,13 +838,14 @@ static inline int ext4_match (int len, const char * const name,
 }
 
 /*
+ * Search @buf_size bytes of directory entries at @search_buf, which
+ * belong to @bh if not inline.
+ *
  * Returns 0 if not found, -1 on failure, and 1 on success
  */
-static inline int search_dirblock(struct buffer_head *bh,
-				  struct inode *dir,
-				  const struct qstr *d_name,
-				  unsigned int offset,
-				  struct ext4_dir_entry_2 ** res_dir)
+int ext4_search_dir(struct buffer_head *bh, char *search_buf, int buf_size,
+		    struct inode *dir, const struct qstr *d_name,
+		    unsigned int offset, struct ext4_dir_entry_2 **res_dir)
 {
 	struct ext4_dir_entry_2 * de;
 	char * dlimit;
@@ -812,8 +853,8 @@ static inline int search_dirblock(struct buffer_head *bh,
 	const char *name = d_name->name;
 	int namelen = d_name->len;
 
-	de = (struct ext4_dir_entry_2 *) bh->b_data;
-	dlimit = bh->b_data + dir->i_sb->s_blocksize;
+	de = (struct ext4_dir_entry_2 *) search_buf;
+	dlimit = search_buf + buf_size;
 	while ((char *) de < dlimit) {
 		/* this code is executed quadratically often */
 		/* do minimal checking `by hand' */
@@ -821,7 +862,8 @@ static inline int search_dirblock(struct buffer_head *bh,
 		if ((char *) de + namelen <= dlimit &&
 		    ext4_match (namelen, name, de)) {
 			/* found a match - just to be sure, do a full check */
-			if (ext4_check_dir_entry(dir, NULL, de, bh, offset))
+			if (ext4_check_dir_entry(dir, NULL, de, bh, search_buf,
+						 buf_size, offset))
 				return -1;
 			*res_dir = de;
 			return 1;
@@ -837,6 +879,21 @@ static inline int search_dirblock(struct buffer_head *bh,
 	return 0;
 }
 
+static inline int search_dirblock(struct buffer_head *bh,
+				  struct inode *dir,
+				  const struct qstr *d_name,
+				  unsigned int offset,
+				  struct ext4_dir_entry_2 **res_dir)
+{
+	int ret;
+
+	ext4_lock_dirblock(bh);
+	ret = ext4_search_dir(bh, bh->b_data, dir->i_sb->s_blocksize, dir,
+			      d_name, offset, res_dir);
+	ext4_unlock_dirblock(bh);
+	return ret;
+}
+
 
 /*
  *	ext4_find_entry()
@@ -848,6 +905,10 @@ static inline int search_dirblock(struct buffer_head *bh,
  *
  * The returned buffer_head has ->b_count elevated.  The caller is expected
  * to brelse() it when appropriate.
+ *
+ * Unless the directory is known to be quiet (the VFS holds i_mutex and has
+ * drained parallel operations), the caller holds i_dir_sem, so that the
+ * entry stays where it is until it has been used.
  */
 static struct buffer_head * ext4_find_entry (struct inode *dir,
 					const struct qstr *d_name,
@@ -872,6 +933,16 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 	namelen = d_name->len;
 	if (namelen > EXT4_NAME_LEN)
 		return NULL;
+
+	if (ext4_has_inline_data(dir)) {
+		int has_inline_data = 1;
+
+		ret = ext4_find_inline_entry(dir, d_name, res_dir,
+					     &has_inline_data);
+		if (has_inline_data)
+			return ret;
+	}
+
 	if ((namelen <= 2) && (name[0] == '.') &&
 	    (name[1] == '.' || name[1] == '\0')) {
 		/*
@@ -1023,14 +1094,18 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, stru
 	struct inode *inode;
 	struct ext4_dir_entry_2 *de;
 	struct buffer_head *bh;
+	__u32 ino = 0;
 
 	if (dentry->d_name.len > EXT4_NAME_LEN)
 		return ERR_PTR(-ENAMETOOLONG);
 
+	down_read(&EXT4_I(dir)->i_dir_sem);
 	bh = ext4_find_entry(dir, &dentry->d_name, &de);
+	if (bh)
+		ino = le32_to_cpu(de->inode);
+	up_read(&EXT4_I(dir)->i_dir_sem);
 	inode = NULL;
 	if (bh) {
-		__u32 ino = le32_to_cpu(de->inode);
 		brelse(bh);
 		if (!ext4_valid_inum(dir->i_sb, ino)) {
 			EXT4_ERROR_INODE(dir, "bad inode number: %u", ino);
@@ -1058,10 +1133,13 @@ struct dentry *ext4_get_parent(struct dentry *child)
 	struct ext4_dir_entry_2 * de;
 	struct buffer_head *bh;
 
+	down_read(&EXT4_I(child->d_inode)->i_dir_sem);
 	bh = ext4_find_entry(child->d_inode, &dotdot, &de);
+	if (bh)
+		ino = le32_to_cpu(de->inode);
+	up_read(&EXT4_I(child->d_inode)->i_dir_sem);
 	if (!bh)
 		return ERR_PTR(-ENOENT);
-	ino = le32_to_cpu(de->inode);
 	brelse(bh);
 
 	if (!ext4_valid_inum(child->d_inode->i_sb, ino)) {
@@ -1240,6 +1318,72 @@ errout:
 	return NULL;
 }
 
+/*
+ * Find room for a @namelen long entry in the @buf_size bytes of
+ * directory entries at @buf, which belong to @bh if not inline.
+ * Returns -ENOSPC if no space is available, and -EIO and -EEXIST if
+ * the directory entry already exists.
+ */
+int ext4_find_dest_de(struct inode *dir, struct buffer_head *bh,
+		      char *buf, int buf_size, const char *name, int namelen,
+		      struct ext4_dir_entry_2 **dest_de)
+{
+	struct ext4_dir_entry_2 *de;
+	unsigned short reclen = EXT4_DIR_REC_LEN(namelen);
+	int nlen, rlen;
+	unsigned int offset = 0;
+	char *top;
+
+	de = (struct ext4_dir_entry_2 *)buf;
+	top = buf + buf_size - reclen;
+	while ((char *) de <= top) {
+		if (ext4_check_dir_entry(dir, NULL, de, bh,
+					 buf, buf_size, offset))
+			return -EIO;
+		if (ext4_match(namelen, name, de))
+			return -EEXIST;
+		nlen = EXT4_DIR_REC_LEN(de->name_len);
+		rlen = ext4_rec_len_from_disk(de->rec_len, buf_size);
+		if ((de->inode? rlen - nlen: rlen) >= reclen)
+			break;
+		de = (struct ext4_dir_entry_2 *)((char *)de + rlen);
+		offset += rlen;
+	}
+	if ((char *) de > top)
+		return -ENOSPC;
+
+	*dest_de = de;
+	return 0;
+}
+
+/*
+ * Fill in the entry found by ext4_find_dest_de(), splitting it first
+ * if it is in use.
+ */
+void ext4_insert_dentry(struct inode *dir, struct inode *inode,
+			struct ext4_dir_entry_2 *de, int buf_size,
+			const char *name, int namelen)
+{
+	int nlen, rlen;
+
+	nlen = EXT4_DIR_REC_LEN(de->name_len);
+	rlen = ext4_rec_len_from_disk(de->rec_len, buf_size);
+	if (de->inode) {
+		struct ext4_dir_entry_2 *de1 = (struct ext4_dir_entry_2 *)((char *)de + nlen);
+		de1->rec_len = ext4_rec_len_to_disk(rlen - nlen, buf_size);
+		de->rec_len = ext4_rec_len_to_disk(nlen, buf_size);
+		de = de1;
+	}
+	de->file_type = EXT4_FT_UNKNOWN;
+	if (inode) {
+		de->inode = cpu_to_le32(inode->i_ino);
+		ext4_set_de_type(dir->i_sb, de, inode->i_mode);
+	} else
+		de->inode = 0;
+	de->name_len = namelen;
+	memcpy(de->name, name, namelen);
+}
+
 /*
  * Add a new entry into a directory (leaf) block.  If de is non-NULL,
  * it points to a directory entry which is guaranteed to be large
@@ -1255,30 +1399,14 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	struct inode	*dir = dentry->d_parent->d_inode;
 	const char	*name = dentry->d_name.name;
 	int		namelen = dentry->d_name.len;
-	unsigned int	offset = 0;
 	unsigned int	blocksize = dir->i_sb->s_blocksize;
-	unsigned short	reclen;
-	int		nlen, rlen, err;
-	char		*top;
+	int		err;
 
-	reclen = EXT4_DIR_REC_LEN(namelen);
 	if (!de) {
-		de = (struct ext4_dir_entry_2 *)bh->b_data;
-		top = bh->b_data + blocksize - reclen;
-		while ((char *) de <= top) {
-			if (ext4_check_dir_entry(dir, NULL, de, bh, offset))
-				return -EIO;
-			if (ext4_match(namelen, name, de))
-				return -EEXIST;
-			nlen = EXT4_DIR_REC_LEN(de->name_len);
-			rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
-			if ((de->inode? rlen - nlen: rlen) >= reclen)
-				break;
-			de = (struct ext4_dir_entry_2 *)((char *)de + rlen);
-			offset += rlen;
-		}
-		if ((char *) de > top)
-			return -ENOSPC;
+		err = ext4_find_dest_de(dir, bh, bh->b_data, blocksize,
+					name, namelen, &de);
+		if (err)
+			return err;
 	}
 	BUFFER_TRACE(bh, "get_write_access");
 	err = ext4_journal_get_write_access(handle, bh);
@@ -1288,22 +1416,7 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	}
 
 	/* By now the buffer is marked for journaling */
-	nlen = EXT4_DIR_REC_LEN(de->name_len);
-	rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
-	if (de->inode) {
-		struct ext4_dir_entry_2 *de1 = (struct ext4_dir_entry_2 *)((char *)de + nlen);
-		de1->rec_len = ext4_rec_len_to_disk(rlen - nlen, blocksize);
-		de->rec_len = ext4_rec_len_to_disk(nlen, blocksize);
-		de = de1;
-	}
-	de->file_type = EXT4_FT_UNKNOWN;
-	if (inode) {
-		de->inode = cpu_to_le32(inode->i_ino);
-		ext4_set_de_type(dir->i_sb, de, inode->i_mode);
-	} else
-		de->inode = 0;
-	de->name_len = namelen;
-	memcpy(de->name, name, namelen);
+	ext4_insert_dentry(dir, inode, de, blocksize, name, namelen);
 	/*
 	 * XXX shouldn't update any times until successful
 	 * completion of syscall, but too many callers depend
@@ -1377,6 +1490,7 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 		return retval;
 	}
 	ext4_set_inode_flag(dir, EXT4_INODE_INDEX);
+	ext4_dir_set_inode_flags(dir);
 	data1 = bh2->b_data;
 
 	memcpy (data1, de, len);
@@ -1432,17 +1546,11 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 }
 
 /*
- *	ext4_add_entry()
- *
- * adds a file entry to the specified directory, using the same
- * semantics as ext4_find_entry(). It returns NULL if it failed.
- *
- * NOTE!! The inode part of 'de' is left at 0 - which means you
- * may not sleep between calling this and putting something into
- * the entry, as someone else might have used it while you slept.
+ * Add an entry with i_dir_sem held exclusive: this may split leaves,
+ * grow the index or turn the directory into an indexed one.
  */
-static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
-			  struct inode *inode)
+static int __ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			    struct inode *inode)
 {
 	struct inode *dir = dentry->d_parent->d_inode;
 	struct buffer_head *bh;
@@ -1455,13 +1563,20 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 
 	sb = dir->i_sb;
 	blocksize = sb->s_blocksize;
-	if (!dentry->d_name.len)
-		return -EINVAL;
+
+	if (ext4_has_inline_data(dir)) {
+		/* 1 if added inline, 0 if the directory got a block */
+		retval = ext4_try_add_inline_entry(handle, dentry, inode);
+		if (retval)
+			return retval < 0 ? retval : 0;
+	}
+
 	if (is_dx(dir)) {
-		retval = ext4_dx_add_entry(handle, dentry, inode);
+		retval = ext4_dx_add_entry(handle, dentry, inode, 0);
 		if (!retval || (retval != ERR_BAD_DX_DIR))
 			return retval;
 		ext4_clear_inode_flag(dir, EXT4_INODE_INDEX);
+		ext4_dir_set_inode_flags(dir);
 		dx_fallback++;
 		ext4_mark_inode_dirty(handle, dir);
 	}
@@ -1495,10 +1610,52 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 }
 
 /*
- * Returns 0 for success, or a negative error value
+ *	ext4_add_entry()
+ *
+ * adds a file entry to the specified directory, using the same
+ * semantics as ext4_find_entry(). It returns NULL if it failed.
+ *
+ * NOTE!! The inode part of 'de' is left at 0 - which means you
+ * may not sleep between calling this and putting something into
+ * the entry, as someone else might have used it while you slept.
+ */
+static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			  struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct ext4_inode_info *ei = EXT4_I(dir);
+	int retval;
+
+	if (!dentry->d_name.len)
+		return -EINVAL;
+
+	/*
+	 * Most adds to an indexed directory only change the one leaf the
+	 * name hashes to, which a shared i_dir_sem is enough for.
+	 */
+	down_read(&ei->i_dir_sem);
+	if (is_dx(dir)) {
+		retval = ext4_dx_add_entry(handle, dentry, inode, 1);
+		if (retval != -EAGAIN && retval != ERR_BAD_DX_DIR) {
+			up_read(&ei->i_dir_sem);
+			return retval;
+		}
+	}
+	up_read(&ei->i_dir_sem);
+
+	down_write(&ei->i_dir_sem);
+	retval = __ext4_add_entry(handle, dentry, inode);
+	up_write(&ei->i_dir_sem);
+	return retval;
+}
+
+/*
+ * Returns 0 for success, or a negative error value.  With @shared set
+ * the caller holds i_dir_sem shared, and -EAGAIN means the leaf is full
+ * and has to be split with it held exclusive.
  */
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
-			     struct inode *inode)
+			     struct inode *inode, int shared)
 {
 	struct dx_frame frames[2], *frame;
 	struct dx_entry *entries, *at;
@@ -1518,12 +1675,23 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 	if (!(bh = ext4_bread(handle,dir, dx_get_block(frame->at), 0, &err)))
 		goto cleanup;
 
+	if (shared)
+		ext4_lock_dirblock(bh);
 	BUFFER_TRACE(bh, "get_write_access");
 	err = ext4_journal_get_write_access(handle, bh);
-	if (err)
+	if (err) {
+		if (shared)
+			ext4_unlock_dirblock(bh);
 		goto journal_error;
+	}
 
 	err = add_dirent_to_buf(handle, dentry, inode, NULL, bh);
+	if (shared) {
+		ext4_unlock_dirblock(bh);
+		if (err == -ENOSPC)
+			err = -EAGAIN;
+		goto cleanup;
+	}
 	if (err != -ENOSPC)
 		goto cleanup;
 
@@ -1633,56 +1801,84 @@ cleanup:
 }
 
 /*
- * ext4_delete_entry deletes a directory entry by merging it with the
- * previous entry
+ * ext4_generic_delete_entry deletes a directory entry from the
+ * @buf_size bytes at @entry_buf by merging it with the previous entry.
+ * The caller is responsible for journaling the change.
  */
-static int ext4_delete_entry(handle_t *handle,
-			     struct inode *dir,
-			     struct ext4_dir_entry_2 *de_del,
-			     struct buffer_head *bh)
+int ext4_generic_delete_entry(struct inode *dir,
+			      struct ext4_dir_entry_2 *de_del,
+			      struct buffer_head *bh,
+			      char *entry_buf,
+			      int buf_size)
 {
 	struct ext4_dir_entry_2 *de, *pde;
-	unsigned int blocksize = dir->i_sb->s_blocksize;
-	int i, err;
+	int i;
 
 	i = 0;
 	pde = NULL;
-	de = (struct ext4_dir_entry_2 *) bh->b_data;
-	while (i < bh->b_size) {
-		if (ext4_check_dir_entry(dir, NULL, de, bh, i))
+	de = (struct ext4_dir_entry_2 *) entry_buf;
+	while (i < buf_size) {
+		if (ext4_check_dir_entry(dir, NULL, de, bh,
+					 entry_buf, buf_size, i))
 			return -EIO;
 		if (de == de_del)  {
-			BUFFER_TRACE(bh, "get_write_access");
-			err = ext4_journal_get_write_access(handle, bh);
-			if (unlikely(err)) {
-				ext4_std_error(dir->i_sb, err);
-				return err;
-			}
 			if (pde)
 				pde->rec_len = ext4_rec_len_to_disk(
 					ext4_rec_len_from_disk(pde->rec_len,
-							       blocksize) +
+							       buf_size) +
 					ext4_rec_len_from_disk(de->rec_len,
-							       blocksize),
-					blocksize);
+							       buf_size),
+					buf_size);
 			else
 				de->inode = 0;
 			dir->i_version++;
-			BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
-			err = ext4_handle_dirty_metadata(handle, dir, bh);
-			if (unlikely(err)) {
-				ext4_std_error(dir->i_sb, err);
-				return err;
-			}
 			return 0;
 		}
-		i += ext4_rec_len_from_disk(de->rec_len, blocksize);
+		i += ext4_rec_len_from_disk(de->rec_len, buf_size);
 		pde = de;
-		de = ext4_next_entry(de, blocksize);
+		de = ext4_next_entry(de, buf_size);
 	}
 	return -ENOENT;
 }
 
+static int ext4_delete_entry(handle_t *handle,
+			     struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh)
+{
+	int err;
+
+	if (ext4_has_inline_data(dir)) {
+		int has_inline_data = 1;
+
+		err = ext4_delete_inline_entry(handle, dir, de_del, bh,
+					       &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
+	ext4_lock_dirblock(bh);
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (likely(!err))
+		err = ext4_generic_delete_entry(dir, de_del, bh, bh->b_data,
+						dir->i_sb->s_blocksize);
+	ext4_unlock_dirblock(bh);
+	if (err)
+		goto out;
+
+	BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+	err = ext4_handle_dirty_metadata(handle, dir, bh);
+	if (unlikely(err))
+		goto out;
+
+	return 0;
+out:
+	if (err != -ENOENT)
+		ext4_std_error(dir->i_sb, err);
+	return err;
+}
+
 /*
  * DIR_NLINK feature is set if 1) nlinks > EXT4_LINK_MAX or 2) nlinks == 2,
  * since this indicates that nlinks count was previously 1.
@@ -1806,13 +2002,72 @@ retry:
 	return err;
 }
 
+/*
+ * Set up the "." and ".." entries at @de in a new directory block, and
+ * return the entry following them.  If @dotdot_real_len is set, ".."
+ * only gets the space it needs, otherwise the rest of the block.
+ */
+struct ext4_dir_entry_2 *ext4_init_dot_dotdot(struct inode *inode,
+			  struct ext4_dir_entry_2 *de,
+			  int blocksize,
+			  unsigned int parent_ino, int dotdot_real_len)
+{
+	de->inode = cpu_to_le32(inode->i_ino);
+	de->name_len = 1;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(de->name_len),
+					   blocksize);
+	strcpy(de->name, ".");
+	ext4_set_de_type(inode->i_sb, de, S_IFDIR);
+
+	de = ext4_next_entry(de, blocksize);
+	de->inode = cpu_to_le32(parent_ino);
+	de->name_len = 2;
+	if (!dotdot_real_len)
+		de->rec_len = ext4_rec_len_to_disk(blocksize -
+					EXT4_DIR_REC_LEN(1), blocksize);
+	else
+		de->rec_len = ext4_rec_len_to_disk(
+				EXT4_DIR_REC_LEN(de->name_len), blocksize);
+	strcpy(de->name, "..");
+	ext4_set_de_type(inode->i_sb, de, S_IFDIR);
+
+	return ext4_next_entry(de, blocksize);
+}
+
+static int ext4_init_new_dir(handle_t *handle, struct inode *dir,
+			     struct inode *inode)
+{
+	struct buffer_head *dir_block = NULL;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	int err;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		err = ext4_try_create_inline_dir(handle, dir, inode);
+		if (err != -ENOSPC)
+			return err;
+	}
+
+	inode->i_size = EXT4_I(inode)->i_disksize = blocksize;
+	dir_block = ext4_bread(handle, inode, 0, 1, &err);
+	if (!dir_block)
+		return err;
+	BUFFER_TRACE(dir_block, "get_write_access");
+	err = ext4_journal_get_write_access(handle, dir_block);
+	if (err)
+		goto out;
+	ext4_init_dot_dotdot(inode, (struct ext4_dir_entry_2 *)
+			     dir_block->b_data, blocksize, dir->i_ino, 0);
+	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_metadata");
+	err = ext4_handle_dirty_metadata(handle, inode, dir_block);
+out:
+	brelse(dir_block);
+	return err;
+}
+
 static int ext4_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 {
 	handle_t *handle;
 	struct inode *inode;
-	struct buffer_head *dir_block = NULL;
-	struct ext4_dir_entry_2 *de;
-	unsigned int blocksize = dir->i_sb->s_blocksize;
 	int err, retries = 0;
 
 	if (EXT4_DIR_LINK_MAX(dir))
@@ -1838,33 +2093,10 @@ retry:
 
 	inode->i_op = &ext4_dir_inode_operations;
 	inode->i_fop = &ext4_dir_operations;
-	inode->i_size = EXT4_I(inode)->i_disksize = inode->i_sb->s_blocksize;
-	dir_block = ext4_bread(handle, inode, 0, 1, &err);
-	if (!dir_block)
-		goto out_clear_inode;
-	BUFFER_TRACE(dir_block, "get_write_access");
-	err = ext4_journal_get_write_access(handle, dir_block);
+	err = ext4_init_new_dir(handle, dir, inode);
 	if (err)
 		goto out_clear_inode;
-	de = (struct ext4_dir_entry_2 *) dir_block->b_data;
-	de->inode = cpu_to_le32(inode->i_ino);
-	de->name_len = 1;
-	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(de->name_len),
-					   blocksize);
-	strcpy(de->name, ".");
-	ext4_set_de_type(dir->i_sb, de, S_IFDIR);
-	de = ext4_next_entry(de, blocksize);
-	de->inode = cpu_to_le32(dir->i_ino);
-	de->rec_len = ext4_rec_len_to_disk(blocksize - EXT4_DIR_REC_LEN(1),
-					   blocksize);
-	de->name_len = 2;
-	strcpy(de->name, "..");
-	ext4_set_de_type(dir->i_sb, de, S_IFDIR);
 	inode->i_nlink = 2;
-	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_metadata");
-	err = ext4_handle_dirty_metadata(handle, dir, dir_block);
-	if (err)
-		goto out_clear_inode;
 	err = ext4_mark_inode_dirty(handle, inode);
 	if (!err)
 		err = ext4_add_entry(handle, dentry, inode);
@@ -1884,7 +2116,6 @@ out_clear_inode:
 	d_instantiate(dentry, inode);
 	unlock_new_inode(inode);
 out_stop:
-	brelse(dir_block);
 	ext4_journal_stop(handle);
 	if (err == -ENOSPC && ext4_should_retry_alloc(dir->i_sb, &retries))
 		goto retry;
@@ -1902,6 +2133,14 @@ static int empty_dir(struct inode *inode)
 	struct super_block *sb;
 	int err = 0;
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		err = empty_inline_dir(inode, &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
 	sb = inode->i_sb;
 	if (inode->i_size < EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2) ||
 	    !(bh = ext4_bread(NULL, inode, 0, 0, &err))) {
@@ -1947,7 +2186,8 @@ static int empty_dir(struct inode *inode)
 			}
 			de = (struct ext4_dir_entry_2 *) bh->b_data;
 		}
-		if (ext4_check_dir_entry(inode, NULL, de, bh, offset)) {
+		if (ext4_check_dir_entry(inode, NULL, de, bh,
+					 bh->b_data, bh->b_size, offset)) {
 			de = (struct ext4_dir_entry_2 *)(bh->b_data +
 							 sb->s_blocksize);
 			offset = (offset | (sb->s_blocksize - 1)) + 1;
@@ -2205,6 +2445,8 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
 
+	/* Hold the entry in place against splits until it is gone */
+	down_read(&EXT4_I(dir)->i_dir_sem);
 	retval = -ENOENT;
 	bh = ext4_find_entry(dir, &dentry->d_name, &de);
 	if (!bh)
@@ -2215,6 +2457,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	retval = -EIO;
 	if (le32_to_cpu(de->inode) != inode->i_ino)
 		goto end_unlink;
+	ext4_fc_mark_ineligible(handle, inode);
 
 	if (!inode->i_nlink) {
 		ext4_warning(inode->i_sb,
@@ -2236,6 +2479,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	retval = 0;
 
 end_unlink:
+	up_read(&EXT4_I(dir)->i_dir_sem);
 	ext4_journal_stop(handle);
 	brelse(bh);
 	trace_ext4_unlink_exit(dentry, retval);
@@ -2370,6 +2614,7 @@ retry:
 
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_inc_count(handle, inode);
+	ext4_fc_mark_ineligible(handle, inode);
 	ihold(inode);
 
 	err = ext4_add_entry(handle, dentry, inode);
@@ -2393,19 +2638,83 @@ retry:
  * Anybody can rename anything with this: the permission checks are left to the
  * higher-level routines.
  */
+/*
+ * Read the ".." entry of directory @inode, whether inline or in its
+ * first block.
+ */
+static int ext4_get_dotdot(handle_t *handle, struct inode *inode,
+			   __u32 *parent_ino)
+{
+	struct buffer_head *bh;
+	int err = -EIO;
+
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		err = ext4_get_inline_dotdot(inode, parent_ino,
+					     &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
+	bh = ext4_bread(handle, inode, 0, 0, &err);
+	if (!bh)
+		return err ? err : -EIO;
+	*parent_ino = le32_to_cpu(PARENT_INO(bh->b_data,
+					     inode->i_sb->s_blocksize));
+	brelse(bh);
+	return 0;
+}
+
+/*
+ * Point the ".." entry of directory @inode at @parent_ino.  The
+ * directory may have been converted from inline data since it was
+ * checked, as its i_mutex isn't held.
+ */
+static int ext4_set_dotdot(handle_t *handle, struct inode *inode,
+			   __u32 parent_ino)
+{
+	struct buffer_head *bh;
+	int err = -EIO;
+
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		err = ext4_set_inline_dotdot(handle, inode, parent_ino,
+					     &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
+	bh = ext4_bread(handle, inode, 0, 0, &err);
+	if (!bh)
+		return err ? err : -EIO;
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (!err) {
+		PARENT_INO(bh->b_data, inode->i_sb->s_blocksize) =
+						cpu_to_le32(parent_ino);
+		BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+		err = ext4_handle_dirty_metadata(handle, inode, bh);
+	}
+	brelse(bh);
+	return err;
+}
+
 static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 		       struct inode *new_dir, struct dentry *new_dentry)
 {
 	handle_t *handle;
 	struct inode *old_inode, *new_inode;
-	struct buffer_head *old_bh, *new_bh, *dir_bh;
+	struct buffer_head *old_bh, *new_bh;
 	struct ext4_dir_entry_2 *old_de, *new_de;
-	int retval, force_da_alloc = 0;
+	int retval, force_da_alloc = 0, move_dir = 0;
+	__u32 parent_ino;
 
 	dquot_initialize(old_dir);
 	dquot_initialize(new_dir);
 
-	old_bh = new_bh = dir_bh = NULL;
+	old_bh = new_bh = NULL;
 
 	/* Initialize quotas before so that eventual writes go
 	 * in separate transaction */
@@ -2431,8 +2740,11 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	retval = -ENOENT;
 	if (!old_bh || le32_to_cpu(old_de->inode) != old_inode->i_ino)
 		goto end_rename;
+	ext4_fc_mark_ineligible(handle, old_inode);
 
 	new_inode = new_dentry->d_inode;
+	if (new_inode)
+		ext4_fc_mark_ineligible(handle, new_inode);
 	new_bh = ext4_find_entry(new_dir, &new_dentry->d_name, &new_de);
 	if (new_bh) {
 		if (!new_inode) {
@@ -2446,21 +2758,17 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 			if (!empty_dir(new_inode))
 				goto end_rename;
 		}
-		retval = -EIO;
-		dir_bh = ext4_bread(handle, old_inode, 0, 0, &retval);
-		if (!dir_bh)
+		retval = ext4_get_dotdot(handle, old_inode, &parent_ino);
+		if (retval)
 			goto end_rename;
-		if (le32_to_cpu(PARENT_INO(dir_bh->b_data,
-				old_dir->i_sb->s_blocksize)) != old_dir->i_ino)
+		retval = -EIO;
+		if (parent_ino != old_dir->i_ino)
 			goto end_rename;
 		retval = -EMLINK;
 		if (!new_inode && new_dir != old_dir &&
 		    EXT4_DIR_LINK_MAX(new_dir))
 			goto end_rename;
-		BUFFER_TRACE(dir_bh, "get_write_access");
-		retval = ext4_journal_get_write_access(handle, dir_bh);
-		if (retval)
-			goto end_rename;
+		move_dir = 1;
 	}
 	if (!new_bh) {
 		retval = ext4_add_entry(handle, new_dentry, old_inode);
@@ -2530,11 +2838,11 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	}
 	old_dir->i_ctime = old_dir->i_mtime = ext4_current_time(old_dir);
 	ext4_update_dx_flag(old_dir);
-	if (dir_bh) {
-		PARENT_INO(dir_bh->b_data, new_dir->i_sb->s_blocksize) =
-						cpu_to_le32(new_dir->i_ino);
-		BUFFER_TRACE(dir_bh, "call ext4_handle_dirty_metadata");
-		retval = ext4_handle_dirty_metadata(handle, old_dir, dir_bh);
+	if (move_dir) {
+		/* Creates may be going on in the directory being moved */
+		down_write(&EXT4_I(old_inode)->i_dir_sem);
+		retval = ext4_set_dotdot(handle, old_inode, new_dir->i_ino);
+		up_write(&EXT4_I(old_inode)->i_dir_sem);
 		if (retval) {
 			ext4_std_error(old_dir->i_sb, retval);
 			goto end_rename;
@@ -2561,7 +2869,6 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	retval = 0;
 
 end_rename:
-	brelse(dir_bh);
 	brelse(old_bh);
 	brelse(new_bh);
 	ext4_journal_stop(handle);
@@ -741,6 +741,11 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 	int gdb_off, gdb_num;
 	int err, err2;
 
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		ext4_warning(sb, "Online resizing not supported with bigalloc");
+		return -EOPNOTSUPP;
+	}
+
 	gdb_num = input->group / EXT4_DESC_PER_BLOCK(sb);
 	gdb_off = input->group % EXT4_DESC_PER_BLOCK(sb);
 
@@ -798,6 +803,8 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 		err = PTR_ERR(handle);
 		goto exit_put;
 	}
+	/* fast commit replay can't allocate from a group it doesn't know */
+	ext4_fc_mark_sb_ineligible(handle, sb);
 
 	mutex_lock(&sbi->s_resize_lock);
 	if (input->group != sbi->s_groups_count) {
@@ -853,7 +860,7 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 	ext4_block_bitmap_set(sb, gdp, input->block_bitmap); /* LV FIXME */
 	ext4_inode_bitmap_set(sb, gdp, input->inode_bitmap); /* LV FIXME */
 	ext4_inode_table_set(sb, gdp, input->inode_table); /* LV FIXME */
-	ext4_free_blks_set(sb, gdp, input->free_blocks_count);
+	ext4_free_group_clusters_set(sb, gdp, input->free_blocks_count);
 	ext4_free_inodes_set(sb, gdp, EXT4_INODES_PER_GROUP(sb));
 	gdp->bg_flags = cpu_to_le16(EXT4_BG_INODE_ZEROED);
 	gdp->bg_checksum = ext4_group_desc_csum(sbi, input->group, gdp);
@@ -919,7 +926,7 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 		input->reserved_blocks);
 
 	/* Update the free space counts */
-	percpu_counter_add(&sbi->s_freeblocks_counter,
+	percpu_counter_add(&sbi->s_freeclusters_counter,
 			   input->free_blocks_count);
 	percpu_counter_add(&sbi->s_freeinodes_counter,
 			   EXT4_INODES_PER_GROUP(sb));
@@ -929,7 +936,7 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 		ext4_group_t flex_group;
 		flex_group = ext4_flex_group(sbi, input->group);
 		atomic_add(input->free_blocks_count,
-			   &sbi->s_flex_groups[flex_group].free_blocks);
+			   &sbi->s_flex_groups[flex_group].free_clusters);
 		atomic_add(EXT4_INODES_PER_GROUP(sb),
 			   &sbi->s_flex_groups[flex_group].free_inodes);
 	}
@@ -984,6 +991,11 @@ int ext4_group_extend(struct super_block *sb, struct ext4_super_block *es,
 	if (n_blocks_count == 0 || n_blocks_count == o_blocks_count)
 		return 0;
 
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		ext4_warning(sb, "Online resizing not supported with bigalloc");
+		return -EOPNOTSUPP;
+	}
+
 	if (n_blocks_count > (sector_t)(~0ULL) >> (sb->s_blocksize_bits - 9)) {
 		printk(KERN_ERR "EXT4-fs: filesystem on %s:"
 			" too large to resize to %llu blocks safely\n",
@@ -1037,6 +1049,8 @@ int ext4_group_extend(struct super_block *sb, struct ext4_super_block *es,
 		ext4_warning(sb, "error %d on journal start", err);
 		goto exit_put;
 	}
+	/* fast commit replay can't allocate from a group it doesn't know */
+	ext4_fc_mark_sb_ineligible(handle, sb);
 
 	mutex_lock(&EXT4_SB(sb)->s_resize_lock);
 	if (o_blocks_count != ext4_blocks_count(es)) {
@@ -21,6 +21,7 @@
 #define EXT4_XATTR_INDEX_TRUSTED		4
 #define	EXT4_XATTR_INDEX_LUSTRE			5
 #define EXT4_XATTR_INDEX_SECURITY	        6
+#define EXT4_XATTR_INDEX_SYSTEM_DATA		7
 
 struct ext4_xattr_header {
 	__le32	h_magic;	/* magic number for identification */
@@ -63,6 +64,26 @@ struct ext4_xattr_entry {
 		EXT4_I(inode)->i_extra_isize))
 #define IFIRST(hdr) ((struct ext4_xattr_entry *)((hdr)+1))
 
+struct ext4_xattr_info {
+	int name_index;
+	const char *name;
+	const void *value;
+	size_t value_len;
+};
+
+struct ext4_xattr_search {
+	struct ext4_xattr_entry *first;
+	void *base;
+	void *end;
+	struct ext4_xattr_entry *here;
+	int not_found;
+};
+
+struct ext4_xattr_ibody_find {
+	struct ext4_xattr_search s;
+	struct ext4_iloc iloc;
+};
+
 # ifdef CONFIG_EXT4_FS_XATTR
 
 extern const struct xattr_handler ext4_xattr_user_handler;
@@ -83,11 +104,62 @@ extern void ext4_xattr_put_super(struct super_block *);
 extern int ext4_expand_extra_isize_ea(struct inode *inode, int new_extra_isize,
 			    struct ext4_inode *raw_inode, handle_t *handle);
 
+extern int ext4_xattr_ibody_find(struct inode *inode, struct ext4_xattr_info *i,
+				 struct ext4_xattr_ibody_find *is);
+extern int ext4_xattr_ibody_set(handle_t *handle, struct inode *inode,
+				struct ext4_xattr_info *i,
+				struct ext4_xattr_ibody_find *is);
+
 extern int __init ext4_init_xattr(void);
 extern void ext4_exit_xattr(void);
 
 extern const struct xattr_handler *ext4_xattr_handlers[];
 
+/* inline.c */
+extern int ext4_get_inline_size(struct inode *inode);
+extern int ext4_read_inline_page(struct inode *inode, struct page *page);
+extern int ext4_restore_inline_data(handle_t *handle, struct inode *inode,
+				    struct page *page, unsigned len);
+extern int ext4_readpage_inline(struct inode *inode, struct page *page);
+extern int ext4_try_to_write_inline_data(struct address_space *mapping,
+					 struct inode *inode,
+					 loff_t pos, unsigned len,
+					 unsigned flags,
+					 struct page **pagep);
+extern int ext4_write_inline_data_end(struct inode *inode,
+				      loff_t pos, unsigned len,
+				      unsigned copied,
+				      struct page *page);
+extern int ext4_destroy_inline_data(handle_t *handle, struct inode *inode);
+extern void ext4_inline_data_truncate(struct inode *inode,
+				      int *has_inline_data);
+extern int ext4_inline_data_fiemap(struct inode *inode,
+				   struct fiemap_extent_info *fieinfo,
+				   int *has_inline_data);
+
+extern int ext4_try_create_inline_dir(handle_t *handle,
+				      struct inode *parent,
+				      struct inode *inode);
+extern struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					const struct qstr *d_name,
+					struct ext4_dir_entry_2 **res_dir,
+					int *has_inline_data);
+extern int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+				     struct inode *inode);
+extern int ext4_delete_inline_entry(handle_t *handle,
+				    struct inode *dir,
+				    struct ext4_dir_entry_2 *de_del,
+				    struct buffer_head *bh,
+				    int *has_inline_data);
+extern int empty_inline_dir(struct inode *dir, int *has_inline_data);
+extern int ext4_read_inline_dir(struct file *filp,
+				void *dirent, filldir_t filldir,
+				int *has_inline_data);
+extern int ext4_get_inline_dotdot(struct inode *dir, __u32 *parent_ino,
+				  int *has_inline_data);
+extern int ext4_set_inline_dotdot(handle_t *handle, struct inode *dir,
+				  __u32 parent_ino, int *has_inline_data);
+
 # else  /* CONFIG_EXT4_FS_XATTR */
 
 static inline int
@@ -141,6 +213,134 @@ ext4_expand_extra_isize_ea(struct inode *inode, int new_extra_isize,
 
 #define ext4_xattr_handlers	NULL
 
+/*
+ * Inline data can't be enabled without xattr support, so these are
+ * never reached with an inline inode.
+ */
+static inline int
+ext4_get_inline_size(struct inode *inode)
+{
+	return 0;
+}
+
+static inline int
+ext4_read_inline_page(struct inode *inode, struct page *page)
+{
+	return 0;
+}
+
+static inline int
+ext4_restore_inline_data(handle_t *handle, struct inode *inode,
+			 struct page *page, unsigned len)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int
+ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	return -EAGAIN;
+}
+
+static inline int
+ext4_try_to_write_inline_data(struct address_space *mapping,
+			      struct inode *inode, loff_t pos, unsigned len,
+			      unsigned flags, struct page **pagep)
+{
+	return 0;
+}
+
+static inline int
+ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			   unsigned copied, struct page *page)
+{
+	return -EIO;
+}
+
+static inline int
+ext4_destroy_inline_data(handle_t *handle, struct inode *inode)
+{
+	return 0;
+}
+
+static inline void
+ext4_inline_data_truncate(struct inode *inode, int *has_inline_data)
+{
+	*has_inline_data = 0;
+}
+
+static inline int
+ext4_inline_data_fiemap(struct inode *inode,
+			struct fiemap_extent_info *fieinfo,
+			int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return 0;
+}
+
+static inline int
+ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			   struct inode *inode)
+{
+	return -ENOSPC;
+}
+
+static inline struct buffer_head *
+ext4_find_inline_entry(struct inode *dir, const struct qstr *d_name,
+		       struct ext4_dir_entry_2 **res_dir,
+		       int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return NULL;
+}
+
+static inline int
+ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			  struct inode *inode)
+{
+	return 0;
+}
+
+static inline int
+ext4_delete_inline_entry(handle_t *handle, struct inode *dir,
+			 struct ext4_dir_entry_2 *de_del,
+			 struct buffer_head *bh, int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return 0;
+}
+
+static inline int
+empty_inline_dir(struct inode *dir, int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return 0;
+}
+
+static inline int
+ext4_read_inline_dir(struct file *filp, void *dirent, filldir_t filldir,
+		     int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return 0;
+}
+
+static inline int
+ext4_get_inline_dotdot(struct inode *dir, __u32 *parent_ino,
+		       int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return 0;
+}
+
+static inline int
+ext4_set_inline_dotdot(handle_t *handle, struct inode *dir, __u32 parent_ino,
+		       int *has_inline_data)
+{
+	*has_inline_data = 0;
+	return 0;
+}
+
 # endif  /* CONFIG_EXT4_FS_XATTR */
 
 #ifdef CONFIG_EXT4_FS_SECURITY
@@ -675,7 +675,7 @@ static inline bool over_bground_thresh(void)
 static void wb_update_bandwidth(struct bdi_writeback *wb,
 				unsigned long start_time)
 {
-	__bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, start_time);
+	__bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, 0, start_time);
 }
 
 /*
@@ -1144,6 +1144,7 @@ EXPORT_SYMBOL(__mark_inode_dirty);
 static void wait_sb_inodes(struct super_block *sb)
 {
 	struct inode *inode, *old_inode = NULL;
+	int cpu;
 
 	/*
 	 * We need to be protected against the filesystem going from
@@ -1151,8 +1152,6 @@ static void wait_sb_inodes(struct super_block *sb)
 	 */
 	WARN_ON(!rwsem_is_locked(&sb->s_umount));
 
-	spin_lock(&inode_sb_list_lock);
-
 	/*
 	 * Data integrity sync. Must wait for all pages under writeback,
 	 * because there may have been pages dirtied before our sync
@@ -1160,37 +1159,42 @@ static void wait_sb_inodes(struct super_block *sb)
 	 * In which case, the inode may not be on the dirty list, but
 	 * we still have to wait for that writeout.
 	 */
-	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
-		struct address_space *mapping = inode->i_mapping;
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *list = per_cpu_ptr(sb->s_inodes, cpu);
 
-		spin_lock(&inode->i_lock);
-		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
-		    (mapping->nrpages == 0)) {
+		spin_lock(&list->lock);
+		list_for_each_entry(inode, &list->head, i_sb_list) {
+			struct address_space *mapping = inode->i_mapping;
+
+			spin_lock(&inode->i_lock);
+			if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
+			    (mapping->nrpages == 0)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+			__iget(inode);
 			spin_unlock(&inode->i_lock);
-			continue;
-		}
-		__iget(inode);
-		spin_unlock(&inode->i_lock);
-		spin_unlock(&inode_sb_list_lock);
+			spin_unlock(&list->lock);
 
-		/*
-		 * We hold a reference to 'inode' so it couldn't have been
-		 * removed from s_inodes list while we dropped the
-		 * inode_sb_list_lock.  We cannot iput the inode now as we can
-		 * be holding the last reference and we cannot iput it under
-		 * inode_sb_list_lock. So we keep the reference and iput it
-		 * later.
-		 */
-		iput(old_inode);
-		old_inode = inode;
+			/*
+			 * We hold a reference to 'inode' so it couldn't have
+			 * been removed from its s_inodes shard while we
+			 * dropped the shard lock.  We cannot iput the inode
+			 * now as we can be holding the last reference and we
+			 * cannot iput it under the shard lock. So we keep the
+			 * reference and iput it later.
+			 */
+			iput(old_inode);
+			old_inode = inode;
 
-		filemap_fdatawait(mapping);
+			filemap_fdatawait(mapping);
 
-		cond_resched();
+			cond_resched();
 
-		spin_lock(&inode_sb_list_lock);
+			spin_lock(&list->lock);
+		}
+		spin_unlock(&list->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 	iput(old_inode);
 }
 
@@ -477,6 +477,7 @@ static void cuse_fc_release(struct fuse_conn *fc)
  */
 static int cuse_channel_open(struct inode *inode, struct file *file)
 {
+	struct fuse_chan *chan;
 	struct cuse_conn *cc;
 	int rc;
 
@@ -490,14 +491,23 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
 	INIT_LIST_HEAD(&cc->list);
 	cc->fc.release = cuse_fc_release;
 
+	chan = fuse_chan_alloc(&cc->fc);
+	if (!chan) {
+		fuse_conn_put(&cc->fc);
+		return -ENOMEM;
+	}
+
 	cc->fc.connected = 1;
 	cc->fc.blocked = 0;
 	rc = cuse_send_init(cc);
 	if (rc) {
+		fuse_chan_release(chan);
 		fuse_conn_put(&cc->fc);
 		return rc;
 	}
-	file->private_data = &cc->fc;	/* channel owns base reference to cc */
+	file->private_data = chan;
+	/* channel owns the reference to cc from here on */
+	fuse_conn_put(&cc->fc);
 
 	return 0;
 }
@@ -515,7 +525,8 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
  */
 static int cuse_channel_release(struct inode *inode, struct file *file)
 {
-	struct cuse_conn *cc = fc_to_cc(file->private_data);
+	struct fuse_chan *chan = file->private_data;
+	struct cuse_conn *cc = fc_to_cc(chan->fc);
 	int rc;
 
 	/* remove from the conntbl, no more access from this point on */
@@ -533,7 +544,7 @@ static int cuse_channel_release(struct inode *inode, struct file *file)
 
 	/* kill connection and shutdown channel */
 	fuse_conn_kill(&cc->fc);
-	rc = fuse_dev_release(inode, file);	/* puts the base reference */
+	rc = fuse_dev_release(inode, file);	/* puts the last reference */
 
 	return rc;
 }
@@ -25,15 +25,180 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or cloning and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+static void fuse_chan_put(struct fuse_chan *chan)
+{
+	if (atomic_dec_and_test(&chan->count)) {
+		struct fuse_conn *fc = chan->fc;
+
+		kfree_rcu(chan, rcu);
+		fuse_conn_put(fc);
+	}
+}
+
+/*
+ * Lock the channel owning a queued request.  The request may be moved
+ * to another channel by fuse_chan_release() until the lock is taken.
+ */
+static struct fuse_chan *fuse_req_lock_chan(struct fuse_req *req)
+{
+	struct fuse_chan *chan;
+
+	rcu_read_lock();
+	for (;;) {
+		chan = ACCESS_ONCE(req->chan);
+		spin_lock(&chan->lock);
+		if (likely(chan == req->chan))
+			break;
+		spin_unlock(&chan->lock);
+	}
+	rcu_read_unlock();
+
+	return chan;
+}
+
+static int fuse_chan_connected(struct fuse_chan *chan)
+{
+	return chan->connected && chan->fc->connected;
+}
+
+/*
+ * Lock the channel this cpu queues requests on.  Returns NULL if the
+ * connection is gone.
+ */
+static struct fuse_chan *fuse_chan_lock_cpu(struct fuse_conn *fc)
+{
+	struct fuse_chan *chan;
+
+	rcu_read_lock();
+	for (;;) {
+		chan = NULL;
+		if (fc->chan_map)
+			chan = rcu_dereference(fc->chan_map[raw_smp_processor_id()]);
+		if (!chan)
+			break;
+
+		spin_lock(&chan->lock);
+		if (fuse_chan_connected(chan))
+			break;
+		spin_unlock(&chan->lock);
+
+		/* The channel is being released, its cpus get remapped */
+		if (!fc->connected) {
+			chan = NULL;
+			break;
+		}
+		cpu_relax();
+	}
+	rcu_read_unlock();
+
+	return chan;
+}
+
+/*
+ * Route requests sent on this cpu to the channel, whose reader is
+ * running here.
+ */
+static void fuse_chan_bind(struct fuse_chan *chan)
+{
+	struct fuse_conn *fc = chan->fc;
+	int cpu = raw_smp_processor_id();
+
+	if (rcu_access_pointer(fc->chan_map[cpu]) == chan)
+		return;
+
+	spin_lock(&fc->lock);
+	if (chan->connected)
+		rcu_assign_pointer(fc->chan_map[cpu], chan);
+	spin_unlock(&fc->lock);
+}
+
+/*
+ * Wake up a reader of the channel, or failing that, a reader of some
+ * other channel which can steal the request
+ */
+static void fuse_chan_wake(struct fuse_chan *chan)
+{
+	struct fuse_chan *other;
+
+	/* Pairs with set_current_state() in request_wait() */
+	smp_mb();
+	if (waitqueue_active(&chan->waitq)) {
+		wake_up(&chan->waitq);
+		return;
+	}
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(other, &chan->fc->chans, entry) {
+		if (waitqueue_active(&other->waitq)) {
+			wake_up(&other->waitq);
+			break;
+		}
+	}
+	rcu_read_unlock();
+}
+
+void fuse_wake_chans(struct fuse_conn *fc)
+{
+	struct fuse_chan *chan;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(chan, &fc->chans, entry)
+		wake_up_all(&chan->waitq);
+	rcu_read_unlock();
+}
+
+struct fuse_chan *fuse_chan_alloc(struct fuse_conn *fc)
+{
+	struct fuse_chan __rcu **map = NULL;
+	struct fuse_chan *chan;
+	int cpu;
+
+	chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+	if (!chan)
+		return NULL;
+
+	/* The first channel is set up before the connection is exposed */
+	if (!fc->chan_map) {
+		map = kcalloc(nr_cpu_ids, sizeof(*map), GFP_KERNEL);
+		if (!map) {
+			kfree(chan);
+			return NULL;
+		}
+	}
+
+	spin_lock_init(&chan->lock);
+	atomic_set(&chan->count, 1);
+	chan->connected = 1;
+	init_waitqueue_head(&chan->waitq);
+	INIT_LIST_HEAD(&chan->pending);
+	INIT_LIST_HEAD(&chan->processing);
+	INIT_LIST_HEAD(&chan->io);
+	INIT_LIST_HEAD(&chan->interrupts);
+	chan->fc = fuse_conn_get(fc);
+
+	spin_lock(&fc->lock);
+	if (map) {
+		for_each_possible_cpu(cpu)
+			RCU_INIT_POINTER(map[cpu], chan);
+		fc->chan_map = map;
+	}
+	list_add_tail_rcu(&chan->entry, &fc->chans);
+	spin_unlock(&fc->lock);
+
+	return chan;
+}
+EXPORT_SYMBOL_GPL(fuse_chan_alloc);
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -205,6 +370,8 @@ struct fuse_req *fuse_get_req_nofail(struct fuse_conn *fc, struct file *file)
 void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req)
 {
 	if (atomic_dec_and_test(&req->count)) {
+		struct fuse_chan *chan = req->chan;
+
 		if (req->waiting)
 			atomic_dec(&fc->num_waiting);
 
@@ -212,6 +379,9 @@ void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req)
 			put_reserved_req(fc, req);
 		else
 			fuse_request_free(req);
+
+		if (chan)
+			fuse_chan_put(chan);
 	}
 }
 EXPORT_SYMBOL_GPL(fuse_put_request);
@@ -229,25 +399,34 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
+	u64 unique = atomic64_inc_return(&fc->reqctr);
+
 	/* zero is special */
-	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+	if (unlikely(!unique))
+		unique = atomic64_inc_return(&fc->reqctr);
 
-	return fc->reqctr;
+	return unique;
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+/*
+ * Called with chan->lock held, the channel takes ownership of the
+ * request
+ */
+static void queue_request(struct fuse_chan *chan, struct fuse_req *req)
 {
+	struct fuse_conn *fc = chan->fc;
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	list_add_tail(&req->list, &chan->pending);
 	req->state = FUSE_REQ_PENDING;
+	req->chan = chan;
+	atomic_inc(&chan->count);
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
+	fuse_chan_wake(chan);
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -260,22 +439,32 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 	spin_lock(&fc->lock);
 	fc->forget_list_tail->next = forget;
 	fc->forget_list_tail = forget;
-	wake_up(&fc->waitq);
+	if (fc->chan_map)
+		fuse_chan_wake(rcu_dereference_protected(
+			fc->chan_map[raw_smp_processor_id()],
+			lockdep_is_held(&fc->lock)));
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	spin_unlock(&fc->lock);
 }
 
+/* Called with fc->lock held */
 static void flush_bg_queue(struct fuse_conn *fc)
 {
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
+		struct fuse_chan *chan;
 		struct fuse_req *req;
 
+		chan = fuse_chan_lock_cpu(fc);
+		if (!chan)
+			break;
+
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(chan, req);
+		spin_unlock(&chan->lock);
 	}
 }
 
@@ -287,17 +476,20 @@ static void flush_bg_queue(struct fuse_conn *fc)
  * the 'end' callback is called if given, else the reference to the
  * request is released
  *
- * Called with fc->lock, unlocks it
+ * Called with the lock of the channel owning the request held, if it
+ * was queued, unlocks it
  */
 static void request_end(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
 {
 	void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 	req->end = NULL;
 	list_del(&req->list);
 	list_del(&req->intr_entry);
 	req->state = FUSE_REQ_FINISHED;
+	if (req->chan)
+		spin_unlock(&req->chan->lock);
 	if (req->background) {
+		spin_lock(&fc->lock);
 		if (fc->num_background == fc->max_background) {
 			fc->blocked = 0;
 			wake_up_all(&fc->blocked_waitq);
@@ -310,8 +502,8 @@ __releases(fc->lock)
 		fc->num_background--;
 		fc->active_background--;
 		flush_bg_queue(fc);
+		spin_unlock(&fc->lock);
 	}
-	spin_unlock(&fc->lock);
 	wake_up(&req->waitq);
 	if (end)
 		end(fc, req);
@@ -320,40 +512,38 @@ __releases(fc->lock)
 
 static void wait_answer_interruptible(struct fuse_conn *fc,
 				      struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
 {
 	if (signal_pending(current))
 		return;
 
-	spin_unlock(&fc->lock);
 	wait_event_interruptible(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+static void queue_interrupt(struct fuse_chan *chan, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &chan->interrupts);
+	wake_up(&chan->waitq);
+	kill_fasync(&chan->fc->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
 {
+	struct fuse_chan *chan;
+
 	if (!fc->no_interrupt) {
 		/* Any signal may interrupt this */
 		wait_answer_interruptible(fc, req);
 
+		chan = fuse_req_lock_chan(req);
 		if (req->aborted)
 			goto aborted;
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto out_unlock;
 
 		req->interrupted = 1;
 		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			queue_interrupt(chan, req);
+		spin_unlock(&chan->lock);
 	}
 
 	if (!req->force) {
@@ -364,30 +554,31 @@ __acquires(fc->lock)
 		wait_answer_interruptible(fc, req);
 		restore_sigs(&oldset);
 
+		chan = fuse_req_lock_chan(req);
 		if (req->aborted)
 			goto aborted;
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto out_unlock;
 
 		/* Request is not yet in userspace, bail out */
 		if (req->state == FUSE_REQ_PENDING) {
 			list_del(&req->list);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
-			return;
+			goto out_unlock;
 		}
+		spin_unlock(&chan->lock);
 	}
 
 	/*
 	 * Either request is already in userspace, or it was forced.
 	 * Wait it out.
 	 */
-	spin_unlock(&fc->lock);
 	wait_event(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
 
+	chan = fuse_req_lock_chan(req);
 	if (!req->aborted)
-		return;
+		goto out_unlock;
 
  aborted:
 	BUG_ON(req->state != FUSE_REQ_FINISHED);
@@ -397,30 +588,35 @@ __acquires(fc->lock)
 		   locked state, there mustn't be any filesystem
 		   operation (e.g. page fault), since that could lead
 		   to deadlock */
-		spin_unlock(&fc->lock);
+		spin_unlock(&chan->lock);
 		wait_event(req->waitq, !req->locked);
-		spin_lock(&fc->lock);
+		return;
 	}
+ out_unlock:
+	spin_unlock(&chan->lock);
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *chan;
+
 	req->isreply = 1;
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	chan = fuse_chan_lock_cpu(fc);
+	if (!chan)
 		req->out.h.error = -ENOTCONN;
-	else if (fc->conn_error)
+	else if (fc->conn_error) {
+		spin_unlock(&chan->lock);
 		req->out.h.error = -ECONNREFUSED;
-	else {
+	} else {
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(chan, req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
 		__fuse_get_request(req);
+		spin_unlock(&chan->lock);
 
 		request_wait_answer(fc, req);
 	}
-	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_request_send);
 
@@ -447,6 +643,7 @@ static void fuse_request_send_nowait(struct fuse_conn *fc, struct fuse_req *req)
 		fuse_request_send_nowait_locked(fc, req);
 		spin_unlock(&fc->lock);
 	} else {
+		spin_unlock(&fc->lock);
 		req->out.h.error = -ENOTCONN;
 		request_end(fc, req);
 	}
@@ -462,16 +659,17 @@ EXPORT_SYMBOL_GPL(fuse_request_send_background);
 static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 					  struct fuse_req *req, u64 unique)
 {
+	struct fuse_chan *chan;
 	int err = -ENODEV;
 
 	req->isreply = 0;
 	req->in.h.unique = unique;
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		queue_request(fc, req);
+	chan = fuse_chan_lock_cpu(fc);
+	if (chan) {
+		queue_request(chan, req);
+		spin_unlock(&chan->lock);
 		err = 0;
 	}
-	spin_unlock(&fc->lock);
 
 	return err;
 }
@@ -493,16 +691,17 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
  * anything that could cause a page-fault.  If the request was already
  * aborted bail out.
  */
-static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
+static int lock_request(struct fuse_req *req)
 {
 	int err = 0;
 	if (req) {
-		spin_lock(&fc->lock);
+		struct fuse_chan *chan = fuse_req_lock_chan(req);
+
 		if (req->aborted)
 			err = -ENOENT;
 		else
 			req->locked = 1;
-		spin_unlock(&fc->lock);
+		spin_unlock(&chan->lock);
 	}
 	return err;
 }
@@ -512,14 +711,15 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
  * requester thread is currently waiting for it to be unlocked, so
  * wake it up.
  */
-static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
+static void unlock_request(struct fuse_req *req)
 {
 	if (req) {
-		spin_lock(&fc->lock);
+		struct fuse_chan *chan = fuse_req_lock_chan(req);
+
 		req->locked = 0;
 		if (req->aborted)
 			wake_up(&req->waitq);
-		spin_unlock(&fc->lock);
+		spin_unlock(&chan->lock);
 	}
 }
 
@@ -586,7 +786,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 	unsigned long offset;
 	int err;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 	if (cs->pipebufs) {
 		struct pipe_buffer *buf = cs->pipebufs;
@@ -644,7 +844,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 		cs->addr += cs->len;
 	}
 
-	return lock_request(cs->fc, cs->req);
+	return lock_request(cs->req);
 }
 
 /* Do as much copy to/from userspace buffer as we can */
@@ -690,9 +890,10 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	struct page *newpage;
 	struct pipe_buffer *buf = cs->pipebufs;
 	struct address_space *mapping;
+	struct fuse_chan *chan;
 	pgoff_t index;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	err = buf->ops->confirm(cs->pipe, buf);
@@ -749,12 +950,12 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 		lru_cache_add_file(newpage);
 
 	err = 0;
-	spin_lock(&cs->fc->lock);
+	chan = fuse_req_lock_chan(cs->req);
 	if (cs->req->aborted)
 		err = -ENOENT;
 	else
 		*pagep = newpage;
-	spin_unlock(&cs->fc->lock);
+	spin_unlock(&chan->lock);
 
 	if (err) {
 		unlock_page(newpage);
@@ -774,7 +975,7 @@ out_fallback:
 	cs->mapaddr = buf->ops->map(cs->pipe, buf, 1);
 	cs->buf = cs->mapaddr + buf->offset;
 
-	err = lock_request(cs->fc, cs->req);
+	err = lock_request(cs->req);
 	if (err)
 		return err;
 
@@ -789,7 +990,7 @@ static int fuse_ref_page(struct fuse_copy_state *cs, struct page *page,
 	if (cs->nr_segs == cs->pipe->buffers)
 		return -EIO;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	buf = cs->pipebufs;
@@ -907,31 +1108,81 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/* Can a reader of the channel steal a request from another one? */
+static int steal_pending(struct fuse_chan *chan)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	struct fuse_chan *other;
+	int ret = 0;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(other, &chan->fc->chans, entry) {
+		if (other != chan && !list_empty(&other->pending)) {
+			ret = 1;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return ret;
 }
 
-/* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static int request_pending(struct fuse_chan *chan)
+{
+	return !list_empty(&chan->pending) || !list_empty(&chan->interrupts) ||
+		forget_pending(chan->fc) || steal_pending(chan);
+}
+
+/*
+ * Wait until a request is available on the pending list of the
+ * channel, or of another one
+ */
+static void request_wait(struct fuse_chan *chan)
+__releases(chan->lock)
+__acquires(chan->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&chan->waitq, &wait);
+	for (;;) {
+		/* Pairs with smp_mb() in fuse_chan_wake() */
 		set_current_state(TASK_INTERRUPTIBLE);
+		if (!fuse_chan_connected(chan) || request_pending(chan))
+			break;
 		if (signal_pending(current))
 			break;
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&chan->lock);
 		schedule();
-		spin_lock(&fc->lock);
+		spin_lock(&chan->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&chan->waitq, &wait);
+}
+
+/*
+ * Find another channel with pending requests and return it locked,
+ * for an idle reader to take a request from
+ */
+static struct fuse_chan *fuse_chan_steal(struct fuse_chan *chan)
+{
+	struct fuse_chan *other;
+	struct fuse_chan *found = NULL;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(other, &chan->fc->chans, entry) {
+		if (other == chan || list_empty(&other->pending))
+			continue;
+
+		spin_lock(&other->lock);
+		if (other->connected && !list_empty(&other->pending)) {
+			found = other;
+			break;
+		}
+		spin_unlock(&other->lock);
+	}
+	rcu_read_unlock();
+
+	return found;
 }
 
 /*
@@ -940,11 +1191,12 @@ __acquires(fc->lock)
  * Unlike other requests this is assembled on demand, without a need
  * to allocate a separate fuse_req structure.
  *
- * Called with fc->lock held, releases it
+ * Called with chan->lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_interrupt(struct fuse_chan *chan,
+			       struct fuse_copy_state *cs,
 			       size_t nbytes, struct fuse_req *req)
-__releases(fc->lock)
+__releases(chan->lock)
 {
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
@@ -952,7 +1204,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = fuse_get_unique(chan->fc);
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -960,7 +1212,7 @@ __releases(fc->lock)
 	ih.unique = req->intr_unique;
 	arg.unique = req->in.h.unique;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&chan->lock);
 	if (nbytes < reqsize)
 		return -EINVAL;
 
@@ -1094,47 +1346,69 @@ __releases(fc->lock)
  * was an error during the copying then it's finished by calling
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
+ *
+ * Requests are taken from the channel's own pending list, or stolen
+ * from another channel if that is empty.  A stolen request stays
+ * owned by its channel.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *chan, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_conn *fc = chan->fc;
+	struct fuse_chan *owner;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
 
  restart:
-	spin_lock(&fc->lock);
+	fuse_chan_bind(chan);
+	spin_lock(&chan->lock);
 	err = -EAGAIN;
-	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	if ((file->f_flags & O_NONBLOCK) && fuse_chan_connected(chan) &&
+	    !request_pending(chan))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(chan);
 	err = -ENODEV;
-	if (!fc->connected)
+	if (!fuse_chan_connected(chan))
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(chan))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&chan->interrupts)) {
+		req = list_entry(chan->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, cs, nbytes, req);
+		return fuse_read_interrupt(chan, cs, nbytes, req);
 	}
 
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (list_empty(&chan->pending) || chan->forget_batch-- > 0) {
+			spin_unlock(&chan->lock);
+			spin_lock(&fc->lock);
+			if (!forget_pending(fc)) {
+				spin_unlock(&fc->lock);
+				goto restart;
+			}
 			return fuse_read_forget(fc, cs, nbytes);
+		}
+
+		if (chan->forget_batch <= -8)
+			chan->forget_batch = 16;
+	}
 
-		if (fc->forget_batch <= -8)
-			fc->forget_batch = 16;
+	owner = chan;
+	if (list_empty(&chan->pending)) {
+		spin_unlock(&chan->lock);
+		owner = fuse_chan_steal(chan);
+		if (!owner)
+			goto restart;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(owner->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &owner->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1147,14 +1421,14 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&owner->lock);
 	cs->req = req;
 	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
 		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
 	fuse_copy_finish(cs);
-	spin_lock(&fc->lock);
+	owner = fuse_req_lock_chan(req);
 	req->locked = 0;
 	if (req->aborted) {
 		request_end(fc, req);
@@ -1169,15 +1443,15 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, &owner->processing);
 		if (req->interrupted)
-			queue_interrupt(fc, req);
-		spin_unlock(&fc->lock);
+			queue_interrupt(owner, req);
+		spin_unlock(&owner->lock);
 	}
 	return reqsize;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&chan->lock);
 	return err;
 }
 
@@ -1186,13 +1460,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(file);
+	if (!chan)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, chan->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(chan, file, &cs, iov_length(iov, nr_segs));
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1220,18 +1494,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(in);
+	if (!chan)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, chan->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(chan, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1595,11 +1869,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *__request_find(struct fuse_chan *chan, u64 unique)
 {
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &chan->processing) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1608,6 +1882,47 @@ static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
 	return NULL;
 }
 
+/*
+ * Look up request by unique ID, on the channel first as the reply
+ * usually comes through the channel the request was read from, then
+ * on the other channels.  These are searched under fc->lock so that
+ * the request can't be moved by fuse_chan_release() meanwhile.
+ *
+ * If found, returns with the lock of the owner channel held.
+ */
+static struct fuse_req *request_find(struct fuse_chan *chan, u64 unique,
+				     struct fuse_chan **ownerp)
+{
+	struct fuse_conn *fc = chan->fc;
+	struct fuse_chan *other;
+	struct fuse_req *req;
+
+	spin_lock(&chan->lock);
+	req = __request_find(chan, unique);
+	if (req) {
+		*ownerp = chan;
+		return req;
+	}
+	spin_unlock(&chan->lock);
+
+	spin_lock(&fc->lock);
+	list_for_each_entry(other, &fc->chans, entry) {
+		if (other == chan)
+			continue;
+
+		spin_lock(&other->lock);
+		req = __request_find(other, unique);
+		if (req) {
+			*ownerp = other;
+			break;
+		}
+		spin_unlock(&other->lock);
+	}
+	spin_unlock(&fc->lock);
+
+	return req;
+}
+
 static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 			 unsigned nbytes)
 {
@@ -1638,10 +1953,12 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *chan,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_conn *fc = chan->fc;
+	struct fuse_chan *owner;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
 
@@ -1669,19 +1986,18 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (oh.error <= -1000 || oh.error > 0)
 		goto err_finish;
 
-	spin_lock(&fc->lock);
 	err = -ENOENT;
-	if (!fc->connected)
-		goto err_unlock;
-
-	req = request_find(fc, oh.unique);
+	req = request_find(chan, oh.unique, &owner);
 	if (!req)
+		goto err_finish;
+
+	if (!fuse_chan_connected(owner))
 		goto err_unlock;
 
 	if (req->aborted) {
-		spin_unlock(&fc->lock);
+		spin_unlock(&owner->lock);
 		fuse_copy_finish(cs);
-		spin_lock(&fc->lock);
+		fuse_req_lock_chan(req);
 		request_end(fc, req);
 		return -ENOENT;
 	}
@@ -1694,26 +2010,26 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+			queue_interrupt(owner, req);
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&owner->lock);
 		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &owner->io);
 	req->out.h = oh;
 	req->locked = 1;
 	cs->req = req;
 	if (!req->out.page_replace)
 		cs->move_pages = 0;
-	spin_unlock(&fc->lock);
+	spin_unlock(&owner->lock);
 
 	err = copy_out_args(cs, &req->out, nbytes);
 	fuse_copy_finish(cs);
 
-	spin_lock(&fc->lock);
+	fuse_req_lock_chan(req);
 	req->locked = 0;
 	if (!err) {
 		if (req->aborted)
@@ -1725,7 +2041,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	return err ? err : nbytes;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&owner->lock);
  err_finish:
 	fuse_copy_finish(cs);
 	return err;
@@ -1735,13 +2051,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(iocb->ki_filp);
+	if (!chan)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, chan->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(chan, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1752,12 +2068,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_chan *chan;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	chan = fuse_get_chan(out);
+	if (!chan)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -1804,14 +2120,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, chan->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(chan, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1825,18 +2141,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(file);
+	if (!chan)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	poll_wait(file, &chan->waitq, wait);
 
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	spin_lock(&chan->lock);
+	if (!fuse_chan_connected(chan))
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(chan))
 		mask |= POLLIN | POLLRDNORM;
-	spin_unlock(&fc->lock);
+	spin_unlock(&chan->lock);
 
 	return mask;
 }
@@ -1844,18 +2160,18 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 /*
  * Abort all requests on the given list (pending or processing)
  *
- * This function releases and reacquires fc->lock
+ * This function releases and reacquires chan->lock
  */
-static void end_requests(struct fuse_conn *fc, struct list_head *head)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_requests(struct fuse_chan *chan, struct list_head *head)
+__releases(chan->lock)
+__acquires(chan->lock)
 {
 	while (!list_empty(head)) {
 		struct fuse_req *req;
 		req = list_entry(head->next, struct fuse_req, list);
 		req->out.h.error = -ECONNABORTED;
-		request_end(fc, req);
-		spin_lock(&fc->lock);
+		request_end(chan->fc, req);
+		spin_lock(&chan->lock);
 	}
 }
 
@@ -1870,13 +2186,15 @@ __acquires(fc->lock)
  * called after waiting for the request to be unlocked (if it was
  * locked).
  */
-static void end_io_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_io_requests(struct fuse_chan *chan)
+__releases(chan->lock)
+__acquires(chan->lock)
 {
-	while (!list_empty(&fc->io)) {
+	struct fuse_conn *fc = chan->fc;
+
+	while (!list_empty(&chan->io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(chan->io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
@@ -1887,23 +2205,37 @@ __acquires(fc->lock)
 		if (end) {
 			req->end = NULL;
 			__fuse_get_request(req);
-			spin_unlock(&fc->lock);
+			spin_unlock(&chan->lock);
 			wait_event(req->waitq, !req->locked);
 			end(fc, req);
 			fuse_put_request(fc, req);
-			spin_lock(&fc->lock);
+			spin_lock(&chan->lock);
 		}
 	}
 }
 
+/*
+ * End the background requests not queued on a channel yet, and drop
+ * the forgets
+ *
+ * Called with fc->lock held and fc->connected cleared, releases and
+ * reacquires fc->lock
+ */
 static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
-	fc->max_background = UINT_MAX;
-	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	while (!list_empty(&fc->bg_queue)) {
+		struct fuse_req *req;
+
+		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
+		list_del_init(&req->list);
+		fc->active_background++;
+		req->out.h.error = -ECONNABORTED;
+		spin_unlock(&fc->lock);
+		request_end(fc, req);
+		spin_lock(&fc->lock);
+	}
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -1923,6 +2255,21 @@ static void end_polls(struct fuse_conn *fc)
 	}
 }
 
+/*
+ * Disconnect the channel and end its requests, the ones under I/O
+ * first, see fuse_abort_conn()
+ */
+static void fuse_chan_abort(struct fuse_chan *chan)
+{
+	spin_lock(&chan->lock);
+	chan->connected = 0;
+	end_io_requests(chan);
+	end_requests(chan, &chan->pending);
+	end_requests(chan, &chan->processing);
+	spin_unlock(&chan->lock);
+	wake_up_all(&chan->waitq);
+}
+
 /*
  * Abort all requests.
  *
@@ -1936,42 +2283,136 @@ static void end_polls(struct fuse_conn *fc)
  *
  * During the aborting, progression of requests from the pending and
  * processing lists onto the io list, and progression of new requests
- * onto the pending list is prevented by req->connected being false.
+ * onto the pending list is prevented by chan->connected being false.
  *
  * Progression of requests under I/O to the processing list is
  * prevented by the req->aborted flag being true for these requests.
  * For this reason requests on the io list must be aborted first.
+ *
+ * The channels are aborted one by one, without fc->lock held since
+ * ending the requests needs it.  Requests can't be moved between
+ * channels once fc->connected is cleared.
  */
 void fuse_abort_conn(struct fuse_conn *fc)
 {
+	struct fuse_chan *chan;
+
 	spin_lock(&fc->lock);
-	if (fc->connected) {
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_io_requests(fc);
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->waitq);
-		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	if (!fc->connected) {
+		spin_unlock(&fc->lock);
+		return;
+	}
+	fc->connected = 0;
+	fc->blocked = 0;
+	end_queued_requests(fc);
+	end_polls(fc);
+	wake_up_all(&fc->blocked_waitq);
+	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+
+	for (;;) {
+		list_for_each_entry(chan, &fc->chans, entry) {
+			if (!chan->aborted)
+				break;
+		}
+		if (&chan->entry == &fc->chans)
+			break;
+
+		chan->aborted = 1;
+		atomic_inc(&chan->count);
+		spin_unlock(&fc->lock);
+		fuse_chan_abort(chan);
+		fuse_chan_put(chan);
+		spin_lock(&fc->lock);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
-int fuse_dev_release(struct inode *inode, struct file *file)
+/*
+ * Move the requests of a released channel to another one, and hand
+ * over the references the requests hold.  Called with fc->lock held.
+ */
+static void fuse_chan_migrate(struct fuse_chan *chan, struct fuse_chan *to)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
-		spin_lock(&fc->lock);
+	struct list_head *lists[] = { &chan->pending, &chan->io,
+				      &chan->processing };
+	struct fuse_req *req;
+	int moved = 0;
+	int i;
+
+	if (chan < to) {
+		spin_lock(&chan->lock);
+		spin_lock_nested(&to->lock, SINGLE_DEPTH_NESTING);
+	} else {
+		spin_lock(&to->lock);
+		spin_lock_nested(&chan->lock, SINGLE_DEPTH_NESTING);
+	}
+
+	chan->connected = 0;
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		list_for_each_entry(req, lists[i], list) {
+			req->chan = to;
+			moved++;
+		}
+	}
+	list_splice_tail_init(&chan->pending, &to->pending);
+	list_splice_tail_init(&chan->io, &to->io);
+	list_splice_tail_init(&chan->processing, &to->processing);
+	list_splice_tail_init(&chan->interrupts, &to->interrupts);
+	atomic_add(moved, &to->count);
+	atomic_sub(moved, &chan->count);
+
+	spin_unlock(&chan->lock);
+	spin_unlock(&to->lock);
+
+	if (moved)
+		wake_up(&to->waitq);
+}
+
+void fuse_chan_release(struct fuse_chan *chan)
+{
+	struct fuse_conn *fc = chan->fc;
+	struct fuse_chan *to = NULL;
+	int cpu;
+
+	spin_lock(&fc->lock);
+	list_del_rcu(&chan->entry);
+	if (!list_empty(&fc->chans))
+		to = list_first_entry(&fc->chans, struct fuse_chan, entry);
+
+	if (!to) {
+		/* Last channel, disconnect */
 		fc->connected = 0;
 		fc->blocked = 0;
 		end_queued_requests(fc);
 		end_polls(fc);
 		wake_up_all(&fc->blocked_waitq);
 		spin_unlock(&fc->lock);
-		fuse_conn_put(fc);
+		fuse_chan_abort(chan);
+	} else {
+		for_each_possible_cpu(cpu) {
+			if (rcu_dereference_protected(fc->chan_map[cpu],
+					lockdep_is_held(&fc->lock)) == chan)
+				rcu_assign_pointer(fc->chan_map[cpu], to);
+		}
+		if (fc->connected) {
+			fuse_chan_migrate(chan, to);
+			spin_unlock(&fc->lock);
+		} else {
+			spin_unlock(&fc->lock);
+			fuse_chan_abort(chan);
+		}
 	}
+	fuse_chan_put(chan);
+}
+EXPORT_SYMBOL_GPL(fuse_chan_release);
+
+int fuse_dev_release(struct inode *inode, struct file *file)
+{
+	struct fuse_chan *chan = fuse_get_chan(file);
+
+	if (chan)
+		fuse_chan_release(chan);
 
 	return 0;
 }
@@ -1979,12 +2420,54 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(file);
+	if (!chan)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &chan->fc->fasync);
+}
+
+/*
+ * Attach the file to the connection of an already mounted /dev/fuse
+ * file, as a new channel for another group of daemon threads to read
+ * requests from
+ */
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_chan *chan;
+	struct file *old;
+	__u32 oldfd;
+	int err;
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+
+	if (get_user(oldfd, (__u32 __user *) arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	/* CUSE uses a copy of these file operations, don't mix the two */
+	err = -EINVAL;
+	if (old->f_op == file->f_op) {
+		mutex_lock(&fuse_mutex);
+		if (!file->private_data && fuse_get_chan(old)) {
+			chan = fuse_chan_alloc(fuse_get_chan(old)->fc);
+			err = -ENOMEM;
+			if (chan) {
+				file->private_data = chan;
+				err = 0;
+			}
+		}
+		mutex_unlock(&fuse_mutex);
+	}
+	fput(old);
+
+	return err;
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -1999,6 +2482,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
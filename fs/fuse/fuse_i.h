@@ -307,6 +307,59 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Channel owning the request once queued */
+	struct fuse_chan *chan;
+};
+
+/**
+ * A channel of a connection, one per open /dev/fuse file.
+ *
+ * A request is queued on the channel of the cpu sending it, which is
+ * the channel last read on that cpu.  The channel's lock protects the
+ * state of the requests it owns, so that daemon threads reading
+ * different channels don't contend.  Readers finding their channel
+ * empty steal pending requests from the other ones.
+ */
+struct fuse_chan {
+	/** The connection */
+	struct fuse_conn *fc;
+
+	/** Lock protecting the lists below and the requests on them */
+	spinlock_t lock;
+
+	/** Refcount, held by the file and by each request owned */
+	atomic_t count;
+
+	/** Requests may be queued, cleared on detach or abort */
+	unsigned connected;
+
+	/** Seen by fuse_abort_conn(), protected by fc->lock */
+	unsigned aborted;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** Batching of FORGET requests (positive indicates FORGET batch) */
+	int forget_batch;
+
+	/** Entry on fuse_conn->chans */
+	struct list_head entry;
+
+	/** RCU head for freeing the channel */
+	struct rcu_head rcu;
 };
 
 /**
@@ -341,17 +394,11 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
-
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Channels of the connection, modified under lock and RCU */
+	struct list_head chans;
 
-	/** The list of requests being processed */
-	struct list_head processing;
-
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Channel each cpu queues requests on, protected like chans */
+	struct fuse_chan __rcu **chan_map;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -374,16 +421,10 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Queue of pending forgets */
 	struct fuse_forget_link forget_list_head;
 	struct fuse_forget_link *forget_list_tail;
 
-	/** Batching of FORGET requests (positive indicates FORGET batch) */
-	int forget_batch;
-
 	/** Flag indicating if connection is blocked.  This will be
 	    the case before the INIT reply is received, and if there
 	    are too many outstading backgrounds requests */
@@ -396,7 +437,7 @@ struct fuse_conn {
 	wait_queue_head_t reserved_req_waitq;
 
 	/** The next unique request id */
-	u64 reqctr;
+	atomic64_t reqctr;
 
 	/** Connection established, cleared on umount, connection
 	    abort and device release */
@@ -419,6 +460,11 @@ struct fuse_conn {
 	/** Filesystem supports NFS exporting.  Only set in INIT */
 	unsigned export_support:1;
 
+	/** Buffered writes go through the page cache and are written
+	    back asynchronously, with size and mtime maintained by the
+	    kernel.  Only set in INIT */
+	unsigned writeback_cache:1;
+
 	/** Set if bdi is valid */
 	unsigned bdi_initialized:1;
 
@@ -627,6 +673,22 @@ void fuse_change_attributes(struct inode *inode, struct fuse_attr *attr,
 void fuse_change_attributes_common(struct inode *inode, struct fuse_attr *attr,
 				   u64 attr_valid);
 
+/**
+ * Allocate a channel on the connection, for a /dev/fuse file
+ */
+struct fuse_chan *fuse_chan_alloc(struct fuse_conn *fc);
+
+/**
+ * Detach a channel from its connection and drop the file's reference.
+ * Detaching the last channel disconnects the connection.
+ */
+void fuse_chan_release(struct fuse_chan *chan);
+
+/**
+ * Wake up the readers of all channels
+ */
+void fuse_wake_chans(struct fuse_conn *fc);
+
 /**
  * Initialize the client device
  */
@@ -764,4 +826,10 @@ int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+/**
+ * Write back the locally maintained mtime (writeback cache mode)
+ */
+int fuse_write_inode(struct inode *inode, struct writeback_control *wbc);
+int fuse_flush_times(struct inode *inode, struct fuse_file *ff);
+
 #endif /* _FS_FUSE_I_H */
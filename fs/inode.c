@@ -35,36 +35,33 @@
  *   inode->i_state, inode->i_hash, __iget()
  * inode->i_sb->s_inode_lru_lock protects:
  *   inode->i_sb->s_inode_lru, inode->i_lru
- * inode_sb_list_lock protects:
- *   sb->s_inodes, inode->i_sb_list
+ * the lock of the inode->i_sb->s_inodes shard protects:
+ *   that shard, inode->i_sb_list
  * bdi->wb.list_lock protects:
  *   bdi->wb.b_{dirty,io,more_io}, inode->i_wb_list
- * inode_hash_lock protects:
- *   inode_hashtable, inode->i_hash
+ * the bit lock of an inode_hashtable bucket protects:
+ *   that bucket, inode->i_hash, inode->i_hash_head
  *
  * Lock ordering:
  *
- * inode_sb_list_lock
+ * s_inodes shard lock
  *   inode->i_lock
  *     inode->i_sb->s_inode_lru_lock
  *
  * bdi->wb.list_lock
  *   inode->i_lock
  *
- * inode_hash_lock
- *   inode_sb_list_lock
+ * inode_hashtable bucket lock
+ *   s_inodes shard lock
  *   inode->i_lock
  *
- * iunique_lock
- *   inode_hash_lock
+ * The hash chains may also be walked under rcu_read_lock() only, inodes
+ * being freed after a grace period.
  */
 
 static unsigned int i_hash_mask __read_mostly;
 static unsigned int i_hash_shift __read_mostly;
-static struct hlist_head *inode_hashtable __read_mostly;
-static __cacheline_aligned_in_smp DEFINE_SPINLOCK(inode_hash_lock);
-
-__cacheline_aligned_in_smp DEFINE_SPINLOCK(inode_sb_list_lock);
+static struct hlist_bl_head *inode_hashtable __read_mostly;
 
 /*
  * Empty aops. Can be used for the cases where the user does not
@@ -288,7 +285,7 @@ EXPORT_SYMBOL(address_space_init_once);
 void inode_init_once(struct inode *inode)
 {
 	memset(inode, 0, sizeof(*inode));
-	INIT_HLIST_NODE(&inode->i_hash);
+	INIT_HLIST_BL_NODE(&inode->i_hash);
 	INIT_LIST_HEAD(&inode->i_dentry);
 	INIT_LIST_HEAD(&inode->i_devices);
 	INIT_LIST_HEAD(&inode->i_wb_list);
@@ -353,21 +350,45 @@ static void inode_lru_list_del(struct inode *inode)
  */
 void inode_sb_list_add(struct inode *inode)
 {
-	spin_lock(&inode_sb_list_lock);
-	list_add(&inode->i_sb_list, &inode->i_sb->s_inodes);
-	spin_unlock(&inode_sb_list_lock);
+	struct sb_inode_list *list;
+	int cpu;
+
+	/* any shard will do, the local one is the least contended */
+	cpu = raw_smp_processor_id();
+	list = per_cpu_ptr(inode->i_sb->s_inodes, cpu);
+
+	spin_lock(&list->lock);
+	inode->i_sb_list_cpu = cpu;
+	list_add(&inode->i_sb_list, &list->head);
+	spin_unlock(&list->lock);
 }
 EXPORT_SYMBOL_GPL(inode_sb_list_add);
 
 static inline void inode_sb_list_del(struct inode *inode)
 {
 	if (!list_empty(&inode->i_sb_list)) {
-		spin_lock(&inode_sb_list_lock);
+		struct sb_inode_list *list;
+
+		list = per_cpu_ptr(inode->i_sb->s_inodes, inode->i_sb_list_cpu);
+		spin_lock(&list->lock);
 		list_del_init(&inode->i_sb_list);
-		spin_unlock(&inode_sb_list_lock);
+		spin_unlock(&list->lock);
 	}
 }
 
+/*
+ * Whether all the s_inodes shards of @sb are empty, without locking.
+ */
+bool sb_inodes_empty(struct super_block *sb)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (!list_empty(&per_cpu_ptr(sb->s_inodes, cpu)->head))
+			return false;
+	return true;
+}
+
 static unsigned long hash(struct super_block *sb, unsigned long hashval)
 {
 	unsigned long tmp;
@@ -386,15 +407,24 @@ static unsigned long hash(struct super_block *sb, unsigned long hashval)
  *
  *	Add an inode to the inode hash for this superblock.
  */
+/*
+ * Called with the bucket @b and inode->i_lock held.
+ */
+static void __inode_hash_add(struct inode *inode, struct hlist_bl_head *b)
+{
+	hlist_bl_add_head_rcu(&inode->i_hash, b);
+	inode->i_hash_head = b;
+}
+
 void __insert_inode_hash(struct inode *inode, unsigned long hashval)
 {
-	struct hlist_head *b = inode_hashtable + hash(inode->i_sb, hashval);
+	struct hlist_bl_head *b = inode_hashtable + hash(inode->i_sb, hashval);
 
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(b);
 	spin_lock(&inode->i_lock);
-	hlist_add_head(&inode->i_hash, b);
+	__inode_hash_add(inode, b);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(b);
 }
 EXPORT_SYMBOL(__insert_inode_hash);
 
@@ -406,11 +436,17 @@ EXPORT_SYMBOL(__insert_inode_hash);
  */
 void remove_inode_hash(struct inode *inode)
 {
-	spin_lock(&inode_hash_lock);
+	/* inodes hashed by inode_fake_hash() are on no bucket */
+	struct hlist_bl_head *b = ACCESS_ONCE(inode->i_hash_head);
+
+	if (b)
+		hlist_bl_lock(b);
 	spin_lock(&inode->i_lock);
-	hlist_del_init(&inode->i_hash);
+	hlist_bl_del_init_rcu(&inode->i_hash);
+	inode->i_hash_head = NULL;
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	if (b)
+		hlist_bl_unlock(b);
 }
 EXPORT_SYMBOL(remove_inode_hash);
 
@@ -511,24 +547,29 @@ void evict_inodes(struct super_block *sb)
 {
 	struct inode *inode, *next;
 	LIST_HEAD(dispose);
+	int cpu;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry_safe(inode, next, &sb->s_inodes, i_sb_list) {
-		if (atomic_read(&inode->i_count))
-			continue;
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *list = per_cpu_ptr(sb->s_inodes, cpu);
 
-		spin_lock(&inode->i_lock);
-		if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+		spin_lock(&list->lock);
+		list_for_each_entry_safe(inode, next, &list->head, i_sb_list) {
+			if (atomic_read(&inode->i_count))
+				continue;
+
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+
+			inode->i_state |= I_FREEING;
+			inode_lru_list_del(inode);
 			spin_unlock(&inode->i_lock);
-			continue;
+			list_add(&inode->i_lru, &dispose);
 		}
-
-		inode->i_state |= I_FREEING;
-		inode_lru_list_del(inode);
-		spin_unlock(&inode->i_lock);
-		list_add(&inode->i_lru, &dispose);
+		spin_unlock(&list->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 
 	dispose_list(&dispose);
 }
@@ -548,31 +589,36 @@ int invalidate_inodes(struct super_block *sb, bool kill_dirty)
 	int busy = 0;
 	struct inode *inode, *next;
 	LIST_HEAD(dispose);
+	int cpu;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry_safe(inode, next, &sb->s_inodes, i_sb_list) {
-		spin_lock(&inode->i_lock);
-		if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
-			spin_unlock(&inode->i_lock);
-			continue;
-		}
-		if (inode->i_state & I_DIRTY && !kill_dirty) {
-			spin_unlock(&inode->i_lock);
-			busy = 1;
-			continue;
-		}
-		if (atomic_read(&inode->i_count)) {
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *list = per_cpu_ptr(sb->s_inodes, cpu);
+
+		spin_lock(&list->lock);
+		list_for_each_entry_safe(inode, next, &list->head, i_sb_list) {
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+			if (inode->i_state & I_DIRTY && !kill_dirty) {
+				spin_unlock(&inode->i_lock);
+				busy = 1;
+				continue;
+			}
+			if (atomic_read(&inode->i_count)) {
+				spin_unlock(&inode->i_lock);
+				busy = 1;
+				continue;
+			}
+
+			inode->i_state |= I_FREEING;
+			inode_lru_list_del(inode);
 			spin_unlock(&inode->i_lock);
-			busy = 1;
-			continue;
+			list_add(&inode->i_lru, &dispose);
 		}
-
-		inode->i_state |= I_FREEING;
-		inode_lru_list_del(inode);
-		spin_unlock(&inode->i_lock);
-		list_add(&inode->i_lru, &dispose);
+		spin_unlock(&list->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 
 	dispose_list(&dispose);
 
@@ -693,20 +739,21 @@ void prune_icache_sb(struct super_block *sb, int nr_to_scan)
 	dispose_list(&freeable);
 }
 
-static void __wait_on_freeing_inode(struct inode *inode);
+static void __wait_on_freeing_inode(struct inode *inode,
+				    struct hlist_bl_head *head);
 /*
- * Called with the inode lock held.
+ * Called with the hash bucket @head locked.
  */
 static struct inode *find_inode(struct super_block *sb,
-				struct hlist_head *head,
+				struct hlist_bl_head *head,
 				int (*test)(struct inode *, void *),
 				void *data)
 {
-	struct hlist_node *node;
+	struct hlist_bl_node *node;
 	struct inode *inode = NULL;
 
 repeat:
-	hlist_for_each_entry(inode, node, head, i_hash) {
+	hlist_bl_for_each_entry(inode, node, head, i_hash) {
 		spin_lock(&inode->i_lock);
 		if (inode->i_sb != sb) {
 			spin_unlock(&inode->i_lock);
@@ -717,7 +764,7 @@ repeat:
 			continue;
 		}
 		if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
-			__wait_on_freeing_inode(inode);
+			__wait_on_freeing_inode(inode, head);
 			goto repeat;
 		}
 		__iget(inode);
@@ -732,13 +779,13 @@ repeat:
  * iget_locked for details.
  */
 static struct inode *find_inode_fast(struct super_block *sb,
-				struct hlist_head *head, unsigned long ino)
+				struct hlist_bl_head *head, unsigned long ino)
 {
-	struct hlist_node *node;
+	struct hlist_bl_node *node;
 	struct inode *inode = NULL;
 
 repeat:
-	hlist_for_each_entry(inode, node, head, i_hash) {
+	hlist_bl_for_each_entry(inode, node, head, i_hash) {
 		spin_lock(&inode->i_lock);
 		if (inode->i_ino != ino) {
 			spin_unlock(&inode->i_lock);
@@ -749,7 +796,7 @@ repeat:
 			continue;
 		}
 		if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
-			__wait_on_freeing_inode(inode);
+			__wait_on_freeing_inode(inode, head);
 			goto repeat;
 		}
 		__iget(inode);
@@ -836,8 +883,6 @@ struct inode *new_inode(struct super_block *sb)
 {
 	struct inode *inode;
 
-	spin_lock_prefetch(&inode_sb_list_lock);
-
 	inode = new_inode_pseudo(sb);
 	if (inode)
 		inode_sb_list_add(inode);
@@ -896,19 +941,19 @@ EXPORT_SYMBOL(unlock_new_inode);
  * hashed, and with the I_NEW flag set. The file system gets to fill it in
  * before unlocking it via unlock_new_inode().
  *
- * Note both @test and @set are called with the inode_hash_lock held, so can't
+ * Note both @test and @set are called with the hash bucket locked, so can't
  * sleep.
  */
 struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *),
 		int (*set)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, hashval);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(head);
 	inode = find_inode(sb, head, test, data);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 
 	if (inode) {
 		wait_on_inode(inode);
@@ -919,7 +964,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 	if (inode) {
 		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
+		hlist_bl_lock(head);
 		/* We released the lock, so.. */
 		old = find_inode(sb, head, test, data);
 		if (!old) {
@@ -928,10 +973,10 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 
 			spin_lock(&inode->i_lock);
 			inode->i_state = I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			__inode_hash_add(inode, head);
 			spin_unlock(&inode->i_lock);
 			inode_sb_list_add(inode);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -944,7 +989,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -952,7 +997,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 	return inode;
 
 set_failed:
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 	destroy_inode(inode);
 	return NULL;
 }
@@ -973,12 +1018,12 @@ EXPORT_SYMBOL(iget5_locked);
  */
 struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, ino);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(head);
 	inode = find_inode_fast(sb, head, ino);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 	if (inode) {
 		wait_on_inode(inode);
 		return inode;
@@ -988,17 +1033,17 @@ struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 	if (inode) {
 		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
+		hlist_bl_lock(head);
 		/* We released the lock, so.. */
 		old = find_inode_fast(sb, head, ino);
 		if (!old) {
 			inode->i_ino = ino;
 			spin_lock(&inode->i_lock);
 			inode->i_state = I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			__inode_hash_add(inode, head);
 			spin_unlock(&inode->i_lock);
 			inode_sb_list_add(inode);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -1011,7 +1056,7 @@ struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -1029,18 +1074,18 @@ EXPORT_SYMBOL(iget_locked);
  */
 static int test_inode_iunique(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *b = inode_hashtable + hash(sb, ino);
-	struct hlist_node *node;
+	struct hlist_bl_head *b = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_node *node;
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	hlist_for_each_entry(inode, node, b, i_hash) {
+	rcu_read_lock();
+	hlist_bl_for_each_entry_rcu(inode, node, b, i_hash) {
 		if (inode->i_ino == ino && inode->i_sb == sb) {
-			spin_unlock(&inode_hash_lock);
+			rcu_read_unlock();
 			return 0;
 		}
 	}
-	spin_unlock(&inode_hash_lock);
+	rcu_read_unlock();
 
 	return 1;
 }
@@ -1115,17 +1160,17 @@ EXPORT_SYMBOL(igrab);
  * Note: I_NEW is not waited upon so you have to be very careful what you do
  * with the returned inode.  You probably should be using ilookup5() instead.
  *
- * Note2: @test is called with the inode_hash_lock held, so can't sleep.
+ * Note2: @test is called with the hash bucket locked, so can't sleep.
  */
 struct inode *ilookup5_nowait(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, hashval);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(head);
 	inode = find_inode(sb, head, test, data);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 
 	return inode;
 }
@@ -1146,7 +1191,7 @@ EXPORT_SYMBOL(ilookup5_nowait);
  * This is a generalized version of ilookup() for file systems where the
  * inode number is not sufficient for unique identification of an inode.
  *
- * Note: @test is called with the inode_hash_lock held, so can't sleep.
+ * Note: @test is called with the hash bucket locked, so can't sleep.
  */
 struct inode *ilookup5(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
@@ -1169,12 +1214,12 @@ EXPORT_SYMBOL(ilookup5);
  */
 struct inode *ilookup(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, ino);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(head);
 	inode = find_inode_fast(sb, head, ino);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 
 	if (inode)
 		wait_on_inode(inode);
@@ -1186,13 +1231,13 @@ int insert_inode_locked(struct inode *inode)
 {
 	struct super_block *sb = inode->i_sb;
 	ino_t ino = inode->i_ino;
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, ino);
 
 	while (1) {
-		struct hlist_node *node;
+		struct hlist_bl_node *node;
 		struct inode *old = NULL;
-		spin_lock(&inode_hash_lock);
-		hlist_for_each_entry(old, node, head, i_hash) {
+		hlist_bl_lock(head);
+		hlist_bl_for_each_entry(old, node, head, i_hash) {
 			if (old->i_ino != ino)
 				continue;
 			if (old->i_sb != sb)
@@ -1207,14 +1252,14 @@ int insert_inode_locked(struct inode *inode)
 		if (likely(!node)) {
 			spin_lock(&inode->i_lock);
 			inode->i_state |= I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			__inode_hash_add(inode, head);
 			spin_unlock(&inode->i_lock);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 			return 0;
 		}
 		__iget(old);
 		spin_unlock(&old->i_lock);
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		wait_on_inode(old);
 		if (unlikely(!inode_unhashed(old))) {
 			iput(old);
@@ -1229,14 +1274,14 @@ int insert_inode_locked4(struct inode *inode, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
 	struct super_block *sb = inode->i_sb;
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, hashval);
 
 	while (1) {
-		struct hlist_node *node;
+		struct hlist_bl_node *node;
 		struct inode *old = NULL;
 
-		spin_lock(&inode_hash_lock);
-		hlist_for_each_entry(old, node, head, i_hash) {
+		hlist_bl_lock(head);
+		hlist_bl_for_each_entry(old, node, head, i_hash) {
 			if (old->i_sb != sb)
 				continue;
 			if (!test(old, data))
@@ -1251,14 +1296,14 @@ int insert_inode_locked4(struct inode *inode, unsigned long hashval,
 		if (likely(!node)) {
 			spin_lock(&inode->i_lock);
 			inode->i_state |= I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			__inode_hash_add(inode, head);
 			spin_unlock(&inode->i_lock);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 			return 0;
 		}
 		__iget(old);
 		spin_unlock(&old->i_lock);
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		wait_on_inode(old);
 		if (unlikely(!inode_unhashed(old))) {
 			iput(old);
@@ -1530,17 +1575,18 @@ EXPORT_SYMBOL(inode_wait);
  * wake_up_bit(&inode->i_state, __I_NEW) after removing from the hash list
  * will DTRT.
  */
-static void __wait_on_freeing_inode(struct inode *inode)
+static void __wait_on_freeing_inode(struct inode *inode,
+				    struct hlist_bl_head *head)
 {
 	wait_queue_head_t *wq;
 	DEFINE_WAIT_BIT(wait, &inode->i_state, __I_NEW);
 	wq = bit_waitqueue(&inode->i_state, __I_NEW);
 	prepare_to_wait(wq, &wait.wait, TASK_UNINTERRUPTIBLE);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 	schedule();
 	finish_wait(wq, &wait.wait);
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(head);
 }
 
 static __initdata unsigned long ihash_entries;
@@ -1568,7 +1614,7 @@ void __init inode_init_early(void)
 
 	inode_hashtable =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					ihash_entries,
 					14,
 					HASH_EARLY,
@@ -1577,7 +1623,7 @@ void __init inode_init_early(void)
 					0);
 
 	for (loop = 0; loop < (1 << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+		INIT_HLIST_BL_HEAD(&inode_hashtable[loop]);
 }
 
 void __init inode_init(void)
@@ -1598,7 +1644,7 @@ void __init inode_init(void)
 
 	inode_hashtable =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					ihash_entries,
 					14,
 					0,
@@ -1607,7 +1653,7 @@ void __init inode_init(void)
 					0);
 
 	for (loop = 0; loop < (1 << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+		INIT_HLIST_BL_HEAD(&inode_hashtable[loop]);
 }
 
 void init_special_inode(struct inode *inode, umode_t mode, dev_t rdev)
@@ -126,7 +126,7 @@ extern long do_handle_open(int mountdirfd,
 /*
  * inode.c
  */
-extern spinlock_t inode_sb_list_lock;
+extern bool sb_inodes_empty(struct super_block *sb);
 
 /*
  * fs-writeback.c
@@ -141,3 +141,4 @@ extern int invalidate_inodes(struct super_block *, bool);
  * dcache.c
  */
 extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
+extern void trim_negative_dentries(struct work_struct *);
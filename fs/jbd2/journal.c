@@ -94,6 +94,9 @@ EXPORT_SYMBOL(jbd2_journal_file_inode);
 EXPORT_SYMBOL(jbd2_journal_init_jbd_inode);
 EXPORT_SYMBOL(jbd2_journal_release_jbd_inode);
 EXPORT_SYMBOL(jbd2_journal_begin_ordered_truncate);
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+EXPORT_SYMBOL(jbd2_fc_get_buf);
 EXPORT_SYMBOL(jbd2_inode_cache);
 
 static int journal_convert_superblock_v1(journal_t *, journal_superblock_t *);
@@ -744,6 +747,105 @@ struct journal_head *jbd2_journal_get_descriptor_buffer(journal_t *journal)
 	return jbd2_journal_add_journal_head(bh);
 }
 
+/*
+ * Fast commits let the client filesystem make some changes of the
+ * running transaction durable without committing it: it logs them in
+ * its own format, in blocks of the fast commit area at the end of the
+ * journal, and replays them itself after journal recovery if that
+ * transaction didn't commit.  The area is reused from its start after
+ * each full commit, so fast commit blocks carry the tid they are for.
+ */
+
+/**
+ * int jbd2_fc_begin_commit() - Start a fast commit.
+ * @journal: Journal to act on.
+ * @tid: Transaction which the fast commit logs changes of.
+ *
+ * Fast commits and full commits exclude each other, and a fast commit
+ * waits for the transaction before @tid to have committed.  Returns 0
+ * if the caller can write its fast commit, which it ends with
+ * jbd2_fc_end_commit(), -EALREADY if @tid committed meanwhile, or
+ * -EAGAIN after waiting for another commit, so the caller checks again
+ * whether it still needs a fast commit.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	DEFINE_WAIT(wait);
+
+	write_lock(&journal->j_state_lock);
+	if (is_journal_aborted(journal)) {
+		write_unlock(&journal->j_state_lock);
+		return -EIO;
+	}
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+	if (journal->j_flags &
+	    (JBD2_FAST_COMMIT_ONGOING | JBD2_FULL_COMMIT_ONGOING)) {
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		return -EAGAIN;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	return 0;
+}
+
+/**
+ * void jbd2_fc_end_commit() - End a fast commit.
+ * @journal: Journal to act on.
+ *
+ * Called once the blocks of the fast commit are written, or it was
+ * given up, to let full commits and other fast commits go ahead.
+ */
+void jbd2_fc_end_commit(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+}
+
+/**
+ * int jbd2_fc_get_buf() - Get the next block of the fast commit area.
+ * @journal: Journal to act on.
+ * @bh_out: Where to return the buffer.
+ *
+ * Returns in @bh_out a zeroed buffer for the next block of the fast
+ * commit area, which the caller fills, writes and releases, or -ENOSPC
+ * if the area is full: the transaction has to commit then.
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	struct buffer_head *bh;
+	int err;
+
+	J_ASSERT(journal->j_flags & JBD2_FAST_COMMIT_ONGOING);
+
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last)
+		return -ENOSPC;
+	err = jbd2_journal_bmap(journal,
+				journal->j_fc_first + journal->j_fc_off,
+				&pblock);
+	if (err)
+		return err;
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+	lock_buffer(bh);
+	memset(bh->b_data, 0, journal->j_blocksize);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	journal->j_fc_off++;
+	*bh_out = bh;
+	return 0;
+}
+
 struct jbd2_stats_proc_session {
 	journal_t *journal;
 	struct transaction_stats_s *stats;
@@ -894,6 +996,7 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_checkpoint);
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
@@ -1078,6 +1181,30 @@ static void journal_fail_superblock (journal_t *journal)
 	journal->j_sb_buffer = NULL;
 }
 
+static unsigned long journal_fc_blocks(journal_superblock_t *sb)
+{
+	return be32_to_cpu(sb->s_num_fc_blks) ? :
+		JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
+/*
+ * Returns the end of the log: with fast commits, the fast commit area
+ * is set aside at the end of the journal and the log stops before it.
+ */
+static unsigned long journal_log_last(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long last = be32_to_cpu(sb->s_maxlen);
+
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		journal->j_fc_last = last;
+		last -= min(last, journal_fc_blocks(sb));
+		journal->j_fc_first = last;
+	}
+	return last;
+}
+
 /*
  * Given a journal_t structure, initialise the various fields for
  * startup of a new journaling session.  We use this both when creating
@@ -1091,7 +1218,7 @@ static int journal_reset(journal_t *journal)
 	unsigned long long first, last;
 
 	first = be32_to_cpu(sb->s_first);
-	last = be32_to_cpu(sb->s_maxlen);
+	last = journal_log_last(journal);
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1277,9 +1404,18 @@ static int load_superblock(journal_t *journal)
 	journal->j_tail_sequence = be32_to_cpu(sb->s_sequence);
 	journal->j_tail = be32_to_cpu(sb->s_start);
 	journal->j_first = be32_to_cpu(sb->s_first);
-	journal->j_last = be32_to_cpu(sb->s_maxlen);
+	journal->j_last = journal_log_last(journal);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    journal->j_first + JBD2_MIN_JOURNAL_BLOCKS > journal->j_last + 1) {
+		printk(KERN_WARNING "JBD: journal too short for its "
+		       "fast commit area\n");
+		journal_fail_superblock(journal);
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
@@ -1479,6 +1615,48 @@ int jbd2_journal_check_available_features (journal_t *journal, unsigned long com
 	return 0;
 }
 
+/*
+ * Set the fast commit area aside in a journal which has just been
+ * loaded and is still empty, so that no log block lives there.  The
+ * superblock goes to disk right away since fast commits may be written
+ * before the first full commit updates it, and recovery must know
+ * where the log ends.
+ */
+static int journal_init_fast_commit(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long last;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_checkpoint_transactions ||
+	    journal->j_head != journal->j_first) {
+		write_unlock(&journal->j_state_lock);
+		printk(KERN_WARNING "JBD: fast commits can only be enabled "
+		       "on an empty journal\n");
+		return -EBUSY;
+	}
+	last = be32_to_cpu(sb->s_maxlen);
+	last -= min(last, journal_fc_blocks(sb));
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
+		write_unlock(&journal->j_state_lock);
+		printk(KERN_WARNING "JBD: journal too short for a fast "
+		       "commit area\n");
+		return -EINVAL;
+	}
+	sb->s_feature_incompat |=
+		cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+	journal->j_last = journal_log_last(journal);
+	journal->j_free = journal->j_last - journal->j_first;
+	journal->j_fc_off = 0;
+	write_unlock(&journal->j_state_lock);
+
+	mark_buffer_dirty(journal->j_sb_buffer);
+	sync_dirty_buffer(journal->j_sb_buffer);
+	return 0;
+}
+
 /**
  * int jbd2_journal_set_features () - Mark a given journal feature in the superblock
  * @journal: Journal to act on.
@@ -1489,6 +1667,8 @@ int jbd2_journal_check_available_features (journal_t *journal, unsigned long com
  * Mark a given journal feature as present on the
  * superblock.  Returns true if the requested features could be set.
  *
+ * The fast commit feature can only be set right after the journal
+ * was loaded, and never cleared again.
  */
 
 int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
@@ -1505,6 +1685,14 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 	jbd_debug(1, "Setting new features 0x%lx/0x%lx/0x%lx\n",
 		  compat, ro, incompat);
 
+	if ((incompat & JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    !JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		if (journal_init_fast_commit(journal))
+			return 0;
+		incompat &= ~JBD2_FEATURE_INCOMPAT_FAST_COMMIT;
+	}
+
 	sb = journal->j_superblock;
 
 	sb->s_feature_compat    |= cpu_to_be32(compat);
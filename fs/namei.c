@@ -33,6 +33,7 @@
 #include <linux/device_cgroup.h>
 #include <linux/fs_struct.h>
 #include <linux/posix_acl.h>
+#include <linux/hash.h>
 #include <asm/uaccess.h>
 
 #include "internal.h"
@@ -1642,6 +1643,84 @@ int vfs_path_lookup(struct dentry *dentry, struct vfsmount *mnt,
 	return err;
 }
 
+/*
+ * Parallel directory operations
+ *
+ * open(O_CREAT) and unlink() in a directory marked S_PARDIROPS hold its
+ * i_mutex only for the lookup.  Before dropping it they count themselves
+ * in the directory's i_dio_count, which is unused on directories, and
+ * from then on they only serialize against each other, per name, on a
+ * hashed bit lock.  Everything else that changes the directory keeps
+ * holding i_mutex and first waits for that count to drain, the same way
+ * truncate waits for direct I/O.  Nothing can be added to the count
+ * without i_mutex, so once drained the directory is as quiet as it ever
+ * was.  The wait comes before the lookup (lookup_create(), lock_rename(),
+ * lookup_one_len()...), so whatever was looked up stays valid.  Lookups
+ * and readdir do not wait; the filesystem has to cope with creates and
+ * unlinks running beside them.
+ *
+ * Lock order: i_mutex of the directory, then the name lock, then
+ * i_mutex of the victim.
+ */
+#define PARDIROPS_HASH_BITS	8
+
+static unsigned long pardirops_name_locks[1 << PARDIROPS_HASH_BITS];
+
+static int pardirops_wait_bit(void *word)
+{
+	schedule();
+	return 0;
+}
+
+static unsigned long *pardirops_lock_name(struct inode *dir,
+					  struct dentry *dentry)
+{
+	unsigned long *lock;
+
+	lock = &pardirops_name_locks[hash_long((unsigned long)dir ^
+					       dentry->d_name.hash,
+					       PARDIROPS_HASH_BITS)];
+	wait_on_bit_lock(lock, 0, pardirops_wait_bit, TASK_UNINTERRUPTIBLE);
+	return lock;
+}
+
+static void pardirops_unlock_name(unsigned long *lock)
+{
+	clear_bit_unlock(0, lock);
+	smp_mb__after_clear_bit();
+	wake_up_bit(lock, 0);
+}
+
+/* Called with dir's i_mutex held, drops it */
+static void pardirops_begin(struct inode *dir)
+{
+	atomic_inc(&dir->i_dio_count);
+	mutex_unlock(&dir->i_mutex);
+}
+
+static void pardirops_end(struct inode *dir)
+{
+	if (atomic_dec_and_test(&dir->i_dio_count))
+		wake_up_bit(&dir->i_state, __I_DIO_WAKEUP);
+}
+
+/* Called with dir's i_mutex held */
+static void pardirops_wait(struct inode *dir)
+{
+	wait_queue_head_t *wq;
+	DEFINE_WAIT_BIT(q, &dir->i_state, __I_DIO_WAKEUP);
+
+	if (!atomic_read(&dir->i_dio_count))
+		return;
+	wq = bit_waitqueue(&dir->i_state, __I_DIO_WAKEUP);
+	do {
+		prepare_to_wait(wq, &q.wait, TASK_UNINTERRUPTIBLE);
+		if (atomic_read(&dir->i_dio_count))
+			schedule();
+	} while (atomic_read(&dir->i_dio_count));
+	finish_wait(wq, &q.wait);
+}
+
 static struct dentry *__lookup_hash(struct qstr *name,
 		struct dentry *base, struct nameidata *nd)
 {
@@ -1747,6 +1826,8 @@ struct dentry *lookup_one_len(const char *name, struct dentry *base, int len)
 			return ERR_PTR(err);
 	}
 
+	/* Callers go on to change the directory, see pardirops_wait() */
+	pardirops_wait(base->d_inode);
 	return __lookup_hash(&this, base, NULL);
 }
 
@@ -1884,6 +1965,7 @@ struct dentry *lock_rename(struct dentry *p1, struct dentry *p2)
 
 	if (p1 == p2) {
 		mutex_lock_nested(&p1->d_inode->i_mutex, I_MUTEX_PARENT);
+		pardirops_wait(p1->d_inode);
 		return NULL;
 	}
 
@@ -1893,19 +1975,22 @@ struct dentry *lock_rename(struct dentry *p1, struct dentry *p2)
 	if (p) {
 		mutex_lock_nested(&p2->d_inode->i_mutex, I_MUTEX_PARENT);
 		mutex_lock_nested(&p1->d_inode->i_mutex, I_MUTEX_CHILD);
-		return p;
+		goto out;
 	}
 
 	p = d_ancestor(p1, p2);
 	if (p) {
 		mutex_lock_nested(&p1->d_inode->i_mutex, I_MUTEX_PARENT);
 		mutex_lock_nested(&p2->d_inode->i_mutex, I_MUTEX_CHILD);
-		return p;
+		goto out;
 	}
 
 	mutex_lock_nested(&p1->d_inode->i_mutex, I_MUTEX_PARENT);
 	mutex_lock_nested(&p2->d_inode->i_mutex, I_MUTEX_CHILD);
-	return NULL;
+out:
+	pardirops_wait(p1->d_inode);
+	pardirops_wait(p2->d_inode);
+	return p;
 }
 
 void unlock_rename(struct dentry *p1, struct dentry *p2)
@@ -1917,6 +2002,24 @@ void unlock_rename(struct dentry *p1, struct dentry *p2)
 	}
 }
 
+/*
+ * Create in an S_PARDIROPS directory: called with dir's i_mutex held
+ * after the lookup, returns with it dropped.
+ */
+static int pardirops_create(struct inode *dir, struct dentry *dentry,
+			    int mode, struct nameidata *nd)
+{
+	unsigned long *lock;
+	int error;
+
+	pardirops_begin(dir);
+	lock = pardirops_lock_name(dir, dentry);
+	error = vfs_create(dir, dentry, mode, nd);
+	pardirops_unlock_name(lock);
+	pardirops_end(dir);
+	return error;
+}
+
 int vfs_create(struct inode *dir, struct dentry *dentry, int mode,
 		struct nameidata *nd)
 {
@@ -2104,6 +2207,8 @@ static struct file *do_last(struct nameidata *nd, struct path *path,
 		goto exit;
 
 	mutex_lock(&dir->d_inode->i_mutex);
+	if (!IS_PARDIROPS(dir->d_inode))
+		pardirops_wait(dir->d_inode);
 
 	dentry = lookup_hash(nd);
 	error = PTR_ERR(dentry);
@@ -2138,10 +2243,25 @@ static struct file *do_last(struct nameidata *nd, struct path *path,
 		error = security_path_mknod(&nd->path, dentry, mode, 0);
 		if (error)
 			goto exit_mutex_unlock;
-		error = vfs_create(dir->d_inode, dentry, mode, nd);
-		if (error)
-			goto exit_mutex_unlock;
-		mutex_unlock(&dir->d_inode->i_mutex);
+		if (IS_PARDIROPS(dir->d_inode)) {
+			error = pardirops_create(dir->d_inode, dentry, mode, nd);
+			if (error == -EEXIST && !(open_flag & O_EXCL)) {
+				/* Somebody else created it meanwhile */
+				mnt_drop_write(nd->path.mnt);
+				want_write = 0;
+				open_flag = op->open_flag;
+				will_truncate = open_flag & O_TRUNC;
+				acc_mode = op->acc_mode;
+				goto exists;
+			}
+			if (error)
+				goto exit_dput;
+		} else {
+			error = vfs_create(dir->d_inode, dentry, mode, nd);
+			if (error)
+				goto exit_mutex_unlock;
+			mutex_unlock(&dir->d_inode->i_mutex);
+		}
 		dput(nd->path.dentry);
 		nd->path.dentry = dentry;
 		goto common;
@@ -2151,6 +2271,7 @@ static struct file *do_last(struct nameidata *nd, struct path *path,
 	 * It already exists.
 	 */
 	mutex_unlock(&dir->d_inode->i_mutex);
+exists:
 	audit_inode(pathname, path->dentry);
 
 	error = -EEXIST;
@@ -2335,6 +2456,7 @@ struct dentry *kern_path_create(int dfd, const char *pathname, struct path *path
 	 * Do the final lookup.
 	 */
 	mutex_lock_nested(&nd.path.dentry->d_inode->i_mutex, I_MUTEX_PARENT);
+	pardirops_wait(nd.path.dentry->d_inode);
 	dentry = lookup_hash(&nd);
 	if (IS_ERR(dentry))
 		goto fail;
@@ -2563,6 +2685,8 @@ int vfs_rmdir(struct inode *dir, struct dentry *dentry)
 		return -EPERM;
 
 	mutex_lock(&dentry->d_inode->i_mutex);
+	/* Let creates which already looked up in it finish */
+	pardirops_wait(dentry->d_inode);
 
 	error = -EBUSY;
 	if (d_mountpoint(dentry))
@@ -2613,6 +2737,7 @@ static long do_rmdir(int dfd, const char __user *pathname)
 	nd.flags &= ~LOOKUP_PARENT;
 
 	mutex_lock_nested(&nd.path.dentry->d_inode->i_mutex, I_MUTEX_PARENT);
+	pardirops_wait(nd.path.dentry->d_inode);
 	dentry = lookup_hash(&nd);
 	error = PTR_ERR(dentry);
 	if (IS_ERR(dentry))
@@ -2677,6 +2802,25 @@ int vfs_unlink(struct inode *dir, struct dentry *dentry)
 	return error;
 }
 
+/*
+ * Unlink in an S_PARDIROPS directory: called with dir's i_mutex held
+ * after the lookup, returns with it dropped.
+ */
+static int pardirops_unlink(struct inode *dir, struct dentry *dentry)
+{
+	unsigned long *lock;
+	int error = -ENOENT;
+
+	pardirops_begin(dir);
+	lock = pardirops_lock_name(dir, dentry);
+	/* Unhashed if another unlink of the name got here first */
+	if (!d_unhashed(dentry))
+		error = vfs_unlink(dir, dentry);
+	pardirops_unlock_name(lock);
+	pardirops_end(dir);
+	return error;
+}
+
 /*
  * Make sure that the actual truncation of the file will occur outside its
  * directory's i_mutex.  Truncate can take a long time if there is a lot of
@@ -2690,6 +2834,7 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 	struct dentry *dentry;
 	struct nameidata nd;
 	struct inode *inode = NULL;
+	int shared;
 
 	error = user_path_parent(dfd, pathname, &nd, &name);
 	if (error)
@@ -2702,6 +2847,9 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 	nd.flags &= ~LOOKUP_PARENT;
 
 	mutex_lock_nested(&nd.path.dentry->d_inode->i_mutex, I_MUTEX_PARENT);
+	shared = IS_PARDIROPS(nd.path.dentry->d_inode);
+	if (!shared)
+		pardirops_wait(nd.path.dentry->d_inode);
 	dentry = lookup_hash(&nd);
 	error = PTR_ERR(dentry);
 	if (!IS_ERR(dentry)) {
@@ -2718,6 +2866,13 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 		error = security_path_unlink(&nd.path, dentry);
 		if (error)
 			goto exit3;
+		if (shared) {
+			error = pardirops_unlink(nd.path.dentry->d_inode,
+						 dentry);
+			mnt_drop_write(nd.path.mnt);
+			dput(dentry);
+			goto exit_unlocked;
+		}
 		error = vfs_unlink(nd.path.dentry->d_inode, dentry);
 exit3:
 		mnt_drop_write(nd.path.mnt);
@@ -2725,6 +2880,7 @@ exit3:
 		dput(dentry);
 	}
 	mutex_unlock(&nd.path.dentry->d_inode->i_mutex);
+exit_unlocked:
 	if (inode)
 		iput(inode);	/* truncate the inode here */
 exit1:
@@ -2971,8 +3127,10 @@ static int vfs_rename_dir(struct inode *old_dir, struct dentry *old_dentry,
 	if (error)
 		return error;
 
-	if (target)
+	if (target) {
 		mutex_lock(&target->i_mutex);
+		pardirops_wait(target);
+	}
 
 	error = -EBUSY;
 	if (d_mountpoint(old_dentry) || d_mountpoint(new_dentry))
@@ -234,19 +234,16 @@ out:
 	return ret;
 }
 
-/**
- * fsnotify_unmount_inodes - an sb is unmounting.  handle any watched inodes.
- * @list: list of inodes being unmounted (sb->s_inodes)
- *
- * Called during unmount with no locks held, so needs to be safe against
- * concurrent modifiers. We temporarily drop inode_sb_list_lock and CAN block.
+/*
+ * Handle the watched inodes of one shard of sb->s_inodes.  We temporarily
+ * drop the shard lock and CAN block.
  */
-void fsnotify_unmount_inodes(struct list_head *list)
+static void fsnotify_unmount_inode_list(struct sb_inode_list *inodes)
 {
 	struct inode *inode, *next_i, *need_iput = NULL;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry_safe(inode, next_i, list, i_sb_list) {
+	spin_lock(&inodes->lock);
+	list_for_each_entry_safe(inode, next_i, &inodes->head, i_sb_list) {
 		struct inode *need_iput_tmp;
 
 		/*
@@ -282,7 +279,7 @@ void fsnotify_unmount_inodes(struct list_head *list)
 		spin_unlock(&inode->i_lock);
 
 		/* In case the dropping of a reference would nuke next_i. */
-		if ((&next_i->i_sb_list != list) &&
+		if ((&next_i->i_sb_list != &inodes->head) &&
 		    atomic_read(&next_i->i_count)) {
 			spin_lock(&next_i->i_lock);
 			if (!(next_i->i_state & (I_FREEING | I_WILL_FREE))) {
@@ -293,11 +290,11 @@ void fsnotify_unmount_inodes(struct list_head *list)
 		}
 
 		/*
-		 * We can safely drop inode_sb_list_lock here because we hold
+		 * We can safely drop the shard lock here because we hold
 		 * references on both inode and next_i.  Also no new inodes
 		 * will be added since the umount has begun.
 		 */
-		spin_unlock(&inode_sb_list_lock);
+		spin_unlock(&inodes->lock);
 
 		if (need_iput_tmp)
 			iput(need_iput_tmp);
@@ -309,7 +306,22 @@ void fsnotify_unmount_inodes(struct list_head *list)
 
 		iput(inode);
 
-		spin_lock(&inode_sb_list_lock);
+		spin_lock(&inodes->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
+	spin_unlock(&inodes->lock);
+}
+
+/**
+ * fsnotify_unmount_inodes - an sb is unmounting.  handle any watched inodes.
+ * @sb: superblock being unmounted
+ *
+ * Called during unmount with no locks held, so needs to be safe against
+ * concurrent modifiers.
+ */
+void fsnotify_unmount_inodes(struct super_block *sb)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		fsnotify_unmount_inode_list(per_cpu_ptr(sb->s_inodes, cpu));
 }
@@ -1603,6 +1603,10 @@ static long vmsplice_to_user(struct file *file, const struct iovec __user *iov,
  * vmsplice splices a user address range into a pipe. It can be thought of
  * as splice-from-memory, where the regular splice is splice-from-file (or
  * to file). In both cases the output is a pipe, naturally.
+ *
+ * The pages are referenced, not copied, so splicing them on to a TCP socket
+ * sends them by reference: setting SO_ZEROCOPY on it tells the user when
+ * the stack is done with them, see Documentation/networking/zerocopy.txt.
  */
 static long vmsplice_to_pipe(struct file *file, const struct iovec __user *iov,
 			     unsigned long nr_segs, unsigned int flags)
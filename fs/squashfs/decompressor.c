@@ -22,7 +22,10 @@
  */
 
 #include <linux/types.h>
-#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/cpumask.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
 
@@ -83,34 +86,202 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+/*
+ * Each mounted filesystem keeps a pool of decompressor streams, so that
+ * readers of different blocks can decompress in parallel rather than
+ * serialising on a single stream.  Streams are created on demand, up to
+ * one per online cpu, and are never freed before unmount.
+ */
+struct squashfs_stream {
+	void			*comp_opts;
+	int			comp_opts_len;
+	spinlock_t		lock;
+	struct list_head	strm_list;	/* idle streams */
+	int			avail_decomp;	/* streams allocated */
+	wait_queue_head_t	wait;
+};
+
+struct decomp_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+
+static struct decomp_stream *squashfs_alloc_decomp_stream(
+	struct squashfs_sb_info *msblk, struct squashfs_stream *stream)
+{
+	struct decomp_stream *decomp_strm;
+
+	decomp_strm = kmalloc(sizeof(*decomp_strm), GFP_KERNEL);
+	if (decomp_strm == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	decomp_strm->stream = msblk->decompressor->init(msblk,
+		stream->comp_opts, stream->comp_opts_len);
+	if (IS_ERR(decomp_strm->stream)) {
+		void *err = decomp_strm->stream;
+
+		kfree(decomp_strm);
+		return err;
+	}
+
+	return decomp_strm;
+}
+
+
+struct squashfs_stream *squashfs_decompressor_init(struct super_block *sb,
+	unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
+	struct squashfs_stream *stream;
+	struct decomp_stream *decomp_strm;
+	int err;
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&stream->lock);
+	INIT_LIST_HEAD(&stream->strm_list);
+	init_waitqueue_head(&stream->wait);
 
 	/*
-	 * Read decompressor specific options from file system if present
+	 * Read decompressor specific options from file system if present.
+	 * They are kept for the streams allocated later on.
 	 */
 	if (SQUASHFS_COMP_OPTS(flags)) {
-		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
-		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
+		stream->comp_opts = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+		if (stream->comp_opts == NULL) {
+			err = -ENOMEM;
+			goto failed;
+		}
 
-		length = squashfs_read_data(sb, &buffer,
-			sizeof(struct squashfs_super_block), 0, NULL,
-			PAGE_CACHE_SIZE, 1);
+		stream->comp_opts_len = squashfs_read_data(sb,
+			&stream->comp_opts, sizeof(struct squashfs_super_block),
+			0, NULL, PAGE_CACHE_SIZE, 1);
 
-		if (length < 0) {
-			strm = ERR_PTR(length);
-			goto finished;
+		if (stream->comp_opts_len < 0) {
+			err = stream->comp_opts_len;
+			goto failed;
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	/*
+	 * Allocate the first stream now, so that a mount fails up front if
+	 * the options are bad or memory is short.
+	 */
+	decomp_strm = squashfs_alloc_decomp_stream(msblk, stream);
+	if (IS_ERR(decomp_strm)) {
+		err = PTR_ERR(decomp_strm);
+		goto failed;
+	}
+
+	list_add(&decomp_strm->list, &stream->strm_list);
+	stream->avail_decomp = 1;
+
+	return stream;
+
+failed:
+	kfree(stream->comp_opts);
+	kfree(stream);
+	return ERR_PTR(err);
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream = msblk->stream;
+	struct decomp_stream *decomp_strm;
+
+	if (stream == NULL)
+		return;
+
+	while (!list_empty(&stream->strm_list)) {
+		decomp_strm = list_entry(stream->strm_list.next,
+			struct decomp_stream, list);
+		list_del(&decomp_strm->list);
+		msblk->decompressor->free(decomp_strm->stream);
+		kfree(decomp_strm);
+		stream->avail_decomp--;
+	}
+
+	WARN_ON(stream->avail_decomp);
+	kfree(stream->comp_opts);
+	kfree(stream);
+}
+
+
+static struct decomp_stream *squashfs_get_decomp_stream(
+	struct squashfs_sb_info *msblk, struct squashfs_stream *stream)
+{
+	struct decomp_stream *decomp_strm;
+
+	while (1) {
+		spin_lock(&stream->lock);
+		if (!list_empty(&stream->strm_list)) {
+			decomp_strm = list_entry(stream->strm_list.next,
+				struct decomp_stream, list);
+			list_del(&decomp_strm->list);
+			spin_unlock(&stream->lock);
+			return decomp_strm;
+		}
+
+		/*
+		 * No idle stream.  Allocate another one if below the limit,
+		 * otherwise wait for one to be put back.  A stream is never
+		 * freed, so failing to allocate can also fall back to waiting
+		 * as there's always at least one.
+		 */
+		if (stream->avail_decomp >= num_online_cpus()) {
+			spin_unlock(&stream->lock);
+			wait_event(stream->wait,
+				!list_empty(&stream->strm_list));
+			continue;
+		}
+
+		stream->avail_decomp++;
+		spin_unlock(&stream->lock);
+
+		decomp_strm = squashfs_alloc_decomp_stream(msblk, stream);
+		if (!IS_ERR(decomp_strm))
+			return decomp_strm;
+
+		spin_lock(&stream->lock);
+		stream->avail_decomp--;
+		spin_unlock(&stream->lock);
+		wait_event(stream->wait, !list_empty(&stream->strm_list));
+	}
+}
+
+
+static void squashfs_put_decomp_stream(struct squashfs_stream *stream,
+	struct decomp_stream *decomp_strm)
+{
+	spin_lock(&stream->lock);
+	list_add(&decomp_strm->list, &stream->strm_list);
+	spin_unlock(&stream->lock);
+	wake_up(&stream->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *stream = msblk->stream;
+	struct decomp_stream *decomp_strm;
+	int res;
+
+	/* Compressed compression options are not supported */
+	if (stream == NULL) {
+		ERROR("compressed block read before decompressor set up\n");
+		return -EIO;
+	}
 
-finished:
-	kfree(buffer);
+	decomp_strm = squashfs_get_decomp_stream(msblk, stream);
+	res = msblk->decompressor->decompress(msblk, decomp_strm->stream,
+		buffer, bh, b, offset, length, srclength, pages);
+	squashfs_put_decomp_stream(stream, decomp_strm);
 
-	return strm;
+	return res;
 }
@@ -371,6 +371,100 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache pages it covers,
+ * rather than into the single shared read_page cache entry and copying
+ * from there.  This lets readers of different blocks proceed in parallel.
+ *
+ * Returns -EAGAIN if the pages couldn't all be grabbed, in which case the
+ * caller falls back to reading through the cache.  On success, or any
+ * other error, all pages but @target_page have been unlocked and released.
+ */
+static int squashfs_readpage_block(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = start_index | mask;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int i, n, pages, offset, bytes, res = -EAGAIN;
+	struct page **page;
+	void **pageaddr;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page = kmalloc(pages * sizeof(*page), GFP_KERNEL);
+	pageaddr = kmalloc(pages * sizeof(*pageaddr), GFP_KERNEL);
+	if (page == NULL || pageaddr == NULL)
+		goto out;
+
+	/*
+	 * Grab all the pages of the block.  Give up if one is missing or
+	 * already uptodate, as the cache path handles those, and on highmem
+	 * pages which the decompressors can't address directly.
+	 */
+	for (n = 0, i = start_index; i <= end_index; n++, i++) {
+		page[n] = (i == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, i);
+
+		if (page[n] == NULL)
+			goto release_pages;
+
+		if (PageHighMem(page[n]) || (page[n] != target_page &&
+						PageUptodate(page[n]))) {
+			n++;
+			goto release_pages;
+		}
+
+		pageaddr[n] = page_address(page[n]);
+	}
+
+	res = squashfs_read_data(inode->i_sb, pageaddr, block, bsize, NULL,
+		msblk->block_size, pages);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		goto release_pages;
+	}
+
+	/* Zero what's past the end of the data in the last pages */
+	for (i = res; i < pages << PAGE_CACHE_SHIFT; i += bytes) {
+		offset = i & (PAGE_CACHE_SIZE - 1);
+		bytes = PAGE_CACHE_SIZE - offset;
+		memset(pageaddr[i >> PAGE_CACHE_SHIFT] + offset, 0, bytes);
+	}
+
+	for (i = 0; i < pages; i++) {
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		if (page[i] != target_page) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+	}
+
+	res = 0;
+	goto out;
+
+release_pages:
+	while (n--) {
+		if (page[n] != target_page) {
+			unlock_page(page[n]);
+			page_cache_release(page[n]);
+		}
+	}
+
+out:
+	kfree(pageaddr);
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -410,8 +504,17 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock, directly into the
+			 * page cache if possible.
 			 */
+			int res = squashfs_readpage_block(page, block, bsize);
+
+			if (res == 0) {
+				unlock_page(page);
+				return 0;
+			} else if (res != -EAGAIN)
+				goto error_out;
+
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
 			if (buffer->error) {
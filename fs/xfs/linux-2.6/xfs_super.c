@@ -44,6 +44,7 @@
 #include "xfs_utils.h"
 #include "xfs_vnodeops.h"
 #include "xfs_log_priv.h"
+#include "xfs_log_recover.h"
 #include "xfs_trans_priv.h"
 #include "xfs_filestream.h"
 #include "xfs_da_btree.h"
@@ -1672,8 +1673,20 @@ xfs_init_workqueues(void)
 	if (!xfs_ail_wq)
 		goto out_destroy_syncd;
 
+	/*
+	 * Log recovery replays each AG on its own work item and most of the
+	 * time is spent waiting for buffer reads, so let the items run on
+	 * any CPU and as many at a time as there are AG queues.
+	 */
+	xfs_recover_wq = alloc_workqueue("xfsrecover", WQ_UNBOUND,
+					 XLOG_RECOVER_MAX_QUEUES);
+	if (!xfs_recover_wq)
+		goto out_destroy_ail;
+
 	return 0;
 
+out_destroy_ail:
+	destroy_workqueue(xfs_ail_wq);
 out_destroy_syncd:
 	destroy_workqueue(xfs_syncd_wq);
 out:
@@ -1683,6 +1696,7 @@ out:
 STATIC void
 xfs_destroy_workqueues(void)
 {
+	destroy_workqueue(xfs_recover_wq);
 	destroy_workqueue(xfs_ail_wq);
 	destroy_workqueue(xfs_syncd_wq);
 }
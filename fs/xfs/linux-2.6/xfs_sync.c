@@ -483,49 +483,76 @@ xfs_sync_worker(
 }
 
 /*
- * Queue a new inode reclaim pass if there are reclaimable inodes and there
- * isn't a reclaim pass already in progress. By default it runs every 5s based
- * on the xfs syncd work default of 30s. Perhaps this should have it's own
- * tunable, but that can be done if this method proves to be ineffective or too
- * aggressive.
+ * Queue a new inode reclaim pass on an AG if it has reclaimable inodes and
+ * there isn't a reclaim pass already in progress. By default it runs every 5s
+ * based on the xfs syncd work default of 30s. Perhaps this should have it's
+ * own tunable, but that can be done if this method proves to be ineffective or
+ * too aggressive.
+ *
+ * Each AG has its own reclaim work, so that the AGs of a large filesystem
+ * are reclaimed in parallel rather than one after the other.
  */
+STATIC int xfs_reclaim_inodes_pag(struct xfs_perag *pag, int flags,
+				  int trylock, int *nr_to_scan);
+
 static void
-xfs_syncd_queue_reclaim(
-	struct xfs_mount        *mp)
+xfs_syncd_queue_pag_reclaim(
+	struct xfs_perag	*pag)
 {
-
 	/*
 	 * We can have inodes enter reclaim after we've shut down the syncd
 	 * workqueue during unmount, so don't allow reclaim work to be queued
 	 * during unmount.
 	 */
-	if (!(mp->m_super->s_flags & MS_ACTIVE))
+	if (!(pag->pag_mount->m_super->s_flags & MS_ACTIVE))
 		return;
 
 	rcu_read_lock();
-	if (radix_tree_tagged(&mp->m_perag_tree, XFS_ICI_RECLAIM_TAG)) {
-		queue_delayed_work(xfs_syncd_wq, &mp->m_reclaim_work,
+	if (radix_tree_tagged(&pag->pag_ici_root, XFS_ICI_RECLAIM_TAG)) {
+		queue_delayed_work(xfs_syncd_wq, &pag->pag_reclaim_work,
 			msecs_to_jiffies(xfs_syncd_centisecs / 6 * 10));
 	}
 	rcu_read_unlock();
 }
 
 /*
- * This is a fast pass over the inode cache to try to get reclaim moving on as
- * many inodes as possible in a short period of time. It kicks itself every few
- * seconds, as well as being kicked by the inode cache shrinker when memory
- * goes low. It scans as quickly as possible avoiding locked inodes or those
- * already being flushed, and once done schedules a future pass.
+ * Queue a reclaim pass on every AG that has reclaimable inodes.
  */
-STATIC void
+static void
+xfs_syncd_queue_reclaim(
+	struct xfs_mount        *mp)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		ag = 0;
+
+	while ((pag = xfs_perag_get_tag(mp, ag, XFS_ICI_RECLAIM_TAG))) {
+		ag = pag->pag_agno + 1;
+		xfs_syncd_queue_pag_reclaim(pag);
+		xfs_perag_put(pag);
+	}
+}
+
+/*
+ * This is a fast pass over the inode cache of an AG to try to get reclaim
+ * moving on as many inodes as possible in a short period of time. It kicks
+ * itself every few seconds, as well as being kicked by the inode cache
+ * shrinker when memory goes low. It scans as quickly as possible avoiding
+ * locked inodes or those already being flushed, and once done schedules a
+ * future pass.
+ */
+void
 xfs_reclaim_worker(
 	struct work_struct *work)
 {
-	struct xfs_mount *mp = container_of(to_delayed_work(work),
-					struct xfs_mount, m_reclaim_work);
+	struct xfs_perag *pag = container_of(to_delayed_work(work),
+					struct xfs_perag, pag_reclaim_work);
+	int		nr_to_scan = INT_MAX;
 
-	xfs_reclaim_inodes(mp, SYNC_TRYLOCK);
-	xfs_syncd_queue_reclaim(mp);
+	if (mutex_trylock(&pag->pag_ici_reclaim_lock)) {
+		xfs_reclaim_inodes_pag(pag, SYNC_TRYLOCK, 1, &nr_to_scan);
+		mutex_unlock(&pag->pag_ici_reclaim_lock);
+	}
+	xfs_syncd_queue_pag_reclaim(pag);
 }
 
 /*
@@ -567,7 +594,6 @@ xfs_syncd_init(
 {
 	INIT_WORK(&mp->m_flush_work, xfs_flush_worker);
 	INIT_DELAYED_WORK(&mp->m_sync_work, xfs_sync_worker);
-	INIT_DELAYED_WORK(&mp->m_reclaim_work, xfs_reclaim_worker);
 
 	xfs_syncd_queue_sync(mp);
 	xfs_syncd_queue_reclaim(mp);
@@ -579,8 +605,15 @@ void
 xfs_syncd_stop(
 	struct xfs_mount	*mp)
 {
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		ag;
+
 	cancel_delayed_work_sync(&mp->m_sync_work);
-	cancel_delayed_work_sync(&mp->m_reclaim_work);
+	for (ag = 0; ag < mp->m_sb.sb_agcount; ag++) {
+		pag = xfs_perag_get(mp, ag);
+		cancel_delayed_work_sync(&pag->pag_reclaim_work);
+		xfs_perag_put(pag);
+	}
 	cancel_work_sync(&mp->m_flush_work);
 }
 
@@ -602,7 +635,7 @@ __xfs_inode_set_reclaim_tag(
 		spin_unlock(&ip->i_mount->m_perag_lock);
 
 		/* schedule periodic background inode reclaim */
-		xfs_syncd_queue_reclaim(ip->i_mount);
+		xfs_syncd_queue_pag_reclaim(pag);
 
 		trace_xfs_perag_set_reclaim(ip->i_mount, pag->pag_agno,
 							-1, _RET_IP_);
@@ -886,6 +919,98 @@ reclaim:
 
 }
 
+/*
+ * Reclaim the inodes in an AG, with the pag_ici_reclaim_lock held. When
+ * trylock is set the scan starts from where the last one left off.
+ */
+STATIC int
+xfs_reclaim_inodes_pag(
+	struct xfs_perag	*pag,
+	int			flags,
+	int			trylock,
+	int			*nr_to_scan)
+{
+	struct xfs_mount	*mp = pag->pag_mount;
+	unsigned long		first_index = 0;
+	int			done = 0;
+	int			nr_found = 0;
+	int			error = 0;
+	int			last_error = 0;
+
+	if (trylock)
+		first_index = pag->pag_ici_reclaim_cursor;
+
+	do {
+		struct xfs_inode *batch[XFS_LOOKUP_BATCH];
+		int	i;
+
+		rcu_read_lock();
+		nr_found = radix_tree_gang_lookup_tag(
+				&pag->pag_ici_root,
+				(void **)batch, first_index,
+				XFS_LOOKUP_BATCH,
+				XFS_ICI_RECLAIM_TAG);
+		if (!nr_found) {
+			done = 1;
+			rcu_read_unlock();
+			break;
+		}
+
+		/*
+		 * Grab the inodes before we drop the lock. if we found
+		 * nothing, nr == 0 and the loop will be skipped.
+		 */
+		for (i = 0; i < nr_found; i++) {
+			struct xfs_inode *ip = batch[i];
+
+			if (done || xfs_reclaim_inode_grab(ip, flags))
+				batch[i] = NULL;
+
+			/*
+			 * Update the index for the next lookup. Catch
+			 * overflows into the next AG range which can
+			 * occur if we have inodes in the last block of
+			 * the AG and we are currently pointing to the
+			 * last inode.
+			 *
+			 * Because we may see inodes that are from the
+			 * wrong AG due to RCU freeing and
+			 * reallocation, only update the index if it
+			 * lies in this AG. It was a race that lead us
+			 * to see this inode, so another lookup from
+			 * the same index will not find it again.
+			 */
+			if (XFS_INO_TO_AGNO(mp, ip->i_ino) != pag->pag_agno)
+				continue;
+			first_index = XFS_INO_TO_AGINO(mp, ip->i_ino + 1);
+			if (first_index < XFS_INO_TO_AGINO(mp, ip->i_ino))
+				done = 1;
+		}
+
+		/* unlock now we've grabbed the inodes. */
+		rcu_read_unlock();
+
+		for (i = 0; i < nr_found; i++) {
+			if (!batch[i])
+				continue;
+			error = xfs_reclaim_inode(batch[i], pag, flags);
+			if (error && last_error != EFSCORRUPTED)
+				last_error = error;
+		}
+
+		*nr_to_scan -= XFS_LOOKUP_BATCH;
+
+		cond_resched();
+
+	} while (nr_found && !done && *nr_to_scan > 0);
+
+	if (trylock && !done)
+		pag->pag_ici_reclaim_cursor = first_index;
+	else
+		pag->pag_ici_reclaim_cursor = 0;
+	return last_error;
+}
+
 /*
  * Walk the AGs and reclaim the inodes in them. Even if the filesystem is
  * corrupted, we still want to try to reclaim all the inodes. If we don't,
@@ -909,10 +1034,6 @@ restart:
 	ag = 0;
 	skipped = 0;
 	while ((pag = xfs_perag_get_tag(mp, ag, XFS_ICI_RECLAIM_TAG))) {
-		unsigned long	first_index = 0;
-		int		done = 0;
-		int		nr_found = 0;
-
 		ag = pag->pag_agno + 1;
 
 		if (trylock) {
@@ -921,79 +1042,13 @@ restart:
 				xfs_perag_put(pag);
 				continue;
 			}
-			first_index = pag->pag_ici_reclaim_cursor;
 		} else
 			mutex_lock(&pag->pag_ici_reclaim_lock);
 
-		do {
-			struct xfs_inode *batch[XFS_LOOKUP_BATCH];
-			int	i;
-
-			rcu_read_lock();
-			nr_found = radix_tree_gang_lookup_tag(
-					&pag->pag_ici_root,
-					(void **)batch, first_index,
-					XFS_LOOKUP_BATCH,
-					XFS_ICI_RECLAIM_TAG);
-			if (!nr_found) {
-				done = 1;
-				rcu_read_unlock();
-				break;
-			}
-
-			/*
-			 * Grab the inodes before we drop the lock. if we found
-			 * nothing, nr == 0 and the loop will be skipped.
-			 */
-			for (i = 0; i < nr_found; i++) {
-				struct xfs_inode *ip = batch[i];
-
-				if (done || xfs_reclaim_inode_grab(ip, flags))
-					batch[i] = NULL;
-
-				/*
-				 * Update the index for the next lookup. Catch
-				 * overflows into the next AG range which can
-				 * occur if we have inodes in the last block of
-				 * the AG and we are currently pointing to the
-				 * last inode.
-				 *
-				 * Because we may see inodes that are from the
-				 * wrong AG due to RCU freeing and
-				 * reallocation, only update the index if it
-				 * lies in this AG. It was a race that lead us
-				 * to see this inode, so another lookup from
-				 * the same index will not find it again.
-				 */
-				if (XFS_INO_TO_AGNO(mp, ip->i_ino) !=
-								pag->pag_agno)
-					continue;
-				first_index = XFS_INO_TO_AGINO(mp, ip->i_ino + 1);
-				if (first_index < XFS_INO_TO_AGINO(mp, ip->i_ino))
-					done = 1;
-			}
-
-			/* unlock now we've grabbed the inodes. */
-			rcu_read_unlock();
-
-			for (i = 0; i < nr_found; i++) {
-				if (!batch[i])
-					continue;
-				error = xfs_reclaim_inode(batch[i], pag, flags);
-				if (error && last_error != EFSCORRUPTED)
-					last_error = error;
-			}
-
-			*nr_to_scan -= XFS_LOOKUP_BATCH;
-
-			cond_resched();
-
-		} while (nr_found && !done && *nr_to_scan > 0);
+		error = xfs_reclaim_inodes_pag(pag, flags, trylock, nr_to_scan);
+		if (error && last_error != EFSCORRUPTED)
+			last_error = error;
 
-		if (trylock && !done)
-			pag->pag_ici_reclaim_cursor = first_index;
-		else
-			pag->pag_ici_reclaim_cursor = 0;
 		mutex_unlock(&pag->pag_ici_reclaim_lock);
 		xfs_perag_put(pag);
 	}
@@ -1016,6 +1016,7 @@ xlog_alloc_log(xfs_mount_t	*mp,
 	INIT_LIST_HEAD(&log->l_writeq);
 	spin_lock_init(&log->l_grant_reserve_lock);
 	spin_lock_init(&log->l_grant_write_lock);
+	spin_lock_init(&log->l_buf_cancel_lock);
 
 	error = EFSCORRUPTED;
 	if (xfs_sb_version_hassector(&mp->m_sb)) {
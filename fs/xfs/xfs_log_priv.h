@@ -21,6 +21,7 @@
 struct xfs_buf;
 struct log;
 struct xlog_ticket;
+struct xlog_recover_replay;
 struct xfs_mount;
 
 /*
@@ -486,6 +487,8 @@ typedef struct log {
 	uint			l_flags;
 	uint			l_quotaoffs_flag; /* XFS_DQ_*, for QUOTAOFFs */
 	struct list_head	*l_buf_cancel_table;
+	spinlock_t		l_buf_cancel_lock;
+	struct xlog_recover_replay *l_recover_replay;
 	int			l_iclog_hsize;  /* size of iclog header */
 	int			l_iclog_heads;  /* # of iclog header sectors */
 	uint			l_sectBBsize;   /* sector size in BBs (2^n) */
@@ -551,6 +554,7 @@ extern int	 xlog_recover_finish(xlog_t *log);
 extern void	 xlog_pack_data(xlog_t *log, xlog_in_core_t *iclog, int);
 
 extern kmem_zone_t *xfs_log_ticket_zone;
+extern struct workqueue_struct *xfs_recover_wq;
 struct xlog_ticket *xlog_ticket_alloc(struct log *log, int unit_bytes,
 				int count, char client, uint xflags,
 				int alloc_flags);
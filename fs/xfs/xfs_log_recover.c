@@ -63,6 +63,8 @@ struct xfs_buf_cancel {
 	struct list_head	bc_list;
 };
 
+struct workqueue_struct	*xfs_recover_wq;	/* log recovery workqueue */
+
 /*
  * Sector aligned buffer routines for buffer create/read/write/access
  */
@@ -1716,12 +1718,15 @@ xlog_check_buffer_cancelled(
 
 	/*
 	 * Search for an entry in the  cancel table that matches our buffer.
+	 * The pass 2 replay queues share the buckets, hence the lock.
 	 */
 	bucket = XLOG_BUF_CANCEL_BUCKET(log, blkno);
+	spin_lock(&log->l_buf_cancel_lock);
 	list_for_each_entry(bcp, bucket, bc_list) {
 		if (bcp->bc_blkno == blkno && bcp->bc_len == len)
 			goto found;
 	}
+	spin_unlock(&log->l_buf_cancel_lock);
 
 	/*
 	 * We didn't find a corresponding entry in the table, so return 0 so
@@ -1743,6 +1748,7 @@ found:
 			kmem_free(bcp);
 		}
 	}
+	spin_unlock(&log->l_buf_cancel_lock);
 	return 1;
 }
 
@@ -2740,11 +2746,159 @@ xlog_recover_commit_pass2(
 	}
 }
 
+/*
+ * Find the AG whose replay queue a pass 2 item goes on, from the block
+ * number of the buffer it modifies.  Returns 0 for items that are not
+ * replayed into a buffer, or whose block number is out of range, and
+ * which therefore have to be recovered right away instead.
+ */
+STATIC int
+xlog_recover_item_agno(
+	struct log		*log,
+	xlog_recover_item_t	*item,
+	xfs_agnumber_t		*agno)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	xfs_buf_log_format_t	*buf_f;
+	xfs_inode_log_format_t	in_f;
+	xfs_dq_logformat_t	*dq_f;
+	xfs_daddr_t		blkno;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		blkno = buf_f->blf_blkno;
+		break;
+	case XFS_LI_INODE:
+		if (xfs_inode_item_format_convert(&item->ri_buf[0], &in_f))
+			return 0;
+		blkno = in_f.ilf_blkno;
+		break;
+	case XFS_LI_DQUOT:
+		dq_f = item->ri_buf[0].i_addr;
+		blkno = dq_f->qlf_blkno;
+		break;
+	default:
+		return 0;
+	}
+
+	if (blkno < 0)
+		return 0;
+	*agno = xfs_daddr_to_agno(mp, blkno);
+	return *agno < mp->m_sb.sb_agcount;
+}
+
+STATIC void
+xlog_recover_queue_worker(
+	struct work_struct	*work)
+{
+	struct xlog_recover_queue *rq = container_of(work,
+					struct xlog_recover_queue, rq_work);
+	xlog_recover_item_t	*item;
+	int			error;
+
+	list_for_each_entry(item, &rq->rq_items, ri_ag_list) {
+		error = xlog_recover_commit_pass2(rq->rq_log, item->ri_trans,
+						  item);
+		if (error) {
+			rq->rq_error = error;
+			break;
+		}
+	}
+}
+
+/*
+ * Free the transactions queued for pass 2 replay, and empty the queues.
+ */
+STATIC void
+xlog_recover_replay_free(
+	struct xlog_recover_replay *rr)
+{
+	struct xlog_recover	*trans, *n;
+	int			i;
+
+	for (i = 0; i < rr->rr_nqueues; i++) {
+		INIT_LIST_HEAD(&rr->rr_queue[i].rq_items);
+		rr->rr_queue[i].rq_error = 0;
+	}
+	list_for_each_entry_safe(trans, n, &rr->rr_trans, r_replay) {
+		list_del(&trans->r_replay);
+		xlog_recover_free_trans(trans);
+	}
+	rr->rr_nitems = 0;
+}
+
+/*
+ * Run all the pass 2 replay queues in parallel and wait for them.  Items
+ * on different queues touch different AGs and hence different buffers,
+ * so only the order within each queue matters.
+ */
+STATIC int
+xlog_recover_replay_flush(
+	struct log		*log)
+{
+	struct xlog_recover_replay *rr = log->l_recover_replay;
+	int			error = 0;
+	int			i;
+
+	for (i = 0; i < rr->rr_nqueues; i++) {
+		if (!list_empty(&rr->rr_queue[i].rq_items))
+			queue_work(xfs_recover_wq, &rr->rr_queue[i].rq_work);
+	}
+	for (i = 0; i < rr->rr_nqueues; i++) {
+		struct xlog_recover_queue *rq = &rr->rr_queue[i];
+
+		if (list_empty(&rq->rq_items))
+			continue;
+		flush_work(&rq->rq_work);
+		if (rq->rq_error && !error)
+			error = rq->rq_error;
+	}
+
+	xlog_recover_replay_free(rr);
+	return error;
+}
+
+/*
+ * Queue the items of a transaction committed in pass 2 for replay.  EFIs
+ * and EFDs only go into the AIL, and must do so in log order, so they are
+ * recovered here.
+ */
+STATIC int
+xlog_recover_queue_trans(
+	struct log		*log,
+	struct xlog_recover	*trans)
+{
+	struct xlog_recover_replay *rr = log->l_recover_replay;
+	xlog_recover_item_t	*item;
+	xfs_agnumber_t		agno;
+	int			error;
+
+	list_add_tail(&trans->r_replay, &rr->rr_trans);
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		if (!xlog_recover_item_agno(log, item, &agno)) {
+			error = xlog_recover_commit_pass2(log, trans, item);
+			if (error)
+				return error;
+			continue;
+		}
+		item->ri_trans = trans;
+		list_add_tail(&item->ri_ag_list,
+			      &rr->rr_queue[agno % rr->rr_nqueues].rq_items);
+		rr->rr_nitems++;
+	}
+
+	if (rr->rr_nitems >= XLOG_RECOVER_BATCH)
+		return xlog_recover_replay_flush(log);
+	return 0;
+}
+
 /*
  * Perform the transaction.
  *
- * If the transaction modifies a buffer or inode, do it now.  Otherwise,
- * EFIs and EFDs get queued up by adding entries into the AIL for them.
+ * If the transaction modifies a buffer or inode, do it now, or in pass 2
+ * queue it for replay by the AG queues.  Otherwise, EFIs and EFDs get
+ * queued up by adding entries into the AIL for them.
  */
 STATIC int
 xlog_recover_commit_trans(
@@ -2761,11 +2915,11 @@ xlog_recover_commit_trans(
 	if (error)
 		return error;
 
+	if (pass == XLOG_RECOVER_PASS2)
+		return xlog_recover_queue_trans(log, trans);
+
 	list_for_each_entry(item, &trans->r_itemq, ri_list) {
-		if (pass == XLOG_RECOVER_PASS1)
-			error = xlog_recover_commit_pass1(log, trans, item);
-		else
-			error = xlog_recover_commit_pass2(log, trans, item);
+		error = xlog_recover_commit_pass1(log, trans, item);
 		if (error)
 			return error;
 	}
@@ -3593,6 +3747,7 @@ xlog_do_log_recovery(
 	xfs_daddr_t	head_blk,
 	xfs_daddr_t	tail_blk)
 {
+	struct xlog_recover_replay *rr;
 	int		error, i;
 
 	ASSERT(head_blk != tail_blk);
@@ -3615,11 +3770,30 @@ xlog_do_log_recovery(
 		return error;
 	}
 	/*
-	 * Then do a second pass to actually recover the items in the log.
-	 * When it is complete free the table of buf cancel items.
+	 * Then do a second pass to actually recover the items in the log,
+	 * replaying the AGs in parallel.  When it is complete free the table
+	 * of buf cancel items.
 	 */
+	rr = kmem_zalloc(sizeof(struct xlog_recover_replay), KM_SLEEP);
+	INIT_LIST_HEAD(&rr->rr_trans);
+	rr->rr_nqueues = min_t(xfs_agnumber_t, log->l_mp->m_sb.sb_agcount,
+			       XLOG_RECOVER_MAX_QUEUES);
+	for (i = 0; i < rr->rr_nqueues; i++) {
+		INIT_WORK(&rr->rr_queue[i].rq_work, xlog_recover_queue_worker);
+		rr->rr_queue[i].rq_log = log;
+		INIT_LIST_HEAD(&rr->rr_queue[i].rq_items);
+	}
+	log->l_recover_replay = rr;
+
 	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
 				      XLOG_RECOVER_PASS2);
+	if (!error)
+		error = xlog_recover_replay_flush(log);
+	else
+		xlog_recover_replay_free(rr);
+
+	log->l_recover_replay = NULL;
+	kmem_free(rr);
 #ifdef DEBUG
 	if (!error) {
 		int	i;
@@ -40,6 +40,8 @@ typedef struct xlog_recover_item {
 	int			ri_cnt;	/* count of regions found */
 	int			ri_total;	/* total regions */
 	xfs_log_iovec_t		*ri_buf;	/* ptr to regions buffer */
+	struct list_head	ri_ag_list;	/* pass 2 replay queue */
+	struct xlog_recover	*ri_trans;	/* owning transaction */
 } xlog_recover_item_t;
 
 struct xlog_tid;
@@ -50,6 +52,7 @@ typedef struct xlog_recover {
 	int			r_state;	/* not needed */
 	xfs_lsn_t		r_lsn;		/* xact lsn */
 	struct list_head	r_itemq;	/* q for items */
+	struct list_head	r_replay;	/* committed, awaiting replay */
 } xlog_recover_t;
 
 #define ITEM_TYPE(i)	(*(ushort *)(i)->ri_buf[0].i_addr)
@@ -63,4 +66,30 @@ typedef struct xlog_recover {
 #define	XLOG_RECOVER_PASS1	1
 #define	XLOG_RECOVER_PASS2	2
 
+/*
+ * Pass 2 replays the buffer, inode and dquot items of committed
+ * transactions in parallel, with one queue per allocation group (AGs
+ * share queues when there are more of them than XLOG_RECOVER_MAX_QUEUES).
+ * Every block lives in exactly one AG, so all the items touching a given
+ * buffer end up on the same queue in log order.  The queues are run
+ * once XLOG_RECOVER_BATCH items have been collected, and the
+ * transactions are freed when all of them have finished.
+ */
+#define XLOG_RECOVER_MAX_QUEUES	32
+#define XLOG_RECOVER_BATCH	512
+
+struct xlog_recover_queue {
+	struct work_struct	rq_work;
+	struct log		*rq_log;
+	struct list_head	rq_items;	/* items to replay, log order */
+	int			rq_error;
+};
+
+struct xlog_recover_replay {
+	struct list_head	rr_trans;	/* transactions queued */
+	int			rr_nitems;	/* items queued */
+	int			rr_nqueues;
+	struct xlog_recover_queue rr_queue[XLOG_RECOVER_MAX_QUEUES];
+};
+
 #endif	/* __XFS_LOG_RECOVER_H__ */
@@ -64,4 +64,6 @@
 #define SO_DOMAIN		39
 
 #define SO_RXQ_OVFL             40
+
+#define SO_ZEROCOPY             41
 #endif /* __ASM_GENERIC_SOCKET_H */
@@ -19,6 +19,7 @@
 #include <linux/gfp.h>
 #include <linux/bsg.h>
 #include <linux/smp.h>
+#include <linux/percpu_refcount.h>
 
 #include <asm/scatterlist.h>
 
@@ -325,6 +326,13 @@ struct request_queue {
 	 */
 	struct kobject kobj;
 
+	/*
+	 * held across ->make_request_fn(), so that blk_cleanup_queue()
+	 * can wait for submitters without them sharing a cacheline
+	 */
+	struct percpu_ref	q_usage_counter;
+	wait_queue_head_t	q_usage_wq;
+
 	/*
 	 * queue settings
 	 */
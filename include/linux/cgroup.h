@@ -12,6 +12,7 @@
 #include <linux/cpumask.h>
 #include <linux/nodemask.h>
 #include <linux/rcupdate.h>
+#include <linux/percpu_refcount.h>
 #include <linux/cgroupstats.h>
 #include <linux/prio_heap.h>
 #include <linux/rwsem.h>
@@ -68,10 +69,13 @@ struct cgroup_subsys_state {
 	/*
 	 * State maintained by the cgroup system to allow subsystems
 	 * to be "busy". Should be accessed via css_get(),
-	 * css_tryget() and and css_put().
+	 * css_tryget() and and css_put().  It is only switched to
+	 * atomic mode, where its exact value is known, while the
+	 * cgroup is being removed or has notify_on_release set.
+	 * Unused for the root state.
 	 */
 
-	atomic_t refcnt;
+	struct percpu_ref refcnt;
 
 	unsigned long flags;
 	/* ID for this css, if possible */
@@ -87,7 +91,7 @@ enum {
 /* Caller must verify that the css is not for root cgroup */
 static inline void __css_get(struct cgroup_subsys_state *css, int count)
 {
-	atomic_add(count, &css->refcnt);
+	percpu_ref_get_many(&css->refcnt, count);
 }
 
 /*
@@ -119,7 +123,7 @@ static inline bool css_tryget(struct cgroup_subsys_state *css)
 {
 	if (test_bit(CSS_ROOT, &css->flags))
 		return true;
-	while (!atomic_inc_not_zero(&css->refcnt)) {
+	while (!percpu_ref_tryget(&css->refcnt)) {
 		if (test_bit(CSS_REMOVED, &css->flags))
 			return false;
 		cpu_relax();
@@ -43,7 +43,8 @@ struct dentry_stat_t {
 	int nr_unused;
 	int age_limit;          /* age in seconds */
 	int want_pages;         /* pages requested by system */
-	int dummy[2];
+	int nr_negative;	/* unused negative dentries */
+	int dummy;
 };
 extern struct dentry_stat_t dentry_stat;
 
@@ -425,5 +426,6 @@ static inline bool d_need_lookup(struct dentry *dentry)
 extern void d_clear_need_lookup(struct dentry *dentry);
 
 extern int sysctl_vfs_cache_pressure;
+extern int sysctl_negative_dentry_limit;
 
 #endif	/* __LINUX_DCACHE_H */
@@ -26,6 +26,9 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/* Set exclusive wakeup mode for the target file descriptor */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -49,6 +52,21 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/* One operation of epoll_ctl_batch(), laid out the same on all ABIs */
+struct epoll_ctl_cmd {
+	/* Reserved, must be zero */
+	__u32 flags;
+	/* The same as the epoll_ctl() op and fd arguments */
+	__s32 op;
+	__s32 fd;
+	/* The same as the fields of struct epoll_event */
+	__u32 events;
+	__u64 data;
+	/* Set to the return value of the operation by the kernel */
+	__s32 result;
+	__u32 pad;
+};
+
 #ifdef __KERNEL__
 
 /* Forward declarations to avoid compiler errors */
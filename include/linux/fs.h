@@ -242,6 +242,7 @@ struct inodes_stat_t {
 #define S_IMA		1024	/* Inode has an associated IMA struct */
 #define S_AUTOMOUNT	2048	/* Automount/referral quasi-directory */
 #define S_NOSEC		4096	/* no suid or xattr security attributes */
+#define S_PARDIROPS	8192	/* Directory takes creates/unlinks in parallel */
 
 /*
  * Note that nosuid etc flags are inode-specific: setting some file-system
@@ -279,6 +280,7 @@ struct inodes_stat_t {
 #define IS_IMA(inode)		((inode)->i_flags & S_IMA)
 #define IS_AUTOMOUNT(inode)	((inode)->i_flags & S_AUTOMOUNT)
 #define IS_NOSEC(inode)		((inode)->i_flags & S_NOSEC)
+#define IS_PARDIROPS(inode)	((inode)->i_flags & S_PARDIROPS)
 
 /* the read-only stuff doesn't really belong here, but any other place is
    probably as bad and I don't want to create yet another include file. */
@@ -395,6 +397,7 @@ struct inodes_stat_t {
 #include <linux/fiemap.h>
 #include <linux/rculist_bl.h>
 #include <linux/shrinker.h>
+#include <linux/workqueue.h>
 #include <linux/atomic.h>
 
 #include <asm/byteorder.h>
@@ -757,10 +760,12 @@ struct inode {
 
 	unsigned long		dirtied_when;	/* jiffies of first dirtying */
 
-	struct hlist_node	i_hash;
+	struct hlist_bl_node	i_hash;
+	struct hlist_bl_head	*i_hash_head;	/* bucket i_hash is on */
 	struct list_head	i_wb_list;	/* backing dev IO list */
 	struct list_head	i_lru;		/* inode LRU list */
 	struct list_head	i_sb_list;
+	int			i_sb_list_cpu;	/* s_inodes shard i_sb_list is on */
 	union {
 		struct list_head	i_dentry;
 		struct rcu_head		i_rcu;
@@ -780,7 +785,7 @@ struct inode {
 	struct timespec		i_ctime;
 	blkcnt_t		i_blocks;
 	unsigned short          i_bytes;
-	atomic_t		i_dio_count;
+	atomic_t		i_dio_count;	/* dirs: parallel ops, see namei.c */
 	const struct file_operations	*i_fop;	/* former ->i_op->default_file_ops */
 	struct file_lock	*i_flock;
 	struct address_space	*i_mapping;
@@ -815,7 +820,16 @@ struct inode {
 
 static inline int inode_unhashed(struct inode *inode)
 {
-	return hlist_unhashed(&inode->i_hash);
+	return hlist_bl_unhashed(&inode->i_hash);
+}
+
+/*
+ * For filesystems which don't use the inode hash but want their inodes
+ * to look hashed, so that generic_drop_inode() doesn't evict them.
+ */
+static inline void inode_fake_hash(struct inode *inode)
+{
+	hlist_bl_add_fake(&inode->i_hash);
 }
 
 /*
@@ -911,6 +925,18 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * A sequential stream which was read ahead for, and may be picked up again
+ * when its reader comes back after another stream had the file_ra_state.
+ */
+struct file_ra_stream {
+	pgoff_t start;
+	unsigned int size;
+	unsigned int async_size;
+};
+
+#define FILE_RA_STREAMS	3		/* idle streams remembered */
+
 /*
  * Track a single file's readahead state
  */
@@ -923,6 +949,13 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	/* Other streams, most recently used first */
+	struct file_ra_stream streams[FILE_RA_STREAMS];
+
+	pgoff_t stride_start;		/* last strided chunk seen */
+	unsigned int stride;		/* distance between strided chunks */
+	unsigned int stride_size;	/* # of pages in a strided chunk */
 };
 
 /*
@@ -1364,6 +1397,16 @@ extern int send_sigurg(struct fown_struct *fown);
 extern struct list_head super_blocks;
 extern spinlock_t sb_lock;
 
+/*
+ * The inodes of a superblock are sharded over per-cpu lists, each with
+ * its own lock, so that instantiating and evicting inodes scales.  An
+ * inode stays on the shard of the cpu which added it, see i_sb_list_cpu.
+ */
+struct sb_inode_list {
+	spinlock_t		lock;
+	struct list_head	head;
+};
+
 struct super_block {
 	struct list_head	s_list;		/* Keep this first */
 	dev_t			s_dev;		/* search index; _not_ kdev_t */
@@ -1388,16 +1431,20 @@ struct super_block {
 #endif
 	const struct xattr_handler **s_xattr;
 
-	struct list_head	s_inodes;	/* all inodes */
+	struct sb_inode_list __percpu *s_inodes;	/* all inodes */
 	struct hlist_bl_head	s_anon;		/* anonymous dentries for (nfs) exporting */
 #ifdef CONFIG_SMP
 	struct list_head __percpu *s_files;
 #else
 	struct list_head	s_files;
 #endif
-	/* s_dentry_lru, s_nr_dentry_unused protected by dcache.c lru locks */
+	/* s_dentry_lru_lock protects the dentry lrus and their counts */
+	spinlock_t		s_dentry_lru_lock ____cacheline_aligned_in_smp;
 	struct list_head	s_dentry_lru;	/* unused dentry lru */
-	int			s_nr_dentry_unused;	/* # of dentry on lru */
+	struct list_head	s_dentry_negative_lru;	/* unused negative ones */
+	int			s_nr_dentry_unused;	/* # of dentry on lrus */
+	int			s_nr_dentry_negative;	/* # of negative ones */
+	struct work_struct	s_dentry_trim_work;	/* negative dentry trim */
 
 	/* s_inode_lru_lock protects s_inode_lru and s_nr_inodes_unused */
 	spinlock_t		s_inode_lru_lock ____cacheline_aligned_in_smp;
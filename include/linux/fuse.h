@@ -47,6 +47,10 @@
  *  - FUSE_IOCTL_UNRESTRICTED shall now return with array of 'struct
  *    fuse_ioctl_iovec' instead of ambiguous 'struct iovec'
  *  - add FUSE_IOCTL_32BIT flag
+ *
+ * 7.17
+ *  - add FUSE_WRITEBACK_CACHE init flag
+ *  - add FUSE_DEV_IOC_CLONE ioctl
  */
 
 #ifndef _LINUX_FUSE_H
@@ -78,7 +82,7 @@
 #define FUSE_KERNEL_VERSION 7
 
 /** Minor version number of this interface */
-#define FUSE_KERNEL_MINOR_VERSION 16
+#define FUSE_KERNEL_MINOR_VERSION 17
 
 /** The node ID of the root inode */
 #define FUSE_ROOT_ID 1
@@ -155,6 +159,8 @@ struct fuse_file_lock {
  *
  * FUSE_EXPORT_SUPPORT: filesystem handles lookups of "." and ".."
  * FUSE_DONT_MASK: don't apply umask to file mode on create operations
+ * FUSE_WRITEBACK_CACHE: use writeback cache for buffered writes, with
+ *			 file size and mtime maintained by the kernel
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -163,6 +169,7 @@ struct fuse_file_lock {
 #define FUSE_EXPORT_SUPPORT	(1 << 4)
 #define FUSE_BIG_WRITES		(1 << 5)
 #define FUSE_DONT_MASK		(1 << 6)
+#define FUSE_WRITEBACK_CACHE	(1 << 7)
 
 /**
  * CUSE INIT request/reply flags
@@ -624,4 +631,11 @@ struct fuse_notify_retrieve_in {
 	__u64	dummy4;
 };
 
+/*
+ * Clone a mounted /dev/fuse file descriptor, given as argument, into a
+ * freshly opened one.  Each clone is a separate channel of the
+ * connection, with its own request queue.
+ */
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, __u32)
+
 #endif /* _LINUX_FUSE_H */
@@ -74,6 +74,7 @@ extern void *jbd2_alloc(size_t size, gfp_t flags);
 extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
 
 #ifdef __KERNEL__
 
@@ -241,7 +242,9 @@ typedef struct journal_superblock_s
 	__be32	s_max_trans_data;	/* Limit of data blocks per trans. */
 
 /* 0x0050 */
-	__u32	s_padding[44];
+	__be32	s_num_fc_blks;		/* Nr of fast commit blocks, 0 means
+					   JBD2_DEFAULT_FAST_COMMIT_BLOCKS */
+	__u32	s_padding[43];
 
 /* 0x0100 */
 	__u8	s_users[16*48];		/* ids of all fs'es sharing the log */
@@ -263,13 +266,15 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
 #define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
 #define JBD2_KNOWN_ROCOMPAT_FEATURES	0
 #define JBD2_KNOWN_INCOMPAT_FEATURES	(JBD2_FEATURE_INCOMPAT_REVOKE | \
 					JBD2_FEATURE_INCOMPAT_64BIT | \
-					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -503,9 +508,6 @@ struct transaction_chp_stats_s {
  *    ->j_list_lock
  *
  *    j_state_lock
- *    ->t_handle_lock
- *
- *    j_state_lock
  *    ->j_list_lock			(journal_unmap_buffer)
  *
  */
@@ -600,13 +602,9 @@ struct transaction_s
 	 */
 	struct list_head	t_inode_list;
 
-	/*
-	 * Protects info related to handles
-	 */
-	spinlock_t		t_handle_lock;
-
 	/*
 	 * Longest time some handle had to wait for running transaction
+	 * [updated with cmpxchg()]
 	 */
 	unsigned long		t_max_wait;
 
@@ -622,13 +620,15 @@ struct transaction_s
 
 	/*
 	 * Number of outstanding updates running on this transaction
-	 * [t_handle_lock]
+	 * [atomic, incremented only under j_state_lock]
 	 */
 	atomic_t		t_updates;
 
 	/*
 	 * Number of buffers reserved for use by all handles in this transaction
-	 * handle but not yet modified. [t_handle_lock]
+	 * handle but not yet modified.  Reserved by adding first and backing
+	 * out if that went over a limit, so it may briefly overshoot.
+	 * [atomic]
 	 */
 	atomic_t		t_outstanding_credits;
 
@@ -650,7 +650,7 @@ struct transaction_s
 	ktime_t			t_start_time;
 
 	/*
-	 * How many handles used this transaction? [t_handle_lock]
+	 * How many handles used this transaction? [atomic]
 	 */
 	atomic_t		t_handle_count;
 
@@ -721,6 +721,7 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_wait_checkpoint:  Wait queue to trigger checkpointing
  * @j_wait_commit: Wait queue to trigger commit
  * @j_wait_updates: Wait queue to wait for updates to complete
+ * @j_fc_wait: Wait queue for fast and full commits to wait for each other
  * @j_checkpoint_mutex: Mutex for locking against concurrent checkpoints
  * @j_head: Journal head - identifies the first unused block in the journal
  * @j_tail: Journal tail - identifies the oldest still-used block in the
@@ -728,6 +729,9 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_free: Journal free - how many free blocks are there in the journal?
  * @j_first: The block number of the first usable block
  * @j_last: The block number one beyond the last usable block
+ * @j_fc_first: The block number of the first fast commit block
+ * @j_fc_last: The block number one beyond the last fast commit block
+ * @j_fc_off: Number of fast commit blocks used since the last full commit
  * @j_dev: Device where we store the journal
  * @j_blocksize: blocksize for the location where we store the journal.
  * @j_blk_offset: starting block offset for into the device where we store the
@@ -838,6 +842,9 @@ struct journal_s
 	/* Wait queue to wait for updates to complete */
 	wait_queue_head_t	j_wait_updates;
 
+	/* Wait queue for fast and full commits to wait for each other */
+	wait_queue_head_t	j_fc_wait;
+
 	/* Semaphore for locking against concurrent checkpoints */
 	struct mutex		j_checkpoint_mutex;
 
@@ -874,6 +881,17 @@ struct journal_s
 	unsigned long		j_first;
 	unsigned long		j_last;
 
+	/*
+	 * Fast commit area, set aside at the end of the journal when the
+	 * fast commit feature is on: the block numbers of its first block
+	 * and one beyond its last, and the number of blocks used since
+	 * the last full commit, only touched by the owner of
+	 * JBD2_FAST_COMMIT_ONGOING or with JBD2_FULL_COMMIT_ONGOING set.
+	 */
+	unsigned long		j_fc_first;
+	unsigned long		j_fc_last;
+	unsigned long		j_fc_off;
+
 	/*
 	 * Device, blocksize and starting block offset for the location where we
 	 * store the journal.
@@ -1016,6 +1034,10 @@ struct journal_s
 #define JBD2_ABORT_ON_SYNCDATA_ERR	0x040	/* Abort the journal on file
 						 * data write error in ordered
 						 * mode */
+#define JBD2_FAST_COMMIT_ONGOING	0x080	/* A fast commit is being
+						 * written */
+#define JBD2_FULL_COMMIT_ONGOING	0x100	/* A transaction is being
+						 * committed */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1152,6 +1174,9 @@ extern int	   jbd2_journal_errno      (journal_t *);
 extern void	   jbd2_journal_ack_err    (journal_t *);
 extern int	   jbd2_journal_clear_err  (journal_t *);
 extern int	   jbd2_journal_bmap(journal_t *, unsigned long, unsigned long long *);
+extern int	   jbd2_fc_begin_commit(journal_t *, tid_t);
+extern void	   jbd2_fc_end_commit(journal_t *);
+extern int	   jbd2_fc_get_buf(journal_t *, struct buffer_head **);
 extern int	   jbd2_journal_force_commit(journal_t *);
 extern int	   jbd2_journal_file_inode(handle_t *handle, struct jbd2_inode *inode);
 extern int	   jbd2_journal_begin_ordered_truncate(journal_t *journal,
@@ -0,0 +1,285 @@
+#ifndef _LINUX_PERCPU_REFCOUNT_H
+#define _LINUX_PERCPU_REFCOUNT_H
+/*
+ * Percpu refcounts: a reference count for hot objects whose gets and puts
+ * only touch a local per-cpu counter in the common case.
+ *
+ * A percpu_ref starts out in percpu mode, where the count can't be read
+ * since it is spread over all the per-cpu counters.  It has an initial
+ * reference like a kref and percpu_ref_kill() is used to drop it: this
+ * switches the ref to atomic mode, folding the per-cpu counters into a
+ * single atomic_long_t once an RCU-sched grace period guarantees that
+ * no cpu still uses them, after which the release callback is invoked
+ * as soon as the count drops to zero.
+ *
+ * Users needing an exact count for a while, without killing the ref,
+ * can switch it to atomic mode with percpu_ref_switch_to_atomic() or
+ * percpu_ref_switch_to_atomic_sync() and back with
+ * percpu_ref_switch_to_percpu().  Mode switches and kill must be
+ * serialized by the caller.
+ *
+ * Note that there's no percpu_ref_read(): in percpu mode the count is
+ * only known as a sum, and in atomic mode percpu_ref_atomic_count()
+ * gives direct access to it.
+ */
+
+#include <linux/atomic.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+
+struct percpu_ref;
+typedef void (percpu_ref_func_t)(struct percpu_ref *);
+
+/* flags stored in the low bits of percpu_ref->percpu_count_ptr */
+enum {
+	__PERCPU_REF_ATOMIC	= 1LU << 0,	/* operating in atomic mode */
+	__PERCPU_REF_DEAD	= 1LU << 1,	/* (being) killed */
+	__PERCPU_REF_ATOMIC_DEAD = __PERCPU_REF_ATOMIC | __PERCPU_REF_DEAD,
+
+	__PERCPU_REF_FLAG_BITS	= 2,
+};
+
+struct percpu_ref {
+	atomic_long_t		count;
+	/*
+	 * The per-cpu counters, with the __PERCPU_REF_* flags in the low
+	 * bits.  If any is set, get/put manipulate the atomic count.
+	 */
+	unsigned long		percpu_count_ptr;
+	percpu_ref_func_t	*release;
+	percpu_ref_func_t	*confirm_switch;	/* switch in progress */
+	struct rcu_head		rcu;
+};
+
+int __must_check percpu_ref_init(struct percpu_ref *ref,
+				 percpu_ref_func_t *release);
+void percpu_ref_exit(struct percpu_ref *ref);
+void percpu_ref_switch_to_atomic(struct percpu_ref *ref,
+				 percpu_ref_func_t *confirm_switch);
+void percpu_ref_switch_to_atomic_sync(struct percpu_ref *ref);
+void percpu_ref_switch_to_percpu(struct percpu_ref *ref);
+void percpu_ref_kill_and_confirm(struct percpu_ref *ref,
+				 percpu_ref_func_t *confirm_kill);
+
+/**
+ * percpu_ref_kill - drop the initial ref
+ * @ref: percpu_ref to kill
+ *
+ * Must be used to drop the initial ref on a percpu refcount; must be called
+ * precisely once before shutdown.  percpu_ref_tryget_live() fails after it.
+ */
+static inline void percpu_ref_kill(struct percpu_ref *ref)
+{
+	percpu_ref_kill_and_confirm(ref, NULL);
+}
+
+/*
+ * Internal helper.  Don't use outside percpu_refcount proper.  The
+ * function doesn't return the pointer and let the caller test it for
+ * NULL because doing so forces the compiler to generate two conditional
+ * branches as it can't assume that @ref->percpu_count is not NULL.
+ */
+static inline bool __ref_is_percpu(struct percpu_ref *ref,
+				   unsigned long __percpu **percpu_countp)
+{
+	unsigned long percpu_ptr = ACCESS_ONCE(ref->percpu_count_ptr);
+
+	/* paired with smp_wmb() in percpu_ref_switch_to_percpu() */
+	smp_read_barrier_depends();
+
+	if (unlikely(percpu_ptr & __PERCPU_REF_ATOMIC_DEAD))
+		return false;
+
+	*percpu_countp = (unsigned long __percpu *)percpu_ptr;
+	return true;
+}
+
+/**
+ * percpu_ref_get_many - increment a percpu refcount
+ * @ref: percpu_ref to get
+ * @nr: number of references to get
+ *
+ * Analogous to atomic_long_add().
+ *
+ * This function is safe to call as long as @ref is between init and exit.
+ */
+static inline void percpu_ref_get_many(struct percpu_ref *ref,
+				       unsigned long nr)
+{
+	unsigned long __percpu *percpu_count;
+
+	rcu_read_lock_sched();
+
+	if (__ref_is_percpu(ref, &percpu_count))
+		this_cpu_add(*percpu_count, nr);
+	else
+		atomic_long_add(nr, &ref->count);
+
+	rcu_read_unlock_sched();
+}
+
+static inline void percpu_ref_get(struct percpu_ref *ref)
+{
+	percpu_ref_get_many(ref, 1);
+}
+
+/**
+ * percpu_ref_tryget - try to increment a percpu refcount
+ * @ref: percpu_ref to try-get
+ *
+ * Increment a percpu refcount unless its count already reached zero.
+ * Returns %true on success; %false on failure.
+ *
+ * This function is safe to call as long as @ref is between init and exit.
+ */
+static inline bool percpu_ref_tryget(struct percpu_ref *ref)
+{
+	unsigned long __percpu *percpu_count;
+	bool ret;
+
+	rcu_read_lock_sched();
+
+	if (__ref_is_percpu(ref, &percpu_count)) {
+		this_cpu_inc(*percpu_count);
+		ret = true;
+	} else {
+		ret = atomic_long_inc_not_zero(&ref->count);
+	}
+
+	rcu_read_unlock_sched();
+
+	return ret;
+}
+
+/**
+ * percpu_ref_tryget_live - try to increment a live percpu refcount
+ * @ref: percpu_ref to try-get
+ *
+ * Increment a percpu refcount unless it has already been killed.  Returns
+ * %true on success; %false on failure.
+ *
+ * Completion of percpu_ref_kill() in itself doesn't guarantee that this
+ * function will fail.  For such guarantee, percpu_ref_kill_and_confirm()
+ * should be used.  After the confirm_kill callback is invoked, it's
+ * guaranteed that no new reference will be given out by
+ * percpu_ref_tryget_live().
+ *
+ * This function is safe to call as long as @ref is between init and exit.
+ */
+static inline bool percpu_ref_tryget_live(struct percpu_ref *ref)
+{
+	unsigned long __percpu *percpu_count;
+	bool ret = false;
+
+	rcu_read_lock_sched();
+
+	if (__ref_is_percpu(ref, &percpu_count)) {
+		this_cpu_inc(*percpu_count);
+		ret = true;
+	} else if (!(ACCESS_ONCE(ref->percpu_count_ptr) & __PERCPU_REF_DEAD)) {
+		ret = atomic_long_inc_not_zero(&ref->count);
+	}
+
+	rcu_read_unlock_sched();
+
+	return ret;
+}
+
+/**
+ * percpu_ref_put_many - decrement a percpu refcount
+ * @ref: percpu_ref to put
+ * @nr: number of references to put
+ *
+ * Decrement the refcount, and if 0, call the release function (which was
+ * passed to percpu_ref_init()).
+ *
+ * This function is safe to call as long as @ref is between init and exit.
+ */
+static inline void percpu_ref_put_many(struct percpu_ref *ref,
+				       unsigned long nr)
+{
+	unsigned long __percpu *percpu_count;
+
+	rcu_read_lock_sched();
+
+	if (__ref_is_percpu(ref, &percpu_count))
+		this_cpu_sub(*percpu_count, nr);
+	else if (unlikely(atomic_long_sub_and_test(nr, &ref->count)))
+		ref->release(ref);
+
+	rcu_read_unlock_sched();
+}
+
+static inline void percpu_ref_put(struct percpu_ref *ref)
+{
+	percpu_ref_put_many(ref, 1);
+}
+
+/**
+ * percpu_ref_put_many_percpu - decrement a percpu refcount in percpu mode
+ * @ref: percpu_ref to put
+ * @nr: number of references to put
+ *
+ * Decrement the per-cpu counter and return %true if @ref is in percpu
+ * mode.  Otherwise leave @ref alone and return %false, for the caller to
+ * drop the references from percpu_ref_atomic_count() under its own rules.
+ *
+ * Must be called under rcu_read_lock_sched(), and the caller must stay in
+ * it until it is done with the atomic count: switching to atomic mode
+ * waits for that, so a put seen in percpu mode is folded into the count.
+ */
+static inline bool percpu_ref_put_many_percpu(struct percpu_ref *ref,
+					      unsigned long nr)
+{
+	unsigned long __percpu *percpu_count;
+
+	if (!__ref_is_percpu(ref, &percpu_count))
+		return false;
+	this_cpu_sub(*percpu_count, nr);
+	return true;
+}
+
+/**
+ * percpu_ref_is_atomic - test whether a percpu refcount is in atomic mode
+ * @ref: percpu_ref to test
+ *
+ * Returns %true if @ref has been switched to atomic mode, or is being,
+ * either explicitly or by being killed.
+ */
+static inline bool percpu_ref_is_atomic(struct percpu_ref *ref)
+{
+	return ACCESS_ONCE(ref->percpu_count_ptr) & __PERCPU_REF_ATOMIC;
+}
+
+/**
+ * percpu_ref_is_zero - test whether a percpu refcount reached zero
+ * @ref: percpu_ref to test
+ *
+ * Returns %true if @ref reached zero.
+ *
+ * This function is safe to call as long as @ref is between init and exit.
+ */
+static inline bool percpu_ref_is_zero(struct percpu_ref *ref)
+{
+	unsigned long __percpu *percpu_count;
+
+	if (__ref_is_percpu(ref, &percpu_count))
+		return false;
+	return !atomic_long_read(&ref->count);
+}
+
+/**
+ * percpu_ref_atomic_count - the count of a percpu refcount in atomic mode
+ * @ref: percpu_ref of interest
+ *
+ * Only exact once percpu_ref_switch_to_atomic_sync() returned and until
+ * @ref is switched back to percpu mode, for users which need to inspect
+ * or update the count under their own rules meanwhile.
+ */
+static inline atomic_long_t *percpu_ref_atomic_count(struct percpu_ref *ref)
+{
+	return &ref->count;
+}
+
+#endif /* _LINUX_PERCPU_REFCOUNT_H */
@@ -925,6 +925,31 @@ static inline struct cpumask *sched_group_cpus(struct sched_group *sg)
 	return to_cpumask(sg->cpumask);
 }
 
+/*
+ * State shared by all the CPUs of a cache-sharing (SD_SHARE_PKG_RESOURCES)
+ * domain, used to place waking tasks without scanning the whole domain.
+ */
+struct sched_domain_shared {
+	atomic_t ref;
+	int has_idle_cores;	/* hint: some SMT core is fully idle */
+
+	/*
+	 * The CPUs of the domain currently running their idle task. Each
+	 * CPU sets its own bit on idle entry and clears it on idle exit,
+	 * so this is a hint that must be confirmed with idle_cpu().
+	 *
+	 * NOTE: this field is variable length. (Allocated dynamically
+	 * by attaching extra space to the end of the structure,
+	 * depending on how many CPUs the kernel has booted up with)
+	 */
+	unsigned long idle_cpus[0];
+};
+
+static inline struct cpumask *sds_idle_cpus(struct sched_domain_shared *sds)
+{
+	return to_cpumask(sds->idle_cpus);
+}
+
 struct sched_domain_attr {
 	int relax_domain_level;
 };
@@ -991,6 +1016,13 @@ struct sched_domain {
 	unsigned int ttwu_wake_remote;
 	unsigned int ttwu_move_affine;
 	unsigned int ttwu_move_balance;
+
+	/* select_idle_sibling() stats */
+	unsigned int sis_attempts;
+	unsigned int sis_idle_core;
+	unsigned int sis_idle_cpu;
+	unsigned int sis_failed;
+	unsigned int sis_scanned;
 #endif
 #ifdef CONFIG_SCHED_DEBUG
 	char *name;
@@ -999,6 +1031,7 @@ struct sched_domain {
 		void *private;		/* used during construction */
 		struct rcu_head rcu;	/* used during destruction */
 	};
+	struct sched_domain_shared *shared;
 
 	unsigned int span_weight;
 	/*
@@ -1130,6 +1163,19 @@ struct load_weight {
 	unsigned long weight, inv_weight;
 };
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity runnable average.  The sums represent an infinite geometric
+ * series of 1024us periods decayed by y per period, where y^32 = 1/2, and
+ * so are bounded above by 1024/(1-y); a u32 is plenty to hold them.
+ */
+struct sched_avg {
+	u32 runnable_avg_sum, runnable_avg_period;
+	u64 last_runnable_update;
+	unsigned long load_avg_contrib;
+};
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 struct sched_statistics {
 	u64			wait_start;
@@ -1183,6 +1229,10 @@ struct sched_entity {
 	struct sched_statistics statistics;
 #endif
 
+#ifdef CONFIG_SMP
+	struct sched_avg	avg;
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct sched_entity	*parent;
 	/* rq on which this entity is (to be) queued: */
@@ -1524,7 +1574,13 @@ struct task_struct {
 #ifdef CONFIG_FAULT_INJECTION
 	int make_it_fail;
 #endif
-	struct prop_local_single dirties;
+	/*
+	 * when (nr_dirtied >= nr_dirtied_pause), it's time to call
+	 * balance_dirty_pages() for some dirty throttling pause
+	 */
+	int nr_dirtied;
+	int nr_dirtied_pause;
+
 #ifdef CONFIG_LATENCYTOP
 	int latency_record_count;
 	struct latency_record latency_record[LT_SAVECOUNT];
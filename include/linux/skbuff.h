@@ -190,6 +190,9 @@ enum {
 
 	/* device driver supports TX zero-copy buffers */
 	SKBTX_DEV_ZEROCOPY = 1 << 4,
+
+	/* frags reference pages of a zero-copy send, see struct sock_zcopy */
+	SKBTX_ZEROCOPY_NOTIFY = 1 << 5,
 };
 
 /*
@@ -203,6 +206,20 @@ struct ubuf_info {
 	unsigned long desc;
 };
 
+/*
+ * Completion tracking of a zero-copy send on a SO_ZEROCOPY socket.  It
+ * lives in the cb of the skb which is queued on the socket error queue as
+ * notification once the last skb referencing the sent pages, each holding
+ * a reference in destructor_arg, is freed.  Unlike with ubuf_info, clones
+ * share the user pages rather than copy them.
+ */
+struct sock_zcopy {
+	atomic_t	refcnt;
+	u32		id;
+	bool		copied;
+	struct sock	*sk;
+};
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -601,6 +618,39 @@ static inline struct skb_shared_hwtstamps *skb_hwtstamps(struct sk_buff *skb)
 	return &skb_shinfo(skb)->hwtstamps;
 }
 
+static inline struct sock_zcopy *skb_zcopy(struct sk_buff *skb)
+{
+	if (skb && (skb_shinfo(skb)->tx_flags & SKBTX_ZEROCOPY_NOTIFY))
+		return skb_shinfo(skb)->destructor_arg;
+	return NULL;
+}
+
+static inline void sock_zcopy_get(struct sock_zcopy *zc)
+{
+	atomic_inc(&zc->refcnt);
+}
+
+extern void sock_zcopy_put(struct sock_zcopy *zc);
+
+static inline void skb_zcopy_set(struct sk_buff *skb, struct sock_zcopy *zc)
+{
+	sock_zcopy_get(zc);
+	skb_shinfo(skb)->destructor_arg = zc;
+	skb_shinfo(skb)->tx_flags |= SKBTX_ZEROCOPY_NOTIFY;
+}
+
+/*
+ * Make a new skb which was given frags of @from also hold the reference
+ * on the zero-copy send they may belong to.
+ */
+static inline void skb_zcopy_clone(struct sk_buff *skb, struct sk_buff *from)
+{
+	struct sock_zcopy *zc = skb_zcopy(from);
+
+	if (zc)
+		skb_zcopy_set(skb, zc);
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -106,6 +106,7 @@ enum {
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
 #define TCP_USER_TIMEOUT	18	/* How long for loss retry before timeout */
+#define TCP_ZEROCOPY_RECEIVE	19	/* Map received payload pages */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
@@ -168,6 +169,13 @@ struct tcp_info {
 	__u32	tcpi_total_retrans;
 };
 
+/* for TCP_ZEROCOPY_RECEIVE socket option, on a mmap()ed socket */
+struct tcp_zerocopy_receive {
+	__u64	address;		/* in: page aligned address in the mapping */
+	__u32	length;			/* in: bytes to map, out: bytes mapped */
+	__u32	recv_skip_hint;		/* out: bytes to read() before mapping */
+};
+
 /* for TCP_MD5SIG socket option */
 #define TCP_MD5SIG_MAXKEYLEN	80
 
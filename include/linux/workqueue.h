@@ -10,9 +10,11 @@
 #include <linux/bitops.h>
 #include <linux/lockdep.h>
 #include <linux/threads.h>
+#include <linux/numa.h>
 #include <linux/atomic.h>
 
 struct workqueue_struct;
+struct cpumask;
 
 struct work_struct;
 typedef void (*work_func_t)(struct work_struct *work);
@@ -55,8 +57,8 @@ enum {
 	WORK_NO_COLOR		= WORK_NR_COLORS,
 
 	/* special cpu IDs */
-	WORK_CPU_UNBOUND	= NR_CPUS,
-	WORK_CPU_NONE		= NR_CPUS + 1,
+	WORK_CPU_UNBOUND	= NR_CPUS,	/* + node for unbound gcwqs */
+	WORK_CPU_NONE		= NR_CPUS + MAX_NUMNODES,
 	WORK_CPU_LAST		= WORK_CPU_NONE,
 
 	/*
@@ -254,9 +256,11 @@ enum {
 	WQ_MEM_RECLAIM		= 1 << 3, /* may be used for memory reclaim */
 	WQ_HIGHPRI		= 1 << 4, /* high priority */
 	WQ_CPU_INTENSIVE	= 1 << 5, /* cpu instensive workqueue */
+	WQ_SYSFS		= 1 << 6, /* visible in sysfs */
 
-	WQ_DRAINING		= 1 << 6, /* internal: workqueue is draining */
-	WQ_RESCUER		= 1 << 7, /* internal: workqueue has rescuer */
+	WQ_DRAINING		= 1 << 7, /* internal: workqueue is draining */
+	WQ_RESCUER		= 1 << 8, /* internal: workqueue has rescuer */
+	WQ_ORDERED		= 1 << 9, /* internal: unbound with max_active 1 */
 
 	WQ_MAX_ACTIVE		= 512,	  /* I like 512, better ideas? */
 	WQ_MAX_UNBOUND_PER_CPU	= 4,	  /* 4 * #cpus for unbound wq */
@@ -285,7 +289,8 @@ enum {
  * system_unbound_wq is unbound workqueue.  Workers are not bound to
  * any specific CPU, not concurrency managed, and all queued works are
  * executed immediately as long as max_active limit is not reached and
- * resources are available.
+ * resources are available.  Works are executed on the NUMA node they
+ * were queued from.
  *
  * system_freezable_wq is equivalent to system_wq except that it's
  * freezable.
@@ -378,6 +383,9 @@ extern bool cancel_delayed_work_sync(struct delayed_work *dwork);
 
 extern void workqueue_set_max_active(struct workqueue_struct *wq,
 				     int max_active);
+extern int workqueue_set_nice(struct workqueue_struct *wq, int nice);
+extern int workqueue_set_cpumask(struct workqueue_struct *wq,
+				 const struct cpumask *cpumask);
 extern bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq);
 extern unsigned int work_cpu(struct work_struct *work);
 extern unsigned int work_busy(struct work_struct *work);
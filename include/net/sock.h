@@ -224,6 +224,8 @@ struct sock_common {
   *	@sk_user_data: RPC layer private data
   *	@sk_sndmsg_page: cached page for sendmsg
   *	@sk_sndmsg_off: cached offset for sendmsg
+  *	@sk_zckey: id of the next %SO_ZEROCOPY message
+  *	@sk_zcopy: %SO_ZEROCOPY message being sent, closed without %MSG_MORE
   *	@sk_send_head: front of stuff to transmit
   *	@sk_security: used by security modules
   *	@sk_mark: generic packet mark
@@ -333,6 +335,8 @@ struct sock {
 	struct page		*sk_sndmsg_page;
 	struct sk_buff		*sk_send_head;
 	__u32			sk_sndmsg_off;
+	u32			sk_zckey;
+	struct sock_zcopy	*sk_zcopy;
 	int			sk_write_pending;
 #ifdef CONFIG_SECURITY
 	void			*sk_security;
@@ -564,6 +568,7 @@ enum sock_flags {
 	SOCK_FASYNC, /* fasync() active */
 	SOCK_RXQ_OVFL,
 	SOCK_ZEROCOPY, /* buffers from userspace */
+	SOCK_ZEROCOPY_NOTIFY, /* %SO_ZEROCOPY setting */
 };
 
 static inline void sock_copy_flags(struct sock *nsk, struct sock *osk)
@@ -1606,6 +1611,11 @@ extern void sk_stop_timer(struct sock *sk, struct timer_list* timer);
 extern int sock_queue_rcv_skb(struct sock *sk, struct sk_buff *skb);
 
 extern int sock_queue_err_skb(struct sock *sk, struct sk_buff *skb);
+extern struct sk_buff *sock_dequeue_err_skb(struct sock *sk);
+
+extern struct sock_zcopy *sock_zcopy_open(struct sock *sk);
+extern void sock_zcopy_close(struct sock *sk);
+extern void sock_zcopy_abort(struct sock *sk);
 
 /*
  *	Recover an error report and clear atomically
@@ -506,6 +506,12 @@ extern void tcp_get_info(struct sock *, struct tcp_info *);
 /* Read 'sendfile()'-style from a TCP socket */
 typedef int (*sk_read_actor_t)(read_descriptor_t *, struct sk_buff *,
 				unsigned int, size_t);
+#ifdef CONFIG_MMU
+extern int tcp_mmap(struct file *file, struct socket *sock,
+		    struct vm_area_struct *vma);
+#else
+#define tcp_mmap	sock_no_mmap
+#endif
 extern int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 			 sk_read_actor_t recv_actor);
 
@@ -828,8 +828,10 @@ static void cgroup_diput(struct dentry *dentry, struct inode *inode)
 		/*
 		 * Release the subsystem state objects.
 		 */
-		for_each_subsys(cgrp->root, ss)
+		for_each_subsys(cgrp->root, ss) {
+			percpu_ref_exit(&cgrp->subsys[ss->subsys_id]->refcnt);
 			ss->destroy(ss, cgrp);
+		}
 
 		cgrp->root->number_of_cgroups--;
 		mutex_unlock(&cgroup_mutex);
@@ -3417,6 +3419,41 @@ static int cgroup_procs_open(struct inode *unused, struct file *file)
 	return cgroup_pidlist_open(file, CGROUP_FILE_PROCS);
 }
 
+/*
+ * Switch the css refcounts of @cgrp to atomic mode, for their exact value
+ * to be known, or back to percpu mode.  Removed css are left alone.  Call
+ * with cgroup_mutex held.
+ */
+static void cgroup_switch_css_refs(struct cgroup *cgrp, bool atomic)
+{
+	struct cgroup_subsys *ss;
+
+	if (atomic) {
+		/* start all the switches to wait for one grace period */
+		for_each_subsys(cgrp->root, ss)
+			percpu_ref_switch_to_atomic(
+				&cgrp->subsys[ss->subsys_id]->refcnt, NULL);
+	}
+	for_each_subsys(cgrp->root, ss) {
+		struct cgroup_subsys_state *css = cgrp->subsys[ss->subsys_id];
+
+		if (atomic)
+			percpu_ref_switch_to_atomic_sync(&css->refcnt);
+		else if (!css_is_removed(css))
+			percpu_ref_switch_to_percpu(&css->refcnt);
+	}
+}
+
+/*
+ * The css refcounts only need to stay in atomic mode for the release
+ * agent once an rmdir attempt gave up.  Call with cgroup_mutex held.
+ */
+static void cgroup_restore_css_refs(struct cgroup *cgrp)
+{
+	if (!notify_on_release(cgrp))
+		cgroup_switch_css_refs(cgrp, false);
+}
+
 static u64 cgroup_read_notify_on_release(struct cgroup *cgrp,
 					    struct cftype *cft)
 {
@@ -3427,11 +3464,17 @@ static int cgroup_write_notify_on_release(struct cgroup *cgrp,
 					  struct cftype *cft,
 					  u64 val)
 {
+	if (!cgroup_lock_live_group(cgrp))
+		return -ENODEV;
 	clear_bit(CGRP_RELEASABLE, &cgrp->flags);
 	if (val)
 		set_bit(CGRP_NOTIFY_ON_RELEASE, &cgrp->flags);
 	else
 		clear_bit(CGRP_NOTIFY_ON_RELEASE, &cgrp->flags);
+	/* check_for_release() needs the exact css refcounts */
+	if (cgrp != cgrp->top_cgroup)
+		cgroup_switch_css_refs(cgrp, val);
+	cgroup_unlock();
 	return 0;
 }
 
@@ -3700,18 +3743,31 @@ static int cgroup_populate_dir(struct cgroup *cgrp)
 	return 0;
 }
 
-static void init_cgroup_css(struct cgroup_subsys_state *css,
+static void css_release(struct percpu_ref *ref)
+{
+	/*
+	 * The base reference is never put, cgroup_clear_css_refs() takes
+	 * it away directly, so this can only be an unbalanced css_put().
+	 */
+	WARN_ON_ONCE(1);
+}
+
+static int init_cgroup_css(struct cgroup_subsys_state *css,
 			       struct cgroup_subsys *ss,
 			       struct cgroup *cgrp)
 {
 	css->cgroup = cgrp;
-	atomic_set(&css->refcnt, 1);
 	css->flags = 0;
 	css->id = NULL;
-	if (cgrp == dummytop)
-		set_bit(CSS_ROOT, &css->flags);
 	BUG_ON(cgrp->subsys[ss->subsys_id]);
 	cgrp->subsys[ss->subsys_id] = css;
+	if (cgrp == dummytop) {
+		/* may be called before percpu allocations are possible */
+		set_bit(CSS_ROOT, &css->flags);
+		memset(&css->refcnt, 0, sizeof(css->refcnt));
+		return 0;
+	}
+	return percpu_ref_init(&css->refcnt, css_release);
 }
 
 static void cgroup_lock_hierarchy(struct cgroupfs_root *root)
@@ -3794,7 +3850,9 @@ static long cgroup_create(struct cgroup *parent, struct dentry *dentry,
 			err = PTR_ERR(css);
 			goto err_destroy;
 		}
-		init_cgroup_css(css, ss, cgrp);
+		err = init_cgroup_css(css, ss, cgrp);
+		if (err)
+			goto err_destroy;
 		if (ss->use_id) {
 			err = alloc_css_id(ss, parent, cgrp);
 			if (err)
@@ -3805,6 +3863,9 @@ static long cgroup_create(struct cgroup *parent, struct dentry *dentry,
 			ss->post_clone(ss, cgrp);
 	}
 
+	if (notify_on_release(cgrp))
+		cgroup_switch_css_refs(cgrp, true);
+
 	cgroup_lock_hierarchy(root);
 	list_add(&cgrp->sibling, &cgrp->parent->children);
 	cgroup_unlock_hierarchy(root);
@@ -3835,8 +3896,10 @@ static long cgroup_create(struct cgroup *parent, struct dentry *dentry,
  err_destroy:
 
 	for_each_subsys(root, ss) {
-		if (cgrp->subsys[ss->subsys_id])
+		if (cgrp->subsys[ss->subsys_id]) {
+			percpu_ref_exit(&cgrp->subsys[ss->subsys_id]->refcnt);
 			ss->destroy(ss, cgrp);
+		}
 	}
 
 	mutex_unlock(&cgroup_mutex);
@@ -3885,8 +3948,11 @@ static int cgroup_has_css_refs(struct cgroup *cgrp)
 		 * and the css deleted. But a false-positive doesn't
 		 * matter, since it can only happen if the cgroup
 		 * has been deleted and hence no longer needs the
-		 * release agent to be called anyway. */
-		if (css && (atomic_read(&css->refcnt) > 1))
+		 * release agent to be called anyway. A css refcount
+		 * in percpu mode can't be read, count it as busy. */
+		if (css && (!percpu_ref_is_atomic(&css->refcnt) ||
+			    atomic_long_read(percpu_ref_atomic_count(
+					&css->refcnt)) > 1))
 			return 1;
 	}
 	return 0;
@@ -3895,7 +3961,8 @@ static int cgroup_has_css_refs(struct cgroup *cgrp)
 /*
  * Atomically mark all (or else none) of the cgroup's CSS objects as
  * CSS_REMOVED. Return true on success, or false if the cgroup has
- * busy subsystems. Call with cgroup_mutex held
+ * busy subsystems. Call with cgroup_mutex held, after switching the
+ * css refcounts to atomic mode
  */
 
 static int cgroup_clear_css_refs(struct cgroup *cgrp)
@@ -3906,10 +3973,11 @@ static int cgroup_clear_css_refs(struct cgroup *cgrp)
 	local_irq_save(flags);
 	for_each_subsys(cgrp->root, ss) {
 		struct cgroup_subsys_state *css = cgrp->subsys[ss->subsys_id];
-		int refcnt;
+		atomic_long_t *count = percpu_ref_atomic_count(&css->refcnt);
+		long refcnt;
 		while (1) {
 			/* We can only remove a CSS with a refcnt==1 */
-			refcnt = atomic_read(&css->refcnt);
+			refcnt = atomic_long_read(count);
 			if (refcnt > 1) {
 				failed = true;
 				goto done;
@@ -3921,7 +3989,7 @@ static int cgroup_clear_css_refs(struct cgroup *cgrp)
 			 * css_tryget() to spin until we set the
 			 * CSS_REMOVED bits or abort
 			 */
-			if (atomic_cmpxchg(&css->refcnt, refcnt, 0) == refcnt)
+			if (atomic_long_cmpxchg(count, refcnt, 0) == refcnt)
 				break;
 			cpu_relax();
 		}
@@ -3929,13 +3997,14 @@ static int cgroup_clear_css_refs(struct cgroup *cgrp)
  done:
 	for_each_subsys(cgrp->root, ss) {
 		struct cgroup_subsys_state *css = cgrp->subsys[ss->subsys_id];
+		atomic_long_t *count = percpu_ref_atomic_count(&css->refcnt);
 		if (failed) {
 			/*
 			 * Restore old refcnt if we previously managed
 			 * to clear it from 1 to 0
 			 */
-			if (!atomic_read(&css->refcnt))
-				atomic_set(&css->refcnt, 1);
+			if (!atomic_long_read(count))
+				atomic_long_set(count, 1);
 		} else {
 			/* Commit the fact that the CSS is removed */
 			set_bit(CSS_REMOVED, &css->flags);
@@ -3958,10 +4027,12 @@ static int cgroup_rmdir(struct inode *unused_dir, struct dentry *dentry)
 again:
 	mutex_lock(&cgroup_mutex);
 	if (atomic_read(&cgrp->count) != 0) {
+		cgroup_restore_css_refs(cgrp);
 		mutex_unlock(&cgroup_mutex);
 		return -EBUSY;
 	}
 	if (!list_empty(&cgrp->children)) {
+		cgroup_restore_css_refs(cgrp);
 		mutex_unlock(&cgroup_mutex);
 		return -EBUSY;
 	}
@@ -3985,6 +4056,9 @@ again:
 	ret = cgroup_call_pre_destroy(cgrp);
 	if (ret) {
 		clear_bit(CGRP_WAIT_ON_RMDIR, &cgrp->flags);
+		mutex_lock(&cgroup_mutex);
+		cgroup_restore_css_refs(cgrp);
+		mutex_unlock(&cgroup_mutex);
 		return ret;
 	}
 
@@ -3992,9 +4066,15 @@ again:
 	parent = cgrp->parent;
 	if (atomic_read(&cgrp->count) || !list_empty(&cgrp->children)) {
 		clear_bit(CGRP_WAIT_ON_RMDIR, &cgrp->flags);
+		cgroup_restore_css_refs(cgrp);
 		mutex_unlock(&cgroup_mutex);
 		return -EBUSY;
 	}
+	/*
+	 * The css refcounts stay in atomic mode while we wait, for
+	 * __css_put() to notice them dropping back to their base ref.
+	 */
+	cgroup_switch_css_refs(cgrp, true);
 	prepare_to_wait(&cgroup_rmdir_waitq, &wait, TASK_INTERRUPTIBLE);
 	if (!cgroup_clear_css_refs(cgrp)) {
 		mutex_unlock(&cgroup_mutex);
@@ -4006,8 +4086,12 @@ again:
 			schedule();
 		finish_wait(&cgroup_rmdir_waitq, &wait);
 		clear_bit(CGRP_WAIT_ON_RMDIR, &cgrp->flags);
-		if (signal_pending(current))
+		if (signal_pending(current)) {
+			mutex_lock(&cgroup_mutex);
+			cgroup_restore_css_refs(cgrp);
+			mutex_unlock(&cgroup_mutex);
 			return -EINTR;
+		}
 		goto again;
 	}
 	/* NO css_tryget() can success after here. */
@@ -4687,9 +4771,24 @@ static void check_for_release(struct cgroup *cgrp)
 void __css_put(struct cgroup_subsys_state *css, int count)
 {
 	struct cgroup *cgrp = css->cgroup;
-	int val;
+	unsigned long val;
+
+	/*
+	 * Only a refcount in atomic mode can be seen dropping to its base
+	 * ref, rmdir and notify_on_release make sure they are then.  The
+	 * mode is tested and the count dropped in one rcu-sched section,
+	 * which cgroup_switch_css_refs() waits out, so that a put is
+	 * either folded into the atomic count before rmdir looks at it or
+	 * takes the val == 1 path below.
+	 */
+	rcu_read_lock_sched();
+	if (percpu_ref_put_many_percpu(&css->refcnt, count)) {
+		rcu_read_unlock_sched();
+		return;
+	}
 	rcu_read_lock();
-	val = atomic_sub_return(count, &css->refcnt);
+	val = atomic_long_sub_return(count,
+				     percpu_ref_atomic_count(&css->refcnt));
 	if (val == 1) {
 		if (notify_on_release(cgrp)) {
 			set_bit(CGRP_RELEASABLE, &cgrp->flags);
@@ -4698,7 +4797,13 @@ void __css_put(struct cgroup_subsys_state *css, int count)
 		cgroup_wakeup_rmdir_waiter(cgrp);
 	}
 	rcu_read_unlock();
-	WARN_ON_ONCE(val < 1);
+	rcu_read_unlock_sched();
+	/*
+	 * Until the per-cpu counters are folded in, the atomic count still
+	 * carries the percpu_ref bias, with the top bit set: test it as an
+	 * unsigned value so that only a real drop to zero warns.
+	 */
+	WARN_ON_ONCE(!val);
 }
 EXPORT_SYMBOL_GPL(__css_put);
 
@@ -4817,7 +4922,8 @@ unsigned short css_id(struct cgroup_subsys_state *css)
 	 * on this or this is under rcu_read_lock(). Once css->id is allocated,
 	 * it's unchanged until freed.
 	 */
-	cssid = rcu_dereference_check(css->id, atomic_read(&css->refcnt));
+	cssid = rcu_dereference_check(css->id,
+				      !percpu_ref_is_zero(&css->refcnt));
 
 	if (cssid)
 		return cssid->id;
@@ -4829,7 +4935,8 @@ unsigned short css_depth(struct cgroup_subsys_state *css)
 {
 	struct css_id *cssid;
 
-	cssid = rcu_dereference_check(css->id, atomic_read(&css->refcnt));
+	cssid = rcu_dereference_check(css->id,
+				      !percpu_ref_is_zero(&css->refcnt));
 
 	if (cssid)
 		return cssid->depth;
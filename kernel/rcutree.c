@@ -57,7 +57,7 @@
 
 static struct lock_class_key rcu_node_class[NUM_RCU_LVLS];
 
-#define RCU_STATE_INITIALIZER(structname) { \
+#define RCU_STATE_INITIALIZER(structname, sabbr) { \
 	.level = { &structname.node[0] }, \
 	.levelcnt = { \
 		NUM_RCU_LVL_0,  /* root of hierarchy. */ \
@@ -74,12 +74,13 @@ static struct lock_class_key rcu_node_class[NUM_RCU_LVLS];
 	.n_force_qs = 0, \
 	.n_force_qs_ngp = 0, \
 	.name = #structname, \
+	.abbr = sabbr, \
 }
 
-struct rcu_state rcu_sched_state = RCU_STATE_INITIALIZER(rcu_sched_state);
+struct rcu_state rcu_sched_state = RCU_STATE_INITIALIZER(rcu_sched_state, 's');
 DEFINE_PER_CPU(struct rcu_data, rcu_sched_data);
 
-struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh_state);
+struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh_state, 'b');
 DEFINE_PER_CPU(struct rcu_data, rcu_bh_data);
 
 static struct rcu_state *rcu_state;
@@ -1503,9 +1504,15 @@ static void invoke_rcu_core(void)
 	raise_softirq(RCU_SOFTIRQ);
 }
 
+/*
+ * Queue a callback for the specified RCU flavor.  If "offload" is set
+ * and the current CPU is a no-CBs CPU, the callback is handed to that
+ * CPU's callback-offload kthread.  Those kthreads themselves pass zero
+ * so that their own grace-period waits are queued the normal way.
+ */
 static void
 __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
-	   struct rcu_state *rsp)
+	   struct rcu_state *rsp, bool offload)
 {
 	unsigned long flags;
 	struct rcu_data *rdp;
@@ -1525,6 +1532,12 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
 	local_irq_save(flags);
 	rdp = this_cpu_ptr(rsp->rda);
 
+	/* Let the callback-offload kthread handle no-CBs CPUs. */
+	if (offload && __call_rcu_nocb(rdp, head)) {
+		local_irq_restore(flags);
+		return;
+	}
+
 	/* Add the callback to our list. */
 	*rdp->nxttail[RCU_NEXT_TAIL] = head;
 	rdp->nxttail[RCU_NEXT_TAIL] = &head->next;
@@ -1575,7 +1588,7 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
  */
 void call_rcu_sched(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_sched_state);
+	__call_rcu(head, func, &rcu_sched_state, 1);
 }
 EXPORT_SYMBOL_GPL(call_rcu_sched);
 
@@ -1584,7 +1597,7 @@ EXPORT_SYMBOL_GPL(call_rcu_sched);
  */
 void call_rcu_bh(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_bh_state);
+	__call_rcu(head, func, &rcu_bh_state, 1);
 }
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
@@ -1796,10 +1809,15 @@ static void _rcu_barrier(struct rcu_state *rsp,
 	 * did their increment, causing this function to return too
 	 * early.  Note that on_each_cpu() disables irqs, which prevents
 	 * any CPUs from coming online or going offline until each online
-	 * CPU has queued its RCU-barrier callback.
+	 * CPU has queued its RCU-barrier callback.  Offline no-CBs CPUs
+	 * can still have offloaded callbacks, so CPU hotplug is held off
+	 * until those CPUs have also had barrier callbacks queued.
 	 */
 	atomic_set(&rcu_barrier_cpu_count, 1);
+	get_online_cpus();
 	on_each_cpu(rcu_barrier_func, (void *)call_rcu_func, 1);
+	rcu_nocb_barrier_offline(rsp);
+	put_online_cpus();
 	if (atomic_dec_and_test(&rcu_barrier_cpu_count))
 		complete(&rcu_barrier_completion);
 	wait_for_completion(&rcu_barrier_completion);
@@ -1846,6 +1864,7 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 	rdp->dynticks = &per_cpu(rcu_dynticks, cpu);
 #endif /* #ifdef CONFIG_NO_HZ */
 	rdp->cpu = cpu;
+	rcu_boot_init_nocb_percpu_data(rdp);
 	raw_spin_unlock_irqrestore(&rnp->lock, flags);
 }
 
@@ -2052,6 +2071,7 @@ static void __init rcu_init_one(struct rcu_state *rsp,
 			}
 			rnp->level = i;
 			INIT_LIST_HEAD(&rnp->blkd_tasks);
+			rcu_init_nocb_node(rsp, rnp);
 		}
 	}
 
@@ -27,6 +27,7 @@
 #include <linux/threads.h>
 #include <linux/cpumask.h>
 #include <linux/seqlock.h>
+#include <linux/wait.h>
 
 /*
  * Define shape of hierarchy based on NR_CPUS and CONFIG_RCU_FANOUT.
@@ -187,6 +188,17 @@ struct rcu_node {
 				/*  per-CPU kthreads as needed. */
 	unsigned int node_kthread_status;
 				/* State of node_kthread_task for tracing. */
+#ifdef CONFIG_RCU_NOCB_CPU
+	struct task_struct *nocb_kthread;
+				/* kthread invoking the callbacks of all */
+				/*  no-CBs CPUs covered by this leaf. */
+	wait_queue_head_t nocb_wq;
+				/* For nocb_kthread to wait for callbacks. */
+	struct rcu_state *nocb_rsp;
+				/* RCU flavor that nocb_kthread serves. */
+	unsigned long n_nocb_gps;
+				/* Grace periods waited for by nocb_kthread. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
 } ____cacheline_internodealigned_in_smp;
 
 /*
@@ -298,6 +310,17 @@ struct rcu_data {
 	unsigned long n_rp_need_fqs;
 	unsigned long n_rp_need_nothing;
 
+#ifdef CONFIG_RCU_NOCB_CPU
+	/* 6) Callback offloading for no-CBs CPUs. */
+	struct rcu_head *nocb_head;	/* CBs waiting for kthread. */
+	struct rcu_head **nocb_tail;
+	atomic_long_t nocb_q_count;	/* # CBs waiting for kthread. */
+	struct rcu_head *nocb_gp_head;	/* CBs waiting for grace period. */
+	struct rcu_head **nocb_gp_tail;
+	long nocb_gp_count;		/* # CBs waiting for grace period. */
+	unsigned long n_nocb_invoked;	/* # CBs invoked by kthread. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 	int cpu;
 };
 
@@ -394,6 +417,7 @@ struct rcu_state {
 	unsigned long gp_max;			/* Maximum GP duration in */
 						/*  jiffies. */
 	char *name;				/* Name of structure. */
+	char abbr;				/* Abbreviated name. */
 };
 
 /* Return values for rcu_preempt_offline_tasks(). */
@@ -466,5 +490,10 @@ static void rcu_yield(void (*f)(unsigned long), unsigned long arg);
 #endif /* #ifdef CONFIG_RCU_BOOST */
 static void rcu_cpu_kthread_setrt(int cpu, int to_rt);
 static void __cpuinit rcu_prepare_kthreads(int cpu);
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp);
+static void rcu_nocb_barrier_offline(struct rcu_state *rsp);
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp);
+static void __init rcu_init_nocb_node(struct rcu_state *rsp,
+				      struct rcu_node *rnp);
 
 #endif /* #ifndef RCU_TREE_NONCORE */
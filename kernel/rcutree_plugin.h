@@ -64,7 +64,7 @@ static void __init rcu_bootup_announce_oddness(void)
 
 #ifdef CONFIG_TREE_PREEMPT_RCU
 
-struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt_state);
+struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt_state, 'p');
 DEFINE_PER_CPU(struct rcu_data, rcu_preempt_data);
 static struct rcu_state *rcu_state = &rcu_preempt_state;
 
@@ -639,7 +639,7 @@ static void rcu_preempt_do_callbacks(void)
  */
 void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_preempt_state);
+	__call_rcu(head, func, &rcu_preempt_state, 1);
 }
 EXPORT_SYMBOL_GPL(call_rcu);
 
@@ -2008,3 +2008,317 @@ static void rcu_needs_cpu_flush(void)
 }
 
 #endif /* #else #if !defined(CONFIG_RCU_FAST_NO_HZ) */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback invocation from the CPUs specified by the rcu_nocbs=
+ * boot parameter.  Callbacks queued on such a "no-CBs" CPU are appended
+ * to a per-CPU list without disabling anything beyond interrupts, and a
+ * kthread per leaf rcu_node structure and RCU flavor gathers up the lists
+ * of all of the no-CBs CPUs covered by that rcu_node structure, waits
+ * for a single grace period on behalf of the whole batch, then invokes
+ * the callbacks.  These "rcuo" kthreads are not bound to any CPU, so
+ * the usual taskset or cpuset mechanisms can confine them to
+ * housekeeping CPUs, keeping softirq callback invocation off of
+ * latency-sensitive CPUs.
+ */
+
+static cpumask_var_t rcu_nocb_mask; /* CPUs to have callbacks offloaded. */
+static bool have_rcu_nocb_mask;	    /* Was rcu_nocb_mask allocated? */
+
+/* Parse the boot-time rcu_nocbs= CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/* Is the specified CPU a no-CBs CPU? */
+static bool is_nocb_cpu(int cpu)
+{
+	if (have_rcu_nocb_mask)
+		return cpumask_test_cpu(cpu, rcu_nocb_mask);
+	return false;
+}
+
+/*
+ * Enqueue the specified callback onto the specified no-CBs CPU's list,
+ * waking the corresponding rcuo kthread if the list was empty.  The
+ * xchg() of ->nocb_tail orders concurrent enqueuers, so the only state
+ * that the rcuo kthread can see is a ->next pointer that is briefly NULL
+ * while an enqueuer links its callback in behind the old tail.
+ */
+static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
+				    struct rcu_head *rhp)
+{
+	struct rcu_head **old_rhpp;
+
+	rhp->next = NULL;
+	old_rhpp = xchg(&rdp->nocb_tail, &rhp->next);
+	ACCESS_ONCE(*old_rhpp) = rhp;
+	atomic_long_inc(&rdp->nocb_q_count);
+
+	/* If we are not being polled and there is a kthread, awaken it. */
+	if (old_rhpp == &rdp->nocb_head && rdp->mynode->nocb_kthread)
+		wake_up(&rdp->mynode->nocb_wq);
+}
+
+/*
+ * Hand off the specified callback to the rcuo kthread if the specified
+ * CPU is a no-CBs CPU, returning true if so.  Otherwise the caller must
+ * queue the callback on the CPU's ->nxtlist as usual.
+ */
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp)
+{
+	if (!is_nocb_cpu(rdp->cpu))
+		return 0;
+	__call_rcu_nocb_enqueue(rdp, rhp);
+	return 1;
+}
+
+/*
+ * No-CBs CPUs keep their offloaded callbacks across CPU-offline events,
+ * so rcu_barrier() must also queue a barrier callback behind those
+ * belonging to offline no-CBs CPUs.  The caller holds off CPU hotplug
+ * and the rcu_barrier_mutex, which protects the per-CPU rcu_barrier_head.
+ */
+static void rcu_nocb_barrier_offline(struct rcu_state *rsp)
+{
+	int cpu;
+	struct rcu_data *rdp;
+	struct rcu_head *rhp;
+
+	if (!have_rcu_nocb_mask)
+		return;
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		if (cpu_online(cpu))
+			continue;
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (atomic_long_read(&rdp->nocb_q_count) == 0) {
+			smp_rmb(); /* Pairs with rcu_nocb_harvest(). */
+			if (ACCESS_ONCE(rdp->nocb_gp_count) == 0)
+				continue;
+		}
+		rhp = &per_cpu(rcu_barrier_head, cpu);
+		debug_rcu_head_queue(rhp);
+		rhp->func = rcu_barrier_callback;
+		atomic_inc(&rcu_barrier_cpu_count);
+		__call_rcu_nocb_enqueue(rdp, rhp);
+	}
+}
+
+/* Does any no-CBs CPU covered by this rcuo kthread have callbacks? */
+static bool rcu_nocb_group_pending(struct rcu_state *rsp,
+				   struct rcu_node *rnp)
+{
+	int cpu;
+
+	for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++)
+		if (is_nocb_cpu(cpu) &&
+		    ACCESS_ONCE(per_cpu_ptr(rsp->rda, cpu)->nocb_head))
+			return 1;
+	return 0;
+}
+
+/*
+ * Move the specified no-CBs CPU's callbacks to its ->nocb_gp_head list,
+ * where they will wait for the next grace period.  Returns true if there
+ * were any callbacks to move.
+ */
+static bool rcu_nocb_harvest(struct rcu_data *rdp)
+{
+	struct rcu_head *list;
+	long count;
+
+	list = ACCESS_ONCE(rdp->nocb_head);
+	if (list == NULL)
+		return 0;
+	/*
+	 * Publish the callbacks as waiting for a grace period before they
+	 * stop counting as queued, so that rcu_nocb_barrier_offline() never
+	 * sees both counts at zero while they are pending.
+	 */
+	count = atomic_long_read(&rdp->nocb_q_count);
+	ACCESS_ONCE(rdp->nocb_gp_count) = count;
+	smp_mb(); /* Pairs with rcu_nocb_barrier_offline(). */
+	atomic_long_sub(count, &rdp->nocb_q_count);
+	rdp->nocb_gp_head = list;
+	ACCESS_ONCE(rdp->nocb_head) = NULL;
+	rdp->nocb_gp_tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+	return 1;
+}
+
+/*
+ * Invoke the callbacks that the specified no-CBs CPU had queued before
+ * the grace period that the rcuo kthread just waited for.
+ */
+static void rcu_nocb_invoke(struct rcu_data *rdp)
+{
+	struct rcu_head *list = rdp->nocb_gp_head;
+	struct rcu_head *next;
+	struct rcu_head **tail = rdp->nocb_gp_tail;
+	unsigned long c = 0;
+
+	while (list) {
+		next = list->next;
+		/* Wait for enqueuing to complete, if needed. */
+		while (next == NULL && &list->next != tail) {
+			schedule_timeout_interruptible(1);
+			next = list->next;
+		}
+		debug_rcu_head_unqueue(list);
+		local_bh_disable();
+		__rcu_reclaim(list);
+		local_bh_enable();
+		list = next;
+		c++;
+		cond_resched();
+	}
+	rdp->nocb_gp_head = NULL;
+	ACCESS_ONCE(rdp->nocb_gp_count) = 0;
+	rdp->n_nocb_invoked += c;
+}
+
+/*
+ * Wait for a full grace period of the rcuo kthread's RCU flavor.  The
+ * wakeup callback is queued on the current CPU's ->nxtlist regardless
+ * of whether it is a no-CBs CPU, as otherwise the kthread would end up
+ * waiting on itself.  Wait interruptibly to avoid inflating the load
+ * average while the kthread is idle awaiting a grace period.
+ */
+static void rcu_nocb_wait_gp(struct rcu_state *rsp)
+{
+	struct rcu_synchronize rcu;
+
+	init_rcu_head_on_stack(&rcu.head);
+	init_completion(&rcu.completion);
+	__call_rcu(&rcu.head, wakeme_after_rcu, rsp, 0);
+	while (wait_for_completion_interruptible(&rcu.completion))
+		flush_signals(current);
+	destroy_rcu_head_on_stack(&rcu.head);
+}
+
+/*
+ * Per-leaf-rcu_node kthread that invokes the callbacks of the no-CBs
+ * CPUs covered by that rcu_node structure.  Each pass harvests the lists
+ * of all of these CPUs and then waits for a single grace period on
+ * behalf of all of them, so that the cost of grace-period waiting is
+ * amortized over the whole group.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	int cpu;
+	bool any;
+	struct rcu_node *rnp = arg;
+	struct rcu_state *rsp = rnp->nocb_rsp;
+
+	for (;;) {
+		wait_event_interruptible(rnp->nocb_wq,
+					 rcu_nocb_group_pending(rsp, rnp));
+		any = 0;
+		for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++)
+			if (is_nocb_cpu(cpu) &&
+			    rcu_nocb_harvest(per_cpu_ptr(rsp->rda, cpu)))
+				any = 1;
+		if (!any)
+			continue;
+		rcu_nocb_wait_gp(rsp);
+		rnp->n_nocb_gps++;
+		for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++)
+			if (is_nocb_cpu(cpu))
+				rcu_nocb_invoke(per_cpu_ptr(rsp->rda, cpu));
+	}
+	return 0;
+}
+
+/* Initialize a CPU's no-CBs callback list at boot time. */
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+	rdp->nocb_head = NULL;
+	rdp->nocb_tail = &rdp->nocb_head;
+	atomic_long_set(&rdp->nocb_q_count, 0);
+	rdp->nocb_gp_head = NULL;
+	rdp->nocb_gp_count = 0;
+}
+
+/* Initialize an rcu_node structure's rcuo kthread state at boot time. */
+static void __init rcu_init_nocb_node(struct rcu_state *rsp,
+				      struct rcu_node *rnp)
+{
+	init_waitqueue_head(&rnp->nocb_wq);
+	rnp->nocb_rsp = rsp;
+}
+
+/*
+ * Spawn the rcuo kthreads for the specified RCU flavor, one for each
+ * leaf rcu_node structure that covers at least one possible no-CBs CPU.
+ */
+static void __init rcu_spawn_nocb_kthreads(struct rcu_state *rsp)
+{
+	int cpu;
+	struct rcu_node *rnp;
+	struct task_struct *t;
+
+	rcu_for_each_leaf_node(rsp, rnp) {
+		for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++)
+			if (cpu_possible(cpu) && is_nocb_cpu(cpu))
+				break;
+		if (cpu > rnp->grphi)
+			continue;
+		t = kthread_run(rcu_nocb_kthread, rnp, "rcuo%c/%d",
+				rsp->abbr, rnp->grplo);
+		if (WARN_ON_ONCE(IS_ERR(t)))
+			continue;
+		ACCESS_ONCE(rnp->nocb_kthread) = t;
+
+		/* Pick up any callbacks queued before the kthread existed. */
+		wake_up(&rnp->nocb_wq);
+	}
+}
+
+/* Spawn the rcuo kthreads for all RCU flavors, if any are needed. */
+static int __init rcu_spawn_all_nocb_kthreads(void)
+{
+	char buf[64];
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	cpumask_and(rcu_nocb_mask, cpu_possible_mask, rcu_nocb_mask);
+	if (cpumask_empty(rcu_nocb_mask))
+		return 0;
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	pr_info("\tOffloading RCU callbacks from CPUs: %s.\n", buf);
+	rcu_spawn_nocb_kthreads(&rcu_sched_state);
+	rcu_spawn_nocb_kthreads(&rcu_bh_state);
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	rcu_spawn_nocb_kthreads(&rcu_preempt_state);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	return 0;
+}
+early_initcall(rcu_spawn_all_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp)
+{
+	return 0;
+}
+
+static void rcu_nocb_barrier_offline(struct rcu_state *rsp)
+{
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+}
+
+static void __init rcu_init_nocb_node(struct rcu_state *rsp,
+				      struct rcu_node *rnp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
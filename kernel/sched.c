@@ -335,6 +335,14 @@ struct cfs_rq {
 	unsigned int nr_spread_over;
 #endif
 
+#ifdef CONFIG_SMP
+	/*
+	 * Sum of the load_avg_contrib of the entities queued on this
+	 * cfs_rq, i.e. the runnable-time weighted load used for balancing.
+	 */
+	unsigned long runnable_load_avg;
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -1517,10 +1525,25 @@ static int tg_nop(struct task_group *tg, void *data)
 #endif
 
 #ifdef CONFIG_SMP
-/* Used instead of source_load when we know the type == 0 */
+/*
+ * The largest cache-sharing domain of each cpu that has shared state,
+ * see update_top_cache_domain(). Protected by RCU like rq->sd.
+ */
+static DEFINE_PER_CPU(struct sched_domain *, sd_llc);
+
+/*
+ * Used instead of source_load when we know the type == 0.  With
+ * LB_RUNNABLE_AVG this is the sum of the per-entity runnable averages
+ * rather than the instantaneous weight of the queued tasks, so that
+ * mostly-sleeping tasks do not make a cpu look busy.
+ */
 static unsigned long weighted_cpuload(const int cpu)
 {
-	return cpu_rq(cpu)->load.weight;
+	struct rq *rq = cpu_rq(cpu);
+
+	if (sched_feat(LB_RUNNABLE_AVG))
+		return rq->cfs.runnable_load_avg;
+	return rq->load.weight;
 }
 
 /*
@@ -1569,7 +1592,7 @@ static unsigned long cpu_avg_load_per_task(int cpu)
 	unsigned long nr_running = ACCESS_ONCE(rq->nr_running);
 
 	if (nr_running)
-		rq->avg_load_per_task = rq->load.weight / nr_running;
+		rq->avg_load_per_task = weighted_cpuload(cpu) / nr_running;
 	else
 		rq->avg_load_per_task = 0;
 
@@ -2819,6 +2842,7 @@ static void __sched_fork(struct task_struct *p)
 	p->se.nr_migrations		= 0;
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
+	init_entity_runnable_average(&p->se);
 
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
@@ -3594,7 +3618,11 @@ decay_load_missed(unsigned long load, unsigned long missed_updates, int idx)
  */
 static void update_cpu_load(struct rq *this_rq)
 {
+#ifdef CONFIG_SMP
+	unsigned long this_load = weighted_cpuload(cpu_of(this_rq));
+#else
 	unsigned long this_load = this_rq->load.weight;
+#endif
 	unsigned long curr_jiffies = jiffies;
 	unsigned long pending_updates;
 	int i, scale;
@@ -6869,6 +6897,8 @@ static void free_sched_domain(struct rcu_head *rcu)
 		kfree(sd->groups->sgp);
 		kfree(sd->groups);
 	}
+	if (sd->shared && atomic_dec_and_test(&sd->shared->ref))
+		kfree(sd->shared);
 	kfree(sd);
 }
 
@@ -6883,6 +6913,41 @@ static void destroy_sched_domains(struct sched_domain *sd, int cpu)
 		destroy_sched_domain(sd, cpu);
 }
 
+/*
+ * Return the highest domain of 'cpu' that has 'flag' set, provided all
+ * the domains below it have it set too.
+ */
+static struct sched_domain *highest_flag_domain(int cpu, int flag)
+{
+	struct sched_domain *sd, *hsd = NULL;
+
+	for_each_domain(cpu, sd) {
+		if (!(sd->flags & flag))
+			break;
+		hsd = sd;
+	}
+
+	return hsd;
+}
+
+/*
+ * Point sd_llc at the largest cache-sharing domain of 'cpu', whose idle
+ * mask select_idle_sibling() searches. An already idle cpu will not pass
+ * through the idle entry path again, so seed its bit here.
+ */
+static void update_top_cache_domain(int cpu)
+{
+	struct sched_domain *sd;
+
+	sd = highest_flag_domain(cpu, SD_SHARE_PKG_RESOURCES);
+	if (sd && !sd->shared)
+		sd = NULL;
+	if (sd && idle_cpu(cpu))
+		cpumask_set_cpu(cpu, sds_idle_cpus(sd->shared));
+
+	rcu_assign_pointer(per_cpu(sd_llc, cpu), sd);
+}
+
 /*
  * Attach the domain 'sd' to 'cpu' as its base domain. Callers must
  * hold the hotplug lock.
@@ -6922,6 +6987,8 @@ cpu_attach_domain(struct sched_domain *sd, struct root_domain *rd, int cpu)
 	tmp = rq->sd;
 	rcu_assign_pointer(rq->sd, sd);
 	destroy_sched_domains(tmp, cpu);
+
+	update_top_cache_domain(cpu);
 }
 
 /* cpus with isolated domains */
@@ -7036,6 +7103,7 @@ struct sd_data {
 	struct sched_domain **__percpu sd;
 	struct sched_group **__percpu sg;
 	struct sched_group_power **__percpu sgp;
+	struct sched_domain_shared **__percpu sds;
 };
 
 struct s_data {
@@ -7348,6 +7416,9 @@ static void claim_allocations(int cpu, struct sched_domain *sd)
 
 	if (atomic_read(&(*per_cpu_ptr(sdd->sgp, cpu))->ref))
 		*per_cpu_ptr(sdd->sgp, cpu) = NULL;
+
+	if (atomic_read(&(*per_cpu_ptr(sdd->sds, cpu))->ref))
+		*per_cpu_ptr(sdd->sds, cpu) = NULL;
 }
 
 #ifdef CONFIG_SCHED_SMT
@@ -7400,10 +7471,15 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 		if (!sdd->sgp)
 			return -ENOMEM;
 
+		sdd->sds = alloc_percpu(struct sched_domain_shared *);
+		if (!sdd->sds)
+			return -ENOMEM;
+
 		for_each_cpu(j, cpu_map) {
 			struct sched_domain *sd;
 			struct sched_group *sg;
 			struct sched_group_power *sgp;
+			struct sched_domain_shared *sds;
 
 		       	sd = kzalloc_node(sizeof(struct sched_domain) + cpumask_size(),
 					GFP_KERNEL, cpu_to_node(j));
@@ -7425,6 +7501,13 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 				return -ENOMEM;
 
 			*per_cpu_ptr(sdd->sgp, j) = sgp;
+
+			sds = kzalloc_node(sizeof(struct sched_domain_shared) +
+					cpumask_size(), GFP_KERNEL, cpu_to_node(j));
+			if (!sds)
+				return -ENOMEM;
+
+			*per_cpu_ptr(sdd->sds, j) = sds;
 		}
 	}
 
@@ -7445,10 +7528,12 @@ static void __sdt_free(const struct cpumask *cpu_map)
 				free_sched_groups(sd->groups, 0);
 			kfree(*per_cpu_ptr(sdd->sg, j));
 			kfree(*per_cpu_ptr(sdd->sgp, j));
+			kfree(*per_cpu_ptr(sdd->sds, j));
 		}
 		free_percpu(sdd->sd);
 		free_percpu(sdd->sg);
 		free_percpu(sdd->sgp);
+		free_percpu(sdd->sds);
 	}
 }
 
@@ -7463,6 +7548,12 @@ struct sched_domain *build_sched_domain(struct sched_domain_topology_level *tl,
 
 	set_domain_attribute(sd, attr);
 	cpumask_and(sched_domain_span(sd), cpu_map, tl->mask(cpu));
+	if (sd->flags & SD_SHARE_PKG_RESOURCES) {
+		int first = cpumask_first(sched_domain_span(sd));
+
+		sd->shared = *per_cpu_ptr(tl->data.sds, first);
+		atomic_inc(&sd->shared->ref);
+	}
 	if (child) {
 		sd->level = child->level + 1;
 		sched_domain_level_max = max(sched_domain_level_max, sd->level);
@@ -7994,6 +8085,7 @@ static void init_tg_cfs_entry(struct task_group *tg, struct cfs_rq *cfs_rq,
 	se->my_q = cfs_rq;
 	update_load_set(&se->load, 0);
 	se->parent = parent;
+	init_entity_runnable_average(se);
 }
 #endif
 
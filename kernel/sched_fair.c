@@ -648,6 +648,301 @@ update_stats_curr_start(struct cfs_rq *cfs_rq, struct sched_entity *se)
  * Scheduling class queueing methods:
  */
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity load tracking.
+ *
+ * Each entity's runnable time is accounted in ~1ms (1024us) periods,
+ * with the contribution of each past period decayed geometrically by
+ * y per period, where y^32 = 1/2: a period 32ms ago counts half as
+ * much as the current one.  An entity's load_avg_contrib is its weight
+ * scaled by the fraction of the (decayed) time it has been runnable,
+ * and cfs_rq->runnable_load_avg sums those of the queued entities.
+ * Group entities are accounted like any other entity, with their
+ * weight being the group's share on this cpu, so the averages
+ * aggregate up the task-group hierarchy to the root cfs_rq.
+ */
+#define LOAD_AVG_PERIOD 32
+#define LOAD_AVG_MAX 47742 /* maximum possible load avg */
+#define LOAD_AVG_MAX_N 345 /* number of full periods to produce LOAD_MAX_AVG */
+
+/* Precomputed fixed inverse multiplies for multiplication by y^n */
+static const u32 runnable_avg_yN_inv[] = {
+	0xffffffff, 0xfa83b2da, 0xf5257d14, 0xefe4b99a, 0xeac0c6e6, 0xe5b906e6,
+	0xe0ccdeeb, 0xdbfbb796, 0xd744fcc9, 0xd2a81d91, 0xce248c14, 0xc9b9bd85,
+	0xc5672a10, 0xc12c4cc9, 0xbd08a39e, 0xb8fbaf46, 0xb504f333, 0xb123f581,
+	0xad583ee9, 0xa9a15ab4, 0xa5fed6a9, 0xa2704302, 0x9ef5325f, 0x9b8d39b9,
+	0x9837f050, 0x94f4efa8, 0x91c3d373, 0x8ea4398a, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/*
+ * Precomputed \Sum y^k { 1<=k<=n }.  These are floor(true_value) to prevent
+ * over-estimates when re-combining.
+ */
+static const u32 runnable_avg_yN_sum[] = {
+	    0, 1002, 1982, 2941, 3880, 4798, 5697, 6576, 7437, 8279, 9103,
+	 9909,10698,11470,12226,12966,13690,14398,15091,15769,16433,17082,
+	17718,18340,18949,19545,20128,20698,21256,21802,22336,22859,23371,
+};
+
+/*
+ * Approximate:
+ *   val * y^n,    where y^32 ~= 0.5 (~1 scheduling period)
+ */
+static __always_inline u64 decay_load(u64 val, u64 n)
+{
+	unsigned int local_n;
+
+	if (!n)
+		return val;
+	else if (unlikely(n > LOAD_AVG_PERIOD * 63))
+		return 0;
+
+	/* after bounds checking we can collapse to 32-bit */
+	local_n = n;
+
+	/*
+	 * As y^PERIOD = 1/2, we can combine
+	 *    y^n = 1/2^(n/PERIOD) * y^(n%PERIOD)
+	 * With a look-up table which covers y^n (n<PERIOD)
+	 *
+	 * To achieve constant time decay_load.
+	 */
+	if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+		val >>= local_n / LOAD_AVG_PERIOD;
+		local_n %= LOAD_AVG_PERIOD;
+	}
+
+	val *= runnable_avg_yN_inv[local_n];
+	/* We don't use SRR here since we always want to round down. */
+	return val >> 32;
+}
+
+/*
+ * For updates fully spanning n periods, the contribution to runnable
+ * average will be: \Sum 1024*y^n
+ *
+ * We can compute this reasonably efficiently by combining:
+ *   y^PERIOD = 1/2 with precomputed \Sum 1024*y^n {for  n <PERIOD}
+ */
+static u32 __compute_runnable_contrib(u64 n)
+{
+	u32 contrib = 0;
+
+	if (likely(n <= LOAD_AVG_PERIOD))
+		return runnable_avg_yN_sum[n];
+	else if (unlikely(n >= LOAD_AVG_MAX_N))
+		return LOAD_AVG_MAX;
+
+	/* Compute \Sum k^n combining precomputed values for k^i, \Sum k^j */
+	do {
+		contrib /= 2; /* y^LOAD_AVG_PERIOD = 1/2 */
+		contrib += runnable_avg_yN_sum[LOAD_AVG_PERIOD];
+
+		n -= LOAD_AVG_PERIOD;
+	} while (n > LOAD_AVG_PERIOD);
+
+	contrib = decay_load(contrib, n);
+	return contrib + runnable_avg_yN_sum[n];
+}
+
+/*
+ * Fold the time since the last update into the entity's runnable
+ * average.  Time is accounted in units of 1024ns (~1us); each time
+ * a 1024us period boundary is crossed, the accumulated sums are
+ * decayed by y for every elapsed period and the fully elapsed
+ * periods are added in with their decayed contributions.
+ *
+ * Returns true if a period boundary was crossed, i.e. the average
+ * changed enough to be worth propagating.
+ */
+static __always_inline int __update_entity_runnable_avg(u64 now,
+							struct sched_avg *sa,
+							int runnable)
+{
+	u64 delta, periods;
+	u32 runnable_contrib;
+	int delta_w, decayed = 0;
+
+	delta = now - sa->last_runnable_update;
+	/*
+	 * This should only happen when time goes backwards, which it
+	 * unfortunately does during sched clock init when we swap over
+	 * to TSC, or when comparing clocks of different cpus.
+	 */
+	if ((s64)delta < 0) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	/*
+	 * Use 1024ns as the unit of measurement since it's a reasonable
+	 * approximation of 1us and fast to compute.
+	 */
+	delta >>= 10;
+	if (!delta)
+		return 0;
+	sa->last_runnable_update = now;
+
+	/* delta_w is the amount already accumulated against our next period */
+	delta_w = sa->runnable_avg_period % 1024;
+	if (delta + delta_w >= 1024) {
+		/* period roll-over */
+		decayed = 1;
+
+		/*
+		 * Now that we know we're crossing a period boundary, figure
+		 * out how much from delta we need to complete the current
+		 * period and accrue it.
+		 */
+		delta_w = 1024 - delta_w;
+		if (runnable)
+			sa->runnable_avg_sum += delta_w;
+		sa->runnable_avg_period += delta_w;
+
+		delta -= delta_w;
+
+		/* Figure out how many additional periods this update spans */
+		periods = delta / 1024;
+		delta %= 1024;
+
+		sa->runnable_avg_sum = decay_load(sa->runnable_avg_sum,
+						  periods + 1);
+		sa->runnable_avg_period = decay_load(sa->runnable_avg_period,
+						     periods + 1);
+
+		/* Efficiently calculate \sum (1..n_period) 1024*y^i */
+		runnable_contrib = __compute_runnable_contrib(periods);
+		if (runnable)
+			sa->runnable_avg_sum += runnable_contrib;
+		sa->runnable_avg_period += runnable_contrib;
+	}
+
+	/* Remainder of delta accrued against u_0` */
+	if (runnable)
+		sa->runnable_avg_sum += delta;
+	sa->runnable_avg_period += delta;
+
+	return decayed;
+}
+
+/*
+ * Recompute the entity's load contribution from its runnable average
+ * and current weight, returning the change.
+ */
+static long __update_entity_load_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.load_avg_contrib;
+	u64 contrib;
+
+	contrib = (u64)se->avg.runnable_avg_sum * se->load.weight;
+	contrib = div_u64(contrib, se->avg.runnable_avg_period + 1);
+	se->avg.load_avg_contrib = contrib;
+
+	return se->avg.load_avg_contrib - old_contrib;
+}
+
+/* Update an entity's runnable average and its cfs_rq's sum if queued. */
+static void update_entity_load_avg(struct sched_entity *se)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	u64 now = rq_of(cfs_rq)->clock_task;
+	long contrib_delta;
+
+	if (!__update_entity_runnable_avg(now, &se->avg, se->on_rq))
+		return;
+
+	contrib_delta = __update_entity_load_avg_contrib(se);
+	if (se->on_rq)
+		cfs_rq->runnable_load_avg += contrib_delta;
+}
+
+/*
+ * Add an entity's contribution to its cfs_rq on enqueue, first
+ * decaying its average over the time it spent blocked or migrating.
+ */
+static void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+				    struct sched_entity *se)
+{
+	u64 now = rq_of(cfs_rq)->clock_task;
+
+	/* A new entity has no history to decay, start its clock now. */
+	if (unlikely(!se->avg.last_runnable_update))
+		se->avg.last_runnable_update = now;
+
+	__update_entity_runnable_avg(now, &se->avg, 0);
+	__update_entity_load_avg_contrib(se);
+	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
+}
+
+/*
+ * Remove an entity's contribution from its cfs_rq on dequeue, after
+ * accruing the time it was runnable up to now.
+ */
+static void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+				    struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	cfs_rq->runnable_load_avg -= min(cfs_rq->runnable_load_avg,
+					 se->avg.load_avg_contrib);
+}
+
+/*
+ * Initialize a new entity as if it had been runnable for one full
+ * period, so that fresh tasks are not invisible to the load balancer
+ * until they have built up some history.
+ */
+static void init_entity_runnable_average(struct sched_entity *se)
+{
+	se->avg.last_runnable_update = 0;
+	se->avg.runnable_avg_sum = 1024;
+	se->avg.runnable_avg_period = 1024;
+	se->avg.load_avg_contrib = 0;
+}
+
+/*
+ * The load an entity or cfs_rq represents to the load balancer: the
+ * runnable averages with LB_RUNNABLE_AVG, the raw weights otherwise.
+ */
+static inline unsigned long se_balance_load(struct sched_entity *se)
+{
+	if (sched_feat(LB_RUNNABLE_AVG))
+		return se->avg.load_avg_contrib;
+	return se->load.weight;
+}
+
+static inline unsigned long cfs_rq_balance_load(struct cfs_rq *cfs_rq)
+{
+	if (sched_feat(LB_RUNNABLE_AVG))
+		return cfs_rq->runnable_load_avg;
+	return cfs_rq->load.weight;
+}
+
+static inline unsigned long task_balance_load(struct task_struct *p)
+{
+	return se_balance_load(&p->se);
+}
+#else /* CONFIG_SMP */
+static inline void update_entity_load_avg(struct sched_entity *se)
+{
+}
+
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se)
+{
+}
+
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se)
+{
+}
+
+static inline void init_entity_runnable_average(struct sched_entity *se)
+{
+}
+#endif /* CONFIG_SMP */
+
 #if defined CONFIG_SMP && defined CONFIG_FAIR_GROUP_SCHED
 static void
 add_cfs_task_weight(struct cfs_rq *cfs_rq, unsigned long weight)
@@ -803,12 +1098,15 @@ static void reweight_entity(struct cfs_rq *cfs_rq, struct sched_entity *se,
 		if (cfs_rq->curr == se)
 			update_curr(cfs_rq);
 		account_entity_dequeue(cfs_rq, se);
+		dequeue_entity_load_avg(cfs_rq, se);
 	}
 
 	update_load_set(&se->load, weight);
 
-	if (se->on_rq)
+	if (se->on_rq) {
 		account_entity_enqueue(cfs_rq, se);
+		enqueue_entity_load_avg(cfs_rq, se);
+	}
 }
 
 static void update_cfs_shares(struct cfs_rq *cfs_rq)
@@ -965,6 +1263,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	 */
 	update_curr(cfs_rq);
 	update_cfs_load(cfs_rq, 0);
+	enqueue_entity_load_avg(cfs_rq, se);
 	account_entity_enqueue(cfs_rq, se);
 	update_cfs_shares(cfs_rq);
 
@@ -1035,6 +1334,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	dequeue_entity_load_avg(cfs_rq, se);
 
 	update_stats_dequeue(cfs_rq, se);
 	if (flags & DEQUEUE_SLEEP) {
@@ -1196,6 +1496,7 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 
 	check_spread(cfs_rq, prev);
 	if (prev->on_rq) {
+		update_entity_load_avg(prev);
 		update_stats_wait_start(cfs_rq, prev);
 		/* Put 'current' back into the tree. */
 		__enqueue_entity(cfs_rq, prev);
@@ -1211,6 +1512,11 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 	 */
 	update_curr(cfs_rq);
 
+	/*
+	 * Ensure that runnable average is periodically updated.
+	 */
+	update_entity_load_avg(curr);
+
 	/*
 	 * Update share accounting for long-running entities.
 	 */
@@ -1467,14 +1773,14 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	 */
 	if (sync) {
 		tg = task_group(current);
-		weight = current->se.load.weight;
+		weight = task_balance_load(current);
 
 		this_load += effective_load(tg, this_cpu, -weight, -weight);
 		load += effective_load(tg, prev_cpu, 0, -weight);
 	}
 
 	tg = task_group(p);
-	weight = p->se.load.weight;
+	weight = task_balance_load(p);
 
 	/*
 	 * In low-load situations, where prev_cpu is idle and this_cpu is idle
@@ -1605,6 +1911,51 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return idlest;
 }
 
+/*
+ * Search the idle mask of the cache-sharing domain of 'target' for a cpu
+ * 'p' may run on: a fully idle core first, while the domain believes it
+ * has one, then any idle cpu. Bits are only hints so every candidate is
+ * confirmed with idle_cpu(). Returns -1 if nothing was found.
+ */
+static int select_idle_cpumask(struct task_struct *p, struct sched_domain *sd)
+{
+	struct sched_domain_shared *sds = sd->shared;
+	struct cpumask *idle_cpus = sds_idle_cpus(sds);
+	int i, scanned = 0;
+
+	schedstat_inc(sd, sis_attempts);
+
+#ifdef CONFIG_SCHED_SMT
+	if (sds->has_idle_cores) {
+		for_each_cpu_and(i, idle_cpus, &p->cpus_allowed) {
+			scanned++;
+			if (!cpumask_subset(topology_thread_cpumask(i), idle_cpus))
+				continue;
+			if (idle_cpu(i)) {
+				schedstat_inc(sd, sis_idle_core);
+				goto found;
+			}
+		}
+		/* Stale hint, it will be set again by the next idle core. */
+		sds->has_idle_cores = 0;
+	}
+#endif
+
+	for_each_cpu_and(i, idle_cpus, &p->cpus_allowed) {
+		scanned++;
+		if (idle_cpu(i)) {
+			schedstat_inc(sd, sis_idle_cpu);
+			goto found;
+		}
+	}
+
+	schedstat_inc(sd, sis_failed);
+	i = -1;
+found:
+	schedstat_add(sd, sis_scanned, scanned);
+	return i;
+}
+
 /*
  * Try and locate an idle CPU in the sched_domain.
  */
@@ -1629,10 +1980,20 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	if (target == prev_cpu && idle_cpu(prev_cpu))
 		return prev_cpu;
 
+	rcu_read_lock();
+	if (sched_feat(IDLE_CPUMASK)) {
+		sd = rcu_dereference(per_cpu(sd_llc, target));
+		if (sd) {
+			i = select_idle_cpumask(p, sd);
+			if (i >= 0)
+				target = i;
+		}
+		goto unlock;
+	}
+
 	/*
 	 * Otherwise, iterate the domains and find an elegible idle cpu.
 	 */
-	rcu_read_lock();
 	for_each_domain(target, sd) {
 		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
 			break;
@@ -1652,6 +2013,7 @@ static int select_idle_sibling(struct task_struct *p, int target)
 		    cpumask_test_cpu(prev_cpu, sched_domain_span(sd)))
 			break;
 	}
+unlock:
 	rcu_read_unlock();
 
 	return target;
@@ -2138,14 +2500,14 @@ balance_tasks(struct rq *this_rq, int this_cpu, struct rq *busiest,
 		if (loops++ > sysctl_sched_nr_migrate)
 			break;
 
-		if ((p->se.load.weight >> 1) > rem_load_move ||
+		if ((task_balance_load(p) >> 1) > rem_load_move ||
 		    !can_migrate_task(p, busiest, this_cpu, sd, idle,
 				      all_pinned))
 			continue;
 
 		pull_task(busiest, p, this_rq, this_cpu);
 		pulled++;
-		rem_load_move -= p->se.load.weight;
+		rem_load_move -= task_balance_load(p);
 
 #ifdef CONFIG_PREEMPT
 		/*
@@ -2233,11 +2595,11 @@ static int tg_load_down(struct task_group *tg, void *data)
 	long cpu = (long)data;
 
 	if (!tg->parent) {
-		load = cpu_rq(cpu)->load.weight;
+		load = weighted_cpuload(cpu);
 	} else {
 		load = tg->parent->cfs_rq[cpu]->h_load;
-		load *= tg->se[cpu]->load.weight;
-		load /= tg->parent->cfs_rq[cpu]->load.weight + 1;
+		load *= se_balance_load(tg->se[cpu]);
+		load /= cfs_rq_balance_load(tg->parent->cfs_rq[cpu]) + 1;
 	}
 
 	tg->cfs_rq[cpu]->h_load = load;
@@ -2264,7 +2626,7 @@ load_balance_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 
 	for_each_leaf_cfs_rq(busiest, busiest_cfs_rq) {
 		unsigned long busiest_h_load = busiest_cfs_rq->h_load;
-		unsigned long busiest_weight = busiest_cfs_rq->load.weight;
+		unsigned long busiest_weight = cfs_rq_balance_load(busiest_cfs_rq);
 		u64 rem_load, moved_load;
 
 		/*
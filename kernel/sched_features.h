@@ -53,6 +53,12 @@ SCHED_FEAT(HRTICK, 0)
 SCHED_FEAT(DOUBLE_TICK, 0)
 SCHED_FEAT(LB_BIAS, 1)
 
+/*
+ * Balance on the per-entity runnable load averages rather than on the
+ * instantaneous weight of the runnable tasks.
+ */
+SCHED_FEAT(LB_RUNNABLE_AVG, 1)
+
 /*
  * Spin-wait on mutex acquisition when the mutex owner is running on
  * another cpu -- assumes that when the owner is running, it will soon
@@ -72,3 +78,9 @@ SCHED_FEAT(NONTASK_POWER, 1)
 SCHED_FEAT(TTWU_QUEUE, 1)
 
 SCHED_FEAT(FORCE_SD_OVERLAP, 0)
+
+/*
+ * Find idle siblings for waking tasks from the idle mask maintained
+ * in the cache-sharing domain instead of scanning its runqueues.
+ */
+SCHED_FEAT(IDLE_CPUMASK, 1)
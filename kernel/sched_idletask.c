@@ -20,10 +20,54 @@ static void check_preempt_curr_idle(struct rq *rq, struct task_struct *p, int fl
 	resched_task(rq->idle);
 }
 
+#ifdef CONFIG_SMP
+/*
+ * Publish this cpu's idle state in the idle mask of its cache-sharing
+ * domain, so that select_idle_sibling() can find idle cpus without
+ * scanning every runqueue. Only touch the shared line when the bit
+ * actually changes.
+ */
+static void update_idle_cpumask(struct rq *rq, int idle)
+{
+	struct sched_domain *sd;
+	struct sched_domain_shared *sds;
+	struct cpumask *idle_cpus;
+	int cpu = cpu_of(rq);
+
+	rcu_read_lock();
+	sd = rcu_dereference(per_cpu(sd_llc, cpu));
+	if (!sd)
+		goto unlock;
+
+	sds = sd->shared;
+	idle_cpus = sds_idle_cpus(sds);
+	if (!idle) {
+		if (cpumask_test_cpu(cpu, idle_cpus))
+			cpumask_clear_cpu(cpu, idle_cpus);
+		goto unlock;
+	}
+
+	if (!cpumask_test_cpu(cpu, idle_cpus))
+		cpumask_set_cpu(cpu, idle_cpus);
+#ifdef CONFIG_SCHED_SMT
+	if (!sds->has_idle_cores &&
+	    cpumask_subset(topology_thread_cpumask(cpu), idle_cpus))
+		sds->has_idle_cores = 1;
+#endif
+unlock:
+	rcu_read_unlock();
+}
+#else
+static inline void update_idle_cpumask(struct rq *rq, int idle)
+{
+}
+#endif /* CONFIG_SMP */
+
 static struct task_struct *pick_next_task_idle(struct rq *rq)
 {
 	schedstat_inc(rq, sched_goidle);
 	calc_load_account_idle(rq);
+	update_idle_cpumask(rq, 1);
 	return rq->idle;
 }
 
@@ -42,6 +86,7 @@ dequeue_task_idle(struct rq *rq, struct task_struct *p, int flags)
 
 static void put_prev_task_idle(struct rq *rq, struct task_struct *prev)
 {
+	update_idle_cpumask(rq, 0);
 }
 
 static void task_tick_idle(struct rq *rq, struct task_struct *curr, int queued)
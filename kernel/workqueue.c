@@ -17,8 +17,8 @@
  * This is the generic async execution mechanism.  Work items as are
  * executed in process context.  The worker pool is shared and
  * automatically managed.  There is one worker pool for each CPU and
- * one extra for works which are better served by workers which are
- * not bound to any specific CPU.
+ * one for each NUMA node with memory for works which are better served
+ * by workers which are not bound to any specific CPU.
  *
  * Please read Documentation/workqueue.txt for details.
  */
@@ -41,6 +41,8 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/device.h>
+#include <linux/nodemask.h>
 
 #include "workqueue_sched.h"
 
@@ -112,6 +114,8 @@ enum {
  * F: wq->flush_mutex protected.
  *
  * W: workqueue_lock protected.
+ *
+ * A: wq_attrs_mutex protected.
  */
 
 struct global_cwq;
@@ -137,17 +141,20 @@ struct worker {
 	unsigned int		flags;		/* X: flags */
 	int			id;		/* I: worker id */
 	struct work_struct	rebind_work;	/* L: rebind worker to cpu */
+	unsigned int		attrs_gen;	/* unbound: wq attrs in effect */
 };
 
 /*
  * Global per-cpu workqueue.  There's one and only one for each cpu
  * and all works are queued and processed here regardless of their
- * target workqueues.
+ * target workqueues.  Works of unbound workqueues go to the one of
+ * the NUMA node they are queued from instead.
  */
 struct global_cwq {
 	spinlock_t		lock;		/* the gcwq lock */
 	struct list_head	worklist;	/* L: list of pending works */
-	unsigned int		cpu;		/* I: the associated cpu */
+	unsigned int		cpu;		/* I: the associated cpu or
+						   WORK_CPU_UNBOUND + node */
 	unsigned int		flags;		/* L: GCWQ_* flags */
 
 	int			nr_workers;	/* L: total number of workers */
@@ -216,15 +223,18 @@ typedef unsigned long mayday_mask_t;
 #define free_mayday_mask(mask)			do { } while (0)
 #endif
 
+struct wq_device;
+
 /*
  * The externally visible workqueue abstraction is an array of
- * per-CPU workqueues:
+ * per-CPU workqueues, or of per-node ones for unbound workqueues:
  */
 struct workqueue_struct {
 	unsigned int		flags;		/* W: WQ_* flags */
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
 		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct		**node;
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
 	struct list_head	list;		/* W: list of all workqueues */
@@ -238,11 +248,22 @@ struct workqueue_struct {
 	struct list_head	flusher_overflow; /* F: flush overflow list */
 
 	mayday_mask_t		mayday_mask;	/* cpus requesting rescue */
+	nodemask_t		mayday_nodes;	/* unbound: nodes requesting
+						   rescue */
 	struct worker		*rescuer;	/* I: rescue worker */
 
 	int			nr_drainers;	/* W: drain in progress */
 	int			saved_max_active; /* W: saved cwq max_active */
+
+	/* attributes of the unbound workers executing the works */
+	int			nice;		/* A: nice level */
+	cpumask_var_t		cpumask;	/* A: allowed cpus */
+	unsigned int		attrs_gen;	/* A: generation of the above */
+
 	const char		*name;		/* I: workqueue name */
+#ifdef CONFIG_SYSFS
+	struct wq_device	*wq_dev;	/* I: for sysfs interface */
+#endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -259,9 +280,30 @@ EXPORT_SYMBOL_GPL(system_nrt_wq);
 EXPORT_SYMBOL_GPL(system_unbound_wq);
 EXPORT_SYMBOL_GPL(system_freezable_wq);
 
+#ifdef CONFIG_SYSFS
+static int workqueue_sysfs_register(struct workqueue_struct *wq);
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq);
+#else
+static inline int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	return 0;
+}
+static inline void workqueue_sysfs_unregister(struct workqueue_struct *wq)
+{
+}
+#endif
+
 #define CREATE_TRACE_POINTS
 #include <trace/events/workqueue.h>
 
+/*
+ * Nodes which have an unbound gcwq: those with memory at boot.  Works
+ * queued from any other node, offline or without memory, go to the
+ * gcwq of the nearest of them given by unbound_gcwq_node[].
+ */
+static nodemask_t unbound_gcwq_nodes __read_mostly;
+static int unbound_gcwq_node[MAX_NUMNODES] __read_mostly;
+
 #define for_each_busy_worker(worker, i, pos, gcwq)			\
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
@@ -269,6 +311,8 @@ EXPORT_SYMBOL_GPL(system_freezable_wq);
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
@@ -276,7 +320,11 @@ static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				return cpu;
 		}
 		if (sw & 2)
-			return WORK_CPU_UNBOUND;
+			return WORK_CPU_UNBOUND + first_node(unbound_gcwq_nodes);
+	} else if (cpu < WORK_CPU_NONE) {
+		node = next_node(cpu - WORK_CPU_UNBOUND, unbound_gcwq_nodes);
+		if (node < MAX_NUMNODES)
+			return WORK_CPU_UNBOUND + node;
 	}
 	return WORK_CPU_NONE;
 }
@@ -290,15 +338,15 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * Extra gcwqs are defined for invalid cpu numbers (WORK_CPU_UNBOUND +
+ * node, for each node in unbound_gcwq_nodes) to host workqueues which
+ * are not bound to any specific CPU.  The following iterators are similar to
+ * for_each_*_cpu() iterators but also considers the unbound gcwqs.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound gcwqs
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound gcwqs
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  unbound gcwqs for unbound workqueues
  */
 #define for_each_gcwq_cpu(cpu)						\
 	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
@@ -445,26 +493,42 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global node workqueues and nr_running counter for unbound gcwqs,
+ * allocated on their node for each node in unbound_gcwq_nodes.  The gcwqs are
+ * always online, have GCWQ_DISASSOCIATED set, and all their workers
+ * have WORKER_UNBOUND set.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq *unbound_global_cwq[MAX_NUMNODES];
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
+/*
+ * Unbound workers are shared by all unbound workqueues and adopt the
+ * attributes of the workqueue whose work they execute.  Updates to
+ * those attributes are serialized by wq_attrs_mutex, which also
+ * protects the scratch cpumask used to apply them.
+ */
+static DEFINE_MUTEX(wq_attrs_mutex);
+static unsigned int wq_attrs_gen;		/* A: last generation used */
+static cpumask_var_t wq_attrs_cpumask;		/* A: scratch */
+
 static int worker_thread(void *__worker);
 
+static inline bool gcwq_cpu_is_unbound(unsigned int cpu)
+{
+	return cpu >= WORK_CPU_UNBOUND;
+}
+
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!gcwq_cpu_is_unbound(cpu))
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return unbound_global_cwq[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!gcwq_cpu_is_unbound(cpu))
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
@@ -481,11 +545,33 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 			return wq->cpu_wq.single;
 #endif
 		}
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(gcwq_cpu_is_unbound(cpu)))
+		return wq->cpu_wq.node[cpu - WORK_CPU_UNBOUND];
 	return NULL;
 }
 
+/*
+ * Return the unbound gcwq serving works of @wq queued on @cpu: the one
+ * of the node of @cpu, or of the local node for WORK_CPU_UNBOUND.
+ * Ordered workqueues always use the same one so that their works are
+ * still executed one by one in queueing order.
+ */
+static unsigned int unbound_gcwq_cpu(struct workqueue_struct *wq,
+				     unsigned int cpu)
+{
+	int node = NUMA_NO_NODE;
+
+	if (wq->flags & WQ_ORDERED)
+		return WORK_CPU_UNBOUND + first_node(unbound_gcwq_nodes);
+	else if (cpu < nr_cpu_ids)
+		node = cpu_to_node(cpu);
+
+	if (node == NUMA_NO_NODE)
+		node = numa_node_id();
+
+	return WORK_CPU_UNBOUND + unbound_gcwq_node[node];
+}
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
@@ -564,7 +650,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && !gcwq_cpu_is_unbound(cpu));
 	return get_gcwq(cpu);
 }
 
@@ -982,7 +1068,7 @@ static bool is_chained_work(struct workqueue_struct *wq)
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
@@ -997,39 +1083,36 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	/* determine gcwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
-
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
 		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	} else
+		gcwq = get_gcwq(unbound_gcwq_cpu(wq, cpu));
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+	/*
+	 * It's multi cpu or multi node.  If @wq is non-reentrant and
+	 * @work was previously on a different gcwq, it might still be
+	 * running there, in which case the work needs to be queued on
+	 * that gcwq to guarantee non-reentrance.  Unbound workqueues
+	 * have always been non-reentrant and stay so across nodes.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		spin_lock_irqsave(&last_gcwq->lock, flags);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
+		worker = find_worker_executing_work(last_gcwq, work);
+
+		if (worker && worker->current_cwq->wq == wq)
+			gcwq = last_gcwq;
+		else {
+			/* meh... not running there, queue here */
+			spin_unlock_irqrestore(&last_gcwq->lock, flags);
 			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		}
+	} else
 		spin_lock_irqsave(&gcwq->lock, flags);
-	}
 
 	/* gcwq determined, get cwq and queue */
 	cwq = get_cwq(gcwq->cpu, wq);
@@ -1142,6 +1225,7 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
+		struct global_cwq *gcwq;
 		unsigned int lcpu;
 
 		BUG_ON(timer_pending(timer));
@@ -1151,18 +1235,17 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 
 		/*
 		 * This stores cwq for the moment, for the timer_fn.
-		 * Note that the work's gcwq is preserved to allow
-		 * reentrance detection for delayed works.
+		 * Note that the work's gcwq is preserved, if @wq has a
+		 * cwq for it, to allow reentrance detection for delayed
+		 * works.
 		 */
-		if (!(wq->flags & WQ_UNBOUND)) {
-			struct global_cwq *gcwq = get_work_gcwq(work);
-
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
-				lcpu = gcwq->cpu;
-			else
-				lcpu = raw_smp_processor_id();
-		} else
-			lcpu = WORK_CPU_UNBOUND;
+		gcwq = get_work_gcwq(work);
+		if (gcwq && get_cwq(gcwq->cpu, wq))
+			lcpu = gcwq->cpu;
+		else if (!(wq->flags & WQ_UNBOUND))
+			lcpu = raw_smp_processor_id();
+		else
+			lcpu = unbound_gcwq_cpu(wq, WORK_CPU_UNBOUND);
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
 
@@ -1352,7 +1435,7 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = gcwq_cpu_is_unbound(gcwq->cpu);
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1377,9 +1460,20 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 						      worker,
 						      cpu_to_node(gcwq->cpu),
 						      "kworker/%u:%d", gcwq->cpu, id);
-	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+	else {
+		int node = gcwq->cpu - WORK_CPU_UNBOUND;
+
+		worker->task = kthread_create_on_node(worker_thread, worker,
+						      node, "kworker/u%d:%d",
+						      node, id);
+		/*
+		 * Stay on the node by default.  This fails harmlessly
+		 * if the node has no cpu online.
+		 */
+		if (!IS_ERR(worker->task))
+			set_cpus_allowed_ptr(worker->task,
+					     cpumask_of_node(node));
+	}
 	if (IS_ERR(worker->task))
 		goto fail;
 
@@ -1496,10 +1590,12 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
-		cpu = 0;
-	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
+	/* unbound gcwqs can't be set in cpumask, use their node instead */
+	if (gcwq_cpu_is_unbound(cpu)) {
+		if (!node_test_and_set(cpu - WORK_CPU_UNBOUND,
+				       wq->mayday_nodes))
+			wake_up_process(wq->rescuer->task);
+	} else if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
 	return true;
 }
@@ -1780,6 +1876,39 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 		complete(&cwq->wq->first_flusher->done);
 }
 
+/**
+ * worker_apply_wq_attrs - make an unbound worker adopt @wq's attributes
+ * @worker: self
+ * @wq: workqueue of the work about to be executed
+ *
+ * Unbound workers serve all unbound workqueues.  Set the nice level
+ * of @worker to the one of @wq and restrict it to the cpus allowed by
+ * @wq, on its gcwq's node if any of them is there.
+ *
+ * CONTEXT:
+ * Might sleep.
+ */
+static void worker_apply_wq_attrs(struct worker *worker,
+				  struct workqueue_struct *wq)
+{
+	int node = worker->gcwq->cpu - WORK_CPU_UNBOUND;
+	struct cpumask *mask = wq_attrs_cpumask;
+
+	mutex_lock(&wq_attrs_mutex);
+
+	cpumask_and(mask, wq->cpumask, cpumask_of_node(node));
+	if (!cpumask_intersects(mask, cpu_online_mask))
+		cpumask_copy(mask, wq->cpumask);
+	if (!cpumask_intersects(mask, cpu_online_mask))
+		cpumask_copy(mask, cpu_possible_mask);
+
+	set_cpus_allowed_ptr(worker->task, mask);
+	set_user_nice(worker->task, wq->nice);
+	worker->attrs_gen = wq->attrs_gen;
+
+	mutex_unlock(&wq_attrs_mutex);
+}
+
 /**
  * process_one_work - process single work
  * @worker: self
@@ -1862,6 +1991,10 @@ __acquires(&gcwq->lock)
 
 	spin_unlock_irq(&gcwq->lock);
 
+	if ((worker->flags & WORKER_UNBOUND) &&
+	    unlikely(worker->attrs_gen != ACCESS_ONCE(cwq->wq->attrs_gen)))
+		worker_apply_wq_attrs(worker, cwq->wq);
+
 	work_clear_pending(work);
 	lock_map_acquire_read(&cwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
@@ -2024,13 +2157,47 @@ sleep:
  *
  * This should happen rarely.
  */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	__set_current_state(TASK_RUNNING);
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
-	bool is_unbound = wq->flags & WQ_UNBOUND;
 	unsigned int cpu;
+	int node;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2040,42 +2207,17 @@ repeat:
 		return 0;
 
 	/*
-	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * See whether any cpu is asking for help.  Unbound workqueues
+	 * use mayday_nodes for their per-node gcwqs instead.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
-		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
+		rescue_cwq(rescuer, get_cwq(cpu, wq));
+	}
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+	for_each_node_mask(node, wq->mayday_nodes) {
+		node_clear(node, wq->mayday_nodes);
+		rescue_cwq(rescuer, get_cwq(WORK_CPU_UNBOUND + node, wq));
 	}
 
 	schedule();
@@ -2882,41 +3024,71 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
-static int alloc_cwqs(struct workqueue_struct *wq)
+/*
+ * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.  Make
+ * sure that the alignment isn't lower than that of unsigned long long.
+ */
+#define CWQ_ALIGN	max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,	\
+			      __alignof__(unsigned long long))
+
+static struct cpu_workqueue_struct *alloc_single_cwq(int node)
 {
+	const size_t size = sizeof(struct cpu_workqueue_struct);
+	struct cpu_workqueue_struct *cwq;
+	void *ptr;
+
 	/*
-	 * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.
-	 * Make sure that the alignment isn't lower than that of
-	 * unsigned long long.
+	 * Allocate enough room to align cwq and put an extra pointer
+	 * at the end pointing back to the originally allocated pointer
+	 * which will be used for free.
 	 */
+	ptr = kzalloc_node(size + CWQ_ALIGN + sizeof(void *), GFP_KERNEL,
+			   node);
+	if (!ptr)
+		return NULL;
+
+	cwq = PTR_ALIGN(ptr, CWQ_ALIGN);
+	*(void **)(cwq + 1) = ptr;
+	return cwq;
+}
+
+static void free_single_cwq(struct cpu_workqueue_struct *cwq)
+{
+	/* the pointer to free is stored right after the cwq */
+	if (cwq)
+		kfree(*(void **)(cwq + 1));
+}
+
+static int alloc_cwqs(struct workqueue_struct *wq)
+{
 	const size_t size = sizeof(struct cpu_workqueue_struct);
-	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
-				   __alignof__(unsigned long long));
 #ifdef CONFIG_SMP
 	bool percpu = !(wq->flags & WQ_UNBOUND);
 #else
 	bool percpu = false;
 #endif
+	int node;
 
 	if (percpu)
-		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
-	else {
-		void *ptr;
-
-		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
-		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
-		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+		wq->cpu_wq.pcpu = __alloc_percpu(size, CWQ_ALIGN);
+	else if (wq->flags & WQ_UNBOUND) {
+		/* one cwq for each unbound gcwq, allocated on its node */
+		wq->cpu_wq.node = kzalloc(nr_node_ids * sizeof(void *),
+					  GFP_KERNEL);
+		if (!wq->cpu_wq.node)
+			return -ENOMEM;
+
+		for_each_node_mask(node, unbound_gcwq_nodes) {
+			wq->cpu_wq.node[node] = alloc_single_cwq(node);
+			if (!wq->cpu_wq.node[node])
+				return -ENOMEM;
 		}
-	}
+		return 0;
+	} else
+		wq->cpu_wq.single = alloc_single_cwq(NUMA_NO_NODE);
 
 	/* just in case, make sure it's actually aligned */
-	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
+	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, CWQ_ALIGN));
 	return wq->cpu_wq.v ? 0 : -ENOMEM;
 }
 
@@ -2927,13 +3099,18 @@ static void free_cwqs(struct workqueue_struct *wq)
 #else
 	bool percpu = false;
 #endif
+	int node;
 
 	if (percpu)
 		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
-	}
+	else if (wq->flags & WQ_UNBOUND) {
+		if (wq->cpu_wq.node) {
+			for_each_node_mask(node, unbound_gcwq_nodes)
+				free_single_cwq(wq->cpu_wq.node[node]);
+			kfree(wq->cpu_wq.node);
+		}
+	} else
+		free_single_cwq(wq->cpu_wq.single);
 }
 
 static int wq_clamp_max_active(int max_active, unsigned int flags,
@@ -2972,6 +3149,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	if (flags & WQ_UNBOUND)
 		flags |= WQ_HIGHPRI;
 
+	/*
+	 * Unbound workqueues with @max_active of one are ordered and
+	 * must not be spread over the per-node gcwqs.
+	 */
+	if (flags & WQ_UNBOUND && max_active == 1)
+		flags |= WQ_ORDERED;
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, name);
 
@@ -2979,6 +3163,16 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	if (!wq)
 		goto err;
 
+	if (flags & WQ_UNBOUND) {
+		if (!alloc_cpumask_var(&wq->cpumask, GFP_KERNEL))
+			goto err;
+		cpumask_copy(wq->cpumask, cpu_possible_mask);
+
+		mutex_lock(&wq_attrs_mutex);
+		wq->attrs_gen = ++wq_attrs_gen;
+		mutex_unlock(&wq_attrs_mutex);
+	}
+
 	wq->flags = flags;
 	wq->saved_max_active = max_active;
 	mutex_init(&wq->flush_mutex);
@@ -3038,12 +3232,18 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 
 	spin_unlock(&workqueue_lock);
 
+	if (flags & WQ_SYSFS && workqueue_sysfs_register(wq)) {
+		destroy_workqueue(wq);
+		return NULL;
+	}
+
 	return wq;
 err:
 	if (wq) {
 		free_cwqs(wq);
 		free_mayday_mask(wq->mayday_mask);
 		kfree(wq->rescuer);
+		free_cpumask_var(wq->cpumask);
 		kfree(wq);
 	}
 	return NULL;
@@ -3060,6 +3260,8 @@ void destroy_workqueue(struct workqueue_struct *wq)
 {
 	unsigned int cpu;
 
+	workqueue_sysfs_unregister(wq);
+
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
 
@@ -3089,6 +3291,7 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	}
 
 	free_cwqs(wq);
+	free_cpumask_var(wq->cpumask);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
@@ -3129,6 +3332,66 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 }
 EXPORT_SYMBOL_GPL(workqueue_set_max_active);
 
+/**
+ * workqueue_set_nice - set the nice level works of a workqueue run at
+ * @wq: target unbound workqueue
+ * @nice: new nice level
+ *
+ * Unbound workers switch to @nice before executing works of @wq.
+ *
+ * CONTEXT:
+ * Might sleep.
+ *
+ * RETURNS:
+ * 0 on success, -EINVAL if @wq isn't unbound or @nice is out of range.
+ */
+int workqueue_set_nice(struct workqueue_struct *wq, int nice)
+{
+	if (!(wq->flags & WQ_UNBOUND) || nice < -20 || nice > 19)
+		return -EINVAL;
+
+	mutex_lock(&wq_attrs_mutex);
+	wq->nice = nice;
+	wq->attrs_gen = ++wq_attrs_gen;
+	mutex_unlock(&wq_attrs_mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(workqueue_set_nice);
+
+/**
+ * workqueue_set_cpumask - set the cpus works of a workqueue may run on
+ * @wq: target unbound workqueue
+ * @cpumask: new allowed cpus
+ *
+ * Unbound workers restrict themselves to @cpumask, intersected with
+ * the cpus of their node if they have any in common, before executing
+ * works of @wq.  This can be used to keep unbound works away from
+ * latency critical cpus.
+ *
+ * CONTEXT:
+ * Might sleep.
+ *
+ * RETURNS:
+ * 0 on success, -EINVAL if @wq isn't unbound or @cpumask has no
+ * possible cpu.
+ */
+int workqueue_set_cpumask(struct workqueue_struct *wq,
+			  const struct cpumask *cpumask)
+{
+	if (!(wq->flags & WQ_UNBOUND) ||
+	    !cpumask_intersects(cpumask, cpu_possible_mask))
+		return -EINVAL;
+
+	mutex_lock(&wq_attrs_mutex);
+	cpumask_and(wq->cpumask, cpumask, cpu_possible_mask);
+	wq->attrs_gen = ++wq_attrs_gen;
+	mutex_unlock(&wq_attrs_mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(workqueue_set_cpumask);
+
 /**
  * workqueue_congested - test whether a workqueue is congested
  * @cpu: CPU in question
@@ -3143,7 +3406,11 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_UNBOUND)
+		cpu = unbound_gcwq_cpu(wq, cpu);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3154,13 +3421,16 @@ EXPORT_SYMBOL_GPL(workqueue_congested);
  * @work: the work of interest
  *
  * RETURNS:
- * CPU number if @work was ever queued.  WORK_CPU_NONE otherwise.
+ * CPU number if @work was ever queued, WORK_CPU_UNBOUND if it was on
+ * an unbound workqueue.  WORK_CPU_NONE otherwise.
  */
 unsigned int work_cpu(struct work_struct *work)
 {
 	struct global_cwq *gcwq = get_work_gcwq(work);
 
-	return gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	if (!gcwq)
+		return WORK_CPU_NONE;
+	return gcwq_cpu_is_unbound(gcwq->cpu) ? WORK_CPU_UNBOUND : gcwq->cpu;
 }
 EXPORT_SYMBOL_GPL(work_cpu);
 
@@ -3762,6 +4032,213 @@ out_unlock:
 }
 #endif /* CONFIG_FREEZER */
 
+#ifdef CONFIG_SYSFS
+/*
+ * Workqueues created with WQ_SYSFS, and system_unbound_wq, are exposed
+ * as devices on the workqueue bus, /sys/bus/workqueue/devices/WQ_NAME:
+ *
+ *  per_cpu	RO bool	: whether the workqueue is per-cpu or unbound
+ *  max_active	RW int	: max in-flight works per cpu, or per node
+ *
+ * Unbound workqueues also have:
+ *
+ *  nice	RW int	: nice level their works are executed at
+ *  cpumask	RW mask	: cpus their works are allowed to run on
+ */
+struct wq_device {
+	struct workqueue_struct		*wq;
+	struct device			dev;
+};
+
+static struct workqueue_struct *dev_to_wq(struct device *dev)
+{
+	return container_of(dev, struct wq_device, dev)->wq;
+}
+
+static ssize_t wq_per_cpu_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", !(wq->flags & WQ_UNBOUND));
+}
+
+static ssize_t wq_max_active_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->saved_max_active);
+}
+
+static ssize_t wq_max_active_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val;
+
+	if (sscanf(buf, "%d", &val) != 1 || val <= 0)
+		return -EINVAL;
+
+	workqueue_set_max_active(wq, val);
+	return count;
+}
+
+static ssize_t wq_nice_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->nice);
+}
+
+static ssize_t wq_nice_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val, ret;
+
+	if (sscanf(buf, "%d", &val) != 1)
+		return -EINVAL;
+
+	ret = workqueue_set_nice(wq, val);
+	return ret ?: count;
+}
+
+static ssize_t wq_cpumask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	mutex_lock(&wq_attrs_mutex);
+	written = cpumask_scnprintf(buf, PAGE_SIZE, wq->cpumask);
+	mutex_unlock(&wq_attrs_mutex);
+
+	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
+	return written;
+}
+
+static ssize_t wq_cpumask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	cpumask_var_t mask;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = bitmap_parse(buf, count, cpumask_bits(mask), nr_cpumask_bits);
+	if (!ret)
+		ret = workqueue_set_cpumask(wq, mask);
+
+	free_cpumask_var(mask);
+	return ret ?: count;
+}
+
+static struct device_attribute wq_sysfs_attrs[] = {
+	__ATTR(per_cpu, 0444, wq_per_cpu_show, NULL),
+	__ATTR(max_active, 0644, wq_max_active_show, wq_max_active_store),
+	__ATTR_NULL,
+};
+
+static struct device_attribute wq_sysfs_unbound_attrs[] = {
+	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
+	__ATTR_NULL,
+};
+
+static struct bus_type wq_subsys = {
+	.name		= "workqueue",
+	.dev_attrs	= wq_sysfs_attrs,
+};
+
+static bool wq_subsys_registered;
+
+static void wq_device_release(struct device *dev)
+{
+	kfree(container_of(dev, struct wq_device, dev));
+}
+
+/**
+ * workqueue_sysfs_register - make a workqueue visible in sysfs
+ * @wq: the workqueue to register
+ *
+ * Expose @wq under /sys/bus/workqueue/devices.  Ordered workqueues
+ * can't be exposed as changing their max_active would break their
+ * ordering guarantee.
+ *
+ * RETURNS:
+ * 0 on success, -errno on failure.
+ */
+static int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev;
+	struct device_attribute *attr;
+	int ret;
+
+	if (WARN_ON(wq->flags & WQ_ORDERED) || WARN_ON(!wq_subsys_registered))
+		return -EINVAL;
+
+	wq->wq_dev = wq_dev = kzalloc(sizeof(*wq_dev), GFP_KERNEL);
+	if (!wq_dev)
+		return -ENOMEM;
+
+	wq_dev->wq = wq;
+	wq_dev->dev.bus = &wq_subsys;
+	wq_dev->dev.release = wq_device_release;
+	dev_set_name(&wq_dev->dev, "%s", wq->name);
+
+	ret = device_register(&wq_dev->dev);
+	if (ret) {
+		put_device(&wq_dev->dev);
+		wq->wq_dev = NULL;
+		return ret;
+	}
+
+	if (wq->flags & WQ_UNBOUND) {
+		for (attr = wq_sysfs_unbound_attrs; attr->attr.name; attr++) {
+			ret = device_create_file(&wq_dev->dev, attr);
+			if (ret) {
+				workqueue_sysfs_unregister(wq);
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev = wq->wq_dev;
+
+	if (!wq_dev)
+		return;
+
+	wq->wq_dev = NULL;
+	device_unregister(&wq_dev->dev);
+}
+
+static int __init wq_sysfs_init(void)
+{
+	int ret;
+
+	ret = bus_register(&wq_subsys);
+	if (ret)
+		return ret;
+	wq_subsys_registered = true;
+
+	/* system_unbound_wq was created before the bus, expose it now */
+	return workqueue_sysfs_register(system_unbound_wq);
+}
+core_initcall(wq_sysfs_init);
+#endif /* CONFIG_SYSFS */
+
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
@@ -3769,6 +4246,31 @@ static int __init init_workqueues(void)
 
 	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
 
+	BUG_ON(!alloc_cpumask_var(&wq_attrs_cpumask, GFP_KERNEL));
+
+	/*
+	 * Only nodes with memory get an unbound gcwq, allocated there.
+	 * The others, possibly not even online, use the nearest one.
+	 */
+	unbound_gcwq_nodes = node_states[N_HIGH_MEMORY];
+	if (nodes_empty(unbound_gcwq_nodes))
+		node_set(first_online_node, unbound_gcwq_nodes);
+
+	for_each_node_mask(i, unbound_gcwq_nodes) {
+		unbound_global_cwq[i] = kzalloc_node(sizeof(struct global_cwq),
+						     GFP_KERNEL, i);
+		BUG_ON(!unbound_global_cwq[i]);
+	}
+
+	for_each_node(i) {
+		int node, best = first_node(unbound_gcwq_nodes);
+
+		for_each_node_mask(node, unbound_gcwq_nodes)
+			if (node_distance(i, node) < node_distance(i, best))
+				best = node;
+		unbound_gcwq_node[i] = best;
+	}
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3800,7 +4302,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (!gcwq_cpu_is_unbound(cpu))
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
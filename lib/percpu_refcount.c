@@ -0,0 +1,244 @@
+/*
+ * Percpu refcounts, see include/linux/percpu_refcount.h.
+ *
+ * The initial count in percpu mode carries PERCPU_COUNT_BIAS so that the
+ * atomic count can't reach zero, whatever gets and puts went to it while
+ * the per-cpu counters are being folded into it on the way to atomic
+ * mode.  Then the sum of the per-cpu counters, which may individually
+ * wrap around, is added and the bias dropped at once.
+ */
+
+#include <linux/percpu_refcount.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#define PERCPU_COUNT_BIAS	(1LU << (BITS_PER_LONG - 1))
+
+static DECLARE_WAIT_QUEUE_HEAD(percpu_ref_switch_waitq);
+
+static unsigned long __percpu *percpu_count_ptr(struct percpu_ref *ref)
+{
+	return (unsigned long __percpu *)
+		(ref->percpu_count_ptr & ~__PERCPU_REF_ATOMIC_DEAD);
+}
+
+/**
+ * percpu_ref_init - initialize a percpu refcount
+ * @ref: percpu_ref to initialize
+ * @release: function which will be called when refcount hits 0
+ *
+ * Initializes @ref in percpu mode with a refcount of 1.  Drop the
+ * initial ref with percpu_ref_kill().
+ *
+ * Note that @release must not sleep - it may potentially be called from
+ * RCU callback context by percpu_ref_kill().
+ */
+int percpu_ref_init(struct percpu_ref *ref, percpu_ref_func_t *release)
+{
+	size_t align = max_t(size_t, 1 << __PERCPU_REF_FLAG_BITS,
+			     __alignof__(unsigned long));
+
+	ref->percpu_count_ptr = (unsigned long)
+		__alloc_percpu(sizeof(unsigned long), align);
+	if (!ref->percpu_count_ptr)
+		return -ENOMEM;
+
+	atomic_long_set(&ref->count, 1 + PERCPU_COUNT_BIAS);
+	ref->release = release;
+	ref->confirm_switch = NULL;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(percpu_ref_init);
+
+/**
+ * percpu_ref_exit - undo percpu_ref_init()
+ * @ref: percpu_ref to exit
+ *
+ * This function exits @ref.  The caller is responsible for ensuring that
+ * @ref is no longer in active use.  The usual places to invoke this
+ * function from are the @ref->release() callback or in init failure path
+ * where percpu_ref_init() succeeded but other parts of the initialization
+ * of the embedding object failed.
+ */
+void percpu_ref_exit(struct percpu_ref *ref)
+{
+	unsigned long __percpu *percpu_count = percpu_count_ptr(ref);
+
+	if (percpu_count) {
+		free_percpu(percpu_count);
+		ref->percpu_count_ptr = __PERCPU_REF_ATOMIC_DEAD;
+	}
+}
+EXPORT_SYMBOL_GPL(percpu_ref_exit);
+
+static void percpu_ref_noop_confirm_switch(struct percpu_ref *ref)
+{
+}
+
+static void percpu_ref_switch_to_atomic_rcu(struct rcu_head *rcu)
+{
+	struct percpu_ref *ref = container_of(rcu, struct percpu_ref, rcu);
+	unsigned long __percpu *percpu_count = percpu_count_ptr(ref);
+	unsigned long count = 0;
+	bool dead;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += *per_cpu_ptr(percpu_count, cpu);
+
+	/*
+	 * Sum the per-cpu counters _before_ adding them to the atomic
+	 * count: gets may happen on one cpu while puts happen on another,
+	 * so only the sum is consistent.  The bias is dropped at the same
+	 * time, which is equivalent and saves an atomic operation.
+	 */
+	atomic_long_add((long)count - PERCPU_COUNT_BIAS, &ref->count);
+
+	WARN_ONCE(atomic_long_read(&ref->count) <= 0,
+		  "percpu ref (%pf) <= 0 (%ld) after switching to atomic",
+		  ref->release, atomic_long_read(&ref->count));
+
+	/*
+	 * A ref which isn't being killed still holds its initial ref, so
+	 * drop the one taken by __percpu_ref_switch_to_atomic() before the
+	 * confirmation, for waiters to find the count exact.
+	 */
+	dead = ref->percpu_count_ptr & __PERCPU_REF_DEAD;
+	if (!dead)
+		atomic_long_dec(&ref->count);
+
+	/* @ref is viewed as atomic on all cpus, send out confirmation */
+	ref->confirm_switch(ref);
+	ref->confirm_switch = NULL;
+	wake_up_all(&percpu_ref_switch_waitq);
+
+	if (dead)
+		percpu_ref_put(ref);
+}
+
+static void __percpu_ref_switch_to_atomic(struct percpu_ref *ref,
+					  percpu_ref_func_t *confirm_switch)
+{
+	if (ref->percpu_count_ptr & __PERCPU_REF_ATOMIC) {
+		if (confirm_switch)
+			confirm_switch(ref);
+		return;
+	}
+
+	ref->percpu_count_ptr |= __PERCPU_REF_ATOMIC;
+
+	/*
+	 * A non-NULL ->confirm_switch tells that a switch is in progress,
+	 * use a noop one if unspecified.  Hold a ref until it's done.
+	 */
+	ref->confirm_switch = confirm_switch ?: percpu_ref_noop_confirm_switch;
+
+	percpu_ref_get(ref);
+	call_rcu_sched(&ref->rcu, percpu_ref_switch_to_atomic_rcu);
+}
+
+/**
+ * percpu_ref_switch_to_atomic - switch a percpu_ref to atomic mode
+ * @ref: percpu_ref to switch to atomic mode
+ * @confirm_switch: optional confirmation callback
+ *
+ * Make all further gets and puts of @ref operate on its atomic count and
+ * schedule folding the per-cpu counters into it after an RCU-sched grace
+ * period.  @confirm_switch, which may not block, is invoked once that is
+ * done, or immediately if @ref was already in atomic mode.
+ *
+ * This allows starting the switch of many refs and waiting only once
+ * for all of them with percpu_ref_switch_to_atomic_sync().
+ *
+ * CONTEXT:
+ * Might sleep if a previous switch of @ref is still in progress.
+ */
+void percpu_ref_switch_to_atomic(struct percpu_ref *ref,
+				 percpu_ref_func_t *confirm_switch)
+{
+	wait_event(percpu_ref_switch_waitq, !ref->confirm_switch);
+	__percpu_ref_switch_to_atomic(ref, confirm_switch);
+}
+EXPORT_SYMBOL_GPL(percpu_ref_switch_to_atomic);
+
+/**
+ * percpu_ref_switch_to_atomic_sync - switch a percpu_ref to atomic mode
+ * @ref: percpu_ref to switch to atomic mode
+ *
+ * Same as percpu_ref_switch_to_atomic() but wait for the per-cpu
+ * counters to be folded.  Afterwards percpu_ref_atomic_count() is exact.
+ *
+ * CONTEXT:
+ * Might sleep.
+ */
+void percpu_ref_switch_to_atomic_sync(struct percpu_ref *ref)
+{
+	percpu_ref_switch_to_atomic(ref, NULL);
+	wait_event(percpu_ref_switch_waitq, !ref->confirm_switch);
+}
+EXPORT_SYMBOL_GPL(percpu_ref_switch_to_atomic_sync);
+
+/**
+ * percpu_ref_switch_to_percpu - switch a percpu_ref back to percpu mode
+ * @ref: percpu_ref to switch to percpu mode
+ *
+ * Undo percpu_ref_switch_to_atomic_sync().  Killed refs stay atomic.
+ *
+ * CONTEXT:
+ * Might sleep.
+ */
+void percpu_ref_switch_to_percpu(struct percpu_ref *ref)
+{
+	unsigned long __percpu *percpu_count = percpu_count_ptr(ref);
+	int cpu;
+
+	wait_event(percpu_ref_switch_waitq, !ref->confirm_switch);
+
+	if ((ref->percpu_count_ptr & __PERCPU_REF_ATOMIC_DEAD) !=
+	    __PERCPU_REF_ATOMIC)
+		return;
+
+	atomic_long_add(PERCPU_COUNT_BIAS, &ref->count);
+
+	/*
+	 * Restore percpu operation.  smp_wmb() makes the zeroing visible
+	 * to all percpu accesses which can see the following
+	 * __PERCPU_REF_ATOMIC clearing.
+	 */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(percpu_count, cpu) = 0;
+
+	smp_wmb();
+	ACCESS_ONCE(ref->percpu_count_ptr) &= ~__PERCPU_REF_ATOMIC;
+}
+EXPORT_SYMBOL_GPL(percpu_ref_switch_to_percpu);
+
+/**
+ * percpu_ref_kill_and_confirm - drop the initial ref and schedule confirmation
+ * @ref: percpu_ref to kill
+ * @confirm_kill: optional confirmation callback
+ *
+ * Equivalent to percpu_ref_kill() but also schedules kill confirmation if
+ * @confirm_kill is not NULL.  @confirm_kill, which may not block, will be
+ * called after @ref is seen as dead from all CPUs at which point all
+ * further invocations of percpu_ref_tryget_live() will fail.
+ *
+ * This function normally doesn't block and can be called from any context
+ * but it may block if @ref is in the process of switching to atomic mode
+ * by percpu_ref_switch_to_atomic_sync().
+ */
+void percpu_ref_kill_and_confirm(struct percpu_ref *ref,
+				 percpu_ref_func_t *confirm_kill)
+{
+	WARN_ONCE(ref->percpu_count_ptr & __PERCPU_REF_DEAD,
+		  "%s called more than once on %pf!", __func__, ref->release);
+
+	if (ref->confirm_switch)
+		wait_event(percpu_ref_switch_waitq, !ref->confirm_switch);
+
+	ref->percpu_count_ptr |= __PERCPU_REF_DEAD;
+	__percpu_ref_switch_to_atomic(ref, confirm_kill);
+	percpu_ref_put(ref);
+}
+EXPORT_SYMBOL_GPL(percpu_ref_kill_and_confirm);
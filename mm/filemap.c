@@ -1066,6 +1066,32 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * Large reads of cached files look up the pages they are about to copy a
+ * pagevec at a time, rather than walking the radix tree for every page.
+ * @pvec holds references to the pages from @pvec->pages[*next] on.
+ */
+static struct page *find_get_read_page(struct address_space *mapping,
+				       pgoff_t index, pgoff_t last_index,
+				       struct pagevec *pvec, unsigned int *next)
+{
+	unsigned int nr_pages;
+
+	if (*next < pagevec_count(pvec) && pvec->pages[*next]->index == index)
+		return pvec->pages[(*next)++];
+
+	while (*next < pagevec_count(pvec))
+		page_cache_release(pvec->pages[(*next)++]);
+
+	nr_pages = min_t(pgoff_t, last_index - index, PAGEVEC_SIZE);
+	pvec->nr = find_get_pages_contig(mapping, index, max(nr_pages, 1U),
+					 pvec->pages);
+	*next = 0;
+	if (!pvec->nr)
+		return NULL;
+	return pvec->pages[(*next)++];
+}
+
 /**
  * do_generic_file_read - generic file read routine
  * @filp:	the file to read
@@ -1085,6 +1111,8 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
 	struct file_ra_state *ra = &filp->f_ra;
+	struct pagevec pvec;
+	unsigned int next = 0;
 	pgoff_t index;
 	pgoff_t last_index;
 	pgoff_t prev_index;
@@ -1092,6 +1120,7 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 	unsigned int prev_offset;
 	int error;
 
+	pagevec_init(&pvec, 0);
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	prev_index = ra->prev_pos >> PAGE_CACHE_SHIFT;
 	prev_offset = ra->prev_pos & (PAGE_CACHE_SIZE-1);
@@ -1106,12 +1135,14 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 
 		cond_resched();
 find_page:
-		page = find_get_page(mapping, index);
+		page = find_get_read_page(mapping, index, last_index,
+					  &pvec, &next);
 		if (!page) {
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
-			page = find_get_page(mapping, index);
+			page = find_get_read_page(mapping, index, last_index,
+						  &pvec, &next);
 			if (unlikely(page == NULL))
 				goto no_cached_page;
 		}
@@ -1288,6 +1319,9 @@ no_cached_page:
 	}
 
 out:
+	while (next < pagevec_count(&pvec))
+		page_cache_release(pvec.pages[next++]);
+
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
 	ra->prev_pos |= prev_offset;
@@ -259,6 +259,23 @@ unsigned long ra_submit(struct file_ra_state *ra,
 	return actual;
 }
 
+/*
+ * Strided readahead reads @chunks chunks of @nr_to_read pages, @stride
+ * apart, marking the first one.
+ */
+static void do_readahead_chunks(struct address_space *mapping,
+				struct file *filp, pgoff_t offset,
+				unsigned long nr_to_read,
+				unsigned long lookahead_size,
+				unsigned long stride, unsigned long chunks)
+{
+	unsigned long i;
+
+	for (i = 0; i < chunks; i++, offset += stride)
+		__do_page_cache_readahead(mapping, filp, offset, nr_to_read,
+					  i ? 0 : lookahead_size);
+}
+
 /*
  * Set the initial window size, round to next power of 2 and square
  * for small size, x 4 for medium, and x 2 for large
@@ -319,7 +336,10 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * be invalidating each other's readahead state. So we flag the new readahead
  * page at (start+size-async_size) with PG_readahead, and use it as readahead
  * indicator. The flag won't be set on already cached pages, to avoid the
- * readahead-for-nothing fuss, saving pointless page cache lookups.
+ * readahead-for-nothing fuss, saving pointless page cache lookups.  The
+ * last FILE_RA_STREAMS streams to be displaced are also kept in
+ * file_ra_state.streams, so that a stream coming back picks up its window
+ * where it left it rather than starting over.
  *
  * prev_pos tracks the last visited byte in the _previous_ read request.
  * It should be maintained by the caller, and will be used for detecting
@@ -336,6 +356,108 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * it approaches max_readhead.
  */
 
+/*
+ * Save the current stream before another one takes over the readahead
+ * state, dropping the least recently used, or the one in @slot.
+ */
+static void ra_push_stream(struct file_ra_state *ra, int slot)
+{
+	if (!ra->size)
+		return;
+
+	memmove(&ra->streams[1], &ra->streams[0],
+		slot * sizeof(ra->streams[0]));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+}
+
+/*
+ * Is @offset where a saved stream expects its next read?  Then make it
+ * the current stream again.
+ */
+static int ra_switch_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct file_ra_stream stream;
+	int i;
+
+	for (i = 0; i < FILE_RA_STREAMS; i++) {
+		stream = ra->streams[i];
+		if (stream.size &&
+		    (offset == stream.start + stream.size - stream.async_size ||
+		     offset == stream.start + stream.size))
+			break;
+	}
+	if (i == FILE_RA_STREAMS)
+		return 0;
+
+	if (ra->size)
+		ra_push_stream(ra, i);
+	else
+		ra->streams[i].size = 0;
+	ra->start = stream.start;
+	ra->size = stream.size;
+	ra->async_size = stream.async_size;
+	return 1;
+}
+
+/*
+ * Strided reads, as when scanning one column of a table, are reads of the
+ * same size a fixed distance apart: they look neither sequential nor leave
+ * history pages behind.  ra->stride_start is the last chunk of the stride
+ * which was read or read ahead.
+ */
+static inline int ra_stride_chunk(struct file_ra_state *ra, pgoff_t offset)
+{
+	return ra->stride && offset <= ra->stride_start &&
+	       (ra->stride_start - offset) % ra->stride == 0;
+}
+
+/*
+ * Track the distance between small random reads, and return 1 once two
+ * of them in a row are the same distance apart.
+ */
+static int try_stride_readahead(struct file_ra_state *ra, pgoff_t offset,
+				unsigned long req_size)
+{
+	pgoff_t distance = offset - ra->stride_start;
+
+	if (req_size == ra->stride_size) {
+		if (ra->stride && distance == ra->stride) {
+			ra->stride_start = offset;
+			return 1;
+		}
+		/* a chunk we read ahead, and which was reclaimed since */
+		if (ra_stride_chunk(ra, offset))
+			return 0;
+	}
+
+	ra->stride = 0;
+	if (offset > ra->stride_start && req_size == ra->stride_size &&
+	    distance > req_size && distance <= UINT_MAX)
+		ra->stride = distance;
+	ra->stride_start = offset;
+	ra->stride_size = req_size;
+	return 0;
+}
+
+/*
+ * Read ahead the chunks of the stride after ra->stride_start, as many as
+ * fit in the readahead window.  The first of them is marked, so that the
+ * reader getting there starts on the chunks after.
+ */
+static void stride_readahead(struct address_space *mapping,
+			     struct file_ra_state *ra, struct file *filp,
+			     unsigned long max)
+{
+	unsigned long nr = ra->stride_size;
+	unsigned long chunks = nr < max ? max / nr : 1;
+
+	do_readahead_chunks(mapping, filp, ra->stride_start + ra->stride, nr, nr,
+			    ra->stride, chunks);
+	ra->stride_start += chunks * ra->stride;
+}
+
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
  * this count is a conservative estimation of
@@ -382,6 +504,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_push_stream(ra, FILE_RA_STREAMS - 1);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -399,25 +522,36 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	int ret;
 
 	/*
 	 * start of file
 	 */
 	if (!offset)
-		goto initial_readahead;
+		goto new_stream;
 
 	/*
-	 * It's the expected callback offset, assume sequential access.
+	 * It's the expected callback offset, assume sequential access, or
+	 * that of a stream another one displaced.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
-	     offset == (ra->start + ra->size))) {
+	     offset == (ra->start + ra->size)) ||
+	    ra_switch_stream(ra, offset)) {
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
 		goto readit;
 	}
 
+	/*
+	 * Hit the marked chunk of a stride.
+	 */
+	if (hit_readahead_marker && ra_stride_chunk(ra, offset)) {
+		stride_readahead(mapping, ra, filp, max);
+		return 0;
+	}
+
 	/*
 	 * Hit a marked page without valid readahead state.
 	 * E.g. interleaved reads.
@@ -434,6 +568,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_push_stream(ra, FILE_RA_STREAMS - 1);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -446,7 +581,7 @@ ondemand_readahead(struct address_space *mapping,
 	 * oversize read
 	 */
 	if (req_size > max)
-		goto initial_readahead;
+		goto new_stream;
 
 	/*
 	 * sequential cache miss
@@ -462,11 +597,16 @@ ondemand_readahead(struct address_space *mapping,
 		goto readit;
 
 	/*
-	 * standalone, small random read
+	 * standalone, small random read, unless it is part of a stride.
 	 * Read as is, and do not pollute the readahead state.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	ret = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	if (try_stride_readahead(ra, offset, req_size))
+		stride_readahead(mapping, ra, filp, max);
+	return ret;
 
+new_stream:
+	ra_push_stream(ra, FILE_RA_STREAMS - 1);
 initial_readahead:
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
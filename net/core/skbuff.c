@@ -341,6 +341,9 @@ static void skb_release_data(struct sk_buff *skb)
 				uarg->callback(uarg);
 		}
 
+		if (skb_shinfo(skb)->tx_flags & SKBTX_ZEROCOPY_NOTIFY)
+			sock_zcopy_put(skb_shinfo(skb)->destructor_arg);
+
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
@@ -493,7 +496,8 @@ bool skb_recycle_check(struct sk_buff *skb, int skb_size)
 	if (irqs_disabled())
 		return false;
 
-	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)
+	if (skb_shinfo(skb)->tx_flags &
+	    (SKBTX_DEV_ZEROCOPY | SKBTX_ZEROCOPY_NOTIFY))
 		return false;
 
 	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE)
@@ -810,6 +814,7 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zcopy_clone(n, skb);
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -901,6 +906,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			get_page(skb_shinfo(skb)->frags[i].page);
 
+		/* the copied shinfo holds its own zero-copy reference */
+		if (skb_zcopy(skb))
+			sock_zcopy_get(skb_zcopy(skb));
+
 		if (skb_has_frag_list(skb))
 			skb_clone_fraglist(skb);
 
@@ -2167,6 +2176,8 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
 		skb_split_no_header(skb, skb1, len, pos);
+
+	skb_zcopy_clone(skb1, skb);
 }
 EXPORT_SYMBOL(skb_split);
 
@@ -2205,6 +2216,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* Don't move pages out of reach of their zero-copy notification */
+	if (skb_zcopy(skb) && skb_zcopy(tgt) != skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2675,6 +2690,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, u32 features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zcopy_clone(nskb, skb);
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -3086,6 +3102,198 @@ int sock_queue_err_skb(struct sock *sk, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(sock_queue_err_skb);
 
+/* Only these set sk_err when queued, zerocopy and timestamp reports don't */
+static bool is_sk_err_skb(const struct sk_buff *skb)
+{
+	u8 origin = SKB_EXT_ERR(skb)->ee.ee_origin;
+
+	return origin == SO_EE_ORIGIN_LOCAL || origin == SO_EE_ORIGIN_ICMP ||
+	       origin == SO_EE_ORIGIN_ICMP6;
+}
+
+/**
+ *	sock_dequeue_err_skb - dequeue the next error queue entry
+ *	@sk: socket
+ *
+ *	Take the next skb off the error queue for MSG_ERRQUEUE and regenerate
+ *	sk->sk_err from the error behind it.  sk_err is only reset when the
+ *	dequeued skb reported an error itself, so reading a zerocopy
+ *	notification doesn't lose a pending error such as %ECONNRESET.
+ */
+struct sk_buff *sock_dequeue_err_skb(struct sock *sk)
+{
+	struct sk_buff_head *q = &sk->sk_error_queue;
+	struct sk_buff *skb, *skb_next;
+	int err = 0, err_next = 0;
+
+	spin_lock_bh(&q->lock);
+	skb = __skb_dequeue(q);
+	if (skb) {
+		err = is_sk_err_skb(skb);
+		skb_next = skb_peek(q);
+		if (skb_next && is_sk_err_skb(skb_next)) {
+			err_next = 1;
+			sk->sk_err = SKB_EXT_ERR(skb_next)->ee.ee_errno;
+		}
+	}
+	spin_unlock_bh(&q->lock);
+
+	if (err && !err_next)
+		sk->sk_err = 0;
+	if (err_next)
+		sk->sk_error_report(sk);
+	return skb;
+}
+EXPORT_SYMBOL(sock_dequeue_err_skb);
+
+static inline struct sk_buff *skb_from_zcopy(struct sock_zcopy *zc)
+{
+	return container_of((void *)zc, struct sk_buff, cb);
+}
+
+static void sock_zcopy_ofree(struct sk_buff *skb)
+{
+	atomic_sub(skb->truesize, &skb->sk->sk_omem_alloc);
+}
+
+/**
+ * sock_zcopy_open - get the zero-copy message being sent on a socket
+ * @sk: locked socket with %SO_ZEROCOPY set
+ *
+ * Returns the completion tracking of the message being sent, starting a
+ * new one with the next id if the previous was closed, or %NULL if the
+ * socket has too many outstanding notifications or memory is short.
+ */
+struct sock_zcopy *sock_zcopy_open(struct sock *sk)
+{
+	struct sock_zcopy *zc = sk->sk_zcopy;
+	struct sk_buff *skb;
+
+	if (zc)
+		return zc;
+
+	if (atomic_read(&sk->sk_omem_alloc) > sysctl_optmem_max)
+		return NULL;
+
+	skb = alloc_skb(0, sk->sk_allocation);
+	if (!skb)
+		return NULL;
+
+	BUILD_BUG_ON(sizeof(*zc) > sizeof(skb->cb));
+	skb->sk = sk;
+	skb->destructor = sock_zcopy_ofree;
+	atomic_add(skb->truesize, &sk->sk_omem_alloc);
+
+	zc = (struct sock_zcopy *)skb->cb;
+	atomic_set(&zc->refcnt, 1);
+	zc->id = sk->sk_zckey;
+	zc->copied = false;
+	zc->sk = sk;
+	sock_hold(sk);
+
+	sk->sk_zcopy = zc;
+	return zc;
+}
+EXPORT_SYMBOL_GPL(sock_zcopy_open);
+
+/**
+ * sock_zcopy_close - end the zero-copy message being sent on a socket
+ * @sk: locked socket
+ *
+ * Drops the socket reference on the current message, if any, so that its
+ * notification is queued once the stack has released all its pages.
+ */
+void sock_zcopy_close(struct sock *sk)
+{
+	struct sock_zcopy *zc = sk->sk_zcopy;
+
+	if (zc) {
+		sk->sk_zcopy = NULL;
+		sk->sk_zckey++;
+		sock_zcopy_put(zc);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zcopy_close);
+
+/**
+ * sock_zcopy_abort - drop a zero-copy message nothing was sent in
+ * @sk: locked socket
+ *
+ * Undoes sock_zcopy_open() for a send which started the message but
+ * failed before attaching any page, without queueing a notification or
+ * consuming an id.
+ */
+void sock_zcopy_abort(struct sock *sk)
+{
+	struct sock_zcopy *zc = sk->sk_zcopy;
+
+	if (zc) {
+		WARN_ON(atomic_read(&zc->refcnt) != 1);
+		sk->sk_zcopy = NULL;
+		kfree_skb(skb_from_zcopy(zc));
+		sock_put(sk);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zcopy_abort);
+
+/*
+ * Notifications for consecutive ids are merged into a single range, so
+ * that a sender which doesn't read them often doesn't run out of optmem.
+ */
+static bool sock_zcopy_extend(struct sk_buff *skb, u32 id, u8 code)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    serr->ee.ee_code != code || serr->ee.ee_data + 1 != id)
+		return false;
+
+	serr->ee.ee_data = id;
+	return true;
+}
+
+void sock_zcopy_put(struct sock_zcopy *zc)
+{
+	struct sk_buff *tail, *skb = skb_from_zcopy(zc);
+	struct sk_buff_head *q;
+	struct sock_exterr_skb *serr;
+	struct sock *sk = zc->sk;
+	unsigned long flags;
+	u32 id;
+	u8 code;
+
+	if (!atomic_dec_and_test(&zc->refcnt))
+		return;
+
+	/* serr overlays zc */
+	id = zc->id;
+	code = zc->copied ? SO_EE_CODE_ZEROCOPY_COPIED : 0;
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = id;
+	serr->ee.ee_data = id;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || !sock_zcopy_extend(tail, id, code)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	/* frees before the socket reference, it uncharges the socket */
+	kfree_skb(skb);
+
+	if (!sock_flag(sk, SOCK_DEAD))
+		sk->sk_error_report(sk);
+	sock_put(sk);
+}
+EXPORT_SYMBOL_GPL(sock_zcopy_put);
+
 void skb_tstamp_tx(struct sk_buff *orig_skb,
 		struct skb_shared_hwtstamps *hwtstamps)
 {
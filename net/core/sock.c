@@ -743,6 +743,16 @@ set_rcvbuf:
 		else
 			sock_reset_flag(sk, SOCK_RXQ_OVFL);
 		break;
+
+	case SO_ZEROCOPY:
+		if (sk->sk_type != SOCK_STREAM || sk->sk_protocol != IPPROTO_TCP ||
+		    (sk->sk_family != PF_INET && sk->sk_family != PF_INET6))
+			ret = -EOPNOTSUPP;
+		else if (valbool)
+			sock_set_flag(sk, SOCK_ZEROCOPY_NOTIFY);
+		else
+			sock_reset_flag(sk, SOCK_ZEROCOPY_NOTIFY);
+		break;
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -964,6 +974,10 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = !!sock_flag(sk, SOCK_RXQ_OVFL);
 		break;
 
+	case SO_ZEROCOPY:
+		v.val = !!sock_flag(sk, SOCK_ZEROCOPY_NOTIFY);
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
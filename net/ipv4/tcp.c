@@ -457,7 +457,7 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	}
 	/* This barrier is coupled with smp_wmb() in tcp_reset() */
 	smp_rmb();
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty(&sk->sk_error_queue))
 		mask |= POLLERR;
 
 	return mask;
@@ -761,6 +761,8 @@ static ssize_t do_tcp_sendpages(struct sock *sk, struct page **pages, int poffse
 			 size_t psize, int flags)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
+	struct sock_zcopy *zc = NULL;
+	bool zc_opened = false;
 	int mss_now, size_goal;
 	int err;
 	ssize_t copied;
@@ -780,6 +782,18 @@ static ssize_t do_tcp_sendpages(struct sock *sk, struct page **pages, int poffse
 	if (sk->sk_err || (sk->sk_shutdown & SEND_SHUTDOWN))
 		goto out_err;
 
+	/*
+	 * The pages are sent by reference anyway, SO_ZEROCOPY only tells
+	 * the user when the stack doesn't reference them anymore.
+	 */
+	if (sock_flag(sk, SOCK_ZEROCOPY_NOTIFY)) {
+		zc_opened = !sk->sk_zcopy;
+		zc = sock_zcopy_open(sk);
+		err = -ENOBUFS;
+		if (!zc)
+			goto out_err;
+	}
+
 	while (psize > 0) {
 		struct sk_buff *skb = tcp_write_queue_tail(sk);
 		struct page *page = pages[poffset / PAGE_SIZE];
@@ -787,7 +801,8 @@ static ssize_t do_tcp_sendpages(struct sock *sk, struct page **pages, int poffse
 		int offset = poffset % PAGE_SIZE;
 		int size = min_t(size_t, psize, PAGE_SIZE - offset);
 
-		if (!tcp_send_head(sk) || (copy = size_goal - skb->len) <= 0) {
+		if (!tcp_send_head(sk) || (copy = size_goal - skb->len) <= 0 ||
+		    (zc && skb_zcopy(skb) && skb_zcopy(skb) != zc)) {
 new_segment:
 			if (!sk_stream_memory_free(sk))
 				goto wait_for_sndbuf;
@@ -818,6 +833,8 @@ new_segment:
 			get_page(page);
 			skb_fill_page_desc(skb, i, page, offset, copy);
 		}
+		if (zc && !skb_zcopy(skb))
+			skb_zcopy_set(skb, zc);
 
 		skb->len += copy;
 		skb->data_len += copy;
@@ -862,12 +879,18 @@ wait_for_memory:
 out:
 	if (copied)
 		tcp_push(sk, flags, mss_now, tp->nonagle);
+	else if (zc_opened)
+		sock_zcopy_abort(sk);
+	if (!(flags & MSG_MORE))
+		sock_zcopy_close(sk);
 	return copied;
 
 do_error:
 	if (copied)
 		goto out;
 out_err:
+	if (zc_opened)
+		sock_zcopy_abort(sk);
 	return sk_stream_error(sk, flags, err);
 }
 
@@ -876,10 +899,14 @@ int tcp_sendpage(struct sock *sk, struct page *page, int offset,
 {
 	ssize_t res;
 
+	/*
+	 * Data sent by copy still gets its SO_ZEROCOPY notification, which
+	 * tcp_sendmsg() flags as copied for MSG_ZEROCOPY sends.
+	 */
 	if (!(sk->sk_route_caps & NETIF_F_SG) ||
 	    !(sk->sk_route_caps & NETIF_F_ALL_CSUM))
 		return sock_no_sendpage(sk->sk_socket, page, offset, size,
-					flags);
+					flags | MSG_ZEROCOPY);
 
 	lock_sock(sk);
 	res = do_tcp_sendpages(sk, &page, offset, size, flags);
@@ -891,6 +918,38 @@ EXPORT_SYMBOL(tcp_sendpage);
 #define TCP_PAGE(sk)	(sk->sk_sndmsg_page)
 #define TCP_OFF(sk)	(sk->sk_sndmsg_off)
 
+/* MSG_ZEROCOPY sends smaller than this are copied, it's cheaper */
+#define TCP_ZEROCOPY_MIN	8192
+
+/*
+ * Attaches up to @copy bytes of user memory at @from, not crossing a page
+ * boundary, to @skb by reference.  Returns the number of bytes attached.
+ */
+static int tcp_zcopy_add(struct sock *sk, struct sk_buff *skb,
+			 unsigned char __user *from, int copy)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+	int off = (unsigned long)from & ~PAGE_MASK;
+	struct page *page;
+
+	if (get_user_pages_fast((unsigned long)from, 1, 0, &page) != 1)
+		return -EFAULT;
+
+	copy = min_t(int, copy, PAGE_SIZE - off);
+	if (skb_can_coalesce(skb, i, page, off)) {
+		skb_shinfo(skb)->frags[i - 1].size += copy;
+		put_page(page);
+	} else
+		skb_fill_page_desc(skb, i, page, off, copy);
+
+	skb->len += copy;
+	skb->data_len += copy;
+	skb->truesize += copy;
+	sk->sk_wmem_queued += copy;
+	sk_mem_charge(sk, copy);
+	return copy;
+}
+
 static inline int select_size(struct sock *sk, int sg)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
@@ -917,6 +976,8 @@ int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct iovec *iov;
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sk_buff *skb;
+	struct sock_zcopy *zc = NULL;
+	bool zc_opened = false, pin = false;
 	int iovlen, flags;
 	int mss_now, size_goal;
 	int sg, err, copied;
@@ -948,6 +1009,21 @@ int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	sg = sk->sk_route_caps & NETIF_F_SG;
 
+	if ((flags & MSG_ZEROCOPY) && sock_flag(sk, SOCK_ZEROCOPY_NOTIFY)) {
+		zc_opened = !sk->sk_zcopy;
+		zc = sock_zcopy_open(sk);
+		err = -ENOBUFS;
+		if (!zc)
+			goto out_err;
+
+		/* pages of kernel senders, like sendpage, can't be pinned */
+		if (!sg || !(sk->sk_route_caps & NETIF_F_ALL_CSUM) ||
+		    segment_eq(get_fs(), KERNEL_DS))
+			zc->copied = true;
+		else
+			pin = size >= TCP_ZEROCOPY_MIN;
+	}
+
 	while (--iovlen >= 0) {
 		size_t seglen = iov->iov_len;
 		unsigned char __user *from = iov->iov_base;
@@ -963,6 +1039,8 @@ int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 				if (skb->ip_summed == CHECKSUM_NONE)
 					max = mss_now;
 				copy = max - skb->len;
+				if (pin && skb_zcopy(skb) && skb_zcopy(skb) != zc)
+					copy = 0;
 			}
 
 			if (copy <= 0) {
@@ -974,7 +1052,7 @@ new_segment:
 					goto wait_for_sndbuf;
 
 				skb = sk_stream_alloc_skb(sk,
-							  select_size(sk, sg),
+							  pin ? 0 : select_size(sk, sg),
 							  sk->sk_allocation);
 				if (!skb)
 					goto wait_for_memory;
@@ -995,7 +1073,22 @@ new_segment:
 				copy = seglen;
 
 			/* Where to copy to? */
-			if (skb_tailroom(skb) > 0) {
+			if (pin && skb->ip_summed == CHECKSUM_PARTIAL) {
+				/* Nowhere, attach the user page. */
+				if (skb_shinfo(skb)->nr_frags == MAX_SKB_FRAGS) {
+					tcp_mark_push(tp, skb);
+					goto new_segment;
+				}
+				if (!sk_wmem_schedule(sk, copy))
+					goto wait_for_memory;
+
+				err = tcp_zcopy_add(sk, skb, from, copy);
+				if (err < 0)
+					goto do_fault;
+				copy = err;
+				if (!skb_zcopy(skb))
+					skb_zcopy_set(skb, zc);
+			} else if (skb_tailroom(skb) > 0) {
 				/* We have some space in skb head. Superb! */
 				if (copy > skb_tailroom(skb))
 					copy = skb_tailroom(skb);
@@ -1111,6 +1204,10 @@ wait_for_memory:
 out:
 	if (copied)
 		tcp_push(sk, flags, mss_now, tp->nonagle);
+	else if (zc_opened)
+		sock_zcopy_abort(sk);
+	if (!(flags & MSG_MORE))
+		sock_zcopy_close(sk);
 	release_sock(sk);
 	return copied;
 
@@ -1128,6 +1225,8 @@ do_error:
 	if (copied)
 		goto out;
 out_err:
+	if (zc_opened)
+		sock_zcopy_abort(sk);
 	err = sk_stream_error(sk, flags, err);
 	release_sock(sk);
 	return err;
@@ -1394,6 +1493,141 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 }
 EXPORT_SYMBOL(tcp_read_sock);
 
+#ifdef CONFIG_MMU
+/*
+ * Receive zero-copy: payload which the NIC placed in whole page frags is
+ * mapped into a mmap()ed area of the socket by TCP_ZEROCOPY_RECEIVE rather
+ * than copied.  The area is read-only and only populated by the socket,
+ * the pages of the previous call are unmapped by the next one.
+ */
+static int tcp_zc_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	return VM_FAULT_SIGBUS;
+}
+
+static const struct vm_operations_struct tcp_vm_ops = {
+	.fault		= tcp_zc_fault,
+};
+
+int tcp_mmap(struct file *file, struct socket *sock,
+	     struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & (VM_WRITE | VM_EXEC))
+		return -EPERM;
+	vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+
+	/* set here as vm_insert_page() would, mmap_sem is only read held */
+	vma->vm_flags |= VM_INSERTPAGE;
+	vma->vm_ops = &tcp_vm_ops;
+	return 0;
+}
+EXPORT_SYMBOL(tcp_mmap);
+
+static bool tcp_zc_frag_ok(const skb_frag_t *frag)
+{
+	return !frag->page_offset && frag->size == PAGE_SIZE &&
+	       !PageCompound(frag->page);
+}
+
+/* tcp_read_sock() actor mapping the frags at @offset, desc->arg.data is the vma */
+static int tcp_zc_map(read_descriptor_t *desc, struct sk_buff *skb,
+		      unsigned int offset, size_t len)
+{
+	struct vm_area_struct *vma = desc->arg.data;
+	unsigned int start = skb_headlen(skb);
+	int i, used = 0;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		if (start < offset) {
+			start += frag->size;
+			continue;
+		}
+		if (start != offset || !tcp_zc_frag_ok(frag) ||
+		    used + PAGE_SIZE > len || desc->count < PAGE_SIZE)
+			break;
+		if (vm_insert_page(vma, vma->vm_start + desc->written,
+				   frag->page))
+			break;
+
+		start += PAGE_SIZE;
+		offset += PAGE_SIZE;
+		used += PAGE_SIZE;
+		desc->written += PAGE_SIZE;
+		desc->count -= PAGE_SIZE;
+	}
+
+	return used;
+}
+
+/* Bytes from @offset to read() until the next frag which can be mapped */
+static u32 tcp_zc_skip_hint(struct sk_buff *skb, u32 offset)
+{
+	unsigned int start = skb_headlen(skb);
+	int i;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		if (start >= offset && tcp_zc_frag_ok(frag))
+			return start - offset;
+		start += frag->size;
+	}
+
+	return skb->len - offset;
+}
+
+static int tcp_zerocopy_receive(struct sock *sk,
+				struct tcp_zerocopy_receive *zc)
+{
+	unsigned long address = (unsigned long)zc->address;
+	struct vm_area_struct *vma;
+	read_descriptor_t desc;
+	struct sk_buff *skb;
+	u32 offset;
+	int ret;
+
+	if (address != zc->address || (address & ~PAGE_MASK))
+		return -EINVAL;
+
+	if (sk->sk_state == TCP_LISTEN)
+		return -ENOTCONN;
+
+	down_read(&current->mm->mmap_sem);
+
+	ret = -EINVAL;
+	vma = find_vma(current->mm, address);
+	if (!vma || vma->vm_start > address || vma->vm_ops != &tcp_vm_ops ||
+	    vma->vm_file->private_data != sk->sk_socket)
+		goto out;
+
+	/* desc.written is relative to the vma start in tcp_zc_map() */
+	desc.written = address - vma->vm_start;
+	desc.count = min_t(unsigned long, zc->length,
+			   vma->vm_end - address) & PAGE_MASK;
+	desc.arg.data = vma;
+	desc.error = 0;
+
+	if (desc.count)
+		zap_page_range(vma, address, desc.count, NULL);
+
+	ret = tcp_read_sock(sk, &desc, tcp_zc_map);
+	if (ret < 0)
+		goto out;
+
+	zc->length = ret;
+	zc->recv_skip_hint = 0;
+	skb = tcp_recv_skb(sk, tcp_sk(sk)->copied_seq, &offset);
+	if (skb && offset < skb->len)
+		zc->recv_skip_hint = tcp_zc_skip_hint(skb, offset);
+	ret = 0;
+out:
+	up_read(&current->mm->mmap_sem);
+	return ret;
+}
+#endif /* CONFIG_MMU */
+
 /*
  *	This routine copies from a sock struct into the user buffer.
  *
@@ -1418,6 +1652,9 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct sk_buff *skb;
 	u32 urg_hole = 0;
 
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ip_recv_error(sk, msg, len);
+
 	lock_sock(sk);
 
 	err = -ENOTCONN;
@@ -1884,6 +2121,7 @@ void tcp_close(struct sock *sk, long timeout)
 
 	lock_sock(sk);
 	sk->sk_shutdown = SHUTDOWN_MASK;
+	sock_zcopy_close(sk);
 
 	if (sk->sk_state == TCP_LISTEN) {
 		tcp_set_state(sk, TCP_CLOSE);
@@ -2072,6 +2310,7 @@ int tcp_disconnect(struct sock *sk, int flags)
 		sk->sk_err = ECONNRESET;
 
 	tcp_clear_xmit_timers(sk);
+	sock_zcopy_close(sk);
 	__skb_queue_purge(&sk->sk_receive_queue);
 	tcp_write_queue_purge(sk);
 	__skb_queue_purge(&tp->out_of_order_queue);
@@ -2560,6 +2799,30 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 			return -EFAULT;
 		return 0;
 	}
+#ifdef CONFIG_MMU
+	case TCP_ZEROCOPY_RECEIVE: {
+		struct tcp_zerocopy_receive zc;
+		int err;
+
+		if (get_user(len, optlen))
+			return -EFAULT;
+		if (len != sizeof(zc))
+			return -EINVAL;
+		if (copy_from_user(&zc, optval, len))
+			return -EFAULT;
+
+		lock_sock(sk);
+		err = tcp_zerocopy_receive(sk, &zc);
+		release_sock(sk);
+
+		if (!err && copy_to_user(optval, &zc, len))
+			return -EFAULT;
+		return err;
+	}
+#else
+	case TCP_ZEROCOPY_RECEIVE:
+		return -EOPNOTSUPP;
+#endif
 	case TCP_QUICKACK:
 		val = !icsk->icsk_ack.pingpong;
 		break;
@@ -2199,6 +2199,16 @@ void tcp6_proc_exit(struct net *net)
 }
 #endif
 
+static int tcp_v6_recvmsg(struct kiocb *iocb, struct sock *sk,
+			  struct msghdr *msg, size_t len, int nonblock,
+			  int flags, int *addr_len)
+{
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ipv6_recv_error(sk, msg, len);
+
+	return tcp_recvmsg(iocb, sk, msg, len, nonblock, flags, addr_len);
+}
+
 struct proto tcpv6_prot = {
 	.name			= "TCPv6",
 	.owner			= THIS_MODULE,
@@ -2212,7 +2222,7 @@ struct proto tcpv6_prot = {
 	.shutdown		= tcp_shutdown,
 	.setsockopt		= tcp_setsockopt,
 	.getsockopt		= tcp_getsockopt,
-	.recvmsg		= tcp_recvmsg,
+	.recvmsg		= tcp_v6_recvmsg,
 	.sendmsg		= tcp_sendmsg,
 	.sendpage		= tcp_sendpage,
 	.backlog_rcv		= tcp_v6_do_rcv,
@@ -0,0 +1,245 @@
+/*
+ *
+ * fs-create.c
+ *
+ * create: Small file creation by many threads, in the style of fs_mark
+ *
+ * Each thread creates files of a given size in a directory of its own,
+ * optionally fsync()ing each one, and unlinks them afterwards.  With a
+ * journalling filesystem nearly every step starts a journal handle, so
+ * this mostly measures how the journal scales with the number of
+ * threads.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static const char	*dir		= ".";
+static int		nr_threads	= 1;
+static int		nr_files	= 10000;
+static int		file_size	= 4096;
+static bool		do_fsync;
+static bool		keep_files;
+
+static const struct option options[] = {
+	OPT_STRING('d', "dir", &dir, "dir",
+		    "Specify directory to create files in"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads"),
+	OPT_INTEGER('n', "files", &nr_files,
+		    "Specify number of files per thread"),
+	OPT_INTEGER('s', "size", &file_size,
+		    "Specify size of each file in bytes"),
+	OPT_BOOLEAN('S', "fsync", &do_fsync,
+		    "fsync() each file before closing it"),
+	OPT_BOOLEAN('k', "keep", &keep_files,
+		    "Don't unlink the files afterwards"),
+	OPT_END()
+};
+
+static const char * const bench_fs_create_usage[] = {
+	"perf bench fs create <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t	thread;
+	char		path[PATH_MAX];
+	unsigned long long create_usec;
+	int		err;
+};
+
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int started;
+static char *buf;
+
+static unsigned long long timeval_usec(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static int write_file(const char *name)
+{
+	int fd, len, done;
+
+	fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return -errno;
+
+	for (done = 0; done < file_size; done += len) {
+		len = write(fd, buf, file_size - done);
+		if (len < 0)
+			goto err;
+	}
+	if (do_fsync && fsync(fd) < 0)
+		goto err;
+	return close(fd) < 0 ? -errno : 0;
+err:
+	len = -errno;
+	close(fd);
+	return len;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct timeval start, stop;
+	char name[PATH_MAX];
+	int i;
+
+	pthread_mutex_lock(&start_mutex);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_mutex);
+	pthread_mutex_unlock(&start_mutex);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_files; i++) {
+		snprintf(name, sizeof(name), "%s/%08d", w->path, i);
+		w->err = write_file(name);
+		if (w->err)
+			return NULL;
+	}
+	gettimeofday(&stop, NULL);
+	w->create_usec = timeval_usec(&stop) - timeval_usec(&start);
+
+	return NULL;
+}
+
+static void cleanup(struct worker *w)
+{
+	char name[PATH_MAX];
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(name, sizeof(name), "%s/%08d", w->path, i);
+		unlink(name);
+	}
+	rmdir(w->path);
+}
+
+int bench_fs_create(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec, slowest = 0;
+	int i, ret = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_create_usage, 0);
+
+	if (nr_threads < 1 || nr_files < 1 || file_size < 0) {
+		usage_with_options(bench_fs_create_usage, options);
+		return 1;
+	}
+
+	buf = calloc(1, file_size ? file_size : 1);
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!buf || !workers) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct worker *w = &workers[i];
+
+		snprintf(w->path, sizeof(w->path), "%s/perf-bench-fs.%d.%d",
+			 dir, getpid(), i);
+		if (mkdir(w->path, 0755) < 0) {
+			fprintf(stderr, "mkdir %s: %s\n", w->path,
+				strerror(errno));
+			nr_threads = i;
+			ret = 1;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	pthread_mutex_lock(&start_mutex);
+	started = 1;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_mutex);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err) {
+			fprintf(stderr, "thread %d: %s\n", i,
+				strerror(-workers[i].err));
+			ret = 1;
+		}
+		if (workers[i].create_usec > slowest)
+			slowest = workers[i].create_usec;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (ret)
+		goto out;
+
+	result_usec = timeval_usec(&diff);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads creating %d files of %d bytes each%s\n\n",
+		       nr_threads, nr_files, file_size,
+		       do_fsync ? ", with fsync" : "");
+
+		printf(" %14s: %lu.%03lu [sec]\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+		printf(" %14s: %llu.%03llu [sec]\n\n", "Slowest thread",
+		       slowest / 1000000, (slowest % 1000000) / 1000);
+
+		printf(" %14lf usecs/file\n",
+		       (double)result_usec /
+		       ((double)nr_threads * nr_files));
+		printf(" %14d files/sec\n",
+		       (int)((double)nr_threads * nr_files /
+			     ((double)result_usec / (double)1000000)));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+out:
+	if (!keep_files)
+		for (i = 0; i < nr_threads; i++)
+			cleanup(&workers[i]);
+	free(workers);
+	free(buf);
+	return ret;
+}
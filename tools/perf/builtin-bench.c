@@ -13,6 +13,7 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  fs    ... filesystem metadata performance
  *
  */
 
@@ -58,6 +59,16 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite fs_suites[] = {
+	{ "create",
+	  "Small file creation by many threads, like fs_mark",
+	  bench_fs_create },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL            }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +82,9 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "fs",
+	  "filesystem metadata performance",
+	  fs_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },